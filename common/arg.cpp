@@ -2186,6 +2186,26 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.defrag_thold = std::stof(value);
         }
     ).set_env("LLAMA_ARG_DEFRAG_THOLD"));
+    add_opt(common_arg(
+        {"--kv-block-size"}, "N",
+        string_format("use a paged KV cache layout with blocks of N cells per sequence, requires LLAMA_SET_ROWS=1; with -fa, the CPU attention also skips the blocks of other sequences (default: %d, 0 = disabled)", params.kv_block_size),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.kv_block_size = value;
+        }
+    ).set_env("LLAMA_ARG_KV_BLOCK_SIZE"));
+    add_opt(common_arg(
+        {"--logits-top-k"}, "N",
+        string_format("compute the top N logits of each output on the backend and sample only from these, the full logits are not available - not compatible with grammars and positive logit biases, n_probs are normalized over the top N, at most 512 (default: %d, 0 = disabled)", params.logits_top_k),
+        [](common_params & params, int value) {
+            if (value < 0 || value > 512) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.logits_top_k = value;
+        }
+    ).set_env("LLAMA_ARG_LOGITS_TOP_K"));
     add_opt(common_arg(
         {"-np", "--parallel"}, "N",
         string_format("number of parallel sequences to decode (default: %d)", params.n_parallel),
@@ -2280,12 +2300,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         "- distribute: spread execution evenly over all nodes\n"
         "- isolate: only spawn threads on CPUs on the node that execution started on\n"
         "- numactl: use the CPU map provided by numactl\n"
+        "- interleave: like distribute, and split the rows of each weight across the nodes so that threads read local memory\n"
         "if run without this previously, it is recommended to drop the system page cache before using this\n"
         "see https://github.com/ggml-org/llama.cpp/issues/1437",
         [](common_params & params, const std::string & value) {
             /**/ if (value == "distribute" || value == "") { params.numa = GGML_NUMA_STRATEGY_DISTRIBUTE; }
             else if (value == "isolate") { params.numa = GGML_NUMA_STRATEGY_ISOLATE; }
             else if (value == "numactl") { params.numa = GGML_NUMA_STRATEGY_NUMACTL; }
+            else if (value == "interleave") { params.numa = GGML_NUMA_STRATEGY_INTERLEAVE; }
             else { throw std::invalid_argument("invalid value"); }
         }
     ).set_env("LLAMA_ARG_NUMA"));
@@ -2829,6 +2851,38 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.n_cache_reuse = value;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_CACHE_REUSE"));
+    add_opt(common_arg(
+        {"--cache-ram"}, "N",
+        string_format("max host memory in MiB for keeping the cached prompts of the slots when they are reused (default: %d, 0 = disabled)", params.cache_ram_mib),
+        [](common_params & params, int value) {
+            params.cache_ram_mib = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_CACHE_RAM"));
+    add_opt(common_arg(
+        {"--cache-disk"}, "N",
+        string_format("max disk space in MiB for the cached prompts that do not fit in --cache-ram, requires --cache-disk-path (default: %d, 0 = disabled)", params.cache_disk_mib),
+        [](common_params & params, int value) {
+            params.cache_disk_mib = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_CACHE_DISK"));
+    add_opt(common_arg(
+        {"--cache-disk-path"}, "PATH",
+        "directory for the cached prompts spilled to disk (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.cache_disk_path = value;
+            // if doesn't end with DIRECTORY_SEPARATOR, add it
+            if (!params.cache_disk_path.empty() && params.cache_disk_path[params.cache_disk_path.size() - 1] != DIRECTORY_SEPARATOR) {
+                params.cache_disk_path += DIRECTORY_SEPARATOR;
+            }
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_CACHE_DISK_PATH"));
+    add_opt(common_arg(
+        {"--prefill-budget"}, "N",
+        string_format("max number of prompt tokens to process per batch while other slots are generating (default: %d, 0 = n_batch)", params.n_prefill_budget),
+        [](common_params & params, int value) {
+            params.n_prefill_budget = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PREFILL_BUDGET"));
     add_opt(common_arg(
         {"--metrics"},
         string_format("enable prometheus compatible metrics endpoint (default: %s)", params.endpoint_metrics ? "enabled" : "disabled"),
@@ -3185,7 +3239,17 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, const std::string & value) {
             params.speculative.p_split = std::stof(value);
         }
-    ).set_examples({LLAMA_EXAMPLE_SPECULATIVE}).set_env("LLAMA_ARG_DRAFT_P_SPLIT"));
+    ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_P_SPLIT"));
+    add_opt(common_arg(
+        {"--draft-branches"}, "N",
+        string_format("maximum number of branches of the draft tree for speculative decoding, split where the draft is uncertain (default: %d)", params.speculative.n_branch),
+        [](common_params & params, int value) {
+            if (value < 1) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.n_branch = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_BRANCHES"));
     add_opt(common_arg(
         {"--draft-p-min"}, "P",
         string_format("minimum speculative decoding probability (greedy) (default: %.1f)", (double)params.speculative.p_min),
@@ -1150,6 +1150,8 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.pooling_type      = params.pooling_type;
     cparams.attention_type    = params.attention_type;
     cparams.defrag_thold      = params.defrag_thold;
+    cparams.kv_block_size     = params.kv_block_size;
+    cparams.logits_top_k      = params.logits_top_k;
     cparams.cb_eval           = params.cb_eval;
     cparams.cb_eval_user_data = params.cb_eval_user_data;
     cparams.offload_kqv       = !params.no_kv_offload;
@@ -1267,6 +1269,16 @@ size_t common_lcs(const llama_tokens & a, const llama_tokens & b) {
     return max_length;
 }
 
+int common_tree_child(const llama_tokens & tokens, const std::vector<int> & parents, int node, llama_token id) {
+    for (int i = node + 1; i < (int) tokens.size(); ++i) {
+        if (parents[i] == node && tokens[i] == id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 //
 // Vocab utils
 //
@@ -197,6 +197,7 @@ struct common_params_speculative {
     int32_t n_max        =    16; // maximum number of tokens to draft during speculative decoding
     int32_t n_min        =     0; // minimum number of draft tokens to use for speculative decoding
     int32_t n_gpu_layers =    -1; // number of layers to store in VRAM for the draft model (-1 - use default)
+    int32_t n_branch     =     1; // maximum number of branches of the draft tree (1 = linear draft)
     float   p_split      =  0.1f; // speculative decoding split probability
     float   p_min        = 0.75f; // minimum speculative decoding probability (greedy)
 
@@ -243,6 +244,8 @@ struct common_params {
     float   yarn_beta_slow        =  1.0f; // YaRN high correction dim
     int32_t yarn_orig_ctx         =     0; // YaRN original context length
     float   defrag_thold          =  0.1f; // KV cache defragmentation threshold
+    int32_t kv_block_size         =     0; // paged KV cache block size (0 = disabled)
+    int32_t logits_top_k          =     0; // copy out only the top-k logits of each output (0 = disabled)
 
     // offload params
     std::vector<ggml_backend_dev_t> devices; // devices to use for offloading
@@ -367,6 +370,8 @@ struct common_params {
     int32_t timeout_write  = timeout_read; // http write timeout in seconds
     int32_t n_threads_http = -1;           // number of threads to process HTTP requests (TODO: support threadpool)
     int32_t n_cache_reuse  = 0;            // min chunk size to reuse from the cache via KV shifting
+    int32_t cache_ram_mib  = 0;            // host memory for saving the cached prompts of the slots (MiB, 0 = disabled)
+    int32_t n_prefill_budget = 0;          // max prompt tokens per batch while other slots are generating (0 = n_batch)
 
     std::string hostname      = "127.0.0.1";
     std::string public_path   = "";                                                                         // NOLINT
@@ -394,6 +399,9 @@ struct common_params {
 
     std::string slot_save_path;
 
+    std::string cache_disk_path;    // directory for the prompt states spilled from host memory
+    int32_t     cache_disk_mib = 0; // disk space for the spilled prompt states (MiB, 0 = disabled)
+
     float slot_prompt_similarity = 0.5f;
 
     // batched-bench params
@@ -587,6 +595,10 @@ size_t common_lcp(const llama_tokens & a, const llama_tokens & b);
 // longet common subsequence
 size_t common_lcs(const llama_tokens & a, const llama_tokens & b);
 
+// index of the child of node with the token id in a tree where tokens[i] follows tokens[parents[i]]
+// (-1 for the root) and the parents come before their children, or -1 if there is none
+int common_tree_child(const llama_tokens & tokens, const std::vector<int> & parents, int node, llama_token id);
+
 //
 // Vocab utils
 //
@@ -4,6 +4,10 @@
 #include "log.h"
 
 #include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <algorithm>
 
@@ -100,6 +104,87 @@ struct ring_buffer {
     std::vector<T> data;
 };
 
+// prepares the grammar masks in the background, one request at a time
+struct common_grammar_worker {
+    common_grammar_worker() : thread([this]() { run(); }) {}
+
+    ~common_grammar_worker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    void prepare(struct llama_sampler * smpl) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = smpl;
+        }
+        cv.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return pending == nullptr; });
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return stop || pending != nullptr; });
+            if (stop) {
+                break;
+            }
+
+            lock.unlock();
+            llama_sampler_grammar_prepare(pending);
+            lock.lock();
+
+            pending = nullptr;
+            cv.notify_all();
+        }
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    struct llama_sampler * pending = nullptr;
+
+    bool stop = false;
+
+    std::thread thread; // last, so that it starts after the other members are initialized
+};
+
+// the workers of the freed samplers are kept for the next ones, e.g. the server creates a sampler for each task
+struct common_grammar_worker_pool {
+    std::unique_ptr<common_grammar_worker> acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.empty()) {
+            return std::make_unique<common_grammar_worker>();
+        }
+
+        auto res = std::move(idle.back());
+        idle.pop_back();
+
+        return res;
+    }
+
+    void release(std::unique_ptr<common_grammar_worker> worker) {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(std::move(worker));
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<common_grammar_worker>> idle;
+};
+
+static common_grammar_worker_pool & common_grammar_workers() {
+    static common_grammar_worker_pool pool;
+    return pool;
+}
+
 struct common_sampler {
     common_params_sampling params;
 
@@ -112,7 +197,35 @@ struct common_sampler {
 
     llama_token_data_array cur_p;
 
+    // taken from the pool by the first common_sampler_prepare_async, returned to it by common_sampler_free
+    std::unique_ptr<common_grammar_worker> worker;
+
+    // the grammar must not be used while its masks are being prepared
+    void wait_grammar() {
+        if (worker) {
+            worker->wait();
+        }
+    }
+
     void set_logits(struct llama_context * ctx, int idx) {
+        float       * top_k_logits = nullptr;
+        llama_token * top_k_tokens = nullptr;
+
+        const int32_t n_top_k = llama_get_logits_top_k_ith(ctx, idx, &top_k_logits, &top_k_tokens);
+
+        if (n_top_k > 0) {
+            // only the candidates were copied out of the backend
+            cur.resize(n_top_k);
+
+            for (int32_t i = 0; i < n_top_k; i++) {
+                cur[i] = llama_token_data{top_k_tokens[i], top_k_logits[i], 0.0f};
+            }
+
+            cur_p = { cur.data(), cur.size(), -1, false };
+
+            return;
+        }
+
         const auto * logits = llama_get_logits_ith(ctx, idx);
 
         const llama_model * model = llama_get_model(ctx);
@@ -220,6 +333,7 @@ struct common_sampler * common_sampler_init(const struct llama_model * model, co
         /* .prev   = */ ring_buffer<llama_token>(std::max(32, params.n_prev)),
         /* .cur    = */ {},
         /* .cur_p  = */ {},
+        /* .worker = */ nullptr,
     };
 
     llama_sampler_chain_add(result->chain,
@@ -289,6 +403,12 @@ struct common_sampler * common_sampler_init(const struct llama_model * model, co
 
 void common_sampler_free(struct common_sampler * gsmpl) {
     if (gsmpl) {
+        gsmpl->wait_grammar();
+
+        if (gsmpl->worker) {
+            common_grammar_workers().release(std::move(gsmpl->worker));
+        }
+
         llama_sampler_free(gsmpl->grmr);
 
         llama_sampler_free(gsmpl->chain);
@@ -298,6 +418,8 @@ void common_sampler_free(struct common_sampler * gsmpl) {
 }
 
 void common_sampler_accept(struct common_sampler * gsmpl, llama_token token, bool accept_grammar) {
+    gsmpl->wait_grammar();
+
     if (accept_grammar) {
         llama_sampler_accept(gsmpl->grmr, token);
     }
@@ -308,12 +430,16 @@ void common_sampler_accept(struct common_sampler * gsmpl, llama_token token, boo
 }
 
 void common_sampler_reset(struct common_sampler * gsmpl) {
+    gsmpl->wait_grammar();
+
     llama_sampler_reset(gsmpl->grmr);
 
     llama_sampler_reset(gsmpl->chain);
 }
 
 struct common_sampler * common_sampler_clone(common_sampler * gsmpl) {
+    gsmpl->wait_grammar();
+
     return new common_sampler {
         /* .params = */ gsmpl->params,
         /* .grmr   = */ llama_sampler_clone(gsmpl->grmr),
@@ -321,6 +447,7 @@ struct common_sampler * common_sampler_clone(common_sampler * gsmpl) {
         /* .prev   = */ gsmpl->prev,
         /* .cur    = */ gsmpl->cur,
         /* .cur_p  = */ gsmpl->cur_p,
+        /* .worker = */ nullptr,
     };
 }
 
@@ -335,7 +462,22 @@ void common_perf_print(const struct llama_context * ctx, const struct common_sam
     }
 }
 
+void common_sampler_prepare_async(struct common_sampler * gsmpl) {
+    if (gsmpl->params.grammar.empty()) {
+        return;
+    }
+
+    if (!gsmpl->worker) {
+        gsmpl->worker = common_grammar_workers().acquire();
+    }
+
+    gsmpl->worker->wait();
+    gsmpl->worker->prepare(gsmpl->grmr);
+}
+
 llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first) {
+    gsmpl->wait_grammar();
+
     gsmpl->set_logits(ctx, idx);
 
     auto & grmr  = gsmpl->grmr;
@@ -420,6 +562,31 @@ std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sample
     return common_sampler_sample_and_accept_n(gsmpl, ctx, idxs, draft, grammar_first);
 }
 
+std::vector<llama_token> common_sampler_sample_and_accept_tree(struct common_sampler * gsmpl, struct llama_context * ctx, const llama_tokens & draft, const std::vector<int> & parents, bool grammar_first) {
+    GGML_ASSERT(draft.size() == parents.size() && "parents.size() must be draft.size()");
+
+    std::vector<llama_token> result;
+
+    // follow the branch of the tree that agrees with the sampler - the children of a token come after it
+    int node = -1;
+    while (true) {
+        const llama_token id = common_sampler_sample(gsmpl, ctx, node + 1, grammar_first);
+
+        common_sampler_accept(gsmpl, id, true);
+
+        result.push_back(id);
+
+        const int next = common_tree_child(draft, parents, node, id);
+        if (next < 0) {
+            break;
+        }
+
+        node = next;
+    }
+
+    return result;
+}
+
 uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl) {
     return llama_sampler_get_seed(gsmpl->chain);
 }
@@ -427,7 +594,26 @@ uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl) {
 // helpers
 
 llama_token_data_array * common_sampler_get_candidates(struct common_sampler * gsmpl) {
-    return &gsmpl->cur_p;
+    auto & cur_p = gsmpl->cur_p;
+
+    // the samplers sort the candidates only when they need to, the callers expect them in descending order
+    if (!cur_p.sorted && cur_p.size > 0) {
+        const llama_token id = cur_p.selected >= 0 ? cur_p.data[cur_p.selected].id : LLAMA_TOKEN_NULL;
+
+        std::sort(cur_p.data, cur_p.data + cur_p.size, [](const llama_token_data & a, const llama_token_data & b) {
+            return a.logit > b.logit;
+        });
+        cur_p.sorted = true;
+
+        for (size_t i = 0; i < cur_p.size && id != LLAMA_TOKEN_NULL; ++i) {
+            if (cur_p.data[i].id == id) {
+                cur_p.selected = i;
+                break;
+            }
+        }
+    }
+
+    return &cur_p;
 }
 
 llama_token common_sampler_last(const struct common_sampler * gsmpl) {
@@ -45,6 +45,11 @@ void                    common_sampler_accept(struct common_sampler * gsmpl, lla
 void                    common_sampler_reset (struct common_sampler * gsmpl);
 struct common_sampler * common_sampler_clone (struct common_sampler * gsmpl);
 
+// compute the tokens allowed by the grammar in its current state on a background thread, e.g. right after
+// common_sampler_accept while the next batch is evaluated, so that the next common_sampler_sample only looks them up
+// the other common_sampler calls wait for it to finish
+void common_sampler_prepare_async(struct common_sampler * gsmpl);
+
 // arguments can be nullptr to skip printing
 void common_perf_print(const struct llama_context * ctx, const struct common_sampler * gsmpl);
 
@@ -81,11 +86,19 @@ std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sample
 // assume idxs == [ 0, 1, 2, ..., draft.size() ]
 std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sampler * gsmpl, struct llama_context * ctx, const llama_tokens & draft, bool grammar_first = false);
 
+// version of common_sampler_sample_and_accept_n for a tree of draft tokens, where draft[i] follows draft[parents[i]]
+// (or the last accepted token if parents[i] == -1) and the parents come before their children
+//
+// assume the outputs are 0 for the last accepted token and i + 1 for draft[i]
+//
+// returns the accepted path of the tree followed by the next sampled token
+std::vector<llama_token> common_sampler_sample_and_accept_tree(struct common_sampler * gsmpl, struct llama_context * ctx, const llama_tokens & draft, const std::vector<int> & parents, bool grammar_first = false);
+
 uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl);
 
 // helpers
 
-// access the internal list of current candidate tokens
+// access the internal list of current candidate tokens, sorted by descending logits
 llama_token_data_array * common_sampler_get_candidates(struct common_sampler * gsmpl);
 
 // get the last accepted token
@@ -134,7 +134,7 @@ bool common_speculative_are_compatible(
     return true;
 }
 
-llama_tokens common_speculative_gen_draft(
+common_speculative_tree common_speculative_gen_draft_tree(
         struct common_speculative * spec,
         struct common_speculative_params params,
         const llama_tokens & prompt_tgt,
@@ -171,8 +171,7 @@ llama_tokens common_speculative_gen_draft(
 
     LOG_DBG("%s: reuse_i = %d, reuse_n = %d, prompt = %d\n", __func__, reuse_i, reuse_n, (int) prompt.size());
 
-    llama_tokens result;
-    result.reserve(params.n_draft);
+    common_speculative_tree result;
 
     if (reuse_n == 0) {
         llama_memory_clear(mem, false);
@@ -183,13 +182,18 @@ llama_tokens common_speculative_gen_draft(
         // target model agreed with it. in this case, we simply pass back the previous results to save compute
         if (reuse_i + reuse_n < (int) prompt.size() && prompt[reuse_i + reuse_n] == id_last) {
             for (int i = reuse_i + reuse_n + 1; i < (int) prompt.size(); ++i) {
-                result.push_back(prompt[i]);
+                result.parents.push_back((int) result.tokens.size() - 1);
+                result.tokens.push_back(prompt[i]);
 
-                if (params.n_draft <= (int) result.size()) {
+                if (params.n_draft <= (int) result.tokens.size()) {
                     break;
                 }
             }
 
+            if (!result.tokens.empty()) {
+                result.leaves.push_back((int) result.tokens.size() - 1);
+            }
+
             return result;
         }
 
@@ -239,42 +243,212 @@ llama_tokens common_speculative_gen_draft(
 
     common_sampler_reset(smpl);
 
+    // each branch is drafted in its own sequence, branch 0 follows the most likely tokens and stays in the context
+    struct branch {
+        struct common_sampler * smpl;
+
+        int  node;    // last token of the branch in the tree
+        int  i_batch; // output of the branch in the batch
+        bool drafting;
+    };
+
+    const int n_branch = std::max(1, std::min(params.n_branch, (int) llama_n_seq_max(ctx)));
+
+    std::vector<branch> branches = { { smpl, -1, 0, true } };
+
     // sample n_draft tokens from the draft model
     for (int i = 0; i < params.n_draft; ++i) {
         common_batch_clear(batch);
 
-        common_sampler_sample(smpl, ctx, 0, true);
+        const int n_cur = branches.size();
 
-        const auto * cur_p = common_sampler_get_candidates(smpl);
+        for (int b = 0; b < n_cur && (int) result.tokens.size() < params.n_draft; ++b) {
+            if (!branches[b].drafting) {
+                continue;
+            }
 
-        for (int k = 0; k < std::min(3, (int) cur_p->size); ++k) {
-            LOG_DBG(" - draft candidate %3d, pos %3d: %6d (%8.3f) '%s'\n",
-                    k, i, cur_p->data[k].id, cur_p->data[k].p, common_token_to_piece(ctx, cur_p->data[k].id).c_str());
-        }
+            common_sampler_sample(branches[b].smpl, ctx, branches[b].i_batch, true);
 
-        // add drafted token for each sequence
-        const llama_token id = cur_p->data[0].id;
+            const auto * cur_p = common_sampler_get_candidates(branches[b].smpl);
 
-        common_sampler_accept(smpl, id, true);
+            for (int k = 0; k < std::min(3, (int) cur_p->size); ++k) {
+                LOG_DBG(" - draft candidate %3d, branch %d, pos %3d: %6d (%8.3f) '%s'\n",
+                        k, b, i, cur_p->data[k].id, cur_p->data[k].p, common_token_to_piece(ctx, cur_p->data[k].id).c_str());
+            }
 
-        result.push_back(id);
+            // only collect very high-confidence draft tokens
+            const bool is_certain = cur_p->data[0].p >= params.p_min;
 
-        if (params.n_draft <= (int) result.size()) {
-            break;
+            // otherwise, the next likely tokens start new branches
+            std::vector<int> bs = { b };
+
+            for (int k = 1; !is_certain && k < (int) cur_p->size && (int) branches.size() < n_branch; ++k) {
+                if (cur_p->data[k].p < params.p_split || (int) (result.tokens.size() + bs.size()) >= params.n_draft) {
+                    break;
+                }
+
+                const llama_seq_id s = branches.size();
+
+                LOG_DBG("%s: splitting branch %d into %d\n", __func__, b, s);
+
+                llama_memory_seq_rm(mem,    s, -1, -1);
+                llama_memory_seq_cp(mem, b, s, -1, -1);
+
+                branches.push_back({ common_sampler_clone(branches[b].smpl), branches[b].node, 0, true });
+
+                bs.push_back(s);
+            }
+
+            // add drafted token for each branch
+            for (int k = 0; k < (int) bs.size(); ++k) {
+                auto & br = branches[bs[k]];
+
+                const llama_token id = cur_p->data[k].id;
+
+                common_sampler_accept(br.smpl, id, true);
+
+                result.parents.push_back(br.node);
+                result.tokens.push_back(id);
+
+                br.node = result.tokens.size() - 1;
+
+                // a branch ends at an uncertain token, unless it was split there
+                if (params.n_draft <= (int) result.tokens.size() || (!is_certain && bs.size() == 1)) {
+                    br.drafting = false;
+                    continue;
+                }
+
+                br.i_batch = batch.n_tokens;
+
+                common_batch_add(batch, id, n_past + i + 1, { bs[k] }, true);
+
+                if (bs[k] == 0) {
+                    prompt.push_back(id);
+                }
+            }
         }
 
-        // only collect very high-confidence draft tokens
-        if (cur_p->data[0].p < params.p_min) {
-            break;
+        if (params.n_draft <= (int) result.tokens.size()) {
+            for (auto & br : branches) {
+                br.drafting = false;
+            }
         }
 
-        common_batch_add(batch, id, n_past + i + 1, { 0 }, true);
+        if (batch.n_tokens == 0) {
+            break;
+        }
 
         // evaluate the drafted tokens on the draft model
         llama_decode(ctx, batch);
+    }
+
+    for (size_t b = 0; b < branches.size(); ++b) {
+        if (branches[b].node >= 0) {
+            result.leaves.push_back(branches[b].node);
+        }
+
+        // only the first branch is kept for the next draft
+        if (b > 0) {
+            common_sampler_free(branches[b].smpl);
 
-        prompt.push_back(id);
+            llama_memory_seq_rm(mem, b, -1, -1);
+        }
     }
 
     return result;
 }
+
+llama_tokens common_speculative_gen_draft(
+        struct common_speculative * spec,
+        struct common_speculative_params params,
+        const llama_tokens & prompt_tgt,
+        llama_token id_last) {
+    params.n_branch = 1;
+
+    return common_speculative_gen_draft_tree(spec, params, prompt_tgt, id_last).tokens;
+}
+
+void common_speculative_tree_batch(
+        llama_memory_t mem,
+        llama_batch & batch,
+        const common_speculative_tree & tree,
+        llama_token id_last,
+        llama_pos n_past,
+        const std::vector<llama_seq_id> & seq_ids) {
+    GGML_ASSERT(tree.leaves.size() <= seq_ids.size());
+
+    const int n_tokens = tree.tokens.size();
+
+    // the sequences of the branches that go through each token
+    std::vector<std::vector<llama_seq_id>> seqs(n_tokens);
+    std::vector<llama_pos>                 pos (n_tokens);
+
+    for (size_t b = 0; b < tree.leaves.size(); ++b) {
+        for (int i = tree.leaves[b]; i >= 0; i = tree.parents[i]) {
+            seqs[i].push_back(seq_ids[b]);
+        }
+    }
+
+    for (int i = 0; i < n_tokens; ++i) {
+        pos[i] = tree.parents[i] < 0 ? n_past + 1 : pos[tree.parents[i]] + 1;
+    }
+
+    std::vector<llama_seq_id> seqs_all = { seq_ids[0] };
+
+    for (size_t b = 1; b < tree.leaves.size(); ++b) {
+        llama_memory_seq_rm(mem,             seq_ids[b], -1, -1);
+        llama_memory_seq_cp(mem, seq_ids[0], seq_ids[b], -1, -1);
+
+        seqs_all.push_back(seq_ids[b]);
+    }
+
+    common_batch_clear(batch);
+    common_batch_add  (batch, id_last, n_past, seqs_all, true);
+
+    for (int i = 0; i < n_tokens; ++i) {
+        common_batch_add(batch, tree.tokens[i], pos[i], seqs[i], true);
+    }
+}
+
+void common_speculative_tree_accept(
+        llama_memory_t mem,
+        const common_speculative_tree & tree,
+        const llama_tokens & ids,
+        llama_pos n_past,
+        const std::vector<llama_seq_id> & seq_ids) {
+    GGML_ASSERT(!ids.empty());
+
+    // follow the accepted tokens in the tree - the last one was sampled after the tree
+    int node = -1;
+    for (size_t i = 0; i + 1 < ids.size(); ++i) {
+        const int next = common_tree_child(tree.tokens, tree.parents, node, ids[i]);
+        GGML_ASSERT(next >= 0 && "the accepted tokens are not a path of the tree");
+        node = next;
+    }
+
+    const llama_pos p_end = n_past + ids.size();
+
+    // the branch of the accepted tokens, if they are not in the first one
+    int b_keep = 0;
+    for (size_t b = 0; b < tree.leaves.size() && node >= 0; ++b) {
+        int i = tree.leaves[b];
+        while (i > node) {
+            i = tree.parents[i];
+        }
+        if (i == node) {
+            b_keep = b;
+            break;
+        }
+    }
+
+    if (b_keep > 0) {
+        llama_memory_seq_rm(mem, seq_ids[0], n_past + 1, -1);
+        llama_memory_seq_cp(mem, seq_ids[b_keep], seq_ids[0], n_past + 1, p_end);
+    }
+
+    llama_memory_seq_rm(mem, seq_ids[0], p_end, -1);
+
+    for (size_t b = 1; b < tree.leaves.size(); ++b) {
+        llama_memory_seq_rm(mem, seq_ids[b], -1, -1);
+    }
+}
@@ -10,6 +10,16 @@ struct common_speculative_params {
     int n_reuse = 256;
 
     float p_min = 0.75f; // min probability required to accept a token in the draft
+
+    int   n_branch = 1;    // max number of branches of the draft tree (1 = linear draft)
+    float p_split  = 0.1f; // min probability of a token to start a new branch where the draft is uncertain
+};
+
+// a tree of draft tokens, verified by the target model in a single batch with one sequence per branch
+struct common_speculative_tree {
+    llama_tokens     tokens;  // the drafted tokens, in order of depth
+    std::vector<int> parents; // the token that each token follows, -1 for the last accepted token
+    std::vector<int> leaves;  // the last token of each branch, the first branch follows the most likely tokens
 };
 
 struct common_speculative * common_speculative_init(struct llama_context * ctx_dft);
@@ -26,3 +36,32 @@ llama_tokens common_speculative_gen_draft(
         struct common_speculative_params   params,
                       const llama_tokens & prompt,
                              llama_token   id_last);
+
+// sample a tree of up to n_draft tokens with up to n_branch branches using the draft model
+// where the most likely token is below p_min, the next tokens above p_split start new branches
+// the branches are drafted in sequences 0, 1, ... of the draft context, so their number is limited by its n_seq_max
+common_speculative_tree common_speculative_gen_draft_tree(
+               struct common_speculative * spec,
+        struct common_speculative_params   params,
+                      const llama_tokens & prompt,
+                             llama_token   id_last);
+
+// add id_last at position n_past followed by the tree to the batch, branch i in sequence seq_ids[i]
+// the memory of the other branches is copied from seq_ids[0], which must hold the tokens before n_past
+// the outputs of the batch are 0 for id_last and i + 1 for tree.tokens[i], see common_sampler_sample_and_accept_tree
+void common_speculative_tree_batch(
+                     llama_memory_t   mem,
+                        llama_batch & batch,
+      const common_speculative_tree & tree,
+                        llama_token   id_last,
+                          llama_pos   n_past,
+    const std::vector<llama_seq_id> & seq_ids);
+
+// keep the accepted tokens (ids, as returned by common_sampler_sample_and_accept_tree) in seq_ids[0]
+// and remove the rest of the tree and the other branches from the memory
+void common_speculative_tree_accept(
+                     llama_memory_t   mem,
+      const common_speculative_tree & tree,
+                 const llama_tokens & ids,
+                          llama_pos   n_past,
+    const std::vector<llama_seq_id> & seq_ids);
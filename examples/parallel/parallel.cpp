@@ -489,6 +489,14 @@ int main(int argc, char ** argv) {
     LOG_INF("Total speed (AVG):   %6s  speed: %5.2f t/s\n", "",             (double) (n_total_prompt + n_total_gen) / (t_main_end - t_main_start) * 1e6);
     LOG_INF("Cache misses:        %6d\n", n_cache_miss);
 
+    {
+        const auto binfo = llama_memory_get_block_info(mem);
+        if (binfo.block_size > 0) {
+            LOG_INF("KV cache blocks:     %6u / %u used, utilisation %.2f%%\n", binfo.n_blocks_used, binfo.n_blocks,
+                    binfo.n_blocks_used > 0 ? 100.0*binfo.n_cells_used/(binfo.n_blocks_used*binfo.block_size) : 0.0);
+        }
+    }
+
     LOG_INF("\n");
 
     // TODO: print sampling/grammar timings for all clients
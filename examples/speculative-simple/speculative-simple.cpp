@@ -29,6 +29,9 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
+    // each branch of the draft tree uses its own sequence in both contexts
+    params.n_parallel = params.speculative.n_branch;
+
     // init llama.cpp
     llama_backend_init();
     llama_numa_init(params.numa);
@@ -130,9 +133,18 @@ int main(int argc, char ** argv) {
     params_spec.n_reuse = llama_n_ctx(ctx_dft) - n_draft;
     params_spec.p_min   = p_min;
 
+    params_spec.n_branch = params.speculative.n_branch;
+    params_spec.p_split  = params.speculative.p_split;
+
     struct common_speculative * spec = common_speculative_init(ctx_dft);
 
-    llama_batch batch_tgt = llama_batch_init(llama_n_batch(ctx_tgt), 0, 1);
+    llama_batch batch_tgt = llama_batch_init(llama_n_batch(ctx_tgt), 0, params_spec.n_branch);
+
+    // the sequences of the branches of the draft tree in the target context
+    std::vector<llama_seq_id> seq_ids;
+    for (int s = 0; s < params_spec.n_branch; ++s) {
+        seq_ids.push_back(s);
+    }
 
     const auto t_enc_end = ggml_time_us();
 
@@ -146,24 +158,20 @@ int main(int argc, char ** argv) {
         // offloaded to a remote device. it doesn't even have to be based on an LLM. instead, it can provide tokens
         // from a cache or lookup tables.
         //
-        llama_tokens draft = common_speculative_gen_draft(spec, params_spec, prompt_tgt, id_last);
+        common_speculative_tree draft = common_speculative_gen_draft_tree(spec, params_spec, prompt_tgt, id_last);
 
-        //LOG_DBG("draft: %s\n", string_from(ctx_dft, draft).c_str());
-
-        // always have a token to evaluate from before - id_last
-        common_batch_clear(batch_tgt);
-        common_batch_add  (batch_tgt, id_last, n_past++, { 0 }, true);
+        //LOG_DBG("draft: %s\n", string_from(ctx_dft, draft.tokens).c_str());
 
         // evaluate the target model on [id_last, draft0, draft1, ..., draftN-1]
+        // always have a token to evaluate from before - id_last
+        // the branches of the draft are evaluated in separate sequences, so each token only attends to its own branch
         {
             // do not waste time on small drafts
-            if (draft.size() < (size_t) n_draft_min) {
-                draft.clear();
+            if (draft.tokens.size() < (size_t) n_draft_min) {
+                draft = {};
             }
 
-            for (size_t i = 0; i < draft.size(); ++i) {
-                common_batch_add(batch_tgt, draft[i], n_past + i, { 0 }, true);
-            }
+            common_speculative_tree_batch(llama_get_memory(ctx_tgt), batch_tgt, draft, id_last, n_past, seq_ids);
 
             //LOG_DBG("target batch: %s\n", string_from(ctx_tgt, batch_tgt).c_str());
 
@@ -175,16 +183,22 @@ int main(int argc, char ** argv) {
         // for each token to be accepted, the sampler would have to sample that same token
         // in such cases, instead of decoding the sampled token as we normally do, we simply continue with the
         // available logits from the batch and sample the next token until we run out of logits or the sampler
-        // disagrees with the draft
+        // disagrees with all the branches of the draft
         //
-        const auto ids = common_sampler_sample_and_accept_n(smpl, ctx_tgt, draft);
+        const auto ids = common_sampler_sample_and_accept_tree(smpl, ctx_tgt, draft.tokens, draft.parents);
 
         //LOG_DBG("ids: %s\n", string_from(ctx_tgt, ids).c_str());
 
         GGML_ASSERT(ids.size() > 0); // there will always be at least one accepted token
 
-        n_past    += ids.size() - 1;
-        n_drafted += draft.size(); // note: we ignore the discarded small drafts
+        {
+            LOG_DBG("clear kv cache from any extra tokens and branches, n_past = %d\n", n_past + (int) ids.size());
+
+            common_speculative_tree_accept(llama_get_memory(ctx_tgt), draft, ids, n_past, seq_ids);
+        }
+
+        n_past    += ids.size();
+        n_drafted += draft.tokens.size(); // note: we ignore the discarded small drafts
         n_accept  += ids.size() - 1;
         n_predict += ids.size();
 
@@ -212,13 +226,7 @@ int main(int argc, char ** argv) {
             }
         }
 
-        LOG_DBG("accepted %d/%d draft tokens, the last target token is: (%d)\n", (int) ids.size() - 1, (int) draft.size(), id_last);
-
-        {
-            LOG_DBG("clear kv cache from any extra tokens, n_past = %d\n", n_past);
-
-            llama_memory_seq_rm(llama_get_memory(ctx_tgt), 0, n_past, -1);
-        }
+        LOG_DBG("accepted %d/%d draft tokens, the last target token is: (%d)\n", (int) ids.size() - 1, (int) draft.tokens.size(), id_last);
 
         if ((params.n_predict >= 0 && n_predict > params.n_predict) || has_eos) {
             break;
@@ -236,6 +244,7 @@ int main(int argc, char ** argv) {
 
     LOG_INF("\n");
     LOG_INF("n_draft   = %d\n", n_draft);
+    LOG_INF("n_branch  = %d\n", params_spec.n_branch);
     LOG_INF("n_predict = %d\n", n_predict);
     LOG_INF("n_drafted = %d\n", n_drafted);
     LOG_INF("n_accept  = %d\n", n_accept);
@@ -28,11 +28,13 @@ extern "C" {
         GGML_NUMA_STRATEGY_ISOLATE    = 2,
         GGML_NUMA_STRATEGY_NUMACTL    = 3,
         GGML_NUMA_STRATEGY_MIRROR     = 4,
+        GGML_NUMA_STRATEGY_INTERLEAVE = 5,
         GGML_NUMA_STRATEGY_COUNT
     };
 
     GGML_BACKEND_API void    ggml_numa_init(enum ggml_numa_strategy numa); // call once for better performance on NUMA systems
     GGML_BACKEND_API bool    ggml_is_numa(void); // true if init detected that system has >1 NUMA node
+    GGML_BACKEND_API bool    ggml_numa_place_tensor(struct ggml_tensor * tensor); // interleave the rows of a weight across the NUMA nodes (GGML_NUMA_STRATEGY_INTERLEAVE)
 
     GGML_BACKEND_API struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value);
     GGML_BACKEND_API struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value);
@@ -52,11 +54,26 @@ extern "C" {
     GGML_BACKEND_API float   ggml_get_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2, int i3);
     GGML_BACKEND_API void    ggml_set_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2, int i3, float value);
 
+    // statistics of the last graph computed with a threadpool, summed over its threads
+    // the barrier at the end of the graph is not included
+    struct ggml_threadpool_stats {
+        int64_t n_barrier;       // number of barriers passed
+        int64_t n_barrier_sleep; // number of barrier waits that went to sleep
+        int64_t t_barrier_ns;    // time spent waiting in barriers
+    };
+
     GGML_BACKEND_API struct ggml_threadpool *      ggml_threadpool_new           (struct ggml_threadpool_params  * params);
     GGML_BACKEND_API void                          ggml_threadpool_free          (struct ggml_threadpool * threadpool);
     GGML_BACKEND_API int                           ggml_threadpool_get_n_threads (struct ggml_threadpool * threadpool);
     GGML_BACKEND_API void                          ggml_threadpool_pause         (struct ggml_threadpool * threadpool);
     GGML_BACKEND_API void                          ggml_threadpool_resume        (struct ggml_threadpool * threadpool);
+    GGML_BACKEND_API void                          ggml_threadpool_get_stats     (struct ggml_threadpool * threadpool, struct ggml_threadpool_stats * stats);
+
+    // partition of a threadpool: a threadpool with n_threads threads that borrows the workers [first, first + n_threads - 1) of threadpool
+    // as usual, the thread calling ggml_graph_compute is thread 0 of the partition
+    // partitions with disjoint workers compute their graphs concurrently (e.g. a draft and a target model)
+    // the threadpool must be idle or paused when a partition is created, and it cannot compute until all its partitions are freed
+    GGML_BACKEND_API struct ggml_threadpool *      ggml_threadpool_new_partition (struct ggml_threadpool * threadpool, int first, int n_threads);
 
     // ggml_graph_plan() has to be called before ggml_graph_compute()
     // when plan.work_size > 0, caller must allocate memory for plan.work_data
@@ -110,11 +127,14 @@ extern "C" {
     typedef void (*ggml_vec_dot_t)  (int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT x, size_t bx,
                                        const void * GGML_RESTRICT y, size_t by, int nrc);
 
+    typedef void (*ggml_vec_mad_t)  (int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT x, float v);
+
     struct ggml_type_traits_cpu {
         ggml_from_float_t        from_float;
         ggml_vec_dot_t           vec_dot;
         enum ggml_type           vec_dot_type;
         int64_t                  nrows; // number of rows to process simultaneously
+        ggml_vec_mad_t           vec_mad; // y += v*x for a row x of this type, NULL if not available
     };
 
     GGML_BACKEND_API const struct ggml_type_traits_cpu * ggml_get_type_traits_cpu(enum ggml_type type);
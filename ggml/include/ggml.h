@@ -2004,6 +2004,7 @@ extern "C" {
             float                 step);
 
     // top k elements per row
+    // the result is a view of the first k elements of an argsort, the backends may sort only these
     GGML_API struct ggml_tensor * ggml_top_k(
             struct ggml_context * ctx,
             struct ggml_tensor  * a,
@@ -4309,3 +4309,73 @@ void ggml_vec_dot_iq4_xs_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const v
 #endif
 }
 
+void ggml_vec_mad_q4_0(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * GGML_RESTRICT x = vx;
+
+    int ib = 0;
+
+#if defined(__AVX2__)
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    const __m128i m8 = _mm_set1_epi8(8);
+
+    for (; ib < nb; ++ib) {
+        const __m256 d = _mm256_set1_ps(v*GGML_CPU_FP16_TO_FP32(x[ib].d));
+
+        // low nibbles are the first 16 values, high nibbles the last 16
+        const __m128i qs = _mm_loadu_si128((const __m128i *) x[ib].qs);
+        const __m128i q0 = _mm_sub_epi8(_mm_and_si128(qs, m4), m8);
+        const __m128i q1 = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(qs, 4), m4), m8);
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        _mm256_storeu_ps(yb +  0, _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q0)),                    _mm256_loadu_ps(yb +  0)));
+        _mm256_storeu_ps(yb +  8, _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q0, 8))), _mm256_loadu_ps(yb +  8)));
+        _mm256_storeu_ps(yb + 16, _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q1)),                    _mm256_loadu_ps(yb + 16)));
+        _mm256_storeu_ps(yb + 24, _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q1, 8))), _mm256_loadu_ps(yb + 24)));
+    }
+#endif
+    for (; ib < nb; ++ib) {
+        const float d = v*GGML_CPU_FP16_TO_FP32(x[ib].d);
+
+        for (int j = 0; j < qk/2; ++j) {
+            y[ib*qk + j       ] += d*((x[ib].qs[j] & 0x0F) - 8);
+            y[ib*qk + j + qk/2] += d*((x[ib].qs[j] >>   4) - 8);
+        }
+    }
+}
+
+void ggml_vec_mad_q8_0(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * GGML_RESTRICT x = vx;
+
+    int ib = 0;
+
+#if defined(__AVX2__)
+    for (; ib < nb; ++ib) {
+        const __m256 d = _mm256_set1_ps(v*GGML_CPU_FP16_TO_FP32(x[ib].d));
+
+        float * GGML_RESTRICT yb = y + ib*qk;
+
+        for (int j = 0; j < qk; j += 8) {
+            const __m256 q = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (x[ib].qs + j))));
+            _mm256_storeu_ps(yb + j, _mm256_fmadd_ps(d, q, _mm256_loadu_ps(yb + j)));
+        }
+    }
+#endif
+    for (; ib < nb; ++ib) {
+        const float d = v*GGML_CPU_FP16_TO_FP32(x[ib].d);
+
+        for (int j = 0; j < qk; ++j) {
+            y[ib*qk + j] += d*x[ib].qs[j];
+        }
+    }
+}
@@ -3283,3 +3283,925 @@ void ggml_gemm_q4_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
     }
 #endif
 }
+
+#if defined(__AVX2__)
+// load eight int8 values and repeat them across the four 64 bit lanes of the vector
+static inline __m256i repeat_i8x8_load(const int8_t * x) {
+    int64_t v;
+    memcpy(&v, x, sizeof(int64_t));
+    return _mm256_set1_epi64x(v);
+}
+
+// load two adjacent int16 values and repeat the pair across the eight 32 bit lanes of the vector
+static inline __m256i repeat_i16x2_load(const int16_t * x) {
+    int32_t v;
+    memcpy(&v, x, sizeof(int32_t));
+    return _mm256_set1_epi32(v);
+}
+
+// the dot products of the columns 0-3 and 4-7 of an interleaved block are accumulated in two int32 lanes per column
+// add the pairs and return the eight column sums in order
+static inline __m256i hsum_cols_int32x8(const __m256i acc_0123, const __m256i acc_4567) {
+    const __m256i sum = _mm256_hadd_epi32(acc_0123, acc_4567); // C0 C1 C4 C5 C2 C3 C6 C7
+    return _mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+// expand the eight 8 bit column scales of a sub block to int16, each of the four scales of a column half
+// repeated across the four int16 lanes that hold the pairwise products of that column
+static inline __m256i col_scales_i16x16(const __m128i scales, const __m128i shuffle) {
+    return _mm256_cvtepi8_epi16(_mm_shuffle_epi8(scales, shuffle));
+}
+
+static inline __m256i col_scales_u16x16(const __m128i scales, const __m128i shuffle) {
+    return _mm256_cvtepu8_epi16(_mm_shuffle_epi8(scales, shuffle));
+}
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// the AVX-512 kernels of the 8x8 layouts process two interleaved blocks at once, the block x in the low 256 bits and
+// the block x + 1 in the high 256 bits, each half laid out as in the AVX2 kernels
+static inline __m512i combine_i256x2(const __m256i lo, const __m256i hi) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+}
+
+static inline __m512i repeat_i8x8_load_x16(const int8_t * x) {
+    int64_t v;
+    memcpy(&v, x, sizeof(int64_t));
+    return _mm512_set1_epi64(v);
+}
+
+static inline __m512i repeat_i16x2_load_x16(const int16_t * x) {
+    int32_t v;
+    memcpy(&v, x, sizeof(int32_t));
+    return _mm512_set1_epi32(v);
+}
+
+// hsum_cols_int32x8 of both halves
+static inline __m512i hsum_cols_int32x16(const __m512i acc_0123, const __m512i acc_4567) {
+    const __m512i idx_even = _mm512_setr_epi32(0, 2, 4, 6, 16, 18, 20, 22,  8, 10, 12, 14, 24, 26, 28, 30);
+    const __m512i idx_odd  = _mm512_setr_epi32(1, 3, 5, 7, 17, 19, 21, 23,  9, 11, 13, 15, 25, 27, 29, 31);
+    return _mm512_add_epi32(_mm512_permutex2var_epi32(acc_0123, idx_even, acc_4567), _mm512_permutex2var_epi32(acc_0123, idx_odd, acc_4567));
+}
+#endif
+
+void ggml_gemv_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const block_q8_0x8 * b_ptr_start = (const block_q8_0x8 *)vx;
+    const block_q8_0 * a_ptr_start = (const block_q8_0 *)vy;
+
+    for (int64_t y = 0; y < nr; y++) {
+        const block_q8_0 * a_ptr = a_ptr_start + (y * nb);
+
+        // Take group of eight interleaved block_q8_0 structures at each pass of the loop and perform dot product operation
+        for (int64_t x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q8_0x8 * b_ptr = b_ptr_start + (x * nb);
+
+            __m256 acc_row = _mm256_setzero_ps();
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc_0123 = _mm256_setzero_si256();
+                __m256i iacc_4567 = _mm256_setzero_si256();
+
+                for (int k = 0; k < qk / blocklen; k++) {
+                    // A0(8k - 8k+7) repeated four times against B0-B3(8k - 8k+7) and B4-B7(8k - 8k+7)
+                    const __m256i lhs_vec = repeat_i8x8_load(a_ptr[b].qs + k * blocklen);
+                    const __m256i rhs_vec_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64));
+                    const __m256i rhs_vec_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64 + 32));
+
+                    iacc_0123 = mul_sum_i8_pairs_acc_int32x8(iacc_0123, rhs_vec_0123, lhs_vec);
+                    iacc_4567 = mul_sum_i8_pairs_acc_int32x8(iacc_4567, rhs_vec_4567, lhs_vec);
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                const __m256 row_scale_f32 = _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d));
+
+                acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_cols_int32x8(iacc_0123, iacc_4567)), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+            }
+
+            _mm256_storeu_ps(s + (y * bs + x * ncols_interleaved), acc_row);
+        }
+    }
+    return;
+#endif
+    ggml_gemv_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const block_q8_0x8 * b_ptr_start = (const block_q8_0x8 *)vx;
+    const block_q8_0x4 * a_ptr_start = (const block_q8_0x4 *)vy;
+
+    int64_t xstart = 0;
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    const int64_t anc = nc - nc % 16;
+    const __m512i zero = _mm512_setzero_si512();
+
+    for (int64_t y = 0; y < nr / 4; y++) {
+        const block_q8_0x4 * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = 0; x < anc / ncols_interleaved; x += 2) {
+            const block_q8_0x8 * b_ptr_0 = b_ptr_start + (x * nb);
+            const block_q8_0x8 * b_ptr_1 = b_ptr_start + ((x + 1) * nb);
+
+            __m512 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm512_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m512i iacc[4][2];
+                for (int m = 0; m < 4; m++) {
+                    iacc[m][0] = _mm512_setzero_si512();
+                    iacc[m][1] = _mm512_setzero_si512();
+                }
+
+                for (int k = 0; k < qk / blocklen; k++) {
+                    const __m512i rhs_vec_0123 = combine_i256x2(_mm256_loadu_si256((const __m256i *)(b_ptr_0[b].qs + k * 64)),
+                                                                _mm256_loadu_si256((const __m256i *)(b_ptr_1[b].qs + k * 64)));
+                    const __m512i rhs_vec_4567 = combine_i256x2(_mm256_loadu_si256((const __m256i *)(b_ptr_0[b].qs + k * 64 + 32)),
+                                                                _mm256_loadu_si256((const __m256i *)(b_ptr_1[b].qs + k * 64 + 32)));
+
+                    // the absolute values of the RHS are shared by the four rows, the signs are moved to the LHS
+                    const __m512i   rhs_abs_0123 = _mm512_abs_epi8(rhs_vec_0123);
+                    const __m512i   rhs_abs_4567 = _mm512_abs_epi8(rhs_vec_4567);
+                    const __mmask64 rhs_neg_0123 = _mm512_movepi8_mask(rhs_vec_0123);
+                    const __mmask64 rhs_neg_4567 = _mm512_movepi8_mask(rhs_vec_4567);
+
+                    for (int m = 0; m < 4; m++) {
+                        const __m512i lhs_vec = repeat_i8x8_load_x16(a_ptr[b].qs + k * 4 * blocklen + m * blocklen);
+
+                        iacc[m][0] = mul_sum_us8_pairs_acc_int32x16(iacc[m][0], rhs_abs_0123, _mm512_mask_sub_epi8(lhs_vec, rhs_neg_0123, zero, lhs_vec));
+                        iacc[m][1] = mul_sum_us8_pairs_acc_int32x16(iacc[m][1], rhs_abs_4567, _mm512_mask_sub_epi8(lhs_vec, rhs_neg_4567, zero, lhs_vec));
+                    }
+                }
+
+                const __m512 col_scale_f32 = GGML_F32Cx8x2_LOAD(b_ptr_0[b].d, b_ptr_1[b].d);
+
+                for (int m = 0; m < 4; m++) {
+                    const __m512 row_scale_f32 = _mm512_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d[m]));
+                    acc_rows[m] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(hsum_cols_int32x16(iacc[m][0], iacc[m][1])), _mm512_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm512_storeu_ps(s + ((y * 4 + m) * bs + x * ncols_interleaved), acc_rows[m]);
+            }
+        }
+    }
+
+    // the remaining block of 8 columns
+    xstart = anc / ncols_interleaved;
+#endif
+
+    // Take group of four interleaved block_q8_0 rows at each pass of the loop
+    for (int64_t y = 0; y < nr / 4; y++) {
+        const block_q8_0x4 * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = xstart; x < nc / ncols_interleaved; x++) {
+            const block_q8_0x8 * b_ptr = b_ptr_start + (x * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc[4][2];
+                for (int m = 0; m < 4; m++) {
+                    iacc[m][0] = _mm256_setzero_si256();
+                    iacc[m][1] = _mm256_setzero_si256();
+                }
+
+                for (int k = 0; k < qk / blocklen; k++) {
+                    const __m256i rhs_vec_0123 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64));
+                    const __m256i rhs_vec_4567 = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64 + 32));
+
+                    // the absolute values of the RHS are shared by the four rows, the signs are moved to the LHS
+                    const __m256i rhs_abs_0123 = _mm256_sign_epi8(rhs_vec_0123, rhs_vec_0123);
+                    const __m256i rhs_abs_4567 = _mm256_sign_epi8(rhs_vec_4567, rhs_vec_4567);
+
+                    for (int m = 0; m < 4; m++) {
+                        const __m256i lhs_vec = repeat_i8x8_load(a_ptr[b].qs + k * 4 * blocklen + m * blocklen);
+
+                        iacc[m][0] = mul_sum_us8_pairs_acc_int32x8(iacc[m][0], rhs_abs_0123, _mm256_sign_epi8(lhs_vec, rhs_vec_0123));
+                        iacc[m][1] = mul_sum_us8_pairs_acc_int32x8(iacc[m][1], rhs_abs_4567, _mm256_sign_epi8(lhs_vec, rhs_vec_4567));
+                    }
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+
+                for (int m = 0; m < 4; m++) {
+                    const __m256 row_scale_f32 = _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d[m]));
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_cols_int32x8(iacc[m][0], iacc[m][1])), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + ((y * 4 + m) * bs + x * ncols_interleaved), acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemv_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+    UNUSED(kmask1);
+    UNUSED(kmask2);
+    UNUSED(kmask3);
+
+#if defined(__AVX2__)
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m1b = _mm256_set1_epi8(0x01);
+    const __m128i scale_shuffle[2] = {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+    };
+
+    const block_q5_Kx8 * b_ptr_start = (const block_q5_Kx8 *)vx;
+    const block_q8_K * a_ptr_start = (const block_q8_K *)vy;
+
+    uint32_t utmp[32];
+
+    for (int64_t y = 0; y < nr; y++) {
+        const block_q8_K * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q5_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+            __m256 acc_row = _mm256_setzero_ps();
+
+            for (int64_t b = 0; b < nb; b++) {
+                // unpack the 6 bit scales and mins, the 8 scales of sub block sb are at utmp + sb * 16, followed by the 8 mins
+                for (int sb = 0; sb < 8; sb++) {
+                    memcpy(utmp + sb * 4, b_ptr[b].scales + sb * 12, 12);
+                    utmp[sb * 4 + 3] = ((utmp[sb * 4 + 2] >> 4) & kmask2) | (((utmp[sb * 4 + 1] >> 6) & kmask3) << 4);
+                    const uint32_t uaux_0 = utmp[sb * 4 + 1] & kmask1;
+                    utmp[sb * 4 + 1] = (utmp[sb * 4 + 2] & kmask2) | (((utmp[sb * 4 + 0] >> 6) & kmask3) << 4);
+                    utmp[sb * 4 + 2] = uaux_0;
+                    utmp[sb * 4 + 0] &= kmask1;
+                }
+                const uint8_t * scales = (const uint8_t *) utmp;
+
+                __m256i iacc[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+
+                for (int k = 0; k < qk / (2 * blocklen); k++) {
+                    // the low nibbles hold quants of sub block 2 * (k / 4), the high nibbles quants of the next sub block
+                    const int sb = 2 * (k / 4);
+                    const __m128i shift_0 = _mm_cvtsi32_si128(sb);
+                    const __m128i shift_1 = _mm_cvtsi32_si128(sb + 1);
+
+                    const __m128i scales_0 = _mm_loadl_epi64((const __m128i *)(scales + sb * 16));
+                    const __m128i scales_1 = _mm_loadl_epi64((const __m128i *)(scales + sb * 16 + 16));
+
+                    const __m256i lhs_vec_0 = repeat_i8x8_load(a_ptr[b].qs + (k >> 2) * 64 + (k % 4) * blocklen);
+                    const __m256i lhs_vec_1 = repeat_i8x8_load(a_ptr[b].qs + (k >> 2) * 64 + (k % 4) * blocklen + 32);
+
+                    for (int h = 0; h < 2; h++) {
+                        const __m256i rhs_raw_ql = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64 + h * 32));
+                        const __m256i rhs_raw_qh = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (k % 4) * 64 + h * 32));
+
+                        const __m256i rhs_vec_0 = _mm256_or_si256(_mm256_and_si256(rhs_raw_ql, m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_0), m1b), 4));
+                        const __m256i rhs_vec_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(rhs_raw_ql, 4), m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_1), m1b), 4));
+
+                        const __m256i dot_0 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_0, lhs_vec_0), col_scales_u16x16(scales_0, scale_shuffle[h]));
+                        const __m256i dot_1 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_1, lhs_vec_1), col_scales_u16x16(scales_1, scale_shuffle[h]));
+
+                        iacc[h] = _mm256_add_epi32(iacc[h], _mm256_add_epi32(dot_0, dot_1));
+                    }
+                }
+
+                // sum of the mins weighted by the sums of the q8_K quants of each sub block
+                __m256i iacc_min = _mm256_setzero_si256();
+                for (int sb = 0; sb < 8; sb++) {
+                    const __m256i mins = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(scales + sb * 16 + 8)));
+                    iacc_min = _mm256_add_epi32(iacc_min, _mm256_mullo_epi32(mins, _mm256_set1_epi32(a_ptr[b].bsums[sb * 2] + a_ptr[b].bsums[sb * 2 + 1])));
+                }
+
+                const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d);
+                const __m256 col_scale_f32 = _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].d), row_scale_f32);
+                const __m256 col_dmin_f32  = _mm256_mul_ps(GGML_F32Cx8_LOAD(b_ptr[b].dmin), row_scale_f32);
+
+                acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_cols_int32x8(iacc[0], iacc[1])), col_scale_f32, acc_row);
+                acc_row = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(iacc_min), col_dmin_f32, acc_row);
+            }
+
+            _mm256_storeu_ps(s + (y * bs + x * ncols_interleaved), acc_row);
+        }
+    }
+    return;
+#endif
+    ggml_gemv_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+    UNUSED(kmask1);
+    UNUSED(kmask2);
+    UNUSED(kmask3);
+
+#if defined(__AVX2__)
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m1b = _mm256_set1_epi8(0x01);
+    const __m128i scale_shuffle[2] = {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+    };
+
+    const block_q5_Kx8 * b_ptr_start = (const block_q5_Kx8 *)vx;
+    const block_q8_Kx4 * a_ptr_start = (const block_q8_Kx4 *)vy;
+
+    uint32_t utmp[32];
+
+    int64_t xstart = 0;
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    const int64_t anc = nc - nc % 16;
+    const __m512i m4b_x16 = _mm512_set1_epi8(0x0F);
+    const __m512i m1b_x16 = _mm512_set1_epi8(0x01);
+
+    for (int64_t y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = 0; x < anc / ncols_interleaved; x += 2) {
+            const block_q5_Kx8 * b_ptrs[2] = { b_ptr_start + (x * nb), b_ptr_start + ((x + 1) * nb) };
+
+            __m512 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm512_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                uint32_t utmp_x2[2][32];
+                for (int i = 0; i < 2; i++) {
+                    for (int sb = 0; sb < 8; sb++) {
+                        uint32_t * u = utmp_x2[i] + sb * 4;
+                        memcpy(u, b_ptrs[i][b].scales + sb * 12, 12);
+                        u[3] = ((u[2] >> 4) & kmask2) | (((u[1] >> 6) & kmask3) << 4);
+                        const uint32_t uaux_0 = u[1] & kmask1;
+                        u[1] = (u[2] & kmask2) | (((u[0] >> 6) & kmask3) << 4);
+                        u[2] = uaux_0;
+                        u[0] &= kmask1;
+                    }
+                }
+                const uint8_t * scales_x2[2] = { (const uint8_t *) utmp_x2[0], (const uint8_t *) utmp_x2[1] };
+
+                __m512i iacc[4][2];
+                for (int m = 0; m < 4; m++) {
+                    iacc[m][0] = _mm512_setzero_si512();
+                    iacc[m][1] = _mm512_setzero_si512();
+                }
+
+                for (int k = 0; k < qk / (2 * blocklen); k++) {
+                    const int sb = 2 * (k / 4);
+                    const __m128i shift_0 = _mm_cvtsi32_si128(sb);
+                    const __m128i shift_1 = _mm_cvtsi32_si128(sb + 1);
+
+                    __m128i scales_0[2], scales_1[2];
+                    for (int i = 0; i < 2; i++) {
+                        scales_0[i] = _mm_loadl_epi64((const __m128i *)(scales_x2[i] + sb * 16));
+                        scales_1[i] = _mm_loadl_epi64((const __m128i *)(scales_x2[i] + sb * 16 + 16));
+                    }
+
+                    for (int h = 0; h < 2; h++) {
+                        const __m512i rhs_raw_ql = combine_i256x2(_mm256_loadu_si256((const __m256i *)(b_ptrs[0][b].qs + k * 64 + h * 32)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b_ptrs[1][b].qs + k * 64 + h * 32)));
+                        const __m512i rhs_raw_qh = combine_i256x2(_mm256_loadu_si256((const __m256i *)(b_ptrs[0][b].qh + (k % 4) * 64 + h * 32)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b_ptrs[1][b].qh + (k % 4) * 64 + h * 32)));
+
+                        const __m512i rhs_vec_0 = _mm512_or_si512(_mm512_and_si512(rhs_raw_ql, m4b_x16),
+                                _mm512_slli_epi16(_mm512_and_si512(_mm512_srl_epi16(rhs_raw_qh, shift_0), m1b_x16), 4));
+                        const __m512i rhs_vec_1 = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(rhs_raw_ql, 4), m4b_x16),
+                                _mm512_slli_epi16(_mm512_and_si512(_mm512_srl_epi16(rhs_raw_qh, shift_1), m1b_x16), 4));
+
+                        const __m512i col_scales_0 = combine_i256x2(col_scales_u16x16(scales_0[0], scale_shuffle[h]), col_scales_u16x16(scales_0[1], scale_shuffle[h]));
+                        const __m512i col_scales_1 = combine_i256x2(col_scales_u16x16(scales_1[0], scale_shuffle[h]), col_scales_u16x16(scales_1[1], scale_shuffle[h]));
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m512i lhs_vec_0 = repeat_i8x8_load_x16(a_ptr[b].qs + (k >> 2) * 256 + (k % 4) * 4 * blocklen + m * blocklen);
+                            const __m512i lhs_vec_1 = repeat_i8x8_load_x16(a_ptr[b].qs + (k >> 2) * 256 + (k % 4) * 4 * blocklen + m * blocklen + 128);
+
+                            const __m512i dot_0 = _mm512_madd_epi16(_mm512_maddubs_epi16(rhs_vec_0, lhs_vec_0), col_scales_0);
+                            const __m512i dot_1 = _mm512_madd_epi16(_mm512_maddubs_epi16(rhs_vec_1, lhs_vec_1), col_scales_1);
+
+                            iacc[m][h] = _mm512_add_epi32(iacc[m][h], _mm512_add_epi32(dot_0, dot_1));
+                        }
+                    }
+                }
+
+                const __m512 col_scale_f32 = GGML_F32Cx8x2_LOAD(b_ptrs[0][b].d, b_ptrs[1][b].d);
+                const __m512 col_dmin_f32  = GGML_F32Cx8x2_LOAD(b_ptrs[0][b].dmin, b_ptrs[1][b].dmin);
+
+                for (int m = 0; m < 4; m++) {
+                    __m512i iacc_min = _mm512_setzero_si512();
+                    for (int sb = 0; sb < 8; sb++) {
+                        const int16_t * bsums = a_ptr[b].bsums + (sb * 8) + (m * 4) - ((sb % 2) * 6);
+                        const __m512i mins = _mm512_cvtepu8_epi32(_mm_unpacklo_epi64(
+                                _mm_loadl_epi64((const __m128i *)(scales_x2[0] + sb * 16 + 8)),
+                                _mm_loadl_epi64((const __m128i *)(scales_x2[1] + sb * 16 + 8))));
+                        iacc_min = _mm512_add_epi32(iacc_min, _mm512_mullo_epi32(mins, _mm512_set1_epi32(bsums[0] + bsums[1])));
+                    }
+
+                    const __m512 row_scale_f32 = _mm512_set1_ps(a_ptr[b].d[m]);
+
+                    acc_rows[m] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(hsum_cols_int32x16(iacc[m][0], iacc[m][1])), _mm512_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                    acc_rows[m] = _mm512_fnmadd_ps(_mm512_cvtepi32_ps(iacc_min), _mm512_mul_ps(col_dmin_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm512_storeu_ps(s + ((y * 4 + m) * bs + x * ncols_interleaved), acc_rows[m]);
+            }
+        }
+    }
+
+    // the remaining block of 8 columns
+    xstart = anc / ncols_interleaved;
+#endif
+
+    for (int64_t y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = xstart; x < nc / ncols_interleaved; x++) {
+            const block_q5_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                for (int sb = 0; sb < 8; sb++) {
+                    memcpy(utmp + sb * 4, b_ptr[b].scales + sb * 12, 12);
+                    utmp[sb * 4 + 3] = ((utmp[sb * 4 + 2] >> 4) & kmask2) | (((utmp[sb * 4 + 1] >> 6) & kmask3) << 4);
+                    const uint32_t uaux_0 = utmp[sb * 4 + 1] & kmask1;
+                    utmp[sb * 4 + 1] = (utmp[sb * 4 + 2] & kmask2) | (((utmp[sb * 4 + 0] >> 6) & kmask3) << 4);
+                    utmp[sb * 4 + 2] = uaux_0;
+                    utmp[sb * 4 + 0] &= kmask1;
+                }
+                const uint8_t * scales = (const uint8_t *) utmp;
+
+                __m256i iacc[4][2];
+                for (int m = 0; m < 4; m++) {
+                    iacc[m][0] = _mm256_setzero_si256();
+                    iacc[m][1] = _mm256_setzero_si256();
+                }
+
+                for (int k = 0; k < qk / (2 * blocklen); k++) {
+                    const int sb = 2 * (k / 4);
+                    const __m128i shift_0 = _mm_cvtsi32_si128(sb);
+                    const __m128i shift_1 = _mm_cvtsi32_si128(sb + 1);
+
+                    const __m128i scales_0 = _mm_loadl_epi64((const __m128i *)(scales + sb * 16));
+                    const __m128i scales_1 = _mm_loadl_epi64((const __m128i *)(scales + sb * 16 + 16));
+
+                    for (int h = 0; h < 2; h++) {
+                        const __m256i rhs_raw_ql = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qs + k * 64 + h * 32));
+                        const __m256i rhs_raw_qh = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + (k % 4) * 64 + h * 32));
+
+                        const __m256i rhs_vec_0 = _mm256_or_si256(_mm256_and_si256(rhs_raw_ql, m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_0), m1b), 4));
+                        const __m256i rhs_vec_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(rhs_raw_ql, 4), m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_1), m1b), 4));
+
+                        const __m256i col_scales_0 = col_scales_u16x16(scales_0, scale_shuffle[h]);
+                        const __m256i col_scales_1 = col_scales_u16x16(scales_1, scale_shuffle[h]);
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m256i lhs_vec_0 = repeat_i8x8_load(a_ptr[b].qs + (k >> 2) * 256 + (k % 4) * 4 * blocklen + m * blocklen);
+                            const __m256i lhs_vec_1 = repeat_i8x8_load(a_ptr[b].qs + (k >> 2) * 256 + (k % 4) * 4 * blocklen + m * blocklen + 128);
+
+                            const __m256i dot_0 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_0, lhs_vec_0), col_scales_0);
+                            const __m256i dot_1 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_1, lhs_vec_1), col_scales_1);
+
+                            iacc[m][h] = _mm256_add_epi32(iacc[m][h], _mm256_add_epi32(dot_0, dot_1));
+                        }
+                    }
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                const __m256 col_dmin_f32  = GGML_F32Cx8_LOAD(b_ptr[b].dmin);
+
+                for (int m = 0; m < 4; m++) {
+                    __m256i iacc_min = _mm256_setzero_si256();
+                    for (int sb = 0; sb < 8; sb++) {
+                        const int16_t * bsums = a_ptr[b].bsums + (sb * 8) + (m * 4) - ((sb % 2) * 6);
+                        const __m256i mins = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(scales + sb * 16 + 8)));
+                        iacc_min = _mm256_add_epi32(iacc_min, _mm256_mullo_epi32(mins, _mm256_set1_epi32(bsums[0] + bsums[1])));
+                    }
+
+                    const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d[m]);
+
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_cols_int32x8(iacc[m][0], iacc[m][1])), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                    acc_rows[m] = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(iacc_min), _mm256_mul_ps(col_dmin_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + ((y * 4 + m) * bs + x * ncols_interleaved), acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemv_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m2b = _mm256_set1_epi8(0x03);
+    const __m128i scale_shuffle[2] = {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+    };
+
+    const block_q6_Kx8 * b_ptr_start = (const block_q6_Kx8 *)vx;
+    const block_q8_K * a_ptr_start = (const block_q8_K *)vy;
+
+    for (int64_t y = 0; y < nr; y++) {
+        const block_q8_K * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q6_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+            __m256 acc_row = _mm256_setzero_ps();
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+
+                for (int k = 0; k < qk / (2 * blocklen); k++) {
+                    // within each half of the super block, the low nibbles hold quants [o, o + 8)
+                    // and the high nibbles quants [o + 64, o + 72)
+                    const int half = k / 8;
+                    const int o    = (k % 8) * blocklen;
+                    const int kh   = half * 4 + (k % 4);
+                    const __m128i shift_0 = _mm_cvtsi32_si128(2 * ((k % 8) / 4));
+                    const __m128i shift_1 = _mm_cvtsi32_si128(2 * ((k % 8) / 4) + 4);
+
+                    const __m128i scales_0 = _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + (half * 8 + (k % 8) / 2) * 8));
+                    const __m128i scales_1 = _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + (half * 8 + (k % 8) / 2) * 8 + 32));
+
+                    const __m256i lhs_vec_0 = repeat_i8x8_load(a_ptr[b].qs + half * 128 + o);
+                    const __m256i lhs_vec_1 = repeat_i8x8_load(a_ptr[b].qs + half * 128 + o + 64);
+
+                    for (int h = 0; h < 2; h++) {
+                        const __m256i rhs_raw_ql = _mm256_loadu_si256((const __m256i *)(b_ptr[b].ql + k * 64 + h * 32));
+                        const __m256i rhs_raw_qh = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + kh * 64 + h * 32));
+
+                        // unsigned 6 bit quants, the offset of 32 is applied below through the q8_K block sums
+                        const __m256i rhs_vec_0 = _mm256_or_si256(_mm256_and_si256(rhs_raw_ql, m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_0), m2b), 4));
+                        const __m256i rhs_vec_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(rhs_raw_ql, 4), m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_1), m2b), 4));
+
+                        const __m256i dot_0 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_0, lhs_vec_0), col_scales_i16x16(scales_0, scale_shuffle[h]));
+                        const __m256i dot_1 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_1, lhs_vec_1), col_scales_i16x16(scales_1, scale_shuffle[h]));
+
+                        iacc[h] = _mm256_add_epi32(iacc[h], _mm256_add_epi32(dot_0, dot_1));
+                    }
+                }
+
+                // 32 * sum of the scales weighted by the sums of the q8_K quants of each sub block,
+                // two sub blocks at a time: each int32 lane holds the pair of scales of one column
+                __m256i iacc_offset = _mm256_setzero_si256();
+                for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                    const __m256i scales = _mm256_cvtepi8_epi16(_mm_unpacklo_epi8(
+                            _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8)),
+                            _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8 + 8))));
+                    iacc_offset = _mm256_add_epi32(iacc_offset, _mm256_madd_epi16(scales, repeat_i16x2_load(a_ptr[b].bsums + sb)));
+                }
+
+                const __m256i isum = _mm256_sub_epi32(hsum_cols_int32x8(iacc[0], iacc[1]), _mm256_slli_epi32(iacc_offset, 5));
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d);
+
+                acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(isum), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+            }
+
+            _mm256_storeu_ps(s + (y * bs + x * ncols_interleaved), acc_row);
+        }
+    }
+    return;
+#endif
+    ggml_gemv_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
+
+void ggml_gemm_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    UNUSED(s);
+    UNUSED(bs);
+    UNUSED(vx);
+    UNUSED(vy);
+    UNUSED(nr);
+    UNUSED(nc);
+    UNUSED(nb);
+    UNUSED(ncols_interleaved);
+    UNUSED(blocklen);
+
+#if defined(__AVX2__)
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m2b = _mm256_set1_epi8(0x03);
+    const __m128i scale_shuffle[2] = {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+    };
+
+    const block_q6_Kx8 * b_ptr_start = (const block_q6_Kx8 *)vx;
+    const block_q8_Kx4 * a_ptr_start = (const block_q8_Kx4 *)vy;
+
+    int64_t xstart = 0;
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    const int64_t anc = nc - nc % 16;
+    const __m512i m4b_x16 = _mm512_set1_epi8(0x0F);
+    const __m512i m2b_x16 = _mm512_set1_epi8(0x03);
+
+    for (int64_t y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = 0; x < anc / ncols_interleaved; x += 2) {
+            const block_q6_Kx8 * b_ptrs[2] = { b_ptr_start + (x * nb), b_ptr_start + ((x + 1) * nb) };
+
+            __m512 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm512_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m512i iacc[4][2];
+                for (int m = 0; m < 4; m++) {
+                    iacc[m][0] = _mm512_setzero_si512();
+                    iacc[m][1] = _mm512_setzero_si512();
+                }
+
+                for (int k = 0; k < qk / (2 * blocklen); k++) {
+                    const int half = k / 8;
+                    const int kh   = half * 4 + (k % 4);
+                    const __m128i shift_0 = _mm_cvtsi32_si128(2 * ((k % 8) / 4));
+                    const __m128i shift_1 = _mm_cvtsi32_si128(2 * ((k % 8) / 4) + 4);
+
+                    __m128i scales_0[2], scales_1[2];
+                    for (int i = 0; i < 2; i++) {
+                        scales_0[i] = _mm_loadl_epi64((const __m128i *)(b_ptrs[i][b].scales + (half * 8 + (k % 8) / 2) * 8));
+                        scales_1[i] = _mm_loadl_epi64((const __m128i *)(b_ptrs[i][b].scales + (half * 8 + (k % 8) / 2) * 8 + 32));
+                    }
+
+                    for (int h = 0; h < 2; h++) {
+                        const __m512i rhs_raw_ql = combine_i256x2(_mm256_loadu_si256((const __m256i *)(b_ptrs[0][b].ql + k * 64 + h * 32)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b_ptrs[1][b].ql + k * 64 + h * 32)));
+                        const __m512i rhs_raw_qh = combine_i256x2(_mm256_loadu_si256((const __m256i *)(b_ptrs[0][b].qh + kh * 64 + h * 32)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b_ptrs[1][b].qh + kh * 64 + h * 32)));
+
+                        const __m512i rhs_vec_0 = _mm512_or_si512(_mm512_and_si512(rhs_raw_ql, m4b_x16),
+                                _mm512_slli_epi16(_mm512_and_si512(_mm512_srl_epi16(rhs_raw_qh, shift_0), m2b_x16), 4));
+                        const __m512i rhs_vec_1 = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(rhs_raw_ql, 4), m4b_x16),
+                                _mm512_slli_epi16(_mm512_and_si512(_mm512_srl_epi16(rhs_raw_qh, shift_1), m2b_x16), 4));
+
+                        const __m512i col_scales_0 = combine_i256x2(col_scales_i16x16(scales_0[0], scale_shuffle[h]), col_scales_i16x16(scales_0[1], scale_shuffle[h]));
+                        const __m512i col_scales_1 = combine_i256x2(col_scales_i16x16(scales_1[0], scale_shuffle[h]), col_scales_i16x16(scales_1[1], scale_shuffle[h]));
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m512i lhs_vec_0 = repeat_i8x8_load_x16(a_ptr[b].qs + (half * 16 + (k % 8)) * 4 * blocklen + m * blocklen);
+                            const __m512i lhs_vec_1 = repeat_i8x8_load_x16(a_ptr[b].qs + (half * 16 + (k % 8)) * 4 * blocklen + m * blocklen + 256);
+
+                            const __m512i dot_0 = _mm512_madd_epi16(_mm512_maddubs_epi16(rhs_vec_0, lhs_vec_0), col_scales_0);
+                            const __m512i dot_1 = _mm512_madd_epi16(_mm512_maddubs_epi16(rhs_vec_1, lhs_vec_1), col_scales_1);
+
+                            iacc[m][h] = _mm512_add_epi32(iacc[m][h], _mm512_add_epi32(dot_0, dot_1));
+                        }
+                    }
+                }
+
+                // pairs of scales of consecutive sub blocks, shared by the four rows
+                __m512i scales[QK_K / 32];
+                for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                    __m256i scales_x2[2];
+                    for (int i = 0; i < 2; i++) {
+                        scales_x2[i] = _mm256_cvtepi8_epi16(_mm_unpacklo_epi8(
+                                _mm_loadl_epi64((const __m128i *)(b_ptrs[i][b].scales + sb * 8)),
+                                _mm_loadl_epi64((const __m128i *)(b_ptrs[i][b].scales + sb * 8 + 8))));
+                    }
+                    scales[sb / 2] = combine_i256x2(scales_x2[0], scales_x2[1]);
+                }
+
+                const __m512 col_scale_f32 = GGML_F32Cx8x2_LOAD(b_ptrs[0][b].d, b_ptrs[1][b].d);
+
+                for (int m = 0; m < 4; m++) {
+                    // the bsums of sub blocks 2i and 2i + 1 of a row are adjacent in block_q8_Kx4
+                    __m512i iacc_offset = _mm512_setzero_si512();
+                    for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                        const int16_t * bsums = a_ptr[b].bsums + (sb / 4) * 16 + m * 4 + (sb % 4);
+                        iacc_offset = _mm512_add_epi32(iacc_offset, _mm512_madd_epi16(scales[sb / 2], repeat_i16x2_load_x16(bsums)));
+                    }
+
+                    const __m512i isum = _mm512_sub_epi32(hsum_cols_int32x16(iacc[m][0], iacc[m][1]), _mm512_slli_epi32(iacc_offset, 5));
+                    const __m512 row_scale_f32 = _mm512_set1_ps(a_ptr[b].d[m]);
+
+                    acc_rows[m] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(isum), _mm512_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm512_storeu_ps(s + ((y * 4 + m) * bs + x * ncols_interleaved), acc_rows[m]);
+            }
+        }
+    }
+
+    // the remaining block of 8 columns
+    xstart = anc / ncols_interleaved;
+#endif
+
+    for (int64_t y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = a_ptr_start + (y * nb);
+
+        for (int64_t x = xstart; x < nc / ncols_interleaved; x++) {
+            const block_q6_Kx8 * b_ptr = b_ptr_start + (x * nb);
+
+            __m256 acc_rows[4];
+            for (int m = 0; m < 4; m++) {
+                acc_rows[m] = _mm256_setzero_ps();
+            }
+
+            for (int64_t b = 0; b < nb; b++) {
+                __m256i iacc[4][2];
+                for (int m = 0; m < 4; m++) {
+                    iacc[m][0] = _mm256_setzero_si256();
+                    iacc[m][1] = _mm256_setzero_si256();
+                }
+
+                for (int k = 0; k < qk / (2 * blocklen); k++) {
+                    const int half = k / 8;
+                    const int kh   = half * 4 + (k % 4);
+                    const __m128i shift_0 = _mm_cvtsi32_si128(2 * ((k % 8) / 4));
+                    const __m128i shift_1 = _mm_cvtsi32_si128(2 * ((k % 8) / 4) + 4);
+
+                    const __m128i scales_0 = _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + (half * 8 + (k % 8) / 2) * 8));
+                    const __m128i scales_1 = _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + (half * 8 + (k % 8) / 2) * 8 + 32));
+
+                    for (int h = 0; h < 2; h++) {
+                        const __m256i rhs_raw_ql = _mm256_loadu_si256((const __m256i *)(b_ptr[b].ql + k * 64 + h * 32));
+                        const __m256i rhs_raw_qh = _mm256_loadu_si256((const __m256i *)(b_ptr[b].qh + kh * 64 + h * 32));
+
+                        const __m256i rhs_vec_0 = _mm256_or_si256(_mm256_and_si256(rhs_raw_ql, m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_0), m2b), 4));
+                        const __m256i rhs_vec_1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(rhs_raw_ql, 4), m4b),
+                                _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(rhs_raw_qh, shift_1), m2b), 4));
+
+                        const __m256i col_scales_0 = col_scales_i16x16(scales_0, scale_shuffle[h]);
+                        const __m256i col_scales_1 = col_scales_i16x16(scales_1, scale_shuffle[h]);
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m256i lhs_vec_0 = repeat_i8x8_load(a_ptr[b].qs + (half * 16 + (k % 8)) * 4 * blocklen + m * blocklen);
+                            const __m256i lhs_vec_1 = repeat_i8x8_load(a_ptr[b].qs + (half * 16 + (k % 8)) * 4 * blocklen + m * blocklen + 256);
+
+                            const __m256i dot_0 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_0, lhs_vec_0), col_scales_0);
+                            const __m256i dot_1 = _mm256_madd_epi16(_mm256_maddubs_epi16(rhs_vec_1, lhs_vec_1), col_scales_1);
+
+                            iacc[m][h] = _mm256_add_epi32(iacc[m][h], _mm256_add_epi32(dot_0, dot_1));
+                        }
+                    }
+                }
+
+                // pairs of scales of consecutive sub blocks, shared by the four rows
+                __m256i scales[QK_K / 32];
+                for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                    scales[sb / 2] = _mm256_cvtepi8_epi16(_mm_unpacklo_epi8(
+                            _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8)),
+                            _mm_loadl_epi64((const __m128i *)(b_ptr[b].scales + sb * 8 + 8))));
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+
+                for (int m = 0; m < 4; m++) {
+                    // the bsums of sub blocks 2i and 2i + 1 of a row are adjacent in block_q8_Kx4
+                    __m256i iacc_offset = _mm256_setzero_si256();
+                    for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                        const int16_t * bsums = a_ptr[b].bsums + (sb / 4) * 16 + m * 4 + (sb % 4);
+                        iacc_offset = _mm256_add_epi32(iacc_offset, _mm256_madd_epi16(scales[sb / 2], repeat_i16x2_load(bsums)));
+                    }
+
+                    const __m256i isum = _mm256_sub_epi32(hsum_cols_int32x8(iacc[m][0], iacc[m][1]), _mm256_slli_epi32(iacc_offset, 5));
+                    const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d[m]);
+
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(isum), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + ((y * 4 + m) * bs + x * ncols_interleaved), acc_rows[m]);
+            }
+        }
+    }
+    return;
+#endif
+    ggml_gemm_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+}
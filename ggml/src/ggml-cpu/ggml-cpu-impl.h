@@ -512,6 +512,19 @@ void ggml_barrier(struct ggml_threadpool * tp);
 void ggml_threadpool_chunk_set(struct ggml_threadpool * tp, int value);
 int  ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value);
 
+struct ggml_cplan;
+
+// the barriers and the fused nodes of a graph computed with n_threads threads, see enum ggml_node_sync
+// node_sync and node_fused have room for cgraph->n_nodes values
+void ggml_graph_plan_sync(const struct ggml_cgraph * cgraph, int n_threads, uint8_t * node_sync, uint8_t * node_fused);
+
+// ggml_graph_compute with the result of ggml_graph_plan_sync for the same graph and cplan->n_threads
+enum ggml_status ggml_graph_compute_synced(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan,
+        const uint8_t * node_sync, const uint8_t * node_fused);
+
+// testing: ggml_graph_compute with a barrier before each node, as without the barrier elision
+enum ggml_status ggml_graph_compute_barriers_testing(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,11 @@
 #if defined(__gnu_linux__)
 #include <syscall.h>
 #endif
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 
 #ifdef GGML_USE_OPENMP
 #include <omp.h>
@@ -215,6 +220,7 @@ static const struct ggml_type_traits_cpu type_traits_cpu[GGML_TYPE_COUNT] = {
 #else
         .nrows                    = 1,
 #endif
+        .vec_mad                  = ggml_vec_mad_q4_0,
     },
     [GGML_TYPE_Q4_1] = {
         .from_float               = quantize_row_q4_1,
@@ -247,6 +253,7 @@ static const struct ggml_type_traits_cpu type_traits_cpu[GGML_TYPE_COUNT] = {
 #else
         .nrows                    = 1,
 #endif
+        .vec_mad                  = ggml_vec_mad_q8_0,
     },
     [GGML_TYPE_Q8_1] = {
         .from_float               = quantize_row_q8_1,
@@ -443,12 +450,14 @@ struct ggml_threadpool {
     atomic_int n_graph;       // incremented when there is work to be done (i.e each graph)
     atomic_int GGML_CACHE_ALIGN n_barrier;
     atomic_int GGML_CACHE_ALIGN n_barrier_passed;
+    atomic_int GGML_CACHE_ALIGN n_barrier_sleep; // number of threads sleeping in the barrier
     atomic_int GGML_CACHE_ALIGN current_chunk; // currently processing chunk during Mat_Mul, shared between all the threads.
 
     // these are atomic as an annotation for thread-sanitizer
     atomic_bool stop;         // Used for stopping the threadpool altogether
     atomic_bool pause;        // Used for pausing the threadpool or individual threads
     atomic_int abort;         // Used for aborting processing of a graph
+    atomic_bool busy;         // a graph is being computed, the workers cannot be lent to a partition
 
     struct ggml_compute_state * workers;   // per thread state
     int          n_threads_max; // number of threads in the pool
@@ -458,6 +467,23 @@ struct ggml_threadpool {
     uint32_t     poll;        // Polling level (0 - no polling)
 
     enum ggml_status ec;
+
+    // synchronization of the nodes of the current graph (enum ggml_node_sync)
+    const uint8_t * node_sync;
+
+    // number of nodes fused into each node of the current graph
+    const uint8_t * node_fused;
+
+    // node_sync and node_fused of the graphs computed without a precomputed synchronization
+    uint8_t    * node_sync_buf;
+    uint8_t    * node_fused_buf;
+    int          node_sync_size;
+
+    // partitions (see ggml_threadpool_new_partition)
+    struct ggml_threadpool * parent; // threadpool whose workers this partition borrows
+    int          first;              // index in the parent of the first borrowed worker
+    atomic_int   n_lent;             // number of borrowed workers that have not returned to the parent yet
+    atomic_int   n_partitions;       // number of partitions of this threadpool
 };
 
 // Per-thread state
@@ -467,9 +493,21 @@ struct ggml_compute_state {
     bool cpumask[GGML_MAX_N_THREADS];
     int  last_graph;
     bool pending;
+
+    // state of this worker in the partition it is lent to, or NULL
+    struct ggml_compute_state * _Atomic part;
 #endif
     struct ggml_threadpool * threadpool;
     int ith;
+
+    // adaptive waiting (see ggml_barrier and ggml_graph_compute_check_for_work)
+    int64_t t_spin;        // how long to spin in the barrier before yielding (ns)
+    int64_t n_preempt;     // number of times the thread was preempted, as of the last check
+    int64_t t_idle_avg;    // average of the recent waits for a new graph (ns)
+    int64_t t_poll;        // duration of the last poll that ran out without finding work (ns)
+
+    struct ggml_threadpool_stats stats;       // current graph
+    struct ggml_threadpool_stats stats_graph; // last graph, without its final barrier
 };
 
 // Helpers for polling loops
@@ -485,6 +523,63 @@ static inline void ggml_thread_cpu_relax(void) {
 static inline void ggml_thread_cpu_relax(void) {;}
 #endif
 
+// Helpers for adaptive waiting
+//   a waiting thread spins for up to t_spin, then yields GGML_WAIT_N_YIELD times, then sleeps (futex on Linux, yield elsewhere)
+#define GGML_WAIT_SPIN_MIN_NS (1000)
+#define GGML_WAIT_SPIN_NS     (100*1000)
+#define GGML_WAIT_N_YIELD     1
+
+static inline int64_t ggml_wait_time_ns(void) {
+#if defined(_WIN32)
+    return ggml_time_us()*1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000 + (int64_t)ts.tv_nsec;
+#endif
+}
+
+// exponential moving average of the recent wait times
+static inline void ggml_wait_time_update(int64_t * avg, int64_t t) {
+    *avg += (t - *avg)/8;
+}
+
+#if defined(__linux__)
+#define GGML_WAIT_FUTEX 1
+
+static inline void ggml_futex_wait(atomic_int * addr, int value) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static inline void ggml_futex_wake(atomic_int * addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+// check if another thread has needed the core of this thread since the last check (i.e. it was preempted)
+// not available outside of Linux, so the spin time does not shrink there
+static inline bool ggml_wait_contended(int64_t * n_preempt) {
+#if defined(__linux__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+        const bool contended = ru.ru_nivcsw != *n_preempt;
+        *n_preempt = ru.ru_nivcsw;
+        return contended;
+    }
+#endif
+    UNUSED(n_preempt);
+    return false;
+}
+
+#if defined(_MSC_VER)
+#define GGML_THREAD_LOCAL __declspec(thread)
+#else
+#define GGML_THREAD_LOCAL _Thread_local
+#endif
+
+// compute state of the current thread, NULL outside of ggml_graph_compute_thread
+static GGML_THREAD_LOCAL struct ggml_compute_state * ggml_cur_state = NULL;
+
 //
 // NUMA support
 //
@@ -526,8 +621,17 @@ void ggml_barrier(struct ggml_threadpool * tp) {
         return;
     }
 
+    struct ggml_compute_state * state = ggml_cur_state;
+
 #ifdef GGML_USE_OPENMP
+    const int64_t t_start = ggml_wait_time_ns();
+
     #pragma omp barrier
+
+    if (state) {
+        state->stats.n_barrier++;
+        state->stats.t_barrier_ns += ggml_wait_time_ns() - t_start;
+    }
 #else
     int n_passed = atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed);
 
@@ -540,12 +644,62 @@ void ggml_barrier(struct ggml_threadpool * tp) {
 
         // exit barrier (fill seq-cst fence)
         atomic_fetch_add_explicit(&tp->n_barrier_passed, 1, memory_order_seq_cst);
+
+    #ifdef GGML_WAIT_FUTEX
+        if (atomic_load_explicit(&tp->n_barrier_sleep, memory_order_seq_cst) > 0) {
+            ggml_futex_wake(&tp->n_barrier_passed);
+        }
+    #endif
+
+        if (state) {
+            state->stats.n_barrier++;
+        }
         return;
     }
 
     // wait for other threads
-    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed) {
-        ggml_thread_cpu_relax();
+    //   spinning only pays off while the other threads are running, it just delays them when they share this core
+    //   (more threads than free cores, or other processes), so the spin time adapts to how the recent waits ended
+    const int64_t t_start = ggml_wait_time_ns();
+    const int64_t t_spin  = state ? state->t_spin : GGML_WAIT_SPIN_NS;
+
+    int  n_slow = 0; // yields and sleeps after the spinning
+    bool slept  = false;
+
+    for (uint32_t i = 1; atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed; i++) {
+        if (n_slow == 0 && ((i & 15) != 0 || ggml_wait_time_ns() - t_start < t_spin)) {
+            ggml_thread_cpu_relax();
+        } else if (n_slow++ < GGML_WAIT_N_YIELD) {
+            sched_yield();
+        } else {
+            slept = true;
+    #ifdef GGML_WAIT_FUTEX
+            atomic_fetch_add_explicit(&tp->n_barrier_sleep, 1, memory_order_seq_cst);
+            ggml_futex_wait(&tp->n_barrier_passed, n_passed);
+            atomic_fetch_sub_explicit(&tp->n_barrier_sleep, 1, memory_order_relaxed);
+    #else
+            sched_yield();
+    #endif
+        }
+    }
+
+    if (state) {
+        const int64_t t_wait = ggml_wait_time_ns() - t_start;
+
+        if (n_slow == 0) {
+            // ended while spinning: keep spinning at least twice as long as this wait
+            state->t_spin = MIN(GGML_WAIT_SPIN_NS, MAX(state->t_spin, 2*t_wait));
+        } else if (ggml_wait_contended(&state->n_preempt)) {
+            // this thread was preempted since the last slow wait: the core is shared, spin less
+            state->t_spin = MAX(GGML_WAIT_SPIN_MIN_NS, state->t_spin/2);
+        } else {
+            // the core is free, the wait was just longer than the spin
+            state->t_spin = MIN(GGML_WAIT_SPIN_NS, 2*state->t_spin);
+        }
+
+        state->stats.n_barrier++;
+        state->stats.n_barrier_sleep += slept;
+        state->stats.t_barrier_ns    += t_wait;
     }
 
     // exit barrier (full seq-cst fence)
@@ -673,6 +827,131 @@ bool ggml_is_numa(void) {
     return g_state.numa.n_nodes > 1;
 }
 
+static inline bool ggml_numa_interleave(void) {
+    return ggml_is_numa() && g_state.numa.numa_strategy == GGML_NUMA_STRATEGY_INTERLEAVE;
+}
+
+// first row of part i when splitting nr rows into n parts
+// the boundaries are kept even so that the mmla kernels can still process 2 rows at a time
+static inline int64_t ggml_numa_split_rows(int64_t nr, int64_t i, int64_t n) {
+    return i == n ? nr : (nr/2)*i/n*2;
+}
+
+#if defined(__gnu_linux__)
+// from <numaif.h>, so that libnuma is not required
+#define GGML_MPOL_BIND    2
+#define GGML_MPOL_MF_MOVE (1 << 1)
+
+// data pointers of the weights placed by ggml_numa_place_tensor, kept sorted
+// an entry that outlives its weight only changes how the rows of a mul_mat are split among the threads
+static struct {
+    pthread_rwlock_t lock;
+    const void ** data;
+    size_t n;
+    size_t cap;
+} g_numa_placed = { PTHREAD_RWLOCK_INITIALIZER, NULL, 0, 0 };
+
+// first entry of g_numa_placed that is not below data
+static size_t ggml_numa_placed_lower_bound(const void * data) {
+    size_t lo = 0;
+    size_t hi = g_numa_placed.n;
+    while (lo < hi) {
+        const size_t mid = (lo + hi)/2;
+        if ((uintptr_t) g_numa_placed.data[mid] < (uintptr_t) data) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void ggml_numa_placed_insert(const void * data) {
+    pthread_rwlock_wrlock(&g_numa_placed.lock);
+    const size_t i = ggml_numa_placed_lower_bound(data);
+    if (i == g_numa_placed.n || g_numa_placed.data[i] != data) {
+        if (g_numa_placed.n == g_numa_placed.cap) {
+            g_numa_placed.cap  = g_numa_placed.cap ? 2*g_numa_placed.cap : 256;
+            g_numa_placed.data = realloc(g_numa_placed.data, g_numa_placed.cap*sizeof(*g_numa_placed.data));
+            GGML_ASSERT(g_numa_placed.data != NULL);
+        }
+        memmove(g_numa_placed.data + i + 1, g_numa_placed.data + i, (g_numa_placed.n - i)*sizeof(*g_numa_placed.data));
+        g_numa_placed.data[i] = data;
+        g_numa_placed.n++;
+    }
+    pthread_rwlock_unlock(&g_numa_placed.lock);
+}
+
+static bool ggml_numa_is_placed(const void * data) {
+    pthread_rwlock_rdlock(&g_numa_placed.lock);
+    const size_t i = ggml_numa_placed_lower_bound(data);
+    const bool placed = i < g_numa_placed.n && g_numa_placed.data[i] == data;
+    pthread_rwlock_unlock(&g_numa_placed.lock);
+    return placed;
+}
+#else
+static bool ggml_numa_is_placed(const void * data) {
+    UNUSED(data);
+    return false;
+}
+#endif
+
+bool ggml_numa_place_tensor(struct ggml_tensor * tensor) {
+#if defined(__gnu_linux__)
+    // mbind is not retried for every weight once it has failed (e.g. not permitted in a container)
+    static bool mbind_failed = false;
+
+    if (!ggml_numa_interleave() || mbind_failed) {
+        return false;
+    }
+
+    const int64_t n_nodes = g_state.numa.n_nodes;
+
+    // only plain matrices, repacked weights and batched tensors are split across the threads differently
+    if (tensor->data == NULL || tensor->extra != NULL || !ggml_is_contiguous(tensor) ||
+        tensor->ne[2] != 1 || tensor->ne[3] != 1 || tensor->ne[1] < n_nodes) {
+        return false;
+    }
+
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t base = (uintptr_t) tensor->data;
+
+    // the rows are bound to the nodes in the same slabs that ggml_compute_forward_mul_mat assigns to the threads of each node
+    // a page shared by two slabs stays with the first one
+    for (int64_t node = 0; node < n_nodes; ++node) {
+        uintptr_t p0 = base + ggml_numa_split_rows(tensor->ne[1], node,     n_nodes)*tensor->nb[1];
+        uintptr_t p1 = base + ggml_numa_split_rows(tensor->ne[1], node + 1, n_nodes)*tensor->nb[1];
+
+        p0 = node == 0 ? p0 & ~(page - 1) : (p0 + page - 1) & ~(page - 1);
+        p1 = (p1 + page - 1) & ~(page - 1);
+
+        if (p0 >= p1) {
+            continue;
+        }
+
+        // mbind only migrates the pages that are present, and a mapped file is not prefetched with NUMA
+        for (uintptr_t p = p0; p < p1; p += page) {
+            (void) *(volatile const char *) p;
+        }
+
+        unsigned long mask = 1UL << node;
+        if (syscall(SYS_mbind, p0, p1 - p0, GGML_MPOL_BIND, &mask, sizeof(mask)*8, GGML_MPOL_MF_MOVE) != 0) {
+            GGML_LOG_WARN("%s: mbind failed: %s, weights will not be interleaved across NUMA nodes\n", __func__, strerror(errno));
+            mbind_failed = true;
+            return false;
+        }
+    }
+
+    // the threads of ggml_compute_forward_mul_mat use the same slabs only for the placed weights
+    ggml_numa_placed_insert(tensor->data);
+
+    return true;
+#else
+    UNUSED(tensor);
+    return false;
+#endif
+}
+
 #if defined(__ARM_ARCH)
 
 #if defined(__linux__) && defined(__aarch64__)
@@ -1233,13 +1512,20 @@ void ggml_compute_forward_mul_mat(
     const int64_t r2 = ne12 / ne02;
     const int64_t r3 = ne13 / ne03;
 
+    // the r2 src1 matrices that share a broadcast src0 matrix (e.g. the query heads of a GQA group)
+    // are multiplied as a single matrix with ne11*r2 columns when src1 and dst are uniformly strided
+    // this gives the kernels a wider tile and lets single-token attention use them at all
+    const bool dst_fold = nb2 == ne1*nb1;
+
     const bool src1_cont = ggml_is_contiguous(src1);
 
     if (src1_cont) {
+        const int64_t nf2 = (dst_fold && nb12 == ne11*nb11) ? r2 : 1;
+
         for (int64_t i13 = 0; i13 < ne13; i13++)
-            for (int64_t i12 = 0; i12 < ne12; i12++)
+            for (int64_t i12 = 0; i12 < ne12; i12 += nf2)
                 if (!llamafile_sgemm(params,
-                                     ne01, ne11, ne00/ggml_blck_size(src0->type),
+                                     ne01, ne11*nf2, ne00/ggml_blck_size(src0->type),
                                      (const char *)src0->data + i12/r2*nb02 + i13/r3*nb03,
                                      nb01/ggml_type_size(src0->type),
                                      (const char *)src1->data + i12*nb12 + i13*nb13,
@@ -1304,10 +1590,13 @@ UseGgmlGemm1:;
         const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
+        // wdata is always packed, so only dst decides whether the broadcast heads can be folded
+        const int64_t nf2 = dst_fold ? r2 : 1;
+
         for (int64_t i13 = 0; i13 < ne13; i13++)
-            for (int64_t i12 = 0; i12 < ne12; i12++)
+            for (int64_t i12 = 0; i12 < ne12; i12 += nf2)
                 if (!llamafile_sgemm(params,
-                                     ne01, ne11, ne00/ggml_blck_size(src0->type),
+                                     ne01, ne11*nf2, ne00/ggml_blck_size(src0->type),
                                      (const char *)src0->data + i12/r2*nb02 + i13/r3*nb03,
                                      nb01/ggml_type_size(src0->type),
                                      (const char *)wdata + (i12*ne11 + i13*ne12*ne11)*row_size,
@@ -1329,6 +1618,29 @@ UseGgmlGemm2:;
     // This is the size of the rest of the dimensions of the result
     const int64_t nr1 = ne1 * ne2 * ne3;
 
+    // With interleaved weights each node holds one slab of the src0 rows (see ggml_numa_place_tensor).
+    //   Thread ith runs on node ith % n_nodes, so split each slab statically among the threads of its node.
+    if (ggml_numa_interleave() && ggml_numa_is_placed(src0->data) && nth >= (int) g_state.numa.n_nodes && nr0 >= nth) {
+        const int64_t n_nodes  = g_state.numa.n_nodes;
+        const int64_t node     = ith % n_nodes;
+        const int64_t ith_node = ith / n_nodes;
+        const int64_t nth_node = (nth - node + n_nodes - 1) / n_nodes;
+
+        const int64_t ir0_node = ggml_numa_split_rows(nr0, node, n_nodes);
+        const int64_t nr0_node = ggml_numa_split_rows(nr0, node + 1, n_nodes) - ir0_node;
+
+        const int64_t ir0_start = ir0_node + ggml_numa_split_rows(nr0_node, ith_node,     nth_node);
+        const int64_t ir0_end   = ir0_node + ggml_numa_split_rows(nr0_node, ith_node + 1, nth_node);
+
+        int64_t num_rows_per_vec_dot = vec_dot_num_rows;
+        if ((nr0 % 2 != 0) || (ne11 % 2 != 0) || ((ir0_end - ir0_start) % 2 != 0) || (nr1 % 2 != 0)) {
+            num_rows_per_vec_dot = 1;
+        }
+
+        ggml_compute_forward_mul_mat_one_chunk(params, dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, 0, nr1);
+        return;
+    }
+
     // Now select a reasonable chunk size.
     int chunk_size = 16;
 
@@ -1467,9 +1779,16 @@ static void * incr_ptr_aligned(void ** p, size_t size, size_t align) {
     return ptr;
 }
 
-static void ggml_compute_forward_mul_mat_id(
+// compute n_mat MUL_MAT_ID nodes that share src1 and ids (e.g. the up and gate projections of the experts)
+// the rows of src1 are converted and grouped by expert once, then all the (matrix, expert, rows, tokens) blocks are
+// distributed between the threads with a single chunk counter, so the threads move on to the next expert as soon
+// as they are done instead of splitting each expert between all of them
+static void ggml_compute_forward_mul_mat_id_n(
         const struct ggml_compute_params * params,
-              struct ggml_tensor * dst) {
+              struct ggml_tensor ** dsts,
+              int n_mat) {
+
+    struct ggml_tensor * dst = dsts[0];
 
     const struct ggml_tensor * src0 = dst->src[0];
     const struct ggml_tensor * src1 = dst->src[1];
@@ -1513,8 +1832,11 @@ static void ggml_compute_forward_mul_mat_id(
     struct mmid_row_mapping * matrix_rows = // [n_as][ids->ne[0]*ids->ne[1]]
         incr_ptr_aligned(&wdata_cur, n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping), sizeof(int64_t));
 
-    char (*atomic_current_chunk)[CACHE_LINE_SIZE] = // [n_as]
-        incr_ptr_aligned(&wdata_cur, CACHE_LINE_SIZE * n_as, CACHE_LINE_SIZE);
+    int64_t * expert_chunk0 = // [n_as + 1] first chunk of each expert
+        incr_ptr_aligned(&wdata_cur, (n_as + 1)*sizeof(int64_t), sizeof(int64_t));
+
+    int64_t * expert_dr0 = // [n_as] src0 rows per chunk of each expert
+        incr_ptr_aligned(&wdata_cur, n_as*sizeof(int64_t), sizeof(int64_t));
 
     GGML_ASSERT(params->wsize >= (size_t)((char *) wdata_cur - (char *) params->wdata));
 
@@ -1555,6 +1877,9 @@ static void ggml_compute_forward_mul_mat_id(
 #endif
     }
 
+    // src1 rows per chunk, same as the blocking of ggml_compute_forward_mul_mat_id_one_chunk
+    const int64_t dr1 = 16;
+
     if (ith == 0) {
         // initialize matrix_row_counts
         memset(matrix_row_counts, 0, n_as*sizeof(int64_t));
@@ -1570,83 +1895,124 @@ static void ggml_compute_forward_mul_mat_id(
                 matrix_row_counts[i02] += 1;
             }
         }
-    }
 
-    // reset current_chunk
-    for (int cur_a = ith; cur_a < n_as; cur_a += nth) {
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
-        *current_chunk_ctr = nth;
-    }
+        // size the chunks so that there are about 4 per thread in total, an expert gets a number of chunks
+        // proportional to its number of rows: the experts with a single row during decode are split between
+        // a few threads only, while the other threads work on the other experts
+        const int64_t n_work     = (int64_t) n_mat*ne01*n_ids*ids->ne[1]; // dot products
+        const int64_t chunk_work = MAX(1, n_work/(4*nth));
 
-    ggml_barrier(params->threadpool);
+        expert_chunk0[0] = 0;
+        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+            const int64_t cne1 = matrix_row_counts[cur_a];
 
-    for (int cur_a = 0; cur_a < n_as; ++cur_a) {
-        const int64_t cne1 = matrix_row_counts[cur_a];
+            int64_t nchunk = 0;
+            if (cne1 > 0) {
+                const int64_t dr0 = MIN(ne01, GGML_PAD(MAX(16, chunk_work/MIN(cne1, dr1)), 16));
 
-        if (cne1 == 0) {
-            continue;
+                expert_dr0[cur_a] = dr0;
+                nchunk = n_mat*((ne01 + dr0 - 1)/dr0)*((cne1 + dr1 - 1)/dr1);
+            }
+            expert_chunk0[cur_a + 1] = expert_chunk0[cur_a] + nchunk;
         }
 
-        const char * src0_cur = (const char *) src0->data + cur_a * nb02;
-        const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
-        const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+        // Every thread starts at ith, so the first unprocessed chunk is nth.  This save a bit of coordination right at the start.
+        ggml_threadpool_chunk_set(params->threadpool, nth);
+    }
 
-        const int64_t nr0 = ne01;
-        const int64_t nr1 = cne1;
+    ggml_barrier(params->threadpool);
 
-        int chunk_size = 16;
-        if (nr0 == 1 || nr1 == 1) {
-            chunk_size = 64;
-        }
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
 #if defined(__aarch64__)
-        // disable for ARM
-        const bool disable_chunking = true;
+    // disable for ARM
+    const bool disable_chunking = true;
 #else
-        // disable for NUMA
-        const bool disable_chunking = ggml_is_numa();
+    // disable for NUMA
+    const bool disable_chunking = ggml_is_numa();
 #endif // defined(__aarch64__)
 
-        int64_t nchunk0 = (nr0 + chunk_size - 1) / chunk_size;
-        int64_t nchunk1 = (nr1 + chunk_size - 1) / chunk_size;
+    if (disable_chunking) {
+        // each thread computes the same slice of every expert
+        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+            const int64_t cne1 = matrix_row_counts[cur_a];
 
-        if (nchunk0 * nchunk1 < nth * 4 || disable_chunking) {
-            nchunk0 = nr0 > nr1 ? nth : 1;
-            nchunk1 = nr0 > nr1 ? 1 : nth;
-        }
+            if (cne1 == 0) {
+                continue;
+            }
 
-        const int64_t dr0 = (nr0 + nchunk0 - 1) / nchunk0;
-        const int64_t dr1 = (nr1 + nchunk1 - 1) / nchunk1;
+            const int64_t nchunk0 = ne01 > cne1 ? nth : 1;
+            const int64_t nchunk1 = ne01 > cne1 ? 1 : nth;
 
-        int current_chunk = ith;
+            const int64_t dr0_cur = (ne01 + nchunk0 - 1)/nchunk0;
+            const int64_t dr1_cur = (cne1 + nchunk1 - 1)/nchunk1;
 
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
+            const int64_t ir0_start = dr0_cur*(ith%nchunk0);
+            const int64_t ir0_end   = MIN(ir0_start + dr0_cur, ne01);
 
-        while (current_chunk < nchunk0 * nchunk1) {
-            const int64_t ith0 = current_chunk % nchunk0;
-            const int64_t ith1 = current_chunk / nchunk0;
+            const int64_t ir1_start = dr1_cur*(ith/nchunk0);
+            const int64_t ir1_end   = MIN(ir1_start + dr1_cur, cne1);
 
-            const int64_t ir0_start = dr0 * ith0;
-            const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
+            for (int im = 0; im < n_mat; ++im) {
+                const struct ggml_tensor * src0_cur = dsts[im]->src[0];
 
-            const int64_t ir1_start = dr1 * ith1;
-            const int64_t ir1_end = MIN(ir1_start + dr1, nr1);
+                ggml_compute_forward_mul_mat_id_one_chunk(
+                    dsts[im], src0_cur, src1, ids, cur_a,
+                    ir0_start, ir0_end, ir1_start, ir1_end,
+                    (const char *) src0_cur->data + cur_a*nb02, matrix_rows, row_size, src1_cont, wdata
+                );
+            }
+        }
 
-            ggml_compute_forward_mul_mat_id_one_chunk(
-                dst, src0, src1, ids, cur_a,
-                ir0_start, ir0_end, ir1_start, ir1_end,
-                src0_cur, matrix_rows, row_size, src1_cont, wdata
-            );
+        return;
+    }
 
-            if (nth >= nchunk0 * nchunk1) {
-                break;
-            }
+    const int64_t nchunk = expert_chunk0[n_as];
 
-            current_chunk = atomic_fetch_add_explicit(current_chunk_ctr, 1, memory_order_relaxed);
+    int cur_a = 0;
+
+    for (int64_t current_chunk = ith; current_chunk < nchunk; current_chunk = ggml_threadpool_chunk_add(params->threadpool, 1)) {
+        // find the expert of the chunk - the chunks of a thread are increasing
+        while (expert_chunk0[cur_a + 1] <= current_chunk) {
+            cur_a++;
         }
+
+        const int64_t cne1 = matrix_row_counts[cur_a];
+        const int64_t dr0  = expert_dr0[cur_a];
+
+        const int64_t nchunk0 = (ne01 + dr0 - 1)/dr0;
+        const int64_t nchunk1 = (cne1 + dr1 - 1)/dr1;
+
+        // chunk index within the expert: matrix, src1 rows, src0 rows
+        const int64_t ic = current_chunk - expert_chunk0[cur_a];
+
+        const int64_t im   = ic/(nchunk0*nchunk1);
+        const int64_t ith1 = (ic/nchunk0)%nchunk1;
+        const int64_t ith0 = ic%nchunk0;
+
+        const int64_t ir0_start = dr0*ith0;
+        const int64_t ir0_end   = MIN(ir0_start + dr0, ne01);
+
+        const int64_t ir1_start = dr1*ith1;
+        const int64_t ir1_end   = MIN(ir1_start + dr1, cne1);
+
+        const struct ggml_tensor * src0_cur = dsts[im]->src[0];
+
+        ggml_compute_forward_mul_mat_id_one_chunk(
+            dsts[im], src0_cur, src1, ids, cur_a,
+            ir0_start, ir0_end, ir1_start, ir1_end,
+            (const char *) src0_cur->data + cur_a*nb02, matrix_rows, row_size, src1_cont, wdata
+        );
     }
 }
 
+static void ggml_compute_forward_mul_mat_id(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+    ggml_compute_forward_mul_mat_id_n(params, &dst, 1);
+}
+
 /////////////////////////////////
 
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
@@ -2036,6 +2402,7 @@ static void set_numa_thread_affinity(int thread_n) {
 
     switch(g_state.numa.numa_strategy) {
         case GGML_NUMA_STRATEGY_DISTRIBUTE:
+        case GGML_NUMA_STRATEGY_INTERLEAVE:
             // run thread on node_num thread_n / (threads per node)
             node_num = thread_n % g_state.numa.n_nodes;
             break;
@@ -2567,6 +2934,8 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
     const int n_threads = threadpool->n_threads_max;
 
 #ifndef GGML_USE_OPENMP
+    GGML_ASSERT(atomic_load_explicit(&threadpool->n_partitions, memory_order_relaxed) == 0 && "free the partitions of a threadpool first");
+
     struct ggml_compute_state* workers = threadpool->workers;
 
     ggml_mutex_lock(&threadpool->mutex);
@@ -2577,10 +2946,18 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
     ggml_cond_broadcast(&threadpool->cond);
     ggml_mutex_unlock(&threadpool->mutex);
 
-    for (int j = 1; j < n_threads; j++) {
-        int32_t rc = ggml_thread_join(workers[j].thrd, NULL);
-        GGML_ASSERT(rc == GGML_EXIT_SUCCESS || rc == GGML_EXIT_ABORTED);
-        UNUSED(rc);
+    if (threadpool->parent) {
+        // wait for the borrowed workers to return to the parent
+        while (atomic_load_explicit(&threadpool->n_lent, memory_order_acquire) > 0) {
+            sched_yield();
+        }
+        atomic_fetch_sub_explicit(&threadpool->parent->n_partitions, 1, memory_order_relaxed);
+    } else {
+        for (int j = 1; j < n_threads; j++) {
+            int32_t rc = ggml_thread_join(workers[j].thrd, NULL);
+            GGML_ASSERT(rc == GGML_EXIT_SUCCESS || rc == GGML_EXIT_ABORTED);
+            UNUSED(rc);
+        }
     }
 
     ggml_mutex_destroy(&threadpool->mutex);
@@ -2589,9 +2966,25 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
 
     const size_t workers_size = sizeof(struct ggml_compute_state) * n_threads;
     ggml_aligned_free(threadpool->workers, workers_size);
+    free(threadpool->node_sync_buf);
+    free(threadpool->node_fused_buf);
     ggml_aligned_free(threadpool, sizeof(struct ggml_threadpool));
 }
 
+void ggml_threadpool_get_stats(struct ggml_threadpool * threadpool, struct ggml_threadpool_stats * stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    const int n_threads = atomic_load_explicit(&threadpool->n_threads_cur, memory_order_relaxed);
+
+    for (int j = 0; j < n_threads; j++) {
+        const struct ggml_threadpool_stats * st = &threadpool->workers[j].stats_graph;
+
+        stats->n_barrier       += st->n_barrier;
+        stats->n_barrier_sleep += st->n_barrier_sleep;
+        stats->t_barrier_ns    += st->t_barrier_ns;
+    }
+}
+
 #ifndef GGML_USE_OPENMP
 // pause/resume must be called under mutex
 static void ggml_threadpool_pause_locked(struct ggml_threadpool * threadpool) {
@@ -2713,8 +3106,8 @@ struct ggml_cplan ggml_graph_plan(
                         cur += n_as * sizeof(int64_t) + sizeof(int64_t);
                         // matrix_rows
                         cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
-                        // atomic_current_chunk
-                        cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
+                        // expert_chunk0, expert_dr0
+                        cur += (2*n_as + 1)*sizeof(int64_t) + 2*sizeof(int64_t);
                     } break;
                 case GGML_OP_OUT_PROD:
                     {
@@ -2776,7 +3169,8 @@ struct ggml_cplan ggml_graph_plan(
                         const int64_t ne10 = node->src[1]->ne[0]; // DK
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+                        // tiles per thread + partial results of at most 2*n_tasks tiles when the K/V sequence is split
+                        cur = sizeof(float)*(GGML_FA_WORK_SIZE_F32(ne10, ne20)*n_tasks + 2*n_tasks*GGML_FA_TILE_Q*(2 + ne20));
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -2823,6 +3217,256 @@ struct ggml_cplan ggml_graph_plan(
     return cplan;
 }
 
+// how a node is synchronized with the nodes before it
+enum ggml_node_sync {
+    GGML_NODE_SYNC_NONE,    // computed right after the previous nodes, while other threads may still work on them
+    GGML_NODE_SYNC_BARRIER, // all threads finish the previous nodes first
+    GGML_NODE_SYNC_SKIP,    // nothing to compute
+};
+
+// max number of nodes that can be computed without a barrier in between
+#define GGML_NODE_SYNC_MAX_OVERLAP 8
+
+static bool ggml_node_is_empty(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the ops that split the work between the threads without any state shared between them (barriers, chunk counters or work data)
+// a thread that is done with such a node can proceed to the next one, unless it depends on the node
+static bool ggml_node_can_overlap(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_DUP:
+        case GGML_OP_ADD:
+        case GGML_OP_ADD1:
+        case GGML_OP_SUB:
+        case GGML_OP_MUL:
+        case GGML_OP_DIV:
+        case GGML_OP_SQR:
+        case GGML_OP_SQRT:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_SCALE:
+        case GGML_OP_CPY:
+        case GGML_OP_CONT:
+        case GGML_OP_GET_ROWS:
+        case GGML_OP_SET_ROWS:
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_ROPE:
+        case GGML_OP_CONCAT:
+        case GGML_OP_UNARY:
+        case GGML_OP_GLU:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the per-thread slices of the work data depend on the node, so only one node that uses them can be in flight
+static bool ggml_node_uses_wdata(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_ROPE:
+            return true;
+        case GGML_OP_DUP:
+        case GGML_OP_CPY:
+        case GGML_OP_CONT:
+            return node->type != node->src[0]->type;
+        case GGML_OP_ADD:
+        case GGML_OP_ADD1:
+            return ggml_is_quantized(node->src[0]->type);
+        default:
+            return false;
+    }
+}
+
+static bool ggml_node_is_f32_rows(const struct ggml_tensor * t) {
+    return t->type == GGML_TYPE_F32 && t->nb[0] == sizeof(float);
+}
+
+// check if the RMS_NORM at node i can be fused with the MUL by a weight after it
+static bool ggml_can_fuse_rms_norm_mul(const struct ggml_cgraph * cgraph, int i) {
+    if (!ggml_can_fuse(cgraph, i, (enum ggml_op[]) { GGML_OP_RMS_NORM, GGML_OP_MUL }, 2)) {
+        return false;
+    }
+
+    const struct ggml_tensor * norm = cgraph->nodes[i];
+    const struct ggml_tensor * mul  = cgraph->nodes[i + 1];
+    const struct ggml_tensor * w    = mul->src[0] == norm ? mul->src[1] : mul->src[0];
+
+    return ggml_node_is_f32_rows(norm->src[0]) && ggml_node_is_f32_rows(mul) && ggml_node_is_f32_rows(w) &&
+        w->ne[0] == norm->ne[0] && ggml_can_repeat(w, norm);
+}
+
+static bool ggml_node_data_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (a->data == NULL || b->data == NULL) {
+        return true;
+    }
+
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// check if the MUL_MAT_ID at node i can be computed together with the next node (e.g. the up and gate projections of the experts)
+static bool ggml_can_fuse_mul_mat_id(const struct ggml_cgraph * cgraph, int i) {
+    if (i + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * a = cgraph->nodes[i];
+    const struct ggml_tensor * b = cgraph->nodes[i + 1];
+
+    // the weights in extra buffer types (e.g. repacked) are computed by their own traits
+    return b->op == GGML_OP_MUL_MAT_ID && b->src[1] == a->src[1] && b->src[2] == a->src[2] &&
+        b->src[0]->type == a->src[0]->type && ggml_are_same_shape(b->src[0], a->src[0]) &&
+        a->src[0]->extra == NULL && b->src[0]->extra == NULL && !ggml_node_data_overlap(a, b) &&
+        !ggml_node_data_overlap(a, b->src[1]) && !ggml_node_data_overlap(a, b->src[2]);
+}
+
+// returns the number of nodes after node i that are computed together with it
+// fused patterns:
+//   - ADD -> RMS_NORM [-> MUL] (e.g. residual + norm of the next block)
+//   - RMS_NORM -> MUL          (norm weight)
+//   - MUL_MAT_ID -> MUL_MAT_ID (same src1 and ids, both are written)
+// the fused nodes must only be used by the next node of the pattern, except for the ADD which is still written
+static int ggml_node_n_fused(const struct ggml_cgraph * cgraph, int i) {
+    const struct ggml_tensor * node = cgraph->nodes[i];
+
+    if (node->op == GGML_OP_MUL_MAT_ID) {
+        return ggml_can_fuse_mul_mat_id(cgraph, i) ? 1 : 0;
+    }
+
+    if (node->op == GGML_OP_RMS_NORM) {
+        return ggml_can_fuse_rms_norm_mul(cgraph, i) ? 1 : 0;
+    }
+
+    if (node->op == GGML_OP_ADD && i + 1 < cgraph->n_nodes) {
+        const struct ggml_tensor * norm = cgraph->nodes[i + 1];
+
+        if (norm->op != GGML_OP_RMS_NORM || norm->src[0] != node || !ggml_are_same_shape(norm, node)) {
+            return 0;
+        }
+
+        if (!ggml_node_is_f32_rows(node) || !ggml_node_is_f32_rows(norm) ||
+            !ggml_node_is_f32_rows(node->src[0]) || !ggml_are_same_shape(node->src[0], node) ||
+            !ggml_node_is_f32_rows(node->src[1]) || !ggml_are_same_shape(node->src[1], node)) {
+            return 0;
+        }
+
+        return ggml_can_fuse_rms_norm_mul(cgraph, i + 1) ? 2 : 1;
+    }
+
+    return 0;
+}
+
+static void ggml_compute_forward_fused(struct ggml_compute_params * params, struct ggml_tensor ** nodes, int n_fused) {
+    switch (nodes[0]->op) {
+        case GGML_OP_ADD:
+            {
+                ggml_compute_forward_rms_norm_fused(params, nodes[0], nodes[1], n_fused > 1 ? nodes[2] : NULL);
+            } break;
+        case GGML_OP_RMS_NORM:
+            {
+                ggml_compute_forward_rms_norm_fused(params, NULL, nodes[0], nodes[1]);
+            } break;
+        case GGML_OP_MUL_MAT_ID:
+            {
+                ggml_compute_forward_mul_mat_id_n(params, nodes, n_fused + 1);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
+// check if the node reads or writes memory that the node b writes, or writes memory that b reads
+static bool ggml_node_depends_on(const struct ggml_tensor * node, const struct ggml_tensor * b) {
+    if (ggml_node_data_overlap(node, b)) {
+        return true;
+    }
+
+    for (int i = 0; i < GGML_MAX_SRC; i++) {
+        if (node->src[i] && ggml_node_data_overlap(node->src[i], b)) {
+            return true;
+        }
+        if (b->src[i] && ggml_node_data_overlap(node, b->src[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// determine the barriers needed to compute the graph and the nodes that are fused
+// instead of a barrier after each node, there is one only before a node that depends on the nodes computed since the last barrier
+void ggml_graph_plan_sync(const struct ggml_cgraph * cgraph, int n_threads, uint8_t * node_sync, uint8_t * node_fused) {
+    // the nodes computed since the last barrier
+    const struct ggml_tensor * pending[GGML_NODE_SYNC_MAX_OVERLAP];
+    int  n_pending       = 0;
+    bool pending_overlap = true;
+    bool pending_wdata   = false;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        node_fused[i] = 0;
+
+        if (ggml_node_is_empty(node)) {
+            node_sync[i] = GGML_NODE_SYNC_SKIP;
+            continue;
+        }
+
+        const int n_fused = ggml_node_n_fused(cgraph, i);
+
+        // fused nodes are always computed between barriers
+        const bool can_overlap = n_fused == 0 && ggml_node_can_overlap(node);
+
+        bool barrier = n_pending > 0;
+
+        if (barrier && n_threads > 1 && n_pending < GGML_NODE_SYNC_MAX_OVERLAP && pending_overlap &&
+                can_overlap && !(pending_wdata && ggml_node_uses_wdata(node))) {
+            barrier = false;
+            for (int j = 0; j < n_pending; j++) {
+                if (ggml_node_depends_on(node, pending[j])) {
+                    barrier = true;
+                    break;
+                }
+            }
+        }
+
+        if (barrier) {
+            n_pending       = 0;
+            pending_overlap = true;
+            pending_wdata   = false;
+        }
+
+        pending[n_pending++] = node;
+        pending_overlap = pending_overlap && can_overlap;
+        pending_wdata   = pending_wdata   || ggml_node_uses_wdata(node);
+
+        node_sync[i]  = barrier ? GGML_NODE_SYNC_BARRIER : GGML_NODE_SYNC_NONE;
+        node_fused[i] = n_fused;
+
+        for (int j = 1; j <= n_fused; j++) {
+            node_fused[i + j] = 0;
+            node_sync [i + j] = GGML_NODE_SYNC_SKIP;
+        }
+
+        i += n_fused;
+    }
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -2830,7 +3474,11 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     const struct ggml_cgraph * cgraph = tp->cgraph;
     const struct ggml_cplan  * cplan  = tp->cplan;
 
-    set_numa_thread_affinity(state->ith);
+    // a borrowed worker keeps the NUMA node of its index in the parent
+    set_numa_thread_affinity(tp->parent && state->ith > 0 ? tp->first + state->ith - 1 : state->ith);
+
+    ggml_cur_state = state;
+    memset(&state->stats, 0, sizeof(state->stats));
 
     struct ggml_compute_params params = {
         /*.ith       =*/ state->ith,
@@ -2840,24 +3488,49 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         /*.threadpool=*/ tp,
     };
 
-    for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
+    for (int node_n = 0; node_n < cgraph->n_nodes; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        const uint8_t sync = tp->node_sync[node_n];
 
-        if (state->ith == 0 && cplan->abort_callback &&
-                cplan->abort_callback(cplan->abort_callback_data)) {
-            atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
-            tp->ec    = GGML_STATUS_ABORTED;
+        if (sync == GGML_NODE_SYNC_SKIP) {
+            continue;
         }
 
-        if (node_n + 1 < cgraph->n_nodes) {
+        if (sync == GGML_NODE_SYNC_BARRIER) {
+            // the abort is checked only before a barrier, so that all threads stop at the same node
+            if (state->ith == 0 && cplan->abort_callback &&
+                    cplan->abort_callback(cplan->abort_callback_data)) {
+                atomic_store_explicit(&tp->abort, node_n, memory_order_relaxed);
+                tp->ec    = GGML_STATUS_ABORTED;
+            }
+
             ggml_barrier(state->threadpool);
+
+            if (atomic_load_explicit(&tp->abort, memory_order_relaxed) == node_n) {
+                break;
+            }
+        }
+
+        if (tp->node_fused[node_n] > 0) {
+            ggml_compute_forward_fused(&params, cgraph->nodes + node_n, tp->node_fused[node_n]);
+        } else {
+            ggml_compute_forward(&params, node);
         }
     }
 
+    if (state->ith == 0 && tp->ec == GGML_STATUS_SUCCESS && cplan->abort_callback &&
+            cplan->abort_callback(cplan->abort_callback_data)) {
+        tp->ec    = GGML_STATUS_ABORTED;
+    }
+
+    // publish the stats before the final barrier, so that they are complete when the graph compute returns
+    state->stats_graph = state->stats;
+
     ggml_barrier(state->threadpool);
 
+    ggml_cur_state = NULL;
+
     return 0;
 }
 
@@ -2876,6 +3549,9 @@ static inline bool ggml_graph_compute_thread_ready(struct ggml_compute_state * s
 
     if (state->pending || threadpool->stop || threadpool->pause) { return true; }
 
+    // lent to a partition
+    if (atomic_load_explicit(&state->part, memory_order_relaxed) != NULL) { return true; }
+
     // check for new graph/work
     int new_graph = atomic_load_explicit(&threadpool->n_graph, memory_order_relaxed);
     if (new_graph != state->last_graph) {
@@ -2905,13 +3581,27 @@ static inline bool ggml_graph_compute_poll_for_work(struct ggml_compute_state *
         return state->pending;
     }
 
+    // Skip polling if the recent graphs arrived later than the polling would have lasted
+    if (state->t_idle_avg > state->t_poll) {
+        return ggml_graph_compute_thread_ready(state);
+    }
+
     // This seems to make 0 ... 100 a decent range for polling level across modern processors.
-    // Perhaps, we can adjust it dynamically based on load and things.
     const uint64_t n_rounds = 1024UL * 128 * threadpool->poll;
 
+    const int64_t t_start = ggml_wait_time_ns();
+
     for (uint64_t i=0; !ggml_graph_compute_thread_ready(state) && i < n_rounds; i++) {
-        // No new work. Keep polling.
-        ggml_thread_cpu_relax();
+        // No new work. Keep polling, and let other threads on this core run once polling takes longer than a short wait.
+        if ((i & 255) == 255 && ggml_wait_time_ns() - t_start > GGML_WAIT_SPIN_NS) {
+            sched_yield();
+        } else {
+            ggml_thread_cpu_relax();
+        }
+    }
+
+    if (!state->pending) {
+        state->t_poll = ggml_wait_time_ns() - t_start;
     }
 
     return state->pending;
@@ -2920,37 +3610,37 @@ static inline bool ggml_graph_compute_poll_for_work(struct ggml_compute_state *
 static inline bool ggml_graph_compute_check_for_work(struct ggml_compute_state * state) {
     struct ggml_threadpool * threadpool = state->threadpool;
 
+    const int64_t t_start = ggml_wait_time_ns();
+
     if (ggml_graph_compute_poll_for_work(state)) {
         ggml_graph_compute_thread_sync(state);
-        return state->pending;
+    } else {
+        ggml_mutex_lock_shared(&threadpool->mutex);
+        while (!ggml_graph_compute_thread_ready(state)) {
+            // No new work. Wait for the signal.
+            GGML_PRINT_DEBUG("thread #%d waiting for work (sleeping)\n", state->ith);
+            ggml_cond_wait(&threadpool->cond, &threadpool->mutex);
+        }
+        ggml_mutex_unlock_shared(&threadpool->mutex);
     }
 
-    ggml_mutex_lock_shared(&threadpool->mutex);
-    while (!ggml_graph_compute_thread_ready(state)) {
-        // No new work. Wait for the signal.
-        GGML_PRINT_DEBUG("thread #%d waiting for work (sleeping)\n", state->ith);
-        ggml_cond_wait(&threadpool->cond, &threadpool->mutex);
+    if (state->pending) {
+        ggml_wait_time_update(&state->t_idle_avg, ggml_wait_time_ns() - t_start);
     }
-    ggml_mutex_unlock_shared(&threadpool->mutex);
 
     return state->pending;
 }
 
-static thread_ret_t ggml_graph_compute_secondary_thread(void* data) {
-    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+// process the graphs of the threadpool of state until it is stopped, or until the worker is lent to a partition
+static void ggml_graph_compute_worker_loop(struct ggml_compute_state * state) {
     struct ggml_threadpool * threadpool = state->threadpool;
 
-    ggml_thread_apply_priority(threadpool->prio);
-    if (ggml_thread_cpumask_is_valid(state->cpumask)) {
-        ggml_thread_apply_affinity(state->cpumask);
-    }
-
-    while (true) {
+    while (atomic_load_explicit(&state->part, memory_order_acquire) == NULL) {
         // Check if we need to sleep
-        while (threadpool->pause) {
+        while (threadpool->pause && atomic_load_explicit(&state->part, memory_order_relaxed) == NULL) {
             GGML_PRINT_DEBUG("thread #%d inside pause loop\n", state->ith);
             ggml_mutex_lock_shared(&threadpool->mutex);
-            if (threadpool->pause) {
+            if (threadpool->pause && atomic_load_explicit(&state->part, memory_order_relaxed) == NULL) {
                 ggml_cond_wait(&threadpool->cond, &threadpool->mutex);
             }
             GGML_PRINT_DEBUG("thread #%d resuming after wait\n", state->ith);
@@ -2970,6 +3660,32 @@ static thread_ret_t ggml_graph_compute_secondary_thread(void* data) {
             ggml_graph_compute_thread(state);
         }
     }
+}
+
+static thread_ret_t ggml_graph_compute_secondary_thread(void* data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_threadpool * threadpool = state->threadpool;
+
+    ggml_thread_apply_priority(threadpool->prio);
+    if (ggml_thread_cpumask_is_valid(state->cpumask)) {
+        ggml_thread_apply_affinity(state->cpumask);
+    }
+
+    while (true) {
+        ggml_graph_compute_worker_loop(state);
+
+        if (threadpool->stop) break;
+
+        // Serve the partition this worker is lent to until it is freed, then return to this threadpool
+        // Nothing of the partition may be accessed after n_lent is decremented
+        struct ggml_compute_state * part = atomic_load_explicit(&state->part, memory_order_acquire);
+        struct ggml_threadpool    * tp   = part->threadpool;
+
+        ggml_graph_compute_worker_loop(part);
+
+        atomic_store_explicit(&state->part, NULL, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&tp->n_lent, 1, memory_order_release);
+    }
 
     return (thread_ret_t) 0;
 }
@@ -3011,7 +3727,9 @@ static void ggml_graph_compute_kickoff(struct ggml_threadpool * threadpool, int
 static struct ggml_threadpool * ggml_threadpool_new_impl(
     struct ggml_threadpool_params * tpp,
                struct ggml_cgraph * cgraph,
-                struct ggml_cplan * cplan) {
+                struct ggml_cplan * cplan,
+           struct ggml_threadpool * parent,
+                              int   first) {
 
     struct ggml_threadpool * threadpool =
         ggml_aligned_malloc(sizeof(struct ggml_threadpool));
@@ -3021,16 +3739,27 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->n_graph          = 0;
         threadpool->n_barrier        = 0;
         threadpool->n_barrier_passed = 0;
+        threadpool->n_barrier_sleep  = 0;
         threadpool->current_chunk    = 0;
         threadpool->stop             = false;
         threadpool->pause            = tpp->paused;
         threadpool->abort            = -1;
+        threadpool->busy             = false;
         threadpool->workers          = NULL;
         threadpool->n_threads_max    = tpp->n_threads;
         threadpool->n_threads_cur    = tpp->n_threads;
         threadpool->poll             = tpp->poll;
         threadpool->prio             = tpp->prio;
         threadpool->ec               = GGML_STATUS_SUCCESS;
+        threadpool->node_sync        = NULL;
+        threadpool->node_fused       = NULL;
+        threadpool->node_sync_buf    = NULL;
+        threadpool->node_fused_buf   = NULL;
+        threadpool->node_sync_size   = 0;
+        threadpool->parent           = parent;
+        threadpool->first            = first;
+        threadpool->n_lent           = parent ? tpp->n_threads - 1 : 0;
+        threadpool->n_partitions     = 0;
     }
 
     // Allocate and init workers state
@@ -3041,6 +3770,8 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
     for (int j = 0; j < tpp->n_threads; j++) {
         workers[j].threadpool = threadpool;
         workers[j].ith        = j;
+        workers[j].t_spin     = GGML_WAIT_SPIN_NS;
+        workers[j].t_poll     = INT64_MAX;
     }
 
     threadpool->workers = workers;
@@ -3049,6 +3780,19 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
     ggml_mutex_init(&threadpool->mutex);
     ggml_cond_init(&threadpool->cond);
 
+    if (parent) {
+        // Borrow the workers of the parent instead of starting new threads, they keep their CPU placement.
+        ggml_mutex_lock(&parent->mutex);
+        for (int j = 1; j < tpp->n_threads; j++) {
+            atomic_store_explicit(&parent->workers[first + j - 1].part, &workers[j], memory_order_release);
+        }
+        atomic_fetch_add_explicit(&parent->n_partitions, 1, memory_order_relaxed);
+        ggml_cond_broadcast(&parent->cond);
+        ggml_mutex_unlock(&parent->mutex);
+
+        return threadpool;
+    }
+
     // Spin the threads for all workers, and update CPU placements.
     // Place the main thread last (towards the higher numbered CPU cores).
 
@@ -3070,16 +3814,49 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
             ggml_thread_apply_affinity(threadpool->workers[0].cpumask);
         }
     }
+#else
+    UNUSED(parent);
+    UNUSED(first);
 #endif // GGML_USE_OPENMP
 
     return threadpool;
 }
 
 struct ggml_threadpool * ggml_threadpool_new(struct ggml_threadpool_params * tpp) {
-    return ggml_threadpool_new_impl(tpp, NULL, NULL);
+    return ggml_threadpool_new_impl(tpp, NULL, NULL, NULL, 0);
 }
 
-enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
+struct ggml_threadpool * ggml_threadpool_new_partition(struct ggml_threadpool * threadpool, int first, int n_threads) {
+    struct ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+    tpp.prio = threadpool->prio;
+    tpp.poll = threadpool->poll;
+
+    if (n_threads < 1 || first < 1 || first + n_threads - 1 > threadpool->n_threads_max || threadpool->parent) {
+        GGML_LOG_ERROR("%s: invalid partition: first %d, n_threads %d of a threadpool with %d threads\n",
+                __func__, first, n_threads, threadpool->n_threads_max);
+        return NULL;
+    }
+
+#ifdef GGML_USE_OPENMP
+    // OpenMP gives each concurrent graph compute its own team of threads
+    return ggml_threadpool_new_impl(&tpp, NULL, NULL, NULL, 0);
+#else
+    GGML_ASSERT(!atomic_load_explicit(&threadpool->busy, memory_order_acquire) &&
+            "the threadpool must be idle or paused to create a partition");
+
+    for (int j = first; j < first + n_threads - 1; j++) {
+        if (atomic_load_explicit(&threadpool->workers[j].part, memory_order_relaxed) != NULL) {
+            GGML_LOG_ERROR("%s: worker %d is already in a partition\n", __func__, j);
+            return NULL;
+        }
+    }
+
+    return ggml_threadpool_new_impl(&tpp, NULL, NULL, threadpool, first);
+#endif
+}
+
+static enum ggml_status ggml_graph_compute_impl(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan,
+        const uint8_t * node_sync, const uint8_t * node_fused) {
     ggml_cpu_init();
 
     GGML_ASSERT(cplan);
@@ -3089,6 +3866,9 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
     int n_threads                               = cplan->n_threads;
     struct ggml_threadpool * threadpool = cplan->threadpool;
 
+    GGML_ASSERT((threadpool == NULL || atomic_load_explicit(&threadpool->n_partitions, memory_order_relaxed) == 0) &&
+            "a partitioned threadpool can only compute through its partitions");
+
     bool disposable_threadpool = false;
 
     if (threadpool == NULL) {
@@ -3096,7 +3876,7 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         disposable_threadpool = true;
 
         struct ggml_threadpool_params ttp = ggml_threadpool_params_default(n_threads);
-        threadpool = ggml_threadpool_new_impl(&ttp, cgraph, cplan);
+        threadpool = ggml_threadpool_new_impl(&ttp, cgraph, cplan, NULL, 0);
     } else {
         // Reset some of the parameters that need resetting
         // No worker threads should be accessing the parameters below at this stage
@@ -3107,6 +3887,27 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+    atomic_store_explicit(&threadpool->busy, true, memory_order_release);
+
+    if (node_sync == NULL) {
+        if (threadpool->node_sync_size < cgraph->n_nodes) {
+            free(threadpool->node_sync_buf);
+            free(threadpool->node_fused_buf);
+            threadpool->node_sync_buf  = malloc(cgraph->n_nodes);
+            threadpool->node_fused_buf = malloc(cgraph->n_nodes);
+            threadpool->node_sync_size = cgraph->n_nodes;
+            GGML_ASSERT(threadpool->node_sync_buf != NULL && threadpool->node_fused_buf != NULL);
+        }
+
+        ggml_graph_plan_sync(cgraph, n_threads, threadpool->node_sync_buf, threadpool->node_fused_buf);
+
+        node_sync  = threadpool->node_sync_buf;
+        node_fused = threadpool->node_fused_buf;
+    }
+
+    threadpool->node_sync  = node_sync;
+    threadpool->node_fused = node_fused;
+
 #ifdef GGML_USE_OPENMP
     if (n_threads > 1) {
         #pragma omp parallel num_threads(n_threads)
@@ -3142,6 +3943,8 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
 
     enum ggml_status ret = threadpool->ec;
 
+    atomic_store_explicit(&threadpool->busy, false, memory_order_release);
+
     if (disposable_threadpool) {
         ggml_threadpool_free(threadpool);
     }
@@ -3149,6 +3952,39 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
     return ret;
 }
 
+enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
+    return ggml_graph_compute_impl(cgraph, cplan, NULL, NULL);
+}
+
+enum ggml_status ggml_graph_compute_synced(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan,
+        const uint8_t * node_sync, const uint8_t * node_fused) {
+    GGML_ASSERT(cgraph->n_nodes == 0 || (node_sync != NULL && node_fused != NULL));
+
+    return ggml_graph_compute_impl(cgraph, cplan, node_sync, node_fused);
+}
+
+enum ggml_status ggml_graph_compute_barriers_testing(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
+    uint8_t * node_sync  = malloc(cgraph->n_nodes + 1);
+    uint8_t * node_fused = malloc(cgraph->n_nodes + 1);
+    GGML_ASSERT(node_sync != NULL && node_fused != NULL);
+
+    ggml_graph_plan_sync(cgraph, cplan->n_threads, node_sync, node_fused);
+
+    // the same nodes are fused, but all threads finish each node before the next one
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        if (node_sync[i] == GGML_NODE_SYNC_NONE) {
+            node_sync[i] = GGML_NODE_SYNC_BARRIER;
+        }
+    }
+
+    const enum ggml_status ret = ggml_graph_compute_impl(cgraph, cplan, node_sync, node_fused);
+
+    free(node_sync);
+    free(node_fused);
+
+    return ret;
+}
+
 enum ggml_status ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads) {
     struct ggml_cplan cplan = ggml_graph_plan(cgraph, n_threads, NULL);
 
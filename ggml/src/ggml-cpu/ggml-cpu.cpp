@@ -82,6 +82,25 @@ static bool ggml_backend_cpu_is_extra_buffer_type(ggml_backend_buffer_type_t buf
 
 // CPU backend - backend (stream)
 
+// number of graphs for which the plan is kept
+// a model split between several backends can have multiple CPU graphs that are computed in turns
+#define GGML_CPU_PLAN_CACHE_SIZE 8
+
+// a plan computed for a graph, reused when the same graph is computed again with the same threads
+// (e.g. when the graph is reused between the decode calls and only the data of the inputs changes)
+struct ggml_backend_cpu_plan_cache_entry {
+    uint64_t          uid;
+    int               n_nodes;
+    int               n_threads;
+    ggml_threadpool_t threadpool;
+
+    struct ggml_cplan cplan;
+
+    // the barriers and the fused nodes of the graph, see ggml_graph_plan_sync
+    std::vector<uint8_t> node_sync;
+    std::vector<uint8_t> node_fused;
+};
+
 struct ggml_backend_cpu_context {
     int                 n_threads;
     ggml_threadpool_t   threadpool;
@@ -91,8 +110,49 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    std::vector<ggml_backend_cpu_plan_cache_entry> plan_cache;
+    size_t                                         plan_cache_next;
 };
 
+// returns the plan for the graph, computing it only if it is not in the cache
+static const ggml_backend_cpu_plan_cache_entry & ggml_backend_cpu_get_plan(struct ggml_backend_cpu_context * cpu_ctx, const struct ggml_cgraph * cgraph) {
+    for (const auto & entry : cpu_ctx->plan_cache) {
+        if (entry.uid        == cgraph->uid &&
+            entry.n_nodes    == cgraph->n_nodes &&
+            entry.n_threads  == cpu_ctx->n_threads &&
+            entry.threadpool == cpu_ctx->threadpool) {
+            return entry;
+        }
+    }
+
+    struct ggml_cplan cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+
+    ggml_backend_cpu_plan_cache_entry entry = {
+        /* .uid        = */ cgraph->uid,
+        /* .n_nodes    = */ cgraph->n_nodes,
+        /* .n_threads  = */ cpu_ctx->n_threads,
+        /* .threadpool = */ cpu_ctx->threadpool,
+        /* .cplan      = */ cplan,
+        /* .node_sync  = */ std::vector<uint8_t>(cgraph->n_nodes),
+        /* .node_fused = */ std::vector<uint8_t>(cgraph->n_nodes),
+    };
+
+    ggml_graph_plan_sync(cgraph, cplan.n_threads, entry.node_sync.data(), entry.node_fused.data());
+
+    if (cpu_ctx->plan_cache.size() < GGML_CPU_PLAN_CACHE_SIZE) {
+        cpu_ctx->plan_cache.push_back(std::move(entry));
+        return cpu_ctx->plan_cache.back();
+    }
+
+    const size_t i = cpu_ctx->plan_cache_next;
+
+    cpu_ctx->plan_cache[i] = std::move(entry);
+    cpu_ctx->plan_cache_next = (i + 1) % GGML_CPU_PLAN_CACHE_SIZE;
+
+    return cpu_ctx->plan_cache[i];
+}
+
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
     return "CPU";
 
@@ -153,7 +213,9 @@ static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backe
 static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
 
-    struct ggml_cplan cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+    const auto & plan = ggml_backend_cpu_get_plan(cpu_ctx, cgraph);
+
+    struct ggml_cplan cplan = plan.cplan;
 
     if (cpu_ctx->work_size < cplan.work_size) {
         delete[] cpu_ctx->work_data;
@@ -169,7 +231,7 @@ static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, s
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
 
-    return ggml_graph_compute(cgraph, &cplan);
+    return ggml_graph_compute_synced(cgraph, &cplan, plan.node_sync.data(), plan.node_fused.data());
 }
 
 static const struct ggml_backend_i ggml_backend_cpu_i = {
@@ -208,6 +270,7 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->work_size           = 0;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
+    ctx->plan_cache_next     = 0;
 
     ggml_backend_t cpu_backend = new ggml_backend {
         /* .guid      = */ ggml_backend_cpu_guid(),
@@ -635,6 +698,9 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_cpu_is_numa") == 0) {
         return (void *)ggml_is_numa;
     }
+    if (strcmp(name, "ggml_backend_cpu_numa_place_tensor") == 0) {
+        return (void *)ggml_numa_place_tensor;
+    }
 
     // threadpool - TODO:  move to ggml-base
     if (strcmp(name, "ggml_threadpool_new") == 0) {
@@ -643,6 +709,9 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_threadpool_free") == 0) {
         return (void *)ggml_threadpool_free;
     }
+    if (strcmp(name, "ggml_threadpool_new_partition") == 0) {
+        return (void *)ggml_threadpool_new_partition;
+    }
     if (strcmp(name, "ggml_backend_cpu_set_threadpool") == 0) {
         return (void *)ggml_backend_cpu_set_threadpool;
     }
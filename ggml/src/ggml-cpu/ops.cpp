@@ -4,10 +4,12 @@
 #include "ggml-impl.h"
 #include "binary-ops.h"
 #include "ggml.h"
+#include "quants.h"
 #include "unary-ops.h"
 #include "vec.h"
 
 #include <float.h>
+#include <algorithm>
 
 // ggml_compute_forward_dup
 
@@ -655,6 +657,39 @@ static void ggml_compute_forward_dup_bf16(
     }
 }
 
+static void ggml_compute_forward_dup_f32_i32(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    const int ith = params->ith; // thread index
+    const int nth = params->nth; // number of threads
+
+    // parallelize by rows
+    const int64_t nr  = ggml_nrows(src0);
+    const int64_t dr  = (nr + nth - 1)/nth;
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = ir - i03*ne02*ne01 - i02*ne01;
+
+        for (int64_t i00 = 0; i00 < ne00; i00++) {
+            const float * src0_ptr = (const float *) ((const char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                int32_t * dst_ptr  = (int32_t *)     ((char *)        dst->data + i00*nb0  + i01*nb1  + i02*nb2  + i03*nb3);
+
+            *dst_ptr = (int32_t) *src0_ptr;
+        }
+    }
+}
+
 static void ggml_compute_forward_dup_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -1174,6 +1209,10 @@ void ggml_compute_forward_dup(
             } break;
         case GGML_TYPE_F32:
             {
+                if (dst->type == GGML_TYPE_I32) {
+                    ggml_compute_forward_dup_f32_i32(params, dst);
+                    break;
+                }
                 ggml_compute_forward_dup_f32(params, dst);
             } break;
         default:
@@ -4039,6 +4078,96 @@ void ggml_compute_forward_rms_norm(
     }
 }
 
+// fused ADD -> RMS_NORM -> MUL, the ADD and the MUL are optional
+// the result of the ADD is still written, since it is usually used again (e.g. as the residual)
+// the result of the RMS_NORM is not written when followed by the MUL
+static void ggml_compute_forward_rms_norm_fused_f32(
+        const ggml_compute_params * params,
+        ggml_tensor * add,
+        ggml_tensor * norm,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = norm->src[0];
+    const ggml_tensor * dst  = mul ? mul : norm;
+    const ggml_tensor * w    = mul ? (mul->src[0] == norm ? mul->src[1] : mul->src[0]) : nullptr;
+
+    GGML_ASSERT(!add || src0 == add);
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps >= 0.0f);
+
+    const int64_t nr = ggml_nrows(src0);
+
+    for (int64_t ir = ith; ir < nr; ir += nth) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+        if (add) {
+            const ggml_tensor * a = add->src[0];
+            const ggml_tensor * b = add->src[1];
+
+            ggml_vec_add_f32(ne00, x,
+                    (const float *) ((const char *) a->data + i01*a->nb[1] + i02*a->nb[2] + i03*a->nb[3]),
+                    (const float *) ((const char *) b->data + i01*b->nb[1] + i02*b->nb[2] + i03*b->nb[3]));
+        }
+
+        ggml_float sum = 0.0;
+        for (int64_t i00 = 0; i00 < ne00; i00++) {
+            sum += (ggml_float)(x[i00] * x[i00]);
+        }
+
+        const float mean = sum/ne00;
+
+        const float scale = 1.0f/sqrtf(mean + eps);
+
+        float * y = (float *) ((char *) dst->data + i01*dst->nb[1] + i02*dst->nb[2] + i03*dst->nb[3]);
+
+        if (w) {
+            const float * wr = (const float *) ((const char *) w->data
+                    + (i01 % w->ne[1])*w->nb[1] + (i02 % w->ne[2])*w->nb[2] + (i03 % w->ne[3])*w->nb[3]);
+
+            // same rounding as the separate ops
+            for (int64_t i00 = 0; i00 < ne00; i00++) {
+                y[i00] = (x[i00]*scale)*wr[i00];
+            }
+        } else {
+            memcpy(y, x, ne00 * sizeof(float));
+            ggml_vec_scale_f32(ne00, y, scale);
+        }
+    }
+}
+
+void ggml_compute_forward_rms_norm_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * add,
+        ggml_tensor * norm,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = norm->src[0];
+
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_rms_norm_fused_f32(params, add, norm, mul);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 static void ggml_compute_forward_rms_norm_back_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -7930,6 +8059,9 @@ static void ggml_compute_forward_argsort_f32(
 
     ggml_sort_order order = (ggml_sort_order) ggml_get_op_params_i32(dst, 0);
 
+    // ggml_top_k: only the first k elements are needed
+    const int32_t k = ggml_get_op_params_i32(dst, 1);
+
     for (int64_t i = ith; i < nr; i += nth) {
         int32_t * dst_data = (int32_t *)((char *) dst->data + i*nb1);
         const float * src_data = (float *)((char *) src0->data + i*nb01);
@@ -7938,6 +8070,19 @@ static void ggml_compute_forward_argsort_f32(
             dst_data[j] = j;
         }
 
+        if (k > 0 && k < ne0) {
+            if (order == GGML_SORT_ORDER_ASC) {
+                std::partial_sort(dst_data, dst_data + k, dst_data + ne0, [src_data](int32_t a, int32_t b) {
+                    return src_data[a] < src_data[b];
+                });
+            } else {
+                std::partial_sort(dst_data, dst_data + k, dst_data + ne0, [src_data](int32_t a, int32_t b) {
+                    return src_data[a] > src_data[b];
+                });
+            }
+            continue;
+        }
+
         // C doesn't have a functional sort, so we do a bubble sort instead
         for (int64_t j = 0; j < ne0; j++) {
             for (int64_t k = j + 1; k < ne0; k++) {
@@ -7972,6 +8117,179 @@ void ggml_compute_forward_argsort(
 
 // ggml_compute_forward_flash_attn_ext
 
+// convert n K/V rows with stride nb to a contiguous F32 tile
+static void ggml_fa_rows_to_f32(const ggml_tensor * t, const char * data, size_t nb, int64_t n, float * dst) {
+    const int64_t ne0 = t->ne[0];
+
+    const ggml_vec_mad_t vec_mad = ggml_get_type_traits_cpu(t->type)->vec_mad;
+    if (vec_mad) {
+        memset(dst, 0, n*ne0*sizeof(float));
+    }
+
+    for (int64_t i = 0; i < n; ++i) {
+        const char * row = data + i*nb;
+
+        if (t->type == GGML_TYPE_F32) {
+            memcpy(dst + i*ne0, row, ne0*sizeof(float));
+        } else if (t->type == GGML_TYPE_F16) {
+            ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) row, dst + i*ne0, ne0);
+        } else if (t->type == GGML_TYPE_BF16) {
+            ggml_cpu_bf16_to_fp32((const ggml_bf16_t *) row, dst + i*ne0, ne0);
+        } else if (vec_mad) {
+            vec_mad(ne0, dst + i*ne0, row, 1.0f);
+        } else {
+            ggml_get_type_traits(t->type)->to_float(row, dst + i*ne0, ne0);
+        }
+    }
+}
+
+// KQ tile: S[i][j] = sum_d Q[i][d]*Kt[d][j] for nq q rows and GGML_FA_TILE_KV cells, Kt is the K tile transposed
+// VKQ tile: O[i][:] += sum_j P[i][j]*V[j][:] for nq q rows and nc cells
+// the rows are processed in groups of GGML_FA_TILE_NR so that each K/V vector is loaded once for all of them
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE)
+#if defined(__AVX512F__) || defined(__ARM_NEON) || defined(__POWER9_VECTOR__) || defined(__loongarch_asx)
+#define GGML_FA_TILE_NR 4 // 32 vector registers
+#else
+#define GGML_FA_TILE_NR 2
+#endif
+
+static_assert(GGML_FA_TILE_KV % GGML_F32_STEP == 0, "GGML_FA_TILE_KV must be a multiple of GGML_F32_STEP");
+
+template <int NR>
+static inline void ggml_fa_tile_kq_rows(int64_t DK, const float * GGML_RESTRICT Q, const float * GGML_RESTRICT Kt, float * GGML_RESTRICT S) {
+    const int64_t KT = GGML_FA_TILE_KV;
+
+    for (int64_t j = 0; j < KT; j += GGML_F32_STEP) {
+        GGML_F32_VEC acc[NR][GGML_F32_ARR];
+        for (int r = 0; r < NR; ++r) {
+            for (int a = 0; a < GGML_F32_ARR; ++a) {
+                acc[r][a] = GGML_F32_VEC_ZERO;
+            }
+        }
+
+        for (int64_t d = 0; d < DK; ++d) {
+            GGML_F32_VEC kv[GGML_F32_ARR];
+            for (int a = 0; a < GGML_F32_ARR; ++a) {
+                kv[a] = GGML_F32_VEC_LOAD(Kt + d*KT + j + a*GGML_F32_EPR);
+            }
+            for (int r = 0; r < NR; ++r) {
+                const GGML_F32_VEC qv = GGML_F32_VEC_SET1(Q[r*DK + d]);
+                for (int a = 0; a < GGML_F32_ARR; ++a) {
+                    acc[r][a] = GGML_F32_VEC_FMA(acc[r][a], kv[a], qv);
+                }
+            }
+        }
+
+        for (int r = 0; r < NR; ++r) {
+            for (int a = 0; a < GGML_F32_ARR; ++a) {
+                GGML_F32_VEC_STORE(S + r*KT + j + a*GGML_F32_EPR, acc[r][a]);
+            }
+        }
+    }
+}
+
+template <int NR, int NV>
+static inline void ggml_fa_tile_vkq_cols(int64_t nc, int64_t DV, const float * GGML_RESTRICT P, const float * GGML_RESTRICT V, float * GGML_RESTRICT O) {
+    const int64_t KT = GGML_FA_TILE_KV;
+
+    GGML_F32_VEC acc[NR][NV];
+    for (int r = 0; r < NR; ++r) {
+        for (int a = 0; a < NV; ++a) {
+            acc[r][a] = GGML_F32_VEC_LOAD(O + r*DV + a*GGML_F32_EPR);
+        }
+    }
+
+    for (int64_t j = 0; j < nc; ++j) {
+        GGML_F32_VEC vv[NV];
+        for (int a = 0; a < NV; ++a) {
+            vv[a] = GGML_F32_VEC_LOAD(V + j*DV + a*GGML_F32_EPR);
+        }
+        for (int r = 0; r < NR; ++r) {
+            const GGML_F32_VEC pv = GGML_F32_VEC_SET1(P[r*KT + j]);
+            for (int a = 0; a < NV; ++a) {
+                acc[r][a] = GGML_F32_VEC_FMA(acc[r][a], vv[a], pv);
+            }
+        }
+    }
+
+    for (int r = 0; r < NR; ++r) {
+        for (int a = 0; a < NV; ++a) {
+            GGML_F32_VEC_STORE(O + r*DV + a*GGML_F32_EPR, acc[r][a]);
+        }
+    }
+}
+
+template <int NR>
+static inline void ggml_fa_tile_vkq_rows(int64_t nc, int64_t DV, const float * GGML_RESTRICT P, const float * GGML_RESTRICT V, float * GGML_RESTRICT O) {
+    const int64_t KT = GGML_FA_TILE_KV;
+
+    int64_t d = 0;
+    for (; d + GGML_F32_STEP <= DV; d += GGML_F32_STEP) {
+        ggml_fa_tile_vkq_cols<NR, GGML_F32_ARR>(nc, DV, P, V + d, O + d);
+    }
+    for (; d + GGML_F32_EPR <= DV; d += GGML_F32_EPR) {
+        ggml_fa_tile_vkq_cols<NR, 1>(nc, DV, P, V + d, O + d);
+    }
+    for (; d < DV; ++d) {
+        for (int r = 0; r < NR; ++r) {
+            float sum = O[r*DV + d];
+            for (int64_t j = 0; j < nc; ++j) {
+                sum += P[r*KT + j]*V[j*DV + d];
+            }
+            O[r*DV + d] = sum;
+        }
+    }
+}
+#endif
+
+static void ggml_fa_tile_kq(int64_t nq, int64_t DK, const float * GGML_RESTRICT Q, const float * GGML_RESTRICT Kt, float * GGML_RESTRICT S) {
+    const int64_t KT = GGML_FA_TILE_KV;
+
+    int64_t i = 0;
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE)
+    for (; i + GGML_FA_TILE_NR - 1 < nq; i += GGML_FA_TILE_NR) {
+        ggml_fa_tile_kq_rows<GGML_FA_TILE_NR>(DK, Q + i*DK, Kt, S + i*KT);
+    }
+    for (; i + 1 < nq; i += 2) {
+        ggml_fa_tile_kq_rows<2>(DK, Q + i*DK, Kt, S + i*KT);
+    }
+    for (; i < nq; ++i) {
+        ggml_fa_tile_kq_rows<1>(DK, Q + i*DK, Kt, S + i*KT);
+    }
+#else
+    for (; i < nq; ++i) {
+        float * s = S + i*KT;
+        memset(s, 0, KT*sizeof(float));
+        for (int64_t d = 0; d < DK; ++d) {
+            ggml_vec_mad_f32(KT, s, Kt + d*KT, Q[i*DK + d]);
+        }
+    }
+#endif
+}
+
+static void ggml_fa_tile_vkq(int64_t nq, int64_t nc, int64_t DV, const float * GGML_RESTRICT P, const float * GGML_RESTRICT V, float * GGML_RESTRICT O) {
+    const int64_t KT = GGML_FA_TILE_KV;
+
+    int64_t i = 0;
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE)
+    for (; i + GGML_FA_TILE_NR - 1 < nq; i += GGML_FA_TILE_NR) {
+        ggml_fa_tile_vkq_rows<GGML_FA_TILE_NR>(nc, DV, P + i*KT, V, O + i*DV);
+    }
+    for (; i + 1 < nq; i += 2) {
+        ggml_fa_tile_vkq_rows<2>(nc, DV, P + i*KT, V, O + i*DV);
+    }
+    for (; i < nq; ++i) {
+        ggml_fa_tile_vkq_rows<1>(nc, DV, P + i*KT, V, O + i*DV);
+    }
+#else
+    for (; i < nq; ++i) {
+        for (int64_t j = 0; j < nc; ++j) {
+            ggml_vec_mad_f32(DV, O + i*DV, V + j*DV, P[i*KT + j]);
+        }
+    }
+#endif
+}
+
 static void ggml_compute_forward_flash_attn_ext_f16(
         const ggml_compute_params * params,
         const ggml_tensor * q,
@@ -8023,18 +8341,6 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     const int64_t rv2 = neq2/nev2;
     const int64_t rv3 = neq3/nev3;
 
-    // parallelize by q rows using ggml_vec_dot_f32
-
-    // total rows in q
-    const int nr = neq1*neq2*neq3;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
-
     float scale         = 1.0f;
     float max_bias      = 0.0f;
     float logit_softcap = 0.0f;
@@ -8053,141 +8359,302 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
     const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
 
-    ggml_type         const k_vec_dot_type = ggml_get_type_traits_cpu(k->type)->vec_dot_type;
-    ggml_from_float_t const q_to_vec_dot   = ggml_get_type_traits_cpu(k_vec_dot_type)->from_float;
-    ggml_vec_dot_t    const kq_vec_dot     = ggml_get_type_traits_cpu(k->type)->vec_dot;
-    ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
+    GGML_ASSERT((k->type == GGML_TYPE_F32 || ggml_get_type_traits(k->type)->to_float) && "fattn: unsupported K-type");
+    GGML_ASSERT((v->type == GGML_TYPE_F32 || ggml_get_type_traits(v->type)->to_float) && "fattn: unsupported V-type");
 
-    GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
-    GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
+    // quantized K: the q rows can be converted to the vec_dot type of K to compute KQ directly on the K blocks
+    const ggml_type         k_vec_dot_type = ggml_get_type_traits_cpu(k->type)->vec_dot_type;
+    const ggml_vec_dot_t    kq_vec_dot     = ggml_get_type_traits_cpu(k->type)->vec_dot;
+    const ggml_from_float_t q_to_vec_dot   = ggml_get_type_traits_cpu(k_vec_dot_type)->from_float;
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+    const bool   k_quant    = ggml_is_quantized(k->type) && kq_vec_dot && q_to_vec_dot;
+    const size_t q_row_size = ggml_row_size(k_vec_dot_type, DK);
 
-        const uint32_t h = iq2; // head index
-        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+    // quantized V: VKQ can be accumulated directly from the V blocks
+    const ggml_vec_mad_t    v_vec_mad      = ggml_get_type_traits_cpu(v->type)->vec_mad;
 
-        float S = 0.0f;      // sum
-        float M = -INFINITY; // maximum KQ value
+    const int64_t QT = GGML_FA_TILE_Q;
+    const int64_t KT = GGML_FA_TILE_KV;
 
-        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
-        float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
-        ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
+    // the q rows are processed in tiles of QT rows against tiles of KT K/V cells converted to F32
+    // the q rows of the heads that share a K/V head (GQA) are put in the same tiles, so each K/V tile is loaded once for all of them
+    const int64_t ng = rk2 == rv2 ? rk2 : 1;
 
-        if (v->type == GGML_TYPE_F16) {
-            memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
-        } else {
-            memset(VKQ32, 0, DV*sizeof(float));
-        }
+    const int64_t nrg    = neq1*ng;                          // q rows per group of heads
+    const int64_t ngroup = (neq2/ng)*neq3;                   // groups of heads
+    const int64_t ntile  = (nrg + QT - 1)/QT;                // q tiles per group
+    const int64_t ntask  = ngroup*ntile;
 
-        const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+    // when there are not enough q tiles to keep the threads busy (e.g. single-token decode), the KV sequence is split
+    // between them and the partial results of the splits are reduced at the end
+    int64_t nsplit = 1;
+    if (ntask < nth) {
+        nsplit = MIN((nth + ntask - 1)/ntask, MAX(1, nek1/GGML_FA_SPLIT_KV_MIN));
+    }
+    const int64_t nkv = GGML_PAD((nek1 + nsplit - 1)/nsplit, KT);  // KV cells per split
 
-        // k indices
-        const int ik3 = iq3 / rk3;
-        const int ik2 = iq2 / rk2;
+    float * Qf  = (float *) params->wdata + ith*GGML_FA_WORK_SIZE_F32(DK, DV); // q tile, pre-scaled  [QT][DK]
+    float * Kf  = Qf  + QT*DK;                                               // K tile, transposed  [DK][KT]
+    float * Vf  = Kf  + KT*DK;                                               // V tile              [KT][DV]
+    float * Sf  = Vf  + KT*MAX(DK, DV);                                      // KQ / softmax tile   [QT][KT]
+    float * Of  = Sf  + QT*KT;                                               // VKQ accumulators    [QT][DV]
+    float * Mf  = Of  + QT*DV;                                               // maximum KQ value    [QT]
+    float * Lf  = Mf  + QT;                                                  // sum                 [QT]
 
-        // v indices
-        const int iv3 = iq3 / rv3;
-        const int iv2 = iq2 / rv2;
+    // q tile converted to the vec_dot type of a quantized K, in place of the K tile
+    char * Qq = (char *) Kf;
 
-        const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
-        q_to_vec_dot(pq, Q_q, DK);
+    // partial results of the splits [ntask*nsplit][QT][2 + DV]: maximum, sum, VKQ accumulator
+    float * Pf = (float *) params->wdata + nth*GGML_FA_WORK_SIZE_F32(DK, DV);
 
-        // online softmax / attention
-        // loop over n_kv and n_head_kv
-        // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
-                continue;
-            }
+    const ggml_fp16_t * mp[GGML_FA_TILE_Q];
+    float slope[GGML_FA_TILE_Q];
 
-            float s; // KQ value
+    if (ith == 0) {
+        // Every thread starts at ith, so the first unprocessed chunk is nth.  This save a bit of coordination right at the start.
+        ggml_threadpool_chunk_set(params->threadpool, nth);
+    }
+
+    ggml_barrier(params->threadpool);
+
+    for (int64_t job = ith; job < ntask*nsplit; job = ggml_threadpool_chunk_add(params->threadpool, 1)) {
+        const int64_t task  = job/nsplit;
+        const int64_t split = job%nsplit;
+
+        const int64_t group = task/ntile;
+        const int64_t r0    = (task%ntile)*QT;
+        const int64_t nq    = MIN(QT, nrg - r0);
+
+        // with few q rows (decode), quantized K/V blocks are used directly instead of being converted to F32 tiles
+        const bool k_direct = k_quant   && nq < GGML_FA_QUANT_DIRECT_Q;
+        const bool v_direct = v_vec_mad && nq < GGML_FA_QUANT_DIRECT_Q;
+
+        const int64_t iq3 = group/(neq2/ng);
+        const int64_t ih0 = (group%(neq2/ng))*ng; // first head of the group
 
-            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
-            kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
+        // k/v indices
+        const int64_t ik2 = ih0/rk2;
+        const int64_t ik3 = iq3/rk3;
+        const int64_t iv2 = ih0/rv2;
+        const int64_t iv3 = iq3/rv3;
 
-            s = s*scale; // scale KQ value
+        for (int64_t i = 0; i < nq; ++i) {
+            const int64_t iq1 = (r0 + i)/ng;
+            const int64_t iq2 = ih0 + (r0 + i)%ng;
 
-            if (logit_softcap != 0.0f) {
-                s = logit_softcap*tanhf(s);
+            const uint32_t h = iq2; // head index
+            slope[i] = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+            mp[i] = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+
+            const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+            ggml_vec_scale_f32(DK, (float *) memcpy(Qf + i*DK, pq, DK*sizeof(float)), scale);
+
+            if (k_direct) {
+                q_to_vec_dot(Qf + i*DK, Qq + i*q_row_size, DK);
             }
 
-            s += mv; // apply mask
+            Mf[i] = -INFINITY;
+            Lf[i] = 0.0f;
+        }
 
-            const float Mold = M;
+        memset(Of, 0, nq*DV*sizeof(float));
 
-            float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
-            float vs = 1.0f; // post-softmax KQ value, expf(s - M)
+        // online softmax / attention
+        // ref: https://arxiv.org/pdf/2112.05682.pdf
+        const int64_t ic1 = MIN(nek1, (split + 1)*nkv);
 
-            const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+        for (int64_t ic0 = split*nkv; ic0 < ic1; ic0 += KT) {
+            const int64_t nc = MIN(KT, ic1 - ic0);
 
-            if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+            // the runs of consecutive rows that attend to at least one cell of the tile
+            // the other rows skip it, e.g. the rows of other sequences or the future cells of a causal mask
+            // note: whole tiles of other sequences only exist when the cache keeps the sequences in separate blocks
+            //       (paged layout of llama.cpp). the cells of a unified cache interleave the sequences, and without
+            //       flash attention KQ and KQV are dense matrix multiplications, so neither skips other sequences
+            int64_t run0[GGML_FA_TILE_Q];
+            int64_t run1[GGML_FA_TILE_Q];
+            int64_t nrun = 0;
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f16(DV, VKQ16, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+            for (int64_t i = 0; i < nq; ++i) {
+                bool active = mp[i] == NULL;
+                for (int64_t j = 0; j < nc && !active; ++j) {
+                    active = GGML_CPU_FP16_TO_FP32(mp[i][ic0 + j]) != -INFINITY;
                 }
 
-                // V += v*expf(s - M)
-                ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
-            } else {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                if (!active) {
+                    continue;
+                }
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(DV, VKQ32, ms);
+                if (nrun > 0 && run1[nrun - 1] == i) {
+                    run1[nrun - 1]++;
                 } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                    run0[nrun] = i;
+                    run1[nrun] = i + 1;
+                    nrun++;
+                }
+            }
+
+            if (nrun == 0) {
+                continue;
+            }
+
+            const char * kp = (const char *) k->data + ic0*nbk1 + ik2*nbk2 + ik3*nbk3;
+            const char * vp = (const char *) v->data + ic0*nbv1 + iv2*nbv2 + iv3*nbv3;
+
+            if (!k_direct) {
+                // K tile, transposed (V buffer used as temporary)
+                ggml_fa_rows_to_f32(k, kp, nbk1, nc, Vf);
+                for (int64_t d = 0; d < DK; ++d) {
+                    for (int64_t j = 0; j < nc; ++j) {
+                        Kf[d*KT + j] = Vf[j*DK + d];
+                    }
+                    for (int64_t j = nc; j < KT; ++j) {
+                        Kf[d*KT + j] = 0.0f;
+                    }
                 }
+            }
 
-                // V += v*expf(s - M)
-                if (v_to_float) {
-                    v_to_float(v_data, V32, DV);
-                    ggml_vec_mad_f32(DV, VKQ32, V32, vs);
+            for (int64_t ir = 0; ir < nrun; ++ir) {
+                const int64_t i0 = run0[ir];
+
+                // KQ
+                if (k_direct) {
+                    for (int64_t i = i0; i < run1[ir]; ++i) {
+                        for (int64_t j = 0; j < nc; ++j) {
+                            kq_vec_dot(DK, Sf + i*KT + j, 0, kp + j*nbk1, 0, Qq + i*q_row_size, 0, 1);
+                        }
+                    }
                 } else {
-                    // V is F32
-                    ggml_vec_mad_f32(DV, VKQ32, (const float *) v_data, vs);
+                    ggml_fa_tile_kq(run1[ir] - i0, DK, Qf + i0*DK, Kf, Sf + i0*KT);
+                }
+
+                for (int64_t i = i0; i < run1[ir]; ++i) {
+                    float * s = Sf + i*KT;
+
+                    float mx = -INFINITY;
+                    for (int64_t j = 0; j < nc; ++j) {
+                        const float mv = mp[i] ? slope[i]*GGML_CPU_FP16_TO_FP32(mp[i][ic0 + j]) : 0.0f;
+                        if (mv == -INFINITY) {
+                            s[j] = -INFINITY;
+                            continue;
+                        }
+
+                        if (logit_softcap != 0.0f) {
+                            s[j] = logit_softcap*tanhf(s[j]);
+                        }
+
+                        s[j] += mv; // apply mask
+                        mx = MAX(mx, s[j]);
+                    }
+
+                    if (mx == -INFINITY) {
+                        // nothing to accumulate for this row
+                        memset(s, 0, nc*sizeof(float));
+                        continue;
+                    }
+
+                    const float Mold = Mf[i];
+                    Mf[i] = MAX(Mold, mx);
+
+                    // s = expf(s - M), masked cells become 0
+                    const ggml_float sum = ggml_vec_soft_max_f32(nc, s, s, Mf[i]);
+
+                    // upon new higher max val, scale VKQ and KQ sum
+                    if (Mf[i] != Mold) {
+                        const float ms = expf(Mold - Mf[i]);
+                        ggml_vec_scale_f32(DV, Of + i*DV, ms);
+                        Lf[i] *= ms;
+                    }
+
+                    Lf[i] += (float) sum;
                 }
             }
 
-            S = S*ms + vs; // scale and increment sum with partial sum
+            // VKQ += V*softmax(KQ)
+            if (v_direct) {
+                for (int64_t ir = 0; ir < nrun; ++ir) {
+                    for (int64_t i = run0[ir]; i < run1[ir]; ++i) {
+                        for (int64_t j = 0; j < nc; ++j) {
+                            if (Sf[i*KT + j] != 0.0f) {
+                                v_vec_mad(DV, Of + i*DV, vp + j*nbv1, Sf[i*KT + j]);
+                            }
+                        }
+                    }
+                }
+            } else {
+                ggml_fa_rows_to_f32(v, vp, nbv1, nc, Vf);
+                for (int64_t ir = 0; ir < nrun; ++ir) {
+                    const int64_t i0 = run0[ir];
+                    ggml_fa_tile_vkq(run1[ir] - i0, nc, DV, Sf + i0*KT, Vf, Of + i0*DV);
+                }
+            }
         }
 
-        if (v->type == GGML_TYPE_F16) {
-            for (int64_t d = 0; d < DV; ++d) {
-                VKQ32[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
+        for (int64_t i = 0; i < nq; ++i) {
+            if (nsplit > 1) {
+                float * p = Pf + (job*QT + i)*(2 + DV);
+                p[0] = Mf[i];
+                p[1] = Lf[i];
+                memcpy(p + 2, Of + i*DV, DV*sizeof(float));
+                continue;
             }
+
+            // V /= S
+            ggml_vec_scale_f32(DV, Of + i*DV, 1.0f/Lf[i]);
+
+            const int64_t i1 = (r0 + i)/ng;
+            const int64_t i2 = ih0 + (r0 + i)%ng;
+            const int64_t i3 = iq3;
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, Of + i*DV, nb1);
         }
+    }
 
-        // V /= S
-        const float S_inv = 1.0f/S;
-        ggml_vec_scale_f32(DV, VKQ32, S_inv);
+    if (nsplit == 1) {
+        return;
+    }
 
-        // dst indices
-        const int i1 = iq1;
-        const int i2 = iq2;
-        const int i3 = iq3;
+    ggml_barrier(params->threadpool);
+
+    // reduce the partial results of the splits
+    for (int64_t ir = ith; ir < ngroup*nrg; ir += nth) {
+        const int64_t group = ir/nrg;
+        const int64_t r     = ir%nrg;
+        const int64_t task  = group*ntile + r/QT;
+
+        const float * p0 = Pf + ((task*nsplit)*QT + r%QT)*(2 + DV);
+        const size_t  ps = QT*(2 + DV); // stride between the splits
+
+        float M = -INFINITY;
+        for (int64_t s = 0; s < nsplit; ++s) {
+            M = MAX(M, p0[s*ps]);
+        }
+
+        float S = 0.0f;
+        memset(Of, 0, DV*sizeof(float));
+
+        for (int64_t s = 0; s < nsplit; ++s) {
+            const float * p = p0 + s*ps;
+            if (p[0] == -INFINITY) {
+                continue;
+            }
+
+            const float ms = expf(p[0] - M);
+            ggml_vec_mad_f32(DV, Of, p + 2, ms);
+            S += p[1]*ms;
+        }
+
+        // V /= S
+        ggml_vec_scale_f32(DV, Of, 1.0f/S);
 
-        // original
-        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+        const int64_t i1 = r/ng;
+        const int64_t i2 = (group%(neq2/ng))*ng + r%ng;
+        const int64_t i3 = group/(neq2/ng);
 
         // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, Of, nb1);
     }
 }
 
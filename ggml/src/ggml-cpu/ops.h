@@ -23,6 +23,21 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 // Work buffer size for im2col operations in CONV2D
 #define GGML_IM2COL_WORK_SIZE (16 * 1024 * 1024)
 
+// Tiles of the flash attention: q rows x K/V cells
+#define GGML_FA_TILE_Q  32
+#define GGML_FA_TILE_KV 64
+
+// Min K/V cells per thread when the K/V sequence is split between the threads
+#define GGML_FA_SPLIT_KV_MIN 512
+
+// Q tiles with fewer rows than this use the blocks of a quantized K/V directly instead of converting them to F32
+#define GGML_FA_QUANT_DIRECT_Q 8
+
+// Work buffer size of the flash attention per thread, in floats: q, K, V, KQ and VKQ tiles + max and sum per q row
+// the V tile is also used to convert the K tile before it is transposed
+#define GGML_FA_WORK_SIZE_F32(DK, DV) \
+    (GGML_FA_TILE_Q*(DK) + GGML_FA_TILE_KV*((DK) + MAX(DK, DV)) + GGML_FA_TILE_Q*(GGML_FA_TILE_KV + (DV) + 2) + CACHE_LINE_SIZE_F32)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,6 +57,7 @@ void ggml_compute_forward_concat(const struct ggml_compute_params * params, stru
 void ggml_compute_forward_silu_back(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_norm(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_rms_norm(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+void ggml_compute_forward_rms_norm_fused(const struct ggml_compute_params * params, struct ggml_tensor * add, struct ggml_tensor * norm, struct ggml_tensor * mul);
 void ggml_compute_forward_rms_norm_back(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_group_norm(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_l2_norm(const struct ggml_compute_params * params, struct ggml_tensor * dst);
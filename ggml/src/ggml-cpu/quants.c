@@ -1145,6 +1145,43 @@ void ggml_vec_dot_iq4_xs_q8_K_generic(int n, float * GGML_RESTRICT s, size_t bs,
     *s = sumf;
 }
 
+//===================================== Multiply-add =================================
+
+void ggml_vec_mad_q4_0_generic(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * GGML_RESTRICT x = vx;
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = v*GGML_CPU_FP16_TO_FP32(x[ib].d);
+
+        for (int j = 0; j < qk/2; ++j) {
+            y[ib*qk + j       ] += d*((x[ib].qs[j] & 0x0F) - 8);
+            y[ib*qk + j + qk/2] += d*((x[ib].qs[j] >>   4) - 8);
+        }
+    }
+}
+
+void ggml_vec_mad_q8_0_generic(int n, float * GGML_RESTRICT y, const void * GGML_RESTRICT vx, float v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * GGML_RESTRICT x = vx;
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = v*GGML_CPU_FP16_TO_FP32(x[ib].d);
+
+        for (int j = 0; j < qk; ++j) {
+            y[ib*qk + j] += d*x[ib].qs[j];
+        }
+    }
+}
+
 // ============================ 4-bit non-linear quants
 
 void quantize_row_iq4_nl(const float * GGML_RESTRICT x, void * GGML_RESTRICT y, int64_t k) {
@@ -306,6 +306,10 @@ struct ggml_cgraph {
     struct ggml_hash_set visited_hash_set;
 
     enum ggml_cgraph_eval_order order;
+
+    // identifies the contents of the graph - a new uid is assigned when the graph is created, cleared or copied into
+    // backends can use it to cache per-graph data, as long as they also check n_nodes (nodes may be appended)
+    uint64_t uid;
 };
 
 // returns a slice of cgraph with nodes [i0, i1)
@@ -4720,6 +4720,9 @@ struct ggml_tensor * ggml_top_k(
 
     struct ggml_tensor * result = ggml_argsort(ctx, a, GGML_SORT_ORDER_DESC);
 
+    // only the first k elements of the argsort are used
+    ggml_set_op_params_i32(result, 1, k);
+
     result = ggml_view_4d(ctx, result,
                 k, result->ne[1], result->ne[2], result->ne[3],
                    result->nb[1], result->nb[2], result->nb[3],
@@ -6332,6 +6335,16 @@ size_t ggml_graph_overhead(void) {
     return ggml_graph_overhead_custom(GGML_DEFAULT_GRAPH_SIZE, false);
 }
 
+static uint64_t ggml_graph_next_uid(void) {
+    static uint64_t uid = 0;
+
+    ggml_critical_section_start();
+    const uint64_t res = ++uid;
+    ggml_critical_section_end();
+
+    return res;
+}
+
 struct ggml_cgraph * ggml_new_graph_custom(struct ggml_context * ctx, size_t size, bool grads) {
     const size_t obj_size = ggml_graph_nbytes(size, grads);
     struct ggml_object * obj = ggml_new_object(ctx, GGML_OBJECT_TYPE_GRAPH, obj_size);
@@ -6365,6 +6378,7 @@ struct ggml_cgraph * ggml_new_graph_custom(struct ggml_context * ctx, size_t siz
         /*.use_counts   =*/ use_counts_ptr,
         /*.hash_table   =*/ { hash_size, hash_used, hash_keys_ptr },
         /*.order        =*/ GGML_CGRAPH_EVAL_ORDER_LEFT_TO_RIGHT,
+        /*.uid          =*/ ggml_graph_next_uid(),
     };
 
     ggml_hash_set_reset(&cgraph->visited_hash_set);
@@ -6392,6 +6406,7 @@ struct ggml_cgraph ggml_graph_view(struct ggml_cgraph * cgraph0, int i0, int i1)
         /*.use_counts       =*/ cgraph0->use_counts,
         /*.visited_hash_set =*/ cgraph0->visited_hash_set,
         /*.order            =*/ cgraph0->order,
+        /*.uid              =*/ ggml_graph_next_uid(),
     };
 
     return cgraph;
@@ -6405,6 +6420,7 @@ void ggml_graph_cpy(struct ggml_cgraph * src, struct ggml_cgraph * dst) {
     dst->n_leafs = src->n_leafs;
     dst->n_nodes = src->n_nodes;
     dst->order   = src->order;
+    dst->uid     = ggml_graph_next_uid();
 
     for (int i = 0; i < src->n_leafs; ++i) {
         dst->leafs[i] = src->leafs[i];
@@ -6502,6 +6518,7 @@ void ggml_graph_reset(struct ggml_cgraph * cgraph) {
 void ggml_graph_clear(struct ggml_cgraph * cgraph) {
     cgraph->n_leafs = 0;
     cgraph->n_nodes = 0;
+    cgraph->uid     = ggml_graph_next_uid();
     ggml_hash_set_reset(&cgraph->visited_hash_set);
 }
 
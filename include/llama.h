@@ -352,6 +352,8 @@ extern "C" {
         float    yarn_beta_slow;   // YaRN high correction dim
         uint32_t yarn_orig_ctx;    // YaRN original context size
         float    defrag_thold;     // defragment the KV cache if holes/size > thold, <= 0 disabled (default)
+        uint32_t kv_block_size;    // paged KV cache: number of cells per sequence block, 0 = disabled (default) [EXPERIMENTAL]
+        uint32_t logits_top_k;     // copy out only the top-k logits of each output, see llama_get_logits_top_k_ith(), 0 = disabled (default) [EXPERIMENTAL]
 
         ggml_backend_sched_eval_callback cb_eval;
         void * cb_eval_user_data;
@@ -680,6 +682,18 @@ extern "C" {
                  llama_pos p1,
                        int d);
 
+    // Attach the longest prefix of the tokens that is already present in the memory for another sequence to the
+    //   empty sequence seq_id, without recomputing it. The cells are shared by reference and are copied on write -
+    //   i.e. when their positions are later modified via llama_memory_seq_add() or llama_memory_seq_div()
+    // Requires a paged KV cache (see llama_context_params.kv_block_size) - the prefix is matched per block, using a
+    //   rolling hash of the token ids
+    // Returns the number of attached tokens - a multiple of the block size. Decoding should continue from this position
+    LLAMA_API int32_t llama_memory_seq_attach_prefix(
+            llama_memory_t mem,
+              llama_seq_id seq_id,
+       const llama_token * tokens,
+                   int32_t n_tokens);
+
     // Returns the smallest position present in the memory for the specified sequence
     // This is typically non-zero only for SWA caches
     // Note that all positions in the range [pos_min, pos_max] are guaranteed to be present in the memory
@@ -698,6 +712,17 @@ extern "C" {
     // Check if the memory supports shifting
     LLAMA_API bool llama_memory_can_shift(llama_memory_t mem);
 
+    // Block utilisation of a paged KV cache (see llama_context_params.kv_block_size)
+    // All fields are 0 if the memory does not use a paged layout
+    struct llama_memory_block_info {
+        uint32_t block_size;    // number of cells per block
+        uint32_t n_blocks;      // total number of blocks
+        uint32_t n_blocks_used; // number of blocks that contain at least one used cell
+        uint32_t n_cells_used;  // number of used cells - utilisation = n_cells_used / (n_blocks_used*block_size)
+    };
+
+    LLAMA_API struct llama_memory_block_info llama_memory_get_block_info(llama_memory_t mem);
+
     //
     // KV cache for self-attention (TODO: deprecate in favor of llama_memory)
     //
@@ -944,6 +969,9 @@ extern "C" {
     // Requires the context to have a memory.
     // For encode-decoder contexts, processes the batch using the decoder.
     // Positive return values does not mean a fatal error, but rather a warning.
+    // The computation of the last ubatch may still be in progress when the call returns - it is synchronized when
+    // the results are first accessed (see llama_synchronize()), so the caller can do other work in the meantime.
+    // This only happens when llama_decode_is_async() returns true.
     // Upon fatal-error or abort, the ubatches that managed to be been processed will remain in the memory state of the context
     //   To handle this correctly, query the memory state using llama_memory_seq_pos_min() and llama_memory_seq_pos_max()
     // Upon other return values, the memory state is restored to the state before this call
@@ -956,6 +984,10 @@ extern "C" {
             struct llama_context * ctx,
               struct llama_batch   batch);
 
+    // Returns true if llama_decode() can return before the outputs are computed
+    // This is the case when the output layer runs on a device that computes asynchronously - the CPU backend does not
+    LLAMA_API bool llama_decode_is_async(const struct llama_context * ctx);
+
     // Set the number of threads used for decoding
     // n_threads is the number of threads used for generation (single token)
     // n_threads_batch is the number of threads used for prompt and batch processing (multiple tokens)
@@ -1000,6 +1032,18 @@ extern "C" {
     // returns NULL for invalid ids.
     LLAMA_API float * llama_get_logits_ith(struct llama_context * ctx, int32_t i);
 
+    // Top-k logits for the ith token, when llama_context_params.logits_top_k > 0
+    // The top-k is computed on the backend and only the candidates are copied out - the full logits are not
+    //   available in this case and llama_get_logits() returns NULL
+    // The top-k is taken over blocks of 1024 logits, so the GPU backends can sort them - logits_top_k must be <= 512
+    // The logits are in descending order and the tokens are the corresponding token ids
+    // Returns the number of candidates, or 0 if logits_top_k is disabled or for invalid ids
+    LLAMA_API int32_t llama_get_logits_top_k_ith(
+            struct llama_context * ctx,
+                         int32_t   i,
+                          float ** logits,
+                    llama_token ** tokens);
+
     // Get all output token embeddings.
     // when pooling_type == LLAMA_POOLING_TYPE_NONE or when using a generative model,
     // the embeddings for which llama_batch.logits[i] != 0 are stored contiguously
@@ -1242,6 +1286,9 @@ extern "C" {
     // available samplers:
 
     LLAMA_API struct llama_sampler * llama_sampler_init_greedy(void);
+
+    /// @details Computes the probabilities and selects a token with a single uniform draw over the candidates in their current order.
+    /// NOTE: The candidates are no longer sorted by this sampler, cur_p->sorted is left unchanged. The token selected for a given seed differs from previous versions.
     LLAMA_API struct llama_sampler * llama_sampler_init_dist  (uint32_t seed);
 
     /// @details Sorts candidate tokens by their logits in descending order and calculate probabilities based on logits.
@@ -1254,6 +1301,7 @@ extern "C" {
     LLAMA_API struct llama_sampler * llama_sampler_init_top_k      (int32_t k);
 
     /// @details Nucleus sampling described in academic paper "The Curious Case of Neural Text Degeneration" https://arxiv.org/abs/1904.09751
+    /// NOTE: Unsorted candidates are filtered in their current order and are not sorted by this sampler.
     LLAMA_API struct llama_sampler * llama_sampler_init_top_p      (float   p, size_t min_keep);
 
     /// @details Minimum P sampling as described in https://github.com/ggml-org/llama.cpp/pull/3841
@@ -1329,6 +1377,12 @@ extern "C" {
                const llama_token * trigger_tokens,
                             size_t num_trigger_tokens);
 
+    /// @details Compute the tokens allowed by the grammar samplers in their current state, so that the next llama_sampler_apply() only looks them up.
+    /// Does not change the state of the sampler, so it can run on another thread while the next batch is evaluated (e.g. right after llama_sampler_accept()),
+    /// but not concurrently with llama_sampler_accept(), llama_sampler_reset() or llama_sampler_free() on the same sampler.
+    /// @param smpl A grammar sampler or a chain containing one - no-op for the other samplers.
+    LLAMA_API void llama_sampler_grammar_prepare(struct llama_sampler * smpl);
+
 
     /// NOTE: Avoid using on the full vocabulary as searching for repeated tokens can become slow. For example, apply top-k or top-p sampling first.
     LLAMA_API struct llama_sampler * llama_sampler_init_penalties(
@@ -1429,6 +1483,8 @@ extern "C" {
 
         int32_t n_p_eval;
         int32_t n_eval;
+        int32_t n_reused; // number of times a ggml compute graph had been reused
+        int32_t n_built;  // number of times a ggml compute graph had been built
     };
 
     struct llama_perf_sampler_data {
@@ -33,6 +33,10 @@ llama_context::llama_context(
         throw std::runtime_error("n_seq_max must be <= " + std::to_string(LLAMA_MAX_SEQ));
     }
 
+    if (params.logits_top_k > LLAMA_MAX_LOGITS_TOP_K) {
+        throw std::runtime_error("logits_top_k must be <= " + std::to_string(LLAMA_MAX_LOGITS_TOP_K));
+    }
+
     cparams.n_threads        = params.n_threads;
     cparams.n_threads_batch  = params.n_threads_batch;
     cparams.yarn_ext_factor  = params.yarn_ext_factor;
@@ -40,6 +44,7 @@ llama_context::llama_context(
     cparams.yarn_beta_fast   = params.yarn_beta_fast;
     cparams.yarn_beta_slow   = params.yarn_beta_slow;
     cparams.defrag_thold     = params.defrag_thold;
+    cparams.logits_top_k     = std::min<uint32_t>(params.logits_top_k, model.vocab.n_tokens());
     cparams.embeddings       = params.embeddings;
     cparams.offload_kqv      = params.offload_kqv;
     cparams.flash_attn       = params.flash_attn;
@@ -189,9 +194,10 @@ llama_context::llama_context(
     // init the memory module
     if (!hparams.vocab_only) {
         llama_memory_params params_mem = {
-            /*.type_k   =*/ params.type_k,
-            /*.type_v   =*/ params.type_v,
-            /*.swa_full =*/ params.swa_full,
+            /*.type_k        =*/ params.type_k,
+            /*.type_v        =*/ params.type_v,
+            /*.swa_full      =*/ params.swa_full,
+            /*.kv_block_size =*/ params.kv_block_size,
         };
 
         memory.reset(model.create_memory(params_mem, cparams));
@@ -263,8 +269,25 @@ llama_context::llama_context(
         if (pipeline_parallel) {
             LLAMA_LOG_INFO("%s: pipeline parallelism enabled (n_copies=%d)\n", __func__, ggml_backend_sched_get_n_copies(sched.get()));
         }
+
+        // env: LLAMA_GRAPH_REUSE_DISABLE
+        {
+            const char * LLAMA_GRAPH_REUSE_DISABLE = getenv("LLAMA_GRAPH_REUSE_DISABLE");
+            graph_reuse_disable = LLAMA_GRAPH_REUSE_DISABLE ? (atoi(LLAMA_GRAPH_REUSE_DISABLE) != 0) : graph_reuse_disable;
+
+            if (graph_reuse_disable) {
+                LLAMA_LOG_WARN("%s: graph reuse disabled\n", __func__);
+            }
+        }
+
+        // with pipeline parallelism, the split inputs of the graph are bound to the current copy of the scheduler
+        if (pipeline_parallel) {
+            graph_reuse_disable = true;
+        }
     }
 
+    graph_cb = graph_get_cb();
+
     // reserve worst-case graph
     if (!hparams.vocab_only && memory) {
         const uint32_t n_seqs = cparams.n_seq_max;
@@ -533,6 +556,53 @@ float * llama_context::get_logits_ith(int32_t i) {
     }
 }
 
+int32_t llama_context::get_logits_top_k_ith(int32_t i, float ** logits_out, llama_token ** tokens_out) {
+    if (cparams.logits_top_k == 0) {
+        return 0;
+    }
+
+    int64_t j = -1;
+
+    try {
+        if (logits_top_k == nullptr) {
+            throw std::runtime_error("no logits");
+        }
+
+        if (i < 0) {
+            j = n_outputs + i;
+            if (j < 0) {
+                throw std::runtime_error(format("negative index out of range [0, %d)", n_outputs));
+            }
+        } else if ((size_t) i >= output_ids.size()) {
+            throw std::runtime_error(format("out of range [0, %zu)", output_ids.size()));
+        } else {
+            j = output_ids[i];
+        }
+
+        if (j < 0) {
+            throw std::runtime_error(format("batch.logits[%d] != true", i));
+        }
+        if (j >= n_outputs) {
+            // This should not happen
+            throw std::runtime_error(format("corrupt output buffer (j=%" PRId64 ", n_outputs=%d)", j, n_outputs));
+        }
+
+        const int32_t k = cparams.logits_top_k;
+
+        *logits_out = logits_top_k        + j*k;
+        *tokens_out = logits_top_k_tokens + j*k;
+
+        return k;
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: invalid logits id %d, reason: %s\n", __func__, i, err.what());
+#ifndef NDEBUG
+        GGML_ABORT("fatal error");
+#else
+        return 0;
+#endif
+    }
+}
+
 float * llama_context::get_embeddings() {
     return embd;
 }
@@ -646,6 +716,9 @@ void llama_context::set_adapter_lora(
     LLAMA_LOG_DEBUG("%s: adapter = %p, scale = %f\n", __func__, (void *) adapter, scale);
 
     loras[adapter] = scale;
+
+    // the adapters are baked into the graph
+    gf_res_prev.reset();
 }
 
 bool llama_context::rm_adapter_lora(
@@ -655,6 +728,9 @@ bool llama_context::rm_adapter_lora(
     auto pos = loras.find(adapter);
     if (pos != loras.end()) {
         loras.erase(pos);
+
+        gf_res_prev.reset();
+
         return true;
     }
 
@@ -665,6 +741,8 @@ void llama_context::clear_adapter_lora() {
     LLAMA_LOG_DEBUG("%s: call\n", __func__);
 
     loras.clear();
+
+    gf_res_prev.reset();
 }
 
 bool llama_context::apply_adapter_cvec(
@@ -675,41 +753,58 @@ bool llama_context::apply_adapter_cvec(
                 int32_t   il_end) {
     LLAMA_LOG_DEBUG("%s: il_start = %d, il_end = %d\n", __func__, il_start, il_end);
 
+    gf_res_prev.reset();
+
     return cvec.apply(model, data, len, n_embd, il_start, il_end);
 }
 
-llm_graph_result_ptr llama_context::process_ubatch(const llama_ubatch & ubatch, llm_graph_type gtype, llama_memory_context_i * mctx, ggml_status & ret) {
+llm_graph_result_i * llama_context::process_ubatch(const llama_ubatch & ubatch, llm_graph_type gtype, llama_memory_context_i * mctx, ggml_status & ret) {
     if (mctx && !mctx->apply()) {
         LLAMA_LOG_ERROR("%s: failed to apply memory context\n", __func__);
         ret = GGML_STATUS_FAILED;
         return nullptr;
     }
 
-    auto * gf = graph_init();
-    if (!gf) {
-        LLAMA_LOG_ERROR("%s: failed to initialize graph\n", __func__);
-        ret = GGML_STATUS_FAILED;
-        return nullptr;
-    }
+    // if the topology of the new graph would be the same as the previous one, skip the graph construction,
+    //   the scheduler splitting and the allocation - only the input tensors need to be updated
+    const bool can_reuse = !graph_reuse_disable && gf_res_prev && gf_res_prev->can_reuse(graph_params(ubatch, gtype, mctx));
 
-    auto res = graph_build(ctx_compute.get(), gf, ubatch, gtype, mctx);
-    if (!res) {
-        LLAMA_LOG_ERROR("%s: failed to build graph\n", __func__);
-        ret = GGML_STATUS_FAILED;
-        return nullptr;
-    }
+    if (can_reuse) {
+        n_reused++;
+    } else {
+        ggml_backend_sched_reset(sched.get());
 
-    // LLAMA_LOG_INFO("graph build time: %.3f ms (%d nodes, %d leafs)\n", (ggml_time_us() - t_start_us)/1000.0, gf->n_nodes, gf->n_leafs);
+        auto * gf = graph_init();
+        if (!gf) {
+            LLAMA_LOG_ERROR("%s: failed to initialize graph\n", __func__);
+            ret = GGML_STATUS_FAILED;
+            return nullptr;
+        }
 
-    if (!ggml_backend_sched_alloc_graph(sched.get(), gf)) {
-        LLAMA_LOG_ERROR("%s: failed to allocate graph\n", __func__);
-        ret = GGML_STATUS_ALLOC_FAILED;
-        return nullptr;
+        auto res = graph_build(ctx_compute.get(), gf, ubatch, gtype, mctx);
+        if (!res) {
+            LLAMA_LOG_ERROR("%s: failed to build graph\n", __func__);
+            ret = GGML_STATUS_FAILED;
+            return nullptr;
+        }
+
+        // LLAMA_LOG_INFO("graph build time: %.3f ms (%d nodes, %d leafs)\n", (ggml_time_us() - t_start_us)/1000.0, gf->n_nodes, gf->n_leafs);
+
+        if (!ggml_backend_sched_alloc_graph(sched.get(), gf)) {
+            LLAMA_LOG_ERROR("%s: failed to allocate graph\n", __func__);
+            ret = GGML_STATUS_ALLOC_FAILED;
+            return nullptr;
+        }
+
+        gf_res_prev = std::move(res);
+        gf_prev     = gf;
+
+        n_built++;
     }
 
-    res->set_inputs(&ubatch);
+    gf_res_prev->set_inputs(&ubatch);
 
-    const auto status = graph_compute(gf, ubatch.n_tokens > 1);
+    const auto status = graph_compute(gf_prev, ubatch.n_tokens > 1);
     if (status != GGML_STATUS_SUCCESS) {
         LLAMA_LOG_ERROR("%s: failed to compute graph, compute status: %d\n", __func__, status);
         ret = status;
@@ -718,7 +813,7 @@ llm_graph_result_ptr llama_context::process_ubatch(const llama_ubatch & ubatch,
 
     ret = GGML_STATUS_SUCCESS;
 
-    return res;
+    return gf_res_prev.get();
 }
 
 int llama_context::encode(const llama_batch & batch_inp) {
@@ -767,7 +862,6 @@ int llama_context::encode(const llama_batch & batch_inp) {
 
     n_outputs = n_tokens;
 
-    ggml_backend_sched_reset(sched.get());
     ggml_backend_sched_set_eval_callback(sched.get(), cparams.cb_eval, cparams.cb_eval_user_data);
 
     const auto causal_attn_org = cparams.causal_attn;
@@ -846,7 +940,10 @@ int llama_context::encode(const llama_batch & batch_inp) {
 
     // Reset state for the next token before backend sync, to allow the CPU activities in the reset to
     // overlap with device computation.
-    ggml_backend_sched_reset(sched.get());
+    // note: when graph reuse is enabled, the scheduler state has to be preserved for the next ubatch
+    if (graph_reuse_disable) {
+        ggml_backend_sched_reset(sched.get());
+    }
 
     // TODO: hacky solution
     if (model.arch == LLM_ARCH_T5 && t_embd) {
@@ -1005,7 +1102,6 @@ int llama_context::decode(const llama_batch & batch_inp) {
             n_outputs = n_outputs_new;
         }
 
-        ggml_backend_sched_reset(sched.get());
         ggml_backend_sched_set_eval_callback(sched.get(), cparams.cb_eval, cparams.cb_eval_user_data);
 
         ggml_status status;
@@ -1047,15 +1143,29 @@ int llama_context::decode(const llama_batch & batch_inp) {
         //    ggml_graph_dump_dot(gf, NULL, "llama.dot");
         //}
 
-        auto * t_logits = res->get_logits();
-        auto * t_embd   = cparams.embeddings ? res->get_embd() : nullptr;
+        auto * t_logits       = res->get_logits();
+        auto * t_logits_top_k = res->get_logits_top_k();
+        auto * t_embd         = cparams.embeddings ? res->get_embd() : nullptr;
 
         if (t_embd && res->get_embd_pooled()) {
             t_embd = res->get_embd_pooled();
         }
 
-        // extract logits
-        if (t_logits && n_outputs > 0) {
+        // extract the top-k logits, the full logits stay on the backend
+        if (t_logits_top_k && n_outputs > 0) {
+            auto * t_logits_top_k_ids = res->get_logits_top_k_ids();
+
+            ggml_backend_t backend_res = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits_top_k);
+            GGML_ASSERT(backend_res != nullptr);
+            GGML_ASSERT(logits_top_k != nullptr);
+
+            const int64_t k = cparams.logits_top_k;
+
+            GGML_ASSERT( n_outputs_prev + n_outputs <= n_outputs_all);
+            GGML_ASSERT((n_outputs_prev + n_outputs)*k <= (int64_t) logits_top_k_size);
+            ggml_backend_tensor_get_async(backend_res, t_logits_top_k,     logits_top_k        + n_outputs_prev*k, 0, n_outputs*k*sizeof(float));
+            ggml_backend_tensor_get_async(backend_res, t_logits_top_k_ids, logits_top_k_tokens + n_outputs_prev*k, 0, n_outputs*k*sizeof(llama_token));
+        } else if (t_logits && n_outputs > 0) {
             ggml_backend_t backend_res = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits);
             GGML_ASSERT(backend_res != nullptr);
             GGML_ASSERT(logits != nullptr);
@@ -1151,6 +1261,7 @@ int llama_context::decode(const llama_batch & batch_inp) {
         if (!sorted_output) {
             const uint32_t n_vocab = model.vocab.n_tokens();
             const uint64_t n_embd  = model.hparams.n_embd;
+            const uint32_t n_top_k = cparams.logits_top_k;
 
             GGML_ASSERT((size_t) n_outputs == out_ids.size());
 
@@ -1177,6 +1288,12 @@ int llama_context::decode(const llama_batch & batch_inp) {
                         std::swap(embd[i*n_embd + k], embd[j_min*n_embd + k]);
                     }
                 }
+                if (logits_top_k_size > 0) {
+                    for (uint32_t k = 0; k < n_top_k; k++) {
+                        std::swap(logits_top_k       [i*n_top_k + k], logits_top_k       [j_min*n_top_k + k]);
+                        std::swap(logits_top_k_tokens[i*n_top_k + k], logits_top_k_tokens[j_min*n_top_k + k]);
+                    }
+                }
             }
 
             std::fill(output_ids.begin(), output_ids.end(), -1);
@@ -1192,11 +1309,27 @@ int llama_context::decode(const llama_batch & batch_inp) {
 
     // Reset state for the next token before backend sync, to allow the CPU activities in the reset to
     // overlap with device computation.
-    ggml_backend_sched_reset(sched.get());
+    // note: when graph reuse is enabled, the scheduler state has to be preserved for the next ubatch
+    if (graph_reuse_disable) {
+        ggml_backend_sched_reset(sched.get());
+    }
 
     return 0;
 }
 
+bool llama_context::decode_async() const {
+    // the CPU backend computes the graph synchronously, so only an offloaded output layer can still be in flight
+    auto * dev = model.dev_output();
+    if (dev == nullptr || ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+        return false;
+    }
+
+    ggml_backend_dev_props props;
+    ggml_backend_dev_get_props(dev, &props);
+
+    return props.caps.async;
+}
+
 //
 // output
 //
@@ -1211,7 +1344,8 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
     const auto n_vocab = vocab.n_tokens();
     const auto n_embd  = hparams.n_embd;
 
-    bool has_logits = true;
+    // with the top-k of the logits computed on the backend, only the candidates are copied out
+    bool has_logits = cparams.logits_top_k == 0;
     bool has_embd   = cparams.embeddings;
 
     // TODO: hacky enc-dec support
@@ -1223,13 +1357,15 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
     logits_size = has_logits ? n_vocab*n_outputs_max : 0;
     embd_size   = has_embd   ?  n_embd*n_outputs_max : 0;
 
+    logits_top_k_size = cparams.logits_top_k*n_outputs_max;
+
     if (output_ids.empty()) {
         // init, never resized afterwards
         output_ids.resize(n_batch);
     }
 
     const size_t prev_size = buf_output ? ggml_backend_buffer_get_size(buf_output.get()) : 0;
-    const size_t new_size  = (logits_size + embd_size) * sizeof(float);
+    const size_t new_size  = (logits_size + embd_size + logits_top_k_size) * sizeof(float) + logits_top_k_size * sizeof(llama_token);
 
     // alloc only when more than the current capacity is required
     // TODO: also consider shrinking the buffer
@@ -1242,6 +1378,8 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
             buf_output = nullptr;
             logits = nullptr;
             embd = nullptr;
+            logits_top_k = nullptr;
+            logits_top_k_tokens = nullptr;
         }
 
         auto * buft = ggml_backend_cpu_buffer_type();
@@ -1263,6 +1401,9 @@ uint32_t llama_context::output_reserve(int32_t n_outputs) {
     logits = has_logits ? output_base               : nullptr;
     embd   = has_embd   ? output_base + logits_size : nullptr;
 
+    logits_top_k        = logits_top_k_size > 0 ? output_base + logits_size + embd_size : nullptr;
+    logits_top_k_tokens = logits_top_k_size > 0 ? (llama_token *) (logits_top_k + logits_top_k_size) : nullptr;
+
     // set all ids as invalid (negative)
     std::fill(output_ids.begin(), output_ids.end(), -1);
 
@@ -1280,6 +1421,10 @@ int32_t llama_context::graph_max_nodes() const {
 }
 
 ggml_cgraph * llama_context::graph_init() {
+    // the previous graph lives in ctx_compute, so it cannot be reused after this point
+    gf_res_prev.reset();
+    gf_prev = nullptr;
+
     ggml_init_params params = {
         /*.mem_size   =*/ buf_compute_meta.size(),
         /*.mem_buffer =*/ buf_compute_meta.data(),
@@ -1331,28 +1476,38 @@ ggml_cgraph * llama_context::graph_reserve(uint32_t n_tokens, uint32_t n_seqs, u
     return gf;
 }
 
+llm_graph_params llama_context::graph_params(
+                const llama_ubatch & ubatch,
+                    llm_graph_type   gtype,
+      const llama_memory_context_i * mctx) const {
+    return {
+        /*.ctx         =*/ ctx_compute.get(),
+        /*.arch        =*/ model.arch,
+        /*.gtype       =*/ gtype,
+        /*.hparams     =*/ model.hparams,
+        /*.cparams     =*/ cparams,
+        /*.ubatch      =*/ ubatch,
+        /*.sched       =*/ sched.get(),
+        /*.backend_cpu =*/ backend_cpu,
+        /*.cvec        =*/ &cvec,
+        /*.loras       =*/ &loras,
+        /*.mctx        =*/ mctx,
+        /*.cross       =*/ &cross,
+        /*.n_outputs   =*/ n_outputs,
+        /*.cb          =*/ graph_cb,
+    };
+}
+
 llm_graph_result_ptr llama_context::graph_build(
                       ggml_context * ctx,
                        ggml_cgraph * gf,
                 const llama_ubatch & ubatch,
                     llm_graph_type   gtype,
       const llama_memory_context_i * mctx) {
-    return model.build_graph(
-            {
-                /*.ctx         =*/ ctx,
-                /*.arch        =*/ model.arch,
-                /*.hparams     =*/ model.hparams,
-                /*.cparams     =*/ cparams,
-                /*.ubatch      =*/ ubatch,
-                /*.sched       =*/ sched.get(),
-                /*.backend_cpu =*/ backend_cpu,
-                /*.cvec        =*/ &cvec,
-                /*.loras       =*/ &loras,
-                /*.mctx        =*/ mctx,
-                /*.cross       =*/ &cross,
-                /*.n_outputs   =*/ n_outputs,
-                /*.cb          =*/ graph_get_cb(),
-            }, gf, gtype);
+    auto params = graph_params(ubatch, gtype, mctx);
+    params.ctx = ctx;
+
+    return model.build_graph(params, gf, gtype);
 }
 
 ggml_status llama_context::graph_compute(
@@ -1930,6 +2085,8 @@ llama_perf_context_data llama_context::perf_get_data() const {
     data.t_eval_ms   = 1e-3 * t_eval_us;
     data.n_p_eval    = std::max(1, n_p_eval);
     data.n_eval      = std::max(1, n_eval);
+    data.n_reused    = std::max(0, n_reused);
+    data.n_built     = std::max(0, n_built);
 
     return data;
 }
@@ -1938,6 +2095,7 @@ void llama_context::perf_reset() {
     t_start_us  = ggml_time_us();
     t_eval_us   = n_eval = 0;
     t_p_eval_us = n_p_eval = 0;
+    n_reused    = n_built  = 0;
 }
 
 //
@@ -2175,6 +2333,8 @@ llama_context_params llama_context_default_params() {
         /*.yarn_beta_slow              =*/ 1.0f,
         /*.yarn_orig_ctx               =*/ 0,
         /*.defrag_thold                =*/ -1.0f,
+        /*.kv_block_size               =*/ 0,
+        /*.logits_top_k                =*/ 0,
         /*.cb_eval                     =*/ nullptr,
         /*.cb_eval_user_data           =*/ nullptr,
         /*.type_k                      =*/ GGML_TYPE_F16,
@@ -2330,6 +2490,12 @@ float * llama_get_logits_ith(llama_context * ctx, int32_t i) {
     return ctx->get_logits_ith(i);
 }
 
+int32_t llama_get_logits_top_k_ith(llama_context * ctx, int32_t i, float ** logits, llama_token ** tokens) {
+    ctx->synchronize();
+
+    return ctx->get_logits_top_k_ith(i, logits, tokens);
+}
+
 float * llama_get_embeddings(llama_context * ctx) {
     ctx->synchronize();
 
@@ -2460,6 +2626,18 @@ void llama_memory_seq_div(
     mem->seq_div(seq_id, p0, p1, d);
 }
 
+int32_t llama_memory_seq_attach_prefix(
+        llama_memory_t mem,
+          llama_seq_id seq_id,
+   const llama_token * tokens,
+               int32_t n_tokens) {
+    if (!mem) {
+        return 0;
+    }
+
+    return mem->seq_attach_prefix(seq_id, tokens, n_tokens);
+}
+
 llama_pos llama_memory_seq_pos_min(
         llama_memory_t mem,
           llama_seq_id seq_id) {
@@ -2488,6 +2666,14 @@ bool llama_memory_can_shift(llama_memory_t mem) {
     return mem->get_can_shift();
 }
 
+llama_memory_block_info llama_memory_get_block_info(llama_memory_t mem) {
+    if (!mem) {
+        return {};
+    }
+
+    return mem->get_block_info();
+}
+
 //
 // kv cache
 //
@@ -2780,6 +2966,10 @@ int32_t llama_decode(
     return ret;
 }
 
+bool llama_decode_is_async(const llama_context * ctx) {
+    return ctx->decode_async();
+}
+
 //
 // perf
 //
@@ -2807,6 +2997,7 @@ void llama_perf_context_print(const llama_context * ctx) {
     LLAMA_LOG_INFO("%s:        eval time = %10.2f ms / %5d runs   (%8.2f ms per token, %8.2f tokens per second)\n",
             __func__, data.t_eval_ms, data.n_eval, data.t_eval_ms / data.n_eval, 1e3 / data.t_eval_ms * data.n_eval);
     LLAMA_LOG_INFO("%s:       total time = %10.2f ms / %5d tokens\n", __func__, (t_end_ms - data.t_start_ms), (data.n_p_eval + data.n_eval));
+    LLAMA_LOG_INFO("%s:    graphs reused = %10d / %5d built\n", __func__, data.n_reused, data.n_built);
 }
 
 void llama_perf_context_reset(llama_context * ctx) {
@@ -58,6 +58,8 @@ struct llama_context {
     float * get_logits();
     float * get_logits_ith(int32_t i);
 
+    int32_t get_logits_top_k_ith(int32_t i, float ** logits_out, llama_token ** tokens_out);
+
     float * get_embeddings();
     float * get_embeddings_ith(int32_t i);
     float * get_embeddings_seq(llama_seq_id seq_id);
@@ -96,7 +98,8 @@ struct llama_context {
     // if memory_context is provided, it will be applied first to the context's memory
     // ret contains the status of the graph computation
     // returns nullptr only if ret != GGML_STATUS_SUCCESS
-    llm_graph_result_ptr process_ubatch(
+    // the returned result is owned by the context and remains valid until the next graph is built
+    llm_graph_result_i * process_ubatch(
                 const llama_ubatch & ubatch,
                     llm_graph_type   gtype,
             llama_memory_context_i * mctx,
@@ -105,6 +108,8 @@ struct llama_context {
     int encode(const llama_batch & batch_inp);
     int decode(const llama_batch & batch_inp);
 
+    bool decode_async() const;
+
     //
     // state save/load
     //
@@ -200,6 +205,11 @@ public:
     ggml_cgraph * graph_reserve(uint32_t n_tokens, uint32_t n_seqs, uint32_t n_outputs, const llama_memory_context_i * mctx);
 
 private:
+    llm_graph_params graph_params(
+                const llama_ubatch & ubatch,
+                    llm_graph_type   gtype,
+      const llama_memory_context_i * mctx) const;
+
     llm_graph_result_ptr graph_build(
                       ggml_context * ctx,
                        ggml_cgraph * gf,
@@ -237,6 +247,11 @@ private:
     size_t  logits_size = 0; // capacity (of floats) for logits
     float * logits      = nullptr;
 
+    // top-k logits output (2-dimensional arrays: [n_outputs][logits_top_k]), when cparams.logits_top_k > 0
+    size_t        logits_top_k_size   = 0; // capacity (of elements) for the top-k logits and tokens
+    float       * logits_top_k        = nullptr;
+    llama_token * logits_top_k_tokens = nullptr;
+
     // embeddings output (2-dimensional array: [n_outputs][n_embd])
     // populated only when pooling_type == LLAMA_POOLING_TYPE_NONE
     size_t  embd_size = 0; // capacity (of floats) for embeddings
@@ -260,6 +275,15 @@ private:
 
     ggml_context_ptr ctx_compute;
 
+    llm_graph_cb graph_cb;
+
+    // the result of the last graph that was built and allocated - reused when the topology of the next graph is the same
+    llm_graph_result_ptr gf_res_prev;
+    ggml_cgraph *        gf_prev = nullptr;
+
+    // env: LLAMA_GRAPH_REUSE_DISABLE
+    bool graph_reuse_disable = false;
+
     // training
     ggml_opt_context_t opt_ctx = nullptr;
 
@@ -294,4 +318,7 @@ private:
 
     mutable int32_t n_p_eval = 0; // number of tokens in eval calls for the prompt (with batch size > 1)
     mutable int32_t n_eval   = 0; // number of eval calls
+
+    mutable int32_t n_reused = 0; // number of times the previous graph was reused
+    mutable int32_t n_built  = 0; // number of times a new graph was built
 };
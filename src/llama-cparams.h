@@ -6,6 +6,11 @@
 
 #define LLAMA_MAX_SEQ 64
 
+// the top-k of the logits is taken over blocks of LLAMA_LOGITS_TOP_K_BLOCK logits, so that the GPU argsort kernels,
+// which sort a row within one thread block, can run it - a block keeps at most half of its candidates
+#define LLAMA_LOGITS_TOP_K_BLOCK 1024
+#define LLAMA_MAX_LOGITS_TOP_K   (LLAMA_LOGITS_TOP_K_BLOCK/2)
+
 struct llama_cparams {
     uint32_t n_ctx;           // context size used during inference
     uint32_t n_batch;
@@ -26,6 +31,8 @@ struct llama_cparams {
     float yarn_beta_slow;
     float defrag_thold;
 
+    uint32_t logits_top_k; // compute the top-k of the logits in the graph, 0 = disabled
+
     bool embeddings;
     bool causal_attn;
     bool offload_kqv;
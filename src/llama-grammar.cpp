@@ -6,7 +6,9 @@
 
 #include <cmath>
 #include <algorithm>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_map>
 
 //
 // helpers
@@ -683,6 +685,19 @@ static bool llama_grammar_match_partial_char(
     return !is_positive_char;
 }
 
+// returns true iff the stack is already in stacks
+// the stacks usually share their bottom elements, so they are compared from the top
+static bool llama_grammar_stacks_contain(
+        const llama_grammar_stacks & stacks,
+        const llama_grammar_stack  & stack) {
+    for (const auto & s : stacks) {
+        if (s.size() == stack.size() && std::equal(s.rbegin(), s.rend(), stack.rbegin())) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // transforms a grammar pushdown stack into N possible stacks, all ending
 // at a character range (terminal element)
 static void llama_grammar_advance_stack(
@@ -690,7 +705,7 @@ static void llama_grammar_advance_stack(
         const llama_grammar_stack  & stack,
               llama_grammar_stacks & new_stacks) {
     if (stack.empty()) {
-        if (std::find(new_stacks.begin(), new_stacks.end(), stack) == new_stacks.end()) {
+        if (!llama_grammar_stacks_contain(new_stacks, stack)) {
             new_stacks.emplace_back(stack);
         }
         return;
@@ -730,7 +745,7 @@ static void llama_grammar_advance_stack(
         case LLAMA_GRETYPE_CHAR:
         case LLAMA_GRETYPE_CHAR_NOT:
         case LLAMA_GRETYPE_CHAR_ANY:
-            if (std::find(new_stacks.begin(), new_stacks.end(), stack) == new_stacks.end()) {
+            if (!llama_grammar_stacks_contain(new_stacks, stack)) {
                 // only add the stack if it's not a duplicate of one we already have
                 new_stacks.emplace_back(stack);
             }
@@ -903,6 +918,227 @@ llama_grammar_candidates llama_grammar_reject_candidates_for_stack(
     return rejects;
 }
 
+//
+// token masks
+//
+
+// the code points of the tokens of the vocab in a trie
+// the tokens that share a prefix are matched against the grammar only once for that prefix
+struct llama_grammar_trie {
+    struct node {
+        uint32_t first_child = 0; // the children of a node are contiguous
+        uint32_t n_children  = 0;
+        uint32_t first_token = 0; // tokens that end at this node
+        uint32_t n_tokens    = 0;
+    };
+
+    std::vector<node>     nodes;
+    std::vector<uint32_t> code_points; // code point of the edge to each node
+
+    std::vector<std::pair<llama_token, llama_partial_utf8>> tokens;
+
+    std::vector<llama_token> eog; // allowed when one of the stacks is empty
+};
+
+// max number of cached masks per grammar
+static constexpr size_t LLAMA_GRAMMAR_MASKS_MAX = 256;
+
+struct llama_grammar_state_hash {
+    size_t operator()(const std::vector<uint64_t> & key) const {
+        uint64_t h = 14695981039346656037ULL;
+        for (const uint64_t v : key) {
+            h = (h ^ v) * 1099511628211ULL;
+        }
+        return h;
+    }
+};
+
+struct llama_grammar_masks {
+    std::mutex mutex;
+
+    llama_grammar_trie trie;
+
+    bool trie_built = false;
+
+    // state key -> bitset of the allowed tokens
+    std::unordered_map<std::vector<uint64_t>, std::vector<uint64_t>, llama_grammar_state_hash> cache;
+};
+
+static void llama_grammar_trie_build(llama_grammar_trie & trie, const llama_vocab & vocab) {
+    const uint32_t n_vocab = vocab.n_tokens();
+
+    std::vector<std::vector<uint32_t>> code_points(n_vocab);
+    std::vector<llama_partial_utf8>    partials(n_vocab);
+    std::vector<llama_token>           ids;
+
+    for (uint32_t id = 0; id < n_vocab; ++id) {
+        const std::string & piece = vocab.token_to_piece(id);
+
+        if (vocab.is_eog(id)) {
+            trie.eog.push_back(id);
+            continue;
+        }
+
+        // never allowed by a grammar
+        if (piece.empty() || piece[0] == 0) {
+            continue;
+        }
+
+        auto decoded = decode_utf8(piece, {});
+        decoded.first.pop_back(); // terminating 0
+
+        code_points[id] = std::move(decoded.first);
+        partials[id]    = decoded.second;
+
+        ids.push_back(id);
+    }
+
+    std::sort(ids.begin(), ids.end(), [&](llama_token a, llama_token b) {
+        return code_points[a] < code_points[b];
+    });
+
+    struct range {
+        uint32_t node;
+        uint32_t i0;
+        uint32_t i1;
+        uint32_t depth;
+    };
+
+    trie.nodes.assign(1, {});
+    trie.code_points.assign(1, 0);
+    trie.tokens.clear();
+    trie.tokens.reserve(ids.size());
+
+    // breadth first, so that the children of each node are contiguous
+    std::vector<range> queue = { { 0, 0, (uint32_t) ids.size(), 0 } };
+
+    for (size_t iq = 0; iq < queue.size(); ++iq) {
+        const range r = queue[iq];
+
+        uint32_t i = r.i0;
+
+        // the tokens that end here sort before the ones that continue
+        trie.nodes[r.node].first_token = trie.tokens.size();
+        for (; i < r.i1 && code_points[ids[i]].size() == r.depth; ++i) {
+            trie.tokens.emplace_back(ids[i], partials[ids[i]]);
+        }
+        trie.nodes[r.node].n_tokens = trie.tokens.size() - trie.nodes[r.node].first_token;
+
+        trie.nodes[r.node].first_child = trie.nodes.size();
+        while (i < r.i1) {
+            const uint32_t cp = code_points[ids[i]][r.depth];
+
+            uint32_t j = i + 1;
+            while (j < r.i1 && code_points[ids[j]][r.depth] == cp) {
+                ++j;
+            }
+
+            queue.push_back({ (uint32_t) trie.nodes.size(), i, j, r.depth + 1 });
+
+            trie.nodes.emplace_back();
+            trie.code_points.push_back(cp);
+
+            i = j;
+        }
+        trie.nodes[r.node].n_children = trie.nodes.size() - trie.nodes[r.node].first_child;
+    }
+}
+
+// set the bits of the tokens in the subtries of nodes that can be accepted from the given stack
+// same as llama_grammar_reject_candidates_for_stack, with trie nodes instead of tokens as the candidates
+static void llama_grammar_trie_accept(
+        const llama_grammar_rules   & rules,
+        const llama_grammar_trie    & trie,
+        const llama_grammar_stack   & stack,
+        const std::vector<uint32_t> & nodes,
+              std::vector<uint64_t> & mask) {
+    const auto accept_token = [&](llama_token id) {
+        mask[id >> 6] |= 1ULL << (id & 63);
+    };
+
+    if (stack.empty()) {
+        for (const uint32_t in : nodes) {
+            const auto & node = trie.nodes[in];
+            for (uint32_t it = node.first_token; it < node.first_token + node.n_tokens; ++it) {
+                if (trie.tokens[it].second.n_remain == 0) {
+                    accept_token(trie.tokens[it].first);
+                }
+            }
+        }
+        return;
+    }
+
+    const llama_grammar_element * stack_pos = stack.back();
+
+    std::vector<uint32_t> next_nodes;
+
+    for (const uint32_t in : nodes) {
+        const auto & node = trie.nodes[in];
+
+        // end of the full code points of the token, accept unless it ended in a partial sequence
+        // that cannot satisfy this position in grammar
+        for (uint32_t it = node.first_token; it < node.first_token + node.n_tokens; ++it) {
+            const auto & partial_utf8 = trie.tokens[it].second;
+            if (partial_utf8.n_remain == 0 || llama_grammar_match_partial_char(stack_pos, partial_utf8)) {
+                accept_token(trie.tokens[it].first);
+            }
+        }
+
+        for (uint32_t ic = node.first_child; ic < node.first_child + node.n_children; ++ic) {
+            if (llama_grammar_match_char(stack_pos, trie.code_points[ic]).first) {
+                next_nodes.push_back(ic);
+            }
+        }
+    }
+
+    if (next_nodes.empty()) {
+        return;
+    }
+
+    const auto * stack_pos_after = llama_grammar_match_char(stack_pos, 0).second;
+
+    // update top of stack to next element, if any
+    llama_grammar_stack stack_after(stack.begin(), stack.end() - 1);
+    if (!llama_grammar_is_end_of_sequence(stack_pos_after)) {
+        stack_after.push_back(stack_pos_after);
+    }
+    llama_grammar_stacks next_stacks;
+    llama_grammar_advance_stack(rules, stack_after, next_stacks);
+
+    for (const auto & next_stack : next_stacks) {
+        llama_grammar_trie_accept(rules, trie, next_stack, next_nodes, mask);
+    }
+}
+
+// the parser state - the stacks and the partial UTF-8 sequence - with the elements as offsets in the rules
+// so that it is the same for the clones of the grammar
+static std::vector<uint64_t> llama_grammar_state_key(const llama_grammar & grammar) {
+    std::vector<uint64_t> key;
+
+    // without remaining bytes, the decoding of the next token does not depend on the partial sequence
+    if (grammar.partial_utf8.n_remain > 0) {
+        key.push_back(((uint64_t) grammar.partial_utf8.value << 32) | (uint32_t) grammar.partial_utf8.n_remain);
+    } else {
+        key.push_back(0);
+    }
+
+    for (const auto & stack : grammar.stacks) {
+        key.push_back(stack.size());
+
+        for (const llama_grammar_element * pos : stack) {
+            for (size_t ir = 0; ir < grammar.rules.size(); ++ir) {
+                const auto & rule = grammar.rules[ir];
+                if (pos >= rule.data() && pos < rule.data() + rule.size()) {
+                    key.push_back(((uint64_t) ir << 32) | (uint64_t) (pos - rule.data()));
+                    break;
+                }
+            }
+        }
+    }
+
+    return key;
+}
+
 ////////////////////
 
 struct llama_grammar * llama_grammar_init_impl(
@@ -970,6 +1206,7 @@ struct llama_grammar * llama_grammar_init_impl(
         /* .trigger_buffer = */   "",
         /* .trigger_tokens   = */ {},
         /* .trigger_patterns    = */ {},
+        /* .masks = */            vocab ? std::make_shared<llama_grammar_masks>() : nullptr,
     };
 }
 
@@ -1075,6 +1312,7 @@ struct llama_grammar * llama_grammar_init_impl(
         /* .trigger_buffer = */   "",
         std::move(vec_trigger_tokens),
         std::move(vec_trigger_patterns),
+        /* .masks = */            vocab ? std::make_shared<llama_grammar_masks>() : nullptr,
     };
 }
 
@@ -1097,6 +1335,7 @@ struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & gra
         grammar.trigger_buffer,
         grammar.trigger_tokens,
         grammar.trigger_patterns,
+        grammar.masks,
     };
 
     // redirect elements in stacks to point to new rules
@@ -1115,21 +1354,12 @@ struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & gra
     return result;
 }
 
-void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_data_array * cur_p) {
-    GGML_ASSERT(grammar.vocab != nullptr);
-
-    if (grammar.awaiting_trigger) {
-        return;
-    }
-
-    bool allow_eog = false;
-    for (const auto & stack : grammar.stacks) {
-        if (stack.empty()) {
-            allow_eog = true;
-            break;
-        }
-    }
+void llama_grammar_share_masks(struct llama_grammar & dst, const struct llama_grammar & src) {
+    dst.masks = src.masks;
+}
 
+// reject the candidates that cannot be accepted in the current state of the grammar, token by token
+static void llama_grammar_apply_candidates(const struct llama_grammar & grammar, llama_token_data_array * cur_p, bool allow_eog) {
     std::vector<std::pair<std::vector<uint32_t>, llama_partial_utf8>> candidates_decoded;
     candidates_decoded.reserve(cur_p->size);
 
@@ -1158,6 +1388,128 @@ void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_
     }
 }
 
+// bitset of the tokens of the vocab that can be accepted in the current state of the grammar
+static std::vector<uint64_t> llama_grammar_compute_mask(const struct llama_grammar & grammar, const llama_grammar_trie & trie, bool allow_eog) {
+    const uint32_t n_vocab = grammar.vocab->n_tokens();
+
+    std::vector<uint64_t> mask((n_vocab + 63)/64, 0);
+
+    if (grammar.partial_utf8.n_remain > 0) {
+        // the tokens continue a partial UTF-8 sequence, so they cannot be matched with the trie
+        std::vector<llama_token_data> cur(n_vocab);
+        for (uint32_t id = 0; id < n_vocab; ++id) {
+            cur[id] = { (llama_token) id, 0.0f, 0.0f };
+        }
+
+        llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+        llama_grammar_apply_candidates(grammar, &cur_p, allow_eog);
+
+        for (uint32_t id = 0; id < n_vocab; ++id) {
+            if (cur[id].logit == 0.0f) {
+                mask[id >> 6] |= 1ULL << (id & 63);
+            }
+        }
+
+        return mask;
+    }
+
+    const std::vector<uint32_t> root = { 0 };
+
+    for (const auto & stack : grammar.stacks) {
+        llama_grammar_trie_accept(grammar.rules, trie, stack, root, mask);
+    }
+
+    if (allow_eog) {
+        for (const llama_token id : trie.eog) {
+            mask[id >> 6] |= 1ULL << (id & 63);
+        }
+    }
+
+    return mask;
+}
+
+static bool llama_grammar_allow_eog(const struct llama_grammar & grammar) {
+    for (const auto & stack : grammar.stacks) {
+        if (stack.empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// the cached mask of the parser state, computed first if compute is true
+// the mutex of the masks must be held by the caller
+static const std::vector<uint64_t> * llama_grammar_get_mask(const struct llama_grammar & grammar, const std::vector<uint64_t> & key, bool compute) {
+    auto & masks = *grammar.masks;
+
+    auto it = masks.cache.find(key);
+    if (it == masks.cache.end()) {
+        if (!compute) {
+            return nullptr;
+        }
+
+        if (!masks.trie_built) {
+            llama_grammar_trie_build(masks.trie, *grammar.vocab);
+            masks.trie_built = true;
+        }
+
+        if (masks.cache.size() >= LLAMA_GRAMMAR_MASKS_MAX) {
+            masks.cache.clear();
+        }
+
+        it = masks.cache.emplace(key, llama_grammar_compute_mask(grammar, masks.trie, llama_grammar_allow_eog(grammar))).first;
+    }
+
+    return &it->second;
+}
+
+void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_data_array * cur_p) {
+    GGML_ASSERT(grammar.vocab != nullptr);
+
+    if (grammar.awaiting_trigger) {
+        return;
+    }
+
+    // the allowed tokens of the whole vocab are computed once per parser state and cached
+    // this pays off when there are many candidates - few candidates are matched directly, unless the state is cached
+    if (grammar.masks) {
+        const auto key = llama_grammar_state_key(grammar);
+
+        std::lock_guard<std::mutex> lock(grammar.masks->mutex);
+
+        const auto * mask = llama_grammar_get_mask(grammar, key, 4*cur_p->size >= grammar.vocab->n_tokens());
+        if (mask) {
+            for (size_t i = 0; i < cur_p->size; ++i) {
+                const llama_token id = cur_p->data[i].id;
+                if (!(((*mask)[id >> 6] >> (id & 63)) & 1)) {
+                    cur_p->data[i].logit = -INFINITY;
+                }
+            }
+
+            return;
+        }
+    }
+
+    llama_grammar_apply_candidates(grammar, cur_p, llama_grammar_allow_eog(grammar));
+}
+
+void llama_grammar_prepare_impl(const struct llama_grammar & grammar) {
+    GGML_ASSERT(grammar.vocab != nullptr);
+
+    // a lazy grammar does not constrain the tokens until it is triggered
+    if (grammar.awaiting_trigger || !grammar.masks) {
+        return;
+    }
+
+    const auto key = llama_grammar_state_key(grammar);
+
+    // computed under the lock, so that a concurrent apply waits for the mask instead of matching the candidates itself
+    std::lock_guard<std::mutex> lock(grammar.masks->mutex);
+
+    llama_grammar_get_mask(grammar, key, true);
+}
+
 void llama_grammar_accept_impl(struct llama_grammar & grammar, llama_token token) {
     GGML_ASSERT(grammar.vocab != nullptr);
 
@@ -3,6 +3,7 @@
 #include "llama.h"
 
 #include <map>
+#include <memory>
 #include <regex>
 #include <string>
 #include <vector>
@@ -106,6 +107,9 @@ struct llama_grammar_parser {
     void print(FILE * file);
 };
 
+// allowed tokens per parser state, see llama_grammar_apply_impl
+struct llama_grammar_masks;
+
 struct llama_grammar_trigger_pattern {
     std::string pattern;
     std::regex  regex;
@@ -132,6 +136,8 @@ struct llama_grammar {
                              trigger_patterns;         // Regular expressions that trigger a lazy grammar. Must be a full match of the entire generated
                                                        // string, and the grammar will be given the string from the first match group onwards.
 
+    // cache of the allowed tokens per parser state, shared with the clones of the grammar (null without a vocab)
+    std::shared_ptr<llama_grammar_masks> masks;
 };
 
 //
@@ -159,11 +165,18 @@ void llama_grammar_free_impl(struct llama_grammar * grammar);
 
 struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & grammar);
 
+// share the cached token masks of a grammar with another instance of the same grammar (e.g. after a reset)
+void llama_grammar_share_masks(struct llama_grammar & dst, const struct llama_grammar & src);
+
 // TODO: move the API below as member functions of llama_grammar
 void llama_grammar_apply_impl(
         const struct llama_grammar & grammar,
             llama_token_data_array * cur_p);
 
+// compute and cache the allowed tokens of the current parser state, without modifying the state
+void llama_grammar_prepare_impl(
+        const struct llama_grammar & grammar);
+
 void llama_grammar_accept_impl(
               struct llama_grammar & grammar,
                        llama_token   token);
@@ -13,6 +13,12 @@
 #include <cmath>
 #include <cstring>
 
+bool llm_graph_input_i::can_reuse(const llm_graph_params & params) {
+    GGML_UNUSED(params);
+
+    return false;
+}
+
 void llm_graph_input_embd::set_input(const llama_ubatch * ubatch) {
     if (ubatch->token) {
         const int64_t n_tokens = ubatch->n_tokens;
@@ -28,6 +34,15 @@ void llm_graph_input_embd::set_input(const llama_ubatch * ubatch) {
     }
 }
 
+bool llm_graph_input_embd::can_reuse(const llm_graph_params & params) {
+    bool res = true;
+
+    res &= (!tokens && !params.ubatch.token) || (tokens && tokens->ne[0] == params.ubatch.n_tokens);
+    res &= (!embd   && !params.ubatch.embd)  || (embd   &&   embd->ne[1] == params.ubatch.n_tokens);
+
+    return res;
+}
+
 void llm_graph_input_pos::set_input(const llama_ubatch * ubatch) {
     if (ubatch->pos && pos) {
         const int64_t n_tokens = ubatch->n_tokens;
@@ -50,6 +65,14 @@ void llm_graph_input_pos::set_input(const llama_ubatch * ubatch) {
     }
 }
 
+bool llm_graph_input_pos::can_reuse(const llm_graph_params & params) {
+    bool res = true;
+
+    res &= pos->ne[0] == params.ubatch.n_tokens*n_pos_per_embd;
+
+    return res;
+}
+
 void llm_graph_input_attn_temp::set_input(const llama_ubatch * ubatch) {
     if (ubatch->pos && attn_scale) {
         const int64_t n_tokens = ubatch->n_tokens;
@@ -66,6 +89,14 @@ void llm_graph_input_attn_temp::set_input(const llama_ubatch * ubatch) {
     }
 }
 
+bool llm_graph_input_attn_temp::can_reuse(const llm_graph_params & params) {
+    bool res = true;
+
+    res &= attn_scale->ne[0] == params.ubatch.n_tokens;
+
+    return res;
+}
+
 void llm_graph_input_pos_bucket::set_input(const llama_ubatch * ubatch) {
     if (pos_bucket) {
         const int64_t n_tokens = ubatch->n_tokens;
@@ -118,6 +149,14 @@ void llm_graph_input_out_ids::set_input(const llama_ubatch * ubatch) {
     }
 }
 
+bool llm_graph_input_out_ids::can_reuse(const llm_graph_params & params) {
+    bool res = true;
+
+    res &= n_outputs == (int32_t) params.n_outputs;
+
+    return res;
+}
+
 void llm_graph_input_mean::set_input(const llama_ubatch * ubatch) {
     if (cparams.embeddings && cparams.pooling_type == LLAMA_POOLING_TYPE_MEAN) {
         const int64_t n_tokens     = ubatch->n_tokens;
@@ -287,6 +326,28 @@ void llm_graph_input_attn_kv_unified::set_input(const llama_ubatch * ubatch) {
     mctx->set_input_kq_mask(self_kq_mask, ubatch, cparams.causal_attn);
 }
 
+bool llm_graph_input_attn_kv_unified::can_reuse(const llm_graph_params & params) {
+    const auto * mctx = static_cast<const llama_kv_cache_unified_context *>(params.mctx);
+    if (!mctx) {
+        return false;
+    }
+
+    this->mctx = mctx;
+
+    bool res = true;
+
+    // without ggml_set_rows the K/V store views depend on the location of the slot in the cache
+    res &= mctx->get_supports_set_rows();
+
+    res &= self_k_idxs->ne[0] == params.ubatch.n_tokens;
+    res &= self_v_idxs->ne[0] == params.ubatch.n_tokens;
+
+    res &= self_kq_mask->ne[0] == mctx->get_n_kv();
+    res &= self_kq_mask->ne[1] == GGML_PAD(params.ubatch.n_tokens, GGML_KQ_MASK_PAD);
+
+    return res;
+}
+
 void llm_graph_input_attn_kv_unified_iswa::set_input(const llama_ubatch * ubatch) {
     mctx->get_base()->set_input_k_idxs(self_k_idxs, ubatch);
     mctx->get_base()->set_input_v_idxs(self_v_idxs, ubatch);
@@ -299,6 +360,34 @@ void llm_graph_input_attn_kv_unified_iswa::set_input(const llama_ubatch * ubatch
     mctx->get_swa()->set_input_kq_mask(self_kq_mask_swa, ubatch, cparams.causal_attn);
 }
 
+bool llm_graph_input_attn_kv_unified_iswa::can_reuse(const llm_graph_params & params) {
+    const auto * mctx = static_cast<const llama_kv_cache_unified_iswa_context *>(params.mctx);
+    if (!mctx) {
+        return false;
+    }
+
+    this->mctx = mctx;
+
+    bool res = true;
+
+    res &= mctx->get_base()->get_supports_set_rows();
+    res &= mctx->get_swa()->get_supports_set_rows();
+
+    res &= self_k_idxs->ne[0] == params.ubatch.n_tokens;
+    res &= self_v_idxs->ne[0] == params.ubatch.n_tokens;
+
+    res &= self_k_idxs_swa->ne[0] == params.ubatch.n_tokens;
+    res &= self_v_idxs_swa->ne[0] == params.ubatch.n_tokens;
+
+    res &= self_kq_mask->ne[0] == mctx->get_base()->get_n_kv();
+    res &= self_kq_mask->ne[1] == GGML_PAD(params.ubatch.n_tokens, GGML_KQ_MASK_PAD);
+
+    res &= self_kq_mask_swa->ne[0] == mctx->get_swa()->get_n_kv();
+    res &= self_kq_mask_swa->ne[1] == GGML_PAD(params.ubatch.n_tokens, GGML_KQ_MASK_PAD);
+
+    return res;
+}
+
 void llm_graph_input_attn_cross::set_input(const llama_ubatch * ubatch) {
     GGML_ASSERT(cross_kq_mask);
 
@@ -361,6 +450,63 @@ void llm_graph_input_one::set_input(const llama_ubatch * ubatch) {
     ggml_backend_tensor_set(one, &f_one, 0, sizeof(float));
 }
 
+bool llm_graph_input_one::can_reuse(const llm_graph_params & params) {
+    GGML_UNUSED(params);
+
+    return true;
+}
+
+//
+// llm_graph_result
+//
+
+void llm_graph_result::set_params(const llm_graph_params & params) {
+    params_prev.gtype        = params.gtype;
+    params_prev.equal_seqs   = params.ubatch.equal_seqs;
+    params_prev.has_token    = params.ubatch.token != nullptr;
+    params_prev.has_embd     = params.ubatch.embd  != nullptr;
+    params_prev.n_tokens     = params.ubatch.n_tokens;
+    params_prev.n_seq_tokens = params.ubatch.n_seq_tokens;
+    params_prev.n_seqs       = params.ubatch.n_seqs;
+    params_prev.n_seqs_unq   = params.ubatch.n_seqs_unq;
+    params_prev.n_outputs    = params.n_outputs;
+    params_prev.causal_attn  = params.cparams.causal_attn;
+    params_prev.embeddings   = params.cparams.embeddings;
+    params_prev.warmup       = params.cparams.warmup;
+    params_prev.cvec         = params.cvec;
+    params_prev.loras        = params.loras;
+}
+
+bool llm_graph_result::can_reuse(const llm_graph_params & params) {
+    bool res = true;
+
+    res &= params_prev.gtype        == params.gtype;
+    res &= params_prev.equal_seqs   == params.ubatch.equal_seqs;
+    res &= params_prev.has_token    == (params.ubatch.token != nullptr);
+    res &= params_prev.has_embd     == (params.ubatch.embd  != nullptr);
+    res &= params_prev.n_tokens     == params.ubatch.n_tokens;
+    res &= params_prev.n_seq_tokens == params.ubatch.n_seq_tokens;
+    res &= params_prev.n_seqs       == params.ubatch.n_seqs;
+    res &= params_prev.n_seqs_unq   == params.ubatch.n_seqs_unq;
+    res &= params_prev.n_outputs    == params.n_outputs;
+    res &= params_prev.causal_attn  == params.cparams.causal_attn;
+    res &= params_prev.embeddings   == params.cparams.embeddings;
+    res &= params_prev.warmup       == params.cparams.warmup;
+    res &= params_prev.cvec         == params.cvec;
+    res &= params_prev.loras        == params.loras;
+
+    if (!res) {
+        return false;
+    }
+
+    // note: all inputs must be visited, because they can update their memory context references
+    for (auto & input : inputs) {
+        res &= input->can_reuse(params);
+    }
+
+    return res;
+}
+
 //
 // llm_graph_context
 //
@@ -404,7 +550,8 @@ llm_graph_context::llm_graph_context(const llm_graph_params & params) :
     cross            (params.cross),
     cb_func          (params.cb),
     res              (std::make_unique<llm_graph_result>()) {
-    }
+    res->set_params(params);
+}
 
 void llm_graph_context::cb(ggml_tensor * cur, const char * name, int il) const {
     if (cb_func) {
@@ -1679,6 +1826,87 @@ void llm_graph_context::build_pooling(
     ggml_build_forward_expand(gf, cur);
 }
 
+void llm_graph_context::build_logits_top_k(ggml_cgraph * gf) const {
+    ggml_tensor * logits = res->t_logits;
+
+    if (cparams.logits_top_k == 0 || logits == nullptr) {
+        return;
+    }
+
+    const int64_t n_vocab = logits->ne[0];
+    const int64_t n_outs  = logits->ne[1];
+    const int64_t k       = std::min<int64_t>(cparams.logits_top_k, n_vocab);
+    const int64_t n_block = LLAMA_LOGITS_TOP_K_BLOCK;
+
+    GGML_ASSERT(2*k <= n_block);
+
+    // the token ids are carried as F32 through the gathers below, which is exact up to 2^24
+    GGML_ASSERT(n_vocab <= (1 << 24));
+
+    ggml_tensor * vals = logits;
+    ggml_tensor * ids  = nullptr; // F32, token ids of vals - nullptr while vals are the logits themselves
+
+    // block-local top-k: keep the top-k of each block of candidates until one block is left
+    while (vals->ne[0] > n_block) {
+        const int64_t n        = vals->ne[0];
+        const int64_t n_blocks = (n + n_block - 1)/n_block;
+        const int64_t n_pad    = n_blocks*n_block - n;
+
+        if (n_pad > 0) {
+            // pad the last block with values below any logit
+            // there are always at least k real candidates, so the padding never reaches the final top-k
+            ggml_tensor * pad = ggml_scale(ctx0, ggml_arange(ctx0, 1.0f, 1.0f + n_pad, 1.0f), -1e30f);
+            pad = ggml_repeat_4d(ctx0, pad, n_pad, n_outs, 1, 1);
+
+            vals = ggml_concat(ctx0, vals, pad, 0);
+            if (ids) {
+                ids = ggml_concat(ctx0, ids, pad, 0);
+            }
+        }
+
+        // [k, n_blocks*n_outs], the positions within each block
+        ggml_tensor * pos = ggml_top_k(ctx0, ggml_reshape_2d(ctx0, vals, n_block, n_blocks*n_outs), k);
+
+        vals = ggml_get_rows(ctx0, ggml_reshape_3d(ctx0, vals, 1, n_block, n_blocks*n_outs), pos);
+        vals = ggml_reshape_2d(ctx0, vals, k*n_blocks, n_outs);
+
+        if (ids) {
+            ids = ggml_get_rows(ctx0, ggml_reshape_3d(ctx0, ids, 1, n_block, n_blocks*n_outs), pos);
+        } else {
+            // token id = position within the block + offset of the block
+            ggml_tensor * iota = ggml_reshape_3d(ctx0, ggml_arange(ctx0, 0.0f, n_block, 1.0f), 1, n_block, 1);
+            ggml_tensor * offs = ggml_reshape_3d(ctx0, ggml_arange(ctx0, 0.0f, n_blocks*n_block, n_block), 1, n_blocks, 1);
+
+            ids = ggml_get_rows(ctx0, iota, ggml_reshape_2d(ctx0, ggml_cont(ctx0, pos), k*n_blocks*n_outs, 1));
+            ids = ggml_add(ctx0, ggml_reshape_3d(ctx0, ids, k, n_blocks, n_outs), offs);
+        }
+        ids = ggml_reshape_2d(ctx0, ids, k*n_blocks, n_outs);
+    }
+
+    // [k, n_outputs]
+    ggml_tensor * pos = ggml_top_k(ctx0, vals, k);
+
+    // gather the logits of the selected candidates: [1, k, n_outputs]
+    ggml_tensor * cur = ggml_get_rows(ctx0, ggml_reshape_3d(ctx0, vals, 1, vals->ne[0], n_outs), pos);
+    cur = ggml_reshape_2d(ctx0, cur, k, n_outs);
+    cb(cur, "result_top_k", -1);
+
+    if (ids) {
+        // the backends cannot gather I32 values, so the ids of the candidates are cast at the end
+        ids = ggml_get_rows(ctx0, ggml_reshape_3d(ctx0, ids, 1, vals->ne[0], n_outs), pos);
+        ids = ggml_cast(ctx0, ggml_reshape_2d(ctx0, ids, k, n_outs), GGML_TYPE_I32);
+    } else {
+        ids = ggml_cont(ctx0, pos);
+    }
+    cb(ids, "result_top_k_ids", -1);
+
+    res->t_logits_top_k     = cur;
+    res->t_logits_top_k_ids = ids;
+
+    ggml_build_forward_expand(gf, cur);
+    ggml_build_forward_expand(gf, ids);
+}
+
 int32_t llama_relative_position_bucket(llama_pos x, llama_pos y, uint64_t n_buckets, bool bidirectional) {
     // TODO move to hparams if a T5 variant appears that uses a different value
     const int64_t max_distance = 128;
@@ -19,6 +19,8 @@ struct llama_cparams;
 
 struct llama_memory_context_i;
 
+struct llm_graph_params;
+
 class llama_kv_cache_unified_context;
 class llama_kv_cache_unified_iswa_context;
 class llama_memory_recurrent_context;
@@ -78,6 +80,12 @@ public:
     virtual ~llm_graph_input_i() = default;
 
     virtual void set_input(const llama_ubatch * ubatch) = 0;
+
+    // return true if the input tensors built with the provided graph parameters would be identical to the ones
+    //   currently stored in the object - i.e. the input can be repopulated without rebuilding the graph
+    // note: inputs that reference a memory context must update it to the one from the provided params
+    // the default is to not allow reuse, so that input types without an explicit check are always rebuilt
+    virtual bool can_reuse(const llm_graph_params & params);
 };
 
 using llm_graph_input_ptr = std::unique_ptr<llm_graph_input_i>;
@@ -89,6 +97,7 @@ public:
     virtual ~llm_graph_input_embd() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * tokens = nullptr; // I32 [n_batch]
     ggml_tensor * embd   = nullptr; // F32 [n_embd, n_batch]
@@ -100,6 +109,7 @@ public:
     virtual ~llm_graph_input_pos() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * pos = nullptr; // I32 [n_batch]
 
@@ -114,6 +124,7 @@ public:
     virtual ~llm_graph_input_attn_temp() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * attn_scale = nullptr; // F32 [n_batch]
 
@@ -158,6 +169,7 @@ public:
     virtual ~llm_graph_input_out_ids() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * out_ids; // I32 [n_outputs]
 
@@ -248,6 +260,7 @@ public:
     ~llm_graph_input_attn_kv_unified() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * get_k_idxs() const { return self_k_idxs; }
     ggml_tensor * get_v_idxs() const { return self_v_idxs; }
@@ -279,6 +292,7 @@ public:
     ~llm_graph_input_attn_kv_unified_iswa() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * get_k_idxs()     const { return self_k_idxs; }
     ggml_tensor * get_v_idxs()     const { return self_v_idxs; }
@@ -359,6 +373,7 @@ public:
     virtual ~llm_graph_input_one() = default;
 
     void set_input(const llama_ubatch * ubatch) override;
+    bool can_reuse(const llm_graph_params & params) override;
 
     ggml_tensor * one = nullptr; // F32
 };
@@ -377,12 +392,18 @@ class llm_graph_result_i {
 public:
     virtual ~llm_graph_result_i() = default;
 
-    virtual ggml_tensor * get_tokens()      = 0;
-    virtual ggml_tensor * get_logits()      = 0;
-    virtual ggml_tensor * get_embd()        = 0;
-    virtual ggml_tensor * get_embd_pooled() = 0;
+    virtual ggml_tensor * get_tokens()           = 0;
+    virtual ggml_tensor * get_logits()           = 0;
+    virtual ggml_tensor * get_logits_top_k()     = 0;
+    virtual ggml_tensor * get_logits_top_k_ids() = 0;
+    virtual ggml_tensor * get_embd()             = 0;
+    virtual ggml_tensor * get_embd_pooled()      = 0;
 
     virtual void set_inputs(const llama_ubatch * ubatch) = 0;
+
+    // return true if the graph that produced this result can be reused to process a ubatch with the provided
+    //   parameters by only updating the input tensors via set_inputs()
+    virtual bool can_reuse(const llm_graph_params & params) = 0;
 };
 
 using llm_graph_result_ptr = std::unique_ptr<llm_graph_result_i>;
@@ -392,10 +413,12 @@ class llm_graph_result : public llm_graph_result_i {
 public:
     virtual ~llm_graph_result() = default;
 
-    ggml_tensor * get_tokens()      override { return t_tokens; }
-    ggml_tensor * get_logits()      override { return t_logits; }
-    ggml_tensor * get_embd()        override { return t_embd; }
-    ggml_tensor * get_embd_pooled() override { return t_embd_pooled; }
+    ggml_tensor * get_tokens()           override { return t_tokens; }
+    ggml_tensor * get_logits()           override { return t_logits; }
+    ggml_tensor * get_logits_top_k()     override { return t_logits_top_k; }
+    ggml_tensor * get_logits_top_k_ids() override { return t_logits_top_k_ids; }
+    ggml_tensor * get_embd()             override { return t_embd; }
+    ggml_tensor * get_embd_pooled()      override { return t_embd_pooled; }
 
     void set_inputs(const llama_ubatch * ubatch) override {
         for (auto & input : inputs) {
@@ -403,18 +426,49 @@ public:
         }
     }
 
+    bool can_reuse(const llm_graph_params & params) override;
+
     llm_graph_input_i * add_input(llm_graph_input_ptr input) {
         inputs.emplace_back(std::move(input));
         return inputs.back().get();
     }
 
+    // store the parameters that determine the topology of the graph
+    void set_params(const llm_graph_params & params);
+
     // important graph nodes
     ggml_tensor * t_tokens      = nullptr;
     ggml_tensor * t_logits      = nullptr;
     ggml_tensor * t_embd        = nullptr;
+
+    // top-k of the logits (cparams.logits_top_k > 0)
+    ggml_tensor * t_logits_top_k     = nullptr; // F32 [logits_top_k, n_outputs]
+    ggml_tensor * t_logits_top_k_ids = nullptr; // I32 [logits_top_k, n_outputs]
     ggml_tensor * t_embd_pooled = nullptr;
 
     std::vector<llm_graph_input_ptr> inputs;
+
+    // the parameters with which the graph was built, used to check if the graph can be reused
+    // the ubatch itself is not stored - only its shape
+    struct {
+        llm_graph_type gtype = LLM_GRAPH_TYPE_DEFAULT;
+
+        bool     equal_seqs   = false;
+        bool     has_token    = false;
+        bool     has_embd     = false;
+        uint32_t n_tokens     = 0;
+        uint32_t n_seq_tokens = 0;
+        uint32_t n_seqs       = 0;
+        uint32_t n_seqs_unq   = 0;
+        uint32_t n_outputs    = 0;
+
+        bool causal_attn = false;
+        bool embeddings  = false;
+        bool warmup      = false;
+
+        const llama_adapter_cvec  * cvec  = nullptr;
+        const llama_adapter_loras * loras = nullptr;
+    } params_prev;
 };
 
 //
@@ -428,6 +482,7 @@ struct llm_graph_params {
     ggml_context * ctx;
 
     const llm_arch arch;
+    const llm_graph_type gtype;
 
     const llama_hparams & hparams;
     const llama_cparams & cparams;
@@ -729,6 +784,13 @@ struct llm_graph_context {
             ggml_tensor * cls_b,
             ggml_tensor * cls_out,
             ggml_tensor * cls_out_b) const;
+
+    //
+    // sampling
+    //
+
+    // top-k of the logits with the token ids, so that only the candidates are copied out of the backend
+    void build_logits_top_k(ggml_cgraph * gf) const;
 };
 
 // TODO: better name
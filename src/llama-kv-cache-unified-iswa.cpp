@@ -21,7 +21,8 @@ llama_kv_cache_unified_iswa::llama_kv_cache_unified_iswa(
                  uint32_t   kv_size,
                  uint32_t   n_seq_max,
                  uint32_t   n_ubatch,
-                 uint32_t   n_pad) : hparams(model.hparams) {
+                 uint32_t   n_pad,
+                 uint32_t   block_size) : hparams(model.hparams) {
     llama_kv_cache_unified::layer_filter_cb filter_base = [&](int32_t il) { return !model.hparams.is_swa(il); };
     llama_kv_cache_unified::layer_filter_cb filter_swa  = [&](int32_t il) { return  model.hparams.is_swa(il); };
 
@@ -42,14 +43,14 @@ llama_kv_cache_unified_iswa::llama_kv_cache_unified_iswa(
     kv_base = std::make_unique<llama_kv_cache_unified>(
             model, std::move(filter_base), type_k, type_v,
             v_trans, offload, size_base, n_seq_max, n_pad,
-            0, LLAMA_SWA_TYPE_NONE);
+            0, LLAMA_SWA_TYPE_NONE, block_size);
 
     LLAMA_LOG_INFO("%s: creating     SWA KV cache, size = %u cells\n", __func__, size_swa);
 
     kv_swa = std::make_unique<llama_kv_cache_unified>(
             model, std::move(filter_swa), type_k, type_v,
             v_trans, offload, size_swa, n_seq_max, n_pad,
-            hparams.n_swa, hparams.swa_type);
+            hparams.n_swa, hparams.swa_type, 0);
 }
 
 void llama_kv_cache_unified_iswa::clear(bool data) {
@@ -86,6 +87,15 @@ void llama_kv_cache_unified_iswa::seq_div(llama_seq_id seq_id, llama_pos p0, lla
     kv_swa ->seq_div(seq_id, p0, p1, d);
 }
 
+int32_t llama_kv_cache_unified_iswa::seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) {
+    GGML_UNUSED(seq_id);
+    GGML_UNUSED(tokens);
+    GGML_UNUSED(n_tokens);
+
+    // the SWA cache does not use the paged layout, so the prefix cannot be shared by both caches
+    return 0;
+}
+
 llama_pos llama_kv_cache_unified_iswa::seq_pos_min(llama_seq_id seq_id) const {
     // the base cache is a superset of the SWA cache, so we can just check the SWA cache
     return kv_swa->seq_pos_min(seq_id);
@@ -188,6 +198,10 @@ bool llama_kv_cache_unified_iswa::get_can_shift() const {
     return kv_base->get_size() == kv_swa->get_size();
 }
 
+llama_memory_block_info llama_kv_cache_unified_iswa::get_block_info() const {
+    return kv_base->get_block_info();
+}
+
 void llama_kv_cache_unified_iswa::state_write(llama_io_write_i & io, llama_seq_id seq_id) const {
     kv_base->state_write(io, seq_id);
     kv_swa ->state_write(io, seq_id);
@@ -23,7 +23,8 @@ public:
                      uint32_t   kv_size,
                      uint32_t   n_seq_max,
                      uint32_t   n_ubatch,
-                     uint32_t   n_pad);
+                     uint32_t   n_pad,
+                     uint32_t   block_size);
 
     ~llama_kv_cache_unified_iswa() = default;
 
@@ -42,6 +43,9 @@ public:
 
     bool get_can_shift() const override;
 
+    // only the non-SWA cache can use the paged layout
+    llama_memory_block_info get_block_info() const override;
+
     void clear(bool data) override;
 
     bool seq_rm  (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1) override;
@@ -50,6 +54,8 @@ public:
     void seq_add (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, llama_pos shift) override;
     void seq_div (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, int d) override;
 
+    int32_t seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) override;
+
     llama_pos seq_pos_min(llama_seq_id seq_id) const override;
     llama_pos seq_pos_max(llama_seq_id seq_id) const override;
 
@@ -12,6 +12,17 @@
 #include <map>
 #include <stdexcept>
 
+// rolling hash of the token ids of a sequence (FNV-1a over the token ids)
+// 0 is reserved for "unknown"
+static const uint64_t LLAMA_KV_HASH_SEED = 14695981039346656037ULL;
+
+static uint64_t llama_kv_hash_next(uint64_t h, llama_token token) {
+    h ^= (uint64_t) (uint32_t) token;
+    h *= 1099511628211ULL;
+
+    return h == 0 ? 1 : h;
+}
+
 //
 // llama_kv_cache_unified
 //
@@ -27,9 +38,10 @@ llama_kv_cache_unified::llama_kv_cache_unified(
                  uint32_t    n_seq_max,
                  uint32_t    n_pad,
                  uint32_t    n_swa,
-           llama_swa_type    swa_type) :
+           llama_swa_type    swa_type,
+                 uint32_t    block_size) :
     model(model), hparams(model.hparams), v_trans(v_trans),
-    n_seq_max(n_seq_max), n_pad(n_pad), n_swa(n_swa), swa_type(swa_type) {
+    n_seq_max(n_seq_max), n_pad(n_pad), n_swa(n_swa), block_size(block_size), swa_type(swa_type) {
 
     GGML_ASSERT(kv_size % n_pad == 0);
 
@@ -163,6 +175,26 @@ llama_kv_cache_unified::llama_kv_cache_unified(
     if (!supports_set_rows) {
         LLAMA_LOG_WARN("%s: LLAMA_SET_ROWS=0, using old ggml_cpy() method for backwards compatibility\n", __func__);
     }
+
+    if (block_size > 0) {
+        if (!supports_set_rows) {
+            LLAMA_LOG_WARN("%s: paged layout requires LLAMA_SET_ROWS=1 - disabling\n", __func__);
+            this->block_size = 0;
+        } else if (n_swa > 0) {
+            LLAMA_LOG_WARN("%s: paged layout is not supported for SWA caches - disabling\n", __func__);
+            this->block_size = 0;
+        } else if (kv_size % block_size != 0) {
+            LLAMA_LOG_WARN("%s: kv_size = %u is not a multiple of block_size = %u - disabling paged layout\n", __func__, kv_size, block_size);
+            this->block_size = 0;
+        } else {
+            LLAMA_LOG_INFO("%s: paged layout, %u blocks of %u cells\n", __func__, kv_size/block_size, block_size);
+        }
+    }
+
+    if (this->block_size > 0) {
+        hashes.resize(kv_size, 0);
+        seq_tail.resize(LLAMA_MAX_SEQ, kv_size);
+    }
 }
 
 void llama_kv_cache_unified::clear(bool data) {
@@ -170,6 +202,10 @@ void llama_kv_cache_unified::clear(bool data) {
 
     head = 0;
 
+    std::fill(hashes.begin(), hashes.end(), 0);
+
+    cells_cpy.clear();
+
     if (data) {
         for (auto & buf : bufs) {
             ggml_backend_buffer_clear(buf.get(), 0);
@@ -284,12 +320,21 @@ void llama_kv_cache_unified::seq_add(llama_seq_id seq_id, llama_pos p0, llama_po
         return;
     }
 
+    if (block_size > 0) {
+        seq_unshare(seq_id, p0, p1);
+    }
+
     for (uint32_t i = 0; i < cells.size(); ++i) {
         if (!cells.pos_in(i, p0, p1)) {
             continue;
         }
 
         if (cells.seq_has(i, seq_id)) {
+            if (block_size > 0) {
+                // the data no longer corresponds to the token prefix
+                hashes[i] = 0;
+            }
+
             if (cells.pos_add(i, shift)) {
                 if (new_head == cells.size()) {
                     new_head = i;
@@ -321,17 +366,168 @@ void llama_kv_cache_unified::seq_div(llama_seq_id seq_id, llama_pos p0, llama_po
         return;
     }
 
+    if (block_size > 0) {
+        seq_unshare(seq_id, p0, p1);
+    }
+
     for (uint32_t i = 0; i < cells.size(); ++i) {
         if (!cells.pos_in(i, p0, p1)) {
             continue;
         }
 
         if (cells.seq_has(i, seq_id)) {
+            if (block_size > 0) {
+                hashes[i] = 0;
+            }
+
             cells.pos_div(i, d);
         }
     }
 }
 
+int32_t llama_kv_cache_unified::seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) {
+    GGML_ASSERT(seq_id >= 0 && (uint32_t) seq_id < n_seq_max);
+
+    if (block_size == 0 || n_tokens < (int32_t) block_size) {
+        return 0;
+    }
+
+    if (cells.seq_pos_max(seq_id) >= 0) {
+        LLAMA_LOG_WARN("%s: sequence %d is not empty - cannot attach a prefix\n", __func__, seq_id);
+        return 0;
+    }
+
+    // rolling hash of the prompt up to each token
+    std::vector<uint64_t> hash(n_tokens);
+    for (int32_t i = 0; i < n_tokens; ++i) {
+        hash[i] = llama_kv_hash_next(i == 0 ? LLAMA_KV_HASH_SEED : hash[i - 1], tokens[i]);
+    }
+
+    // find the longest block-aligned prefix that ends in a cell of another sequence
+    llama_seq_id seq_src = -1;
+    llama_pos    n_match = 0;
+
+    for (uint32_t i = 0; i < cells.used_max_p1(); ++i) {
+        if (cells.is_empty(i) || hashes[i] == 0) {
+            continue;
+        }
+
+        const llama_pos p = cells.pos_get(i);
+
+        if (p >= n_tokens || p + 1 <= n_match || (p + 1) % block_size != 0 || hashes[i] != hash[p]) {
+            continue;
+        }
+
+        for (uint32_t s = 0; s < n_seq_max; ++s) {
+            if (cells.seq_has(i, s)) {
+                seq_src = s;
+                break;
+            }
+        }
+
+        n_match = p + 1;
+    }
+
+    if (n_match == 0) {
+        return 0;
+    }
+
+    // gather the cells of the prefix - all positions [0, n_match) must be present with a matching hash
+    std::vector<int32_t> idxs(n_match, -1);
+
+    for (uint32_t i = 0; i < cells.used_max_p1(); ++i) {
+        if (cells.is_empty(i) || !cells.seq_has(i, seq_src)) {
+            continue;
+        }
+
+        const llama_pos p = cells.pos_get(i);
+
+        if (p < n_match && hashes[i] == hash[p]) {
+            idxs[p] = i;
+        }
+    }
+
+    int32_t n_attach = 0;
+    while (n_attach < n_match && idxs[n_attach] >= 0) {
+        n_attach++;
+    }
+
+    n_attach -= n_attach % block_size;
+
+    for (int32_t p = 0; p < n_attach; ++p) {
+        cells.seq_add(idxs[p], seq_id);
+    }
+
+    if (n_attach > 0) {
+        seq_tail[seq_id] = idxs[n_attach - 1];
+    }
+
+    LLAMA_LOG_DEBUG("%s: attached %d tokens of sequence %d to sequence %d\n", __func__, n_attach, seq_src, seq_id);
+
+    return n_attach;
+}
+
+uint32_t llama_kv_cache_unified::find_cell(llama_seq_id seq_id, llama_pos pos) const {
+    for (uint32_t i = 0; i < cells.used_max_p1(); ++i) {
+        if (!cells.is_empty(i) && cells.pos_get(i) == pos && cells.seq_has(i, seq_id)) {
+            return i;
+        }
+    }
+
+    return cells.size();
+}
+
+void llama_kv_cache_unified::seq_unshare(llama_seq_id seq_id, llama_pos p0, llama_pos p1) {
+    std::vector<uint32_t> ids_src;
+
+    for (uint32_t i = 0; i < cells.size(); ++i) {
+        if (!cells.pos_in(i, p0, p1)) {
+            continue;
+        }
+
+        if (cells.seq_has(i, seq_id) && cells.seq_count(i) > 1) {
+            ids_src.push_back(i);
+        }
+    }
+
+    if (ids_src.empty()) {
+        return;
+    }
+
+    // find new cells for the copies, the same way as for new tokens of the sequence
+    llama_batch_allocr balloc(hparams.n_pos_per_embd());
+
+    llama_ubatch ubatch = balloc.ubatch_reserve(ids_src.size(), 1);
+
+    for (uint32_t j = 0; j < ids_src.size(); ++j) {
+        ubatch.pos[j]      = cells.pos_get(ids_src[j]);
+        ubatch.n_seq_id[j] = 1;
+        ubatch.seq_id[j]   = &seq_id;
+    }
+
+    const auto sinfo = find_slot(ubatch, false);
+    if (sinfo.empty()) {
+        LLAMA_LOG_WARN("%s: not enough free cells to copy %zu shared cells of sequence %d - the change will apply to all sequences sharing them\n",
+                __func__, ids_src.size(), seq_id);
+        return;
+    }
+
+    for (uint32_t j = 0; j < ids_src.size(); ++j) {
+        const uint32_t i_src = ids_src[j];
+        const uint32_t i_dst = sinfo.idxs[j];
+
+        cells.seq_rm (i_src, seq_id);
+        cells.pos_set(i_dst, cells.pos_get(i_src));
+        cells.seq_add(i_dst, seq_id);
+
+        hashes[i_dst] = hashes[i_src];
+
+        cells_cpy.emplace_back(i_src, i_dst);
+    }
+
+    LLAMA_LOG_DEBUG("%s: sequence %d: copying %zu shared cells\n", __func__, seq_id, ids_src.size());
+}
+
 llama_pos llama_kv_cache_unified::seq_pos_min(llama_seq_id seq_id) const {
     return cells.seq_pos_min(seq_id);
 }
@@ -382,6 +578,7 @@ llama_memory_context_ptr llama_kv_cache_unified::init_full() {
 }
 
 llama_memory_context_ptr llama_kv_cache_unified::init_update(llama_context * lctx, bool optimize) {
+    bool do_copy  = !cells_cpy.empty();
     bool do_shift = get_has_shift();
 
     defrag_info dinfo;
@@ -392,7 +589,10 @@ llama_memory_context_ptr llama_kv_cache_unified::init_update(llama_context * lct
 
         const auto thold = lctx->get_cparams().defrag_thold;
 
-        if (!do_defrag && thold > 0.0f) {
+        // the paged layout does not depend on contiguous free space, and moving cells would break the blocks
+        if (block_size > 0) {
+            do_defrag = false;
+        } else if (!do_defrag && thold > 0.0f) {
             const auto n_kv = cells.used_max_p1();
 
             // - do not defrag small contexts (i.e. < 2048 tokens)
@@ -411,7 +611,7 @@ llama_memory_context_ptr llama_kv_cache_unified::init_update(llama_context * lct
         }
     }
 
-    return std::make_unique<llama_kv_cache_unified_context>(this, lctx, do_shift, std::move(dinfo));
+    return std::make_unique<llama_kv_cache_unified_context>(this, lctx, do_copy, do_shift, std::move(dinfo));
 }
 
 llama_kv_cache_unified::slot_info_vec_t llama_kv_cache_unified::prepare(const std::vector<llama_ubatch> & ubatches) {
@@ -428,6 +628,8 @@ llama_kv_cache_unified::slot_info_vec_t llama_kv_cache_unified::prepare(const st
     // remember the old state of the cells so we can restore it in the end
     std::vector<state> states;
 
+    const auto seq_tail_old = seq_tail;
+
     bool success = true;
 
     for (const auto & ubatch : ubatches) {
@@ -457,6 +659,8 @@ llama_kv_cache_unified::slot_info_vec_t llama_kv_cache_unified::prepare(const st
         head = it->head_old;
     }
 
+    seq_tail = seq_tail_old;
+
     if (!success) {
         return {};
     }
@@ -464,11 +668,51 @@ llama_kv_cache_unified::slot_info_vec_t llama_kv_cache_unified::prepare(const st
     return res;
 }
 
-bool llama_kv_cache_unified::update(llama_context * lctx, bool do_shift, const defrag_info & dinfo) {
+bool llama_kv_cache_unified::update(llama_context * lctx, bool do_copy, bool do_shift, const defrag_info & dinfo) {
     bool updated = false;
 
     auto * sched = lctx->get_sched();
 
+    // the copies have to be done before the K-shift, which is then applied to the new cells
+    if (do_copy) {
+        LLAMA_LOG_DEBUG("%s: copying %zu shared cells\n", __func__, cells_cpy.size());
+
+        const uint32_t n_layer = layers.size();
+
+        // each copy requires 6*n_layer tensors (see build_graph_defrag)
+        const size_t max_copies = (lctx->graph_max_nodes() - 2*n_layer)/(6*n_layer);
+
+        for (size_t i0 = 0; i0 < cells_cpy.size(); i0 += max_copies) {
+            const size_t i1 = std::min(cells_cpy.size(), i0 + max_copies);
+
+            ggml_backend_sched_reset(sched);
+
+            auto * gf = lctx->graph_init();
+
+            auto res = build_graph_copy(lctx->get_cparams(), lctx->get_ctx_compute(), gf, i0, i1);
+            if (!res) {
+                LLAMA_LOG_ERROR("%s: failed to build graph for copy\n", __func__);
+                return updated;
+            }
+
+            if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+                LLAMA_LOG_ERROR("%s: failed to allocate compute graph for copy\n", __func__);
+                return updated;
+            }
+
+            res->set_inputs(nullptr);
+
+            if (lctx->graph_compute(gf, false) != GGML_STATUS_SUCCESS) {
+                LLAMA_LOG_ERROR("%s: failed to compute copy\n", __func__);
+                return updated;
+            }
+        }
+
+        cells_cpy.clear();
+
+        updated = true;
+    }
+
     if (do_shift) {
         if (!get_can_shift()) {
             GGML_ABORT("The current KV cache / model configuration does not support K-shift");
@@ -629,6 +873,16 @@ llama_kv_cache_unified::slot_info llama_kv_cache_unified::find_slot(const llama_
         }
     }
 
+    if (block_size > 0 && !cont) {
+        auto res = find_slot_paged(ubatch);
+        if (!res.empty()) {
+            return res;
+        }
+
+        // not enough free blocks - fallback to placing the tokens in any free cells
+        LLAMA_LOG_DEBUG("%s: not enough free blocks for %d tokens - using the flat layout\n", __func__, n_tokens);
+    }
+
     uint32_t n_tested = 0;
 
     // for continuous slots, we test that all tokens in the ubatch fit, starting from the current head
@@ -713,6 +967,131 @@ llama_kv_cache_unified::slot_info llama_kv_cache_unified::find_slot(const llama_
     return res;
 }
 
+llama_kv_cache_unified::slot_info llama_kv_cache_unified::find_slot_paged(const llama_ubatch & ubatch) const {
+    const uint32_t n_tokens = ubatch.n_tokens;
+    const uint32_t n_blocks = cells.size()/block_size;
+
+    // blocks after the last used cell are all free
+    const uint32_t n_blocks_scan = (cells.used_max_p1() + block_size - 1)/block_size;
+
+    // the owner of each block:
+    //   -1: the block is free
+    //   -2: the block contains cells from different sequences, or cells shared by several sequences
+    std::vector<llama_seq_id> owner(n_blocks, -1);
+
+    // the number of empty cells in each block that have not been assigned to the ubatch yet
+    std::vector<uint32_t> n_free(n_blocks, block_size);
+
+    for (uint32_t ib = 0; ib < n_blocks_scan; ++ib) {
+        for (uint32_t i = ib*block_size; i < (ib + 1)*block_size; ++i) {
+            if (cells.is_empty(i)) {
+                continue;
+            }
+
+            n_free[ib]--;
+
+            if (owner[ib] == -2) {
+                continue;
+            }
+
+            const llama_seq_id seq_id = cells.seq_count(i) == 1 ? cells.seq_get(i) : -2;
+
+            if (owner[ib] == -1) {
+                owner[ib] = seq_id;
+            } else if (owner[ib] != seq_id) {
+                owner[ib] = -2;
+            }
+        }
+    }
+
+    // the block table - the block that is currently being filled by each sequence
+    std::vector<int32_t> seq_block(LLAMA_MAX_SEQ, -1);
+
+    // offset within each block from where to search for the next empty cell
+    std::vector<uint32_t> cursor(n_blocks, 0);
+
+    slot_info res;
+
+    auto & idxs = res.idxs;
+
+    idxs.reserve(n_tokens);
+
+    for (uint32_t i = 0; i < n_tokens; ++i) {
+        const llama_seq_id seq_id = ubatch.seq_id[i][0];
+
+        int32_t ib = seq_block[seq_id];
+
+        if (ib < 0 || n_free[ib] == 0) {
+            ib = -1;
+
+            // continue filling a partially-used block of this sequence
+            for (uint32_t j = 0; j < n_blocks_scan; ++j) {
+                if (owner[j] == seq_id && n_free[j] > 0) {
+                    ib = j;
+                    break;
+                }
+            }
+
+            // otherwise, take the first free block
+            if (ib < 0) {
+                for (uint32_t j = 0; j < n_blocks; ++j) {
+                    if (owner[j] == -1 && n_free[j] == block_size) {
+                        ib = j;
+                        break;
+                    }
+                }
+            }
+
+            if (ib < 0) {
+                return { };
+            }
+
+            owner[ib]         = seq_id;
+            seq_block[seq_id] = ib;
+        }
+
+        // take the next empty cell of the block
+        uint32_t idx = ib*block_size + cursor[ib];
+        while (!cells.is_empty(idx)) {
+            idx++;
+        }
+
+        cursor[ib] = idx - ib*block_size + 1;
+
+        idxs.push_back(idx);
+
+        n_free[ib]--;
+    }
+
+    return res;
+}
+
+llama_memory_block_info llama_kv_cache_unified::get_block_info() const {
+    llama_memory_block_info res = {};
+
+    if (block_size == 0) {
+        return res;
+    }
+
+    res.block_size = block_size;
+    res.n_blocks   = cells.size()/block_size;
+
+    const uint32_t n_blocks_scan = (cells.used_max_p1() + block_size - 1)/block_size;
+
+    for (uint32_t ib = 0; ib < n_blocks_scan; ++ib) {
+        uint32_t n_used = 0;
+
+        for (uint32_t i = ib*block_size; i < (ib + 1)*block_size; ++i) {
+            n_used += cells.is_empty(i) ? 0 : 1;
+        }
+
+        res.n_blocks_used += n_used > 0 ? 1 : 0;
+        res.n_cells_used  += n_used;
+    }
+
+    return res;
+}
+
 void llama_kv_cache_unified::apply_ubatch(const slot_info & sinfo, const llama_ubatch & ubatch) {
     // keep track of the max sequence position that we would overwrite with this ubatch
     // for non-SWA cache, this would be always empty
@@ -742,6 +1121,34 @@ void llama_kv_cache_unified::apply_ubatch(const slot_info & sinfo, const llama_u
         for (int32_t s = 0; s < ubatch.n_seq_id[i]; s++) {
             cells.seq_add(idx, ubatch.seq_id[i][s]);
         }
+
+        if (block_size > 0) {
+            hashes[idx] = 0;
+
+            // continue the rolling hash of the sequence, if the previous token is known
+            if (ubatch.token && ubatch.n_seq_id[i] == 1) {
+                const llama_seq_id seq_id = ubatch.seq_id[i][0];
+                const llama_pos    pos    = ubatch.pos[i];
+
+                if (pos == 0) {
+                    hashes[idx] = llama_kv_hash_next(LLAMA_KV_HASH_SEED, ubatch.token[i]);
+                } else {
+                    uint32_t idx_prev = seq_tail[seq_id];
+
+                    // the tail is stale after the sequence was modified (e.g. seq_rm, seq_cp) - look up the cell
+                    if (idx_prev >= cells.size() || cells.is_empty(idx_prev) ||
+                        !cells.seq_has(idx_prev, seq_id) || cells.pos_get(idx_prev) != pos - 1) {
+                        idx_prev = find_cell(seq_id, pos - 1);
+                    }
+
+                    if (idx_prev < cells.size() && hashes[idx_prev] != 0) {
+                        hashes[idx] = llama_kv_hash_next(hashes[idx_prev], ubatch.token[i]);
+                    }
+                }
+
+                seq_tail[seq_id] = idx;
+            }
+        }
     }
 
     // note: we want to preserve the invariant that all positions between [pos_min, pos_max] for each sequence
@@ -776,6 +1183,10 @@ bool llama_kv_cache_unified::get_has_shift() const {
     return cells.get_has_shift();
 }
 
+bool llama_kv_cache_unified::get_supports_set_rows() const {
+    return supports_set_rows;
+}
+
 uint32_t llama_kv_cache_unified::get_n_kv() const {
     return std::min(cells.size(), std::max(n_pad, GGML_PAD(cells.used_max_p1(), n_pad)));
 }
@@ -1277,51 +1688,7 @@ llm_graph_result_ptr llama_kv_cache_unified::build_graph_defrag(
             nm++;
         }
 
-        for (const auto & layer : layers) {
-            const uint32_t il = layer.il;
-
-            const int64_t n_embd_k_gqa = hparams.n_embd_k_gqa(il);
-            const int64_t n_embd_v_gqa = hparams.n_embd_v_gqa(il);
-
-            ggml_tensor * view_k_src = ggml_view_2d(ctx, layer.k,
-                    n_embd_k_gqa, nm,
-                    ggml_row_size(layer.k->type, n_embd_k_gqa),
-                    ggml_row_size(layer.k->type, n_embd_k_gqa*i));
-
-            ggml_tensor * view_k_dst = ggml_view_2d(ctx, layer.k,
-                    n_embd_k_gqa, nm,
-                    ggml_row_size(layer.k->type, n_embd_k_gqa),
-                    ggml_row_size(layer.k->type, n_embd_k_gqa*id));
-
-            ggml_tensor * view_v_src;
-            ggml_tensor * view_v_dst;
-
-            if (cparams.flash_attn) {
-                // NOTE: the V cache is not transposed when using flash attention
-                view_v_src = ggml_view_2d(ctx, layer.v,
-                        n_embd_v_gqa, nm,
-                        ggml_row_size(layer.v->type, n_embd_v_gqa),
-                        ggml_row_size(layer.v->type, n_embd_v_gqa*i));
-
-                view_v_dst = ggml_view_2d(ctx, layer.v,
-                        n_embd_v_gqa, nm,
-                        ggml_row_size(layer.v->type, n_embd_v_gqa),
-                        ggml_row_size(layer.v->type, n_embd_v_gqa*id));
-            } else {
-                view_v_src = ggml_view_2d(ctx, layer.v,
-                        nm, n_embd_v_gqa,
-                        ggml_row_size(layer.v->type, cells.size()),
-                        ggml_row_size(layer.v->type, i));
-
-                view_v_dst = ggml_view_2d(ctx, layer.v,
-                        nm, n_embd_v_gqa,
-                        ggml_row_size(layer.v->type, cells.size()),
-                        ggml_row_size(layer.v->type, id));
-            }
-
-            ggml_build_forward_expand(gf, ggml_cpy(ctx, view_k_src, view_k_dst));
-            ggml_build_forward_expand(gf, ggml_cpy(ctx, view_v_src, view_v_dst));
-        }
+        build_cpy_cells(cparams, ctx, gf, i, id, nm);
 
         i += nm - 1;
     }
@@ -1332,6 +1699,87 @@ llm_graph_result_ptr llama_kv_cache_unified::build_graph_defrag(
     return res;
 }
 
+llm_graph_result_ptr llama_kv_cache_unified::build_graph_copy(
+                const llama_cparams & cparams,
+                       ggml_context * ctx,
+                        ggml_cgraph * gf,
+                             size_t   i0,
+                             size_t   i1) const {
+    auto res = std::make_unique<llm_graph_result>();
+
+    for (size_t i = i0; i < i1; ++i) {
+        const uint32_t i_src = cells_cpy[i].first;
+        const uint32_t i_dst = cells_cpy[i].second;
+
+        // batch consecutive source cells that go to consecutive destination cells
+        uint32_t nm = 1;
+
+        while (i + nm < i1 && cells_cpy[i + nm].first == i_src + nm && cells_cpy[i + nm].second == i_dst + nm) {
+            nm++;
+        }
+
+        build_cpy_cells(cparams, ctx, gf, i_src, i_dst, nm);
+
+        i += nm - 1;
+    }
+
+    return res;
+}
+
+void llama_kv_cache_unified::build_cpy_cells(
+                const llama_cparams & cparams,
+                       ggml_context * ctx,
+                        ggml_cgraph * gf,
+                             uint32_t i_src,
+                             uint32_t i_dst,
+                             uint32_t n) const {
+    for (const auto & layer : layers) {
+        const uint32_t il = layer.il;
+
+        const int64_t n_embd_k_gqa = hparams.n_embd_k_gqa(il);
+        const int64_t n_embd_v_gqa = hparams.n_embd_v_gqa(il);
+
+        ggml_tensor * view_k_src = ggml_view_2d(ctx, layer.k,
+                n_embd_k_gqa, n,
+                ggml_row_size(layer.k->type, n_embd_k_gqa),
+                ggml_row_size(layer.k->type, n_embd_k_gqa*i_src));
+
+        ggml_tensor * view_k_dst = ggml_view_2d(ctx, layer.k,
+                n_embd_k_gqa, n,
+                ggml_row_size(layer.k->type, n_embd_k_gqa),
+                ggml_row_size(layer.k->type, n_embd_k_gqa*i_dst));
+
+        ggml_tensor * view_v_src;
+        ggml_tensor * view_v_dst;
+
+        if (cparams.flash_attn) {
+            // NOTE: the V cache is not transposed when using flash attention
+            view_v_src = ggml_view_2d(ctx, layer.v,
+                    n_embd_v_gqa, n,
+                    ggml_row_size(layer.v->type, n_embd_v_gqa),
+                    ggml_row_size(layer.v->type, n_embd_v_gqa*i_src));
+
+            view_v_dst = ggml_view_2d(ctx, layer.v,
+                    n_embd_v_gqa, n,
+                    ggml_row_size(layer.v->type, n_embd_v_gqa),
+                    ggml_row_size(layer.v->type, n_embd_v_gqa*i_dst));
+        } else {
+            view_v_src = ggml_view_2d(ctx, layer.v,
+                    n, n_embd_v_gqa,
+                    ggml_row_size(layer.v->type, cells.size()),
+                    ggml_row_size(layer.v->type, i_src));
+
+            view_v_dst = ggml_view_2d(ctx, layer.v,
+                    n, n_embd_v_gqa,
+                    ggml_row_size(layer.v->type, cells.size()),
+                    ggml_row_size(layer.v->type, i_dst));
+        }
+
+        ggml_build_forward_expand(gf, ggml_cpy(ctx, view_k_src, view_k_dst));
+        ggml_build_forward_expand(gf, ggml_cpy(ctx, view_v_src, view_v_dst));
+    }
+}
+
 llama_kv_cache_unified::defrag_info llama_kv_cache_unified::defrag_prepare(int32_t n_max_nodes) const {
     const uint32_t n_layer = layers.size();
 
@@ -1688,6 +2136,13 @@ bool llama_kv_cache_unified::state_read_meta(llama_io_read_i & io, uint32_t cell
 
         apply_ubatch(sinfo, ubatch);
 
+        // the restored cells cannot be shared - the tokens are unknown
+        if (block_size > 0) {
+            for (const auto idx : sinfo.idxs) {
+                hashes[idx] = 0;
+            }
+        }
+
         const auto head_cur = sinfo.head();
 
         // keep the head at the old position because we will read the KV data into it in state_read_data()
@@ -1884,9 +2339,10 @@ llama_kv_cache_unified_context::llama_kv_cache_unified_context(
 llama_kv_cache_unified_context::llama_kv_cache_unified_context(
         llama_kv_cache_unified * kv,
         llama_context * lctx,
+        bool do_copy,
         bool do_shift,
-        defrag_info dinfo) : status(LLAMA_MEMORY_STATUS_SUCCESS), kv(kv), lctx(lctx), do_shift(do_shift), dinfo(std::move(dinfo)) {
-    if (!do_shift && this->dinfo.empty()) {
+        defrag_info dinfo) : status(LLAMA_MEMORY_STATUS_SUCCESS), kv(kv), lctx(lctx), do_copy(do_copy), do_shift(do_shift), dinfo(std::move(dinfo)) {
+    if (!do_copy && !do_shift && this->dinfo.empty()) {
         status = LLAMA_MEMORY_STATUS_NO_UPDATE;
     }
 }
@@ -1914,7 +2370,7 @@ bool llama_kv_cache_unified_context::apply() {
 
     // no ubatches -> this is a KV cache update
     if (ubatches.empty()) {
-        kv->update(lctx, do_shift, dinfo);
+        kv->update(lctx, do_copy, do_shift, dinfo);
 
         return true;
     }
@@ -1940,6 +2396,10 @@ uint32_t llama_kv_cache_unified_context::get_n_kv() const {
     return n_kv;
 }
 
+bool llama_kv_cache_unified_context::get_supports_set_rows() const {
+    return kv->get_supports_set_rows();
+}
+
 ggml_tensor * llama_kv_cache_unified_context::get_k(ggml_context * ctx, int32_t il) const {
     return kv->get_k(ctx, il, n_kv);
 }
@@ -72,7 +72,8 @@ public:
                      uint32_t    n_seq_max,
                      uint32_t    n_pad,
                      uint32_t    n_swa,
-               llama_swa_type    swa_type);
+               llama_swa_type    swa_type,
+                     uint32_t    block_size);
 
     ~llama_kv_cache_unified() = default;
 
@@ -91,6 +92,8 @@ public:
 
     bool get_can_shift() const override;
 
+    llama_memory_block_info get_block_info() const override;
+
     void clear(bool data) override;
 
     bool seq_rm  (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1) override;
@@ -99,6 +102,8 @@ public:
     void seq_add (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, llama_pos shift) override;
     void seq_div (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, int d) override;
 
+    int32_t seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) override;
+
     llama_pos seq_pos_min(llama_seq_id seq_id) const override;
     llama_pos seq_pos_max(llama_seq_id seq_id) const override;
 
@@ -115,6 +120,9 @@ public:
 
     bool get_has_shift() const;
 
+    // true if the K/V are stored via ggml_set_rows - the graph then does not depend on the slot location
+    bool get_supports_set_rows() const;
+
     //
     // graph_build API
     //
@@ -137,13 +145,17 @@ public:
     // return empty vector on failure
     slot_info_vec_t prepare(const std::vector<llama_ubatch> & ubatches);
 
-    bool update(llama_context * lctx, bool do_shift, const defrag_info & dinfo);
+    bool update(llama_context * lctx, bool do_copy, bool do_shift, const defrag_info & dinfo);
 
     // find a slot of kv cells that can hold the ubatch
     // if cont == true, then the slot must be continuous
     // return empty slot_info on failure
     slot_info find_slot(const llama_ubatch & ubatch, bool cont) const;
 
+    // find a slot for the ubatch using the paged layout (see block_size)
+    // return empty slot_info if there are not enough free blocks
+    slot_info find_slot_paged(const llama_ubatch & ubatch) const;
+
     // emplace the ubatch context into slot: [sinfo.idxs[0...ubatch.n_tokens - 1]]
     void apply_ubatch(const slot_info & sinfo, const llama_ubatch & ubatch);
 
@@ -188,6 +200,24 @@ private:
     // SWA
     const uint32_t n_swa = 0;
 
+    // paged layout: the cells are split in blocks of block_size cells and each block holds the tokens of a single
+    //   sequence (or a prefix shared by several sequences via seq_cp). new tokens of a sequence are placed in its
+    //   last partially-filled block, or in the first free block. no contiguity is required, so the cache never
+    //   needs to be defragmented
+    // 0 - disabled
+    uint32_t block_size = 0;
+
+    // paged layout: rolling hash of the tokens of the sequence up to and including each cell (0 - unknown)
+    //   used to find prefixes that can be shared with new sequences, see seq_attach_prefix()
+    std::vector<uint64_t> hashes;
+
+    // paged layout: the last cell written for each sequence - used to continue the rolling hash
+    std::vector<uint32_t> seq_tail;
+
+    // paged layout: pending copies of shared cells (src -> dst), performed in update()
+    //   cells shared by several sequences are copied on write, when a sequence modifies their positions
+    std::vector<std::pair<uint32_t, uint32_t>> cells_cpy;
+
     // env: LLAMA_KV_CACHE_DEBUG
     int debug = 0;
 
@@ -217,6 +247,21 @@ private:
 
     bool is_masked_swa(llama_pos p0, llama_pos p1) const;
 
+    // index of the cell of seq_id at position pos, cells.size() if not found
+    uint32_t find_cell(llama_seq_id seq_id, llama_pos pos) const;
+
+    // give seq_id its own copy of the cells in [p0, p1) that it shares with other sequences (paged layout)
+    void seq_unshare(llama_seq_id seq_id, llama_pos p0, llama_pos p1);
+
+    // copy the K and V data of the cells [i_src, i_src + n) to [i_dst, i_dst + n)
+    void build_cpy_cells(
+            const llama_cparams & cparams,
+                   ggml_context * ctx,
+                    ggml_cgraph * gf,
+                         uint32_t i_src,
+                         uint32_t i_dst,
+                         uint32_t n) const;
+
     ggml_tensor * build_rope_shift(
             const llama_cparams & cparams,
                    ggml_context * ctx,
@@ -237,6 +282,14 @@ private:
                     ggml_cgraph * gf,
               const defrag_info & dinfo) const;
 
+    // perform the pending copies cells_cpy[i0, i1)
+    llm_graph_result_ptr build_graph_copy(
+            const llama_cparams & cparams,
+                   ggml_context * ctx,
+                    ggml_cgraph * gf,
+                           size_t i0,
+                           size_t i1) const;
+
     void state_write_meta(llama_io_write_i & io, const std::vector<std::pair<uint32_t, uint32_t>> & cell_ranges, llama_seq_id seq_id = -1) const;
     void state_write_data(llama_io_write_i & io, const std::vector<std::pair<uint32_t, uint32_t>> & cell_ranges) const;
 
@@ -261,6 +314,7 @@ public:
     llama_kv_cache_unified_context(
             llama_kv_cache_unified * kv,
             llama_context * lctx,
+            bool do_copy,
             bool do_shift,
             defrag_info dinfo);
 
@@ -288,6 +342,8 @@ public:
 
     uint32_t get_n_kv() const;
 
+    bool get_supports_set_rows() const;
+
     // get views of the current state of the cache
     ggml_tensor * get_k(ggml_context * ctx, int32_t il) const;
     ggml_tensor * get_v(ggml_context * ctx, int32_t il) const;
@@ -316,6 +372,7 @@ private:
     // update context
     //
 
+    bool do_copy  = false;
     bool do_shift = false;
 
     defrag_info dinfo;
@@ -42,7 +42,8 @@ llama_memory_hybrid::llama_memory_hybrid(
         n_seq_max,
         n_pad,
         n_swa,
-        swa_type
+        swa_type,
+        0
     )),
     mem_recr(new llama_memory_recurrent(
         model,
@@ -119,6 +120,10 @@ bool llama_memory_hybrid::get_can_shift() const {
     return mem_attn->get_can_shift();
 }
 
+llama_memory_block_info llama_memory_hybrid::get_block_info() const {
+    return mem_attn->get_block_info();
+}
+
 void llama_memory_hybrid::clear(bool data) {
     mem_attn->clear(data);
     mem_recr->clear(data);
@@ -153,6 +158,15 @@ void llama_memory_hybrid::seq_div(llama_seq_id seq_id, llama_pos p0, llama_pos p
     mem_recr->seq_div(seq_id, p0, p1, d);
 }
 
+int32_t llama_memory_hybrid::seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) {
+    GGML_UNUSED(seq_id);
+    GGML_UNUSED(tokens);
+    GGML_UNUSED(n_tokens);
+
+    // the recurrent state cannot be shared by reference
+    return 0;
+}
+
 llama_pos llama_memory_hybrid::seq_pos_min(llama_seq_id seq_id) const {
     // the min of the total cache is the max of the two caches' min values
     return std::max(mem_attn->seq_pos_min(seq_id), mem_recr->seq_pos_min(seq_id));
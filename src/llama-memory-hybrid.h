@@ -60,6 +60,8 @@ public:
 
     bool get_can_shift() const override;
 
+    llama_memory_block_info get_block_info() const override;
+
     void clear(bool data) override;
 
     bool seq_rm  (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1) override;
@@ -68,6 +70,8 @@ public:
     void seq_add (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, llama_pos shift) override;
     void seq_div (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, int d) override;
 
+    int32_t seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) override;
+
     llama_pos seq_pos_min(llama_seq_id seq_id) const override;
     llama_pos seq_pos_max(llama_seq_id seq_id) const override;
 
@@ -334,6 +334,15 @@ void llama_memory_recurrent::seq_div(llama_seq_id seq_id, llama_pos p0, llama_po
     }
 }
 
+int32_t llama_memory_recurrent::seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) {
+    GGML_UNUSED(seq_id);
+    GGML_UNUSED(tokens);
+    GGML_UNUSED(n_tokens);
+
+    // the state of a sequence cannot be split into blocks
+    return 0;
+}
+
 llama_pos llama_memory_recurrent::seq_pos_min(llama_seq_id seq_id) const {
     llama_pos result = std::numeric_limits<llama_pos>::max();
 
@@ -646,6 +655,10 @@ bool llama_memory_recurrent::get_can_shift() const {
     return true;
 }
 
+llama_memory_block_info llama_memory_recurrent::get_block_info() const {
+    return {};
+}
+
 size_t llama_memory_recurrent::total_size() const {
     size_t size = 0;
     for (const auto & buf : bufs) {
@@ -18,6 +18,9 @@ struct llama_memory_params {
 
     // use full-size SWA cache
     bool swa_full;
+
+    // paged layout - number of cells per block (0 = disabled)
+    uint32_t kv_block_size;
 };
 
 enum llama_memory_status {
@@ -84,6 +87,8 @@ struct llama_memory_i {
     // getters
     virtual bool get_can_shift() const = 0;
 
+    virtual llama_memory_block_info get_block_info() const = 0;
+
     //
     // ops
     //
@@ -97,6 +102,10 @@ struct llama_memory_i {
     virtual void seq_add (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, llama_pos shift) = 0;
     virtual void seq_div (llama_seq_id seq_id,                              llama_pos p0, llama_pos p1, int d) = 0;
 
+    // share the longest cached prefix of the tokens with the empty sequence seq_id
+    // returns the number of shared tokens (0 if not supported)
+    virtual int32_t seq_attach_prefix(llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) = 0;
+
     virtual llama_pos seq_pos_min(llama_seq_id seq_id) const = 0;
     virtual llama_pos seq_pos_max(llama_seq_id seq_id) const = 0;
 
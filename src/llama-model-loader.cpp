@@ -1008,6 +1008,13 @@ bool llama_model_loader::load_all_data(
         return backend;
     }(__func__);
 
+    // with --numa interleave the CPU backend binds the rows of each weight to the NUMA nodes of the threads that use them
+    decltype(ggml_numa_place_tensor) * numa_place_tensor = nullptr;
+    if (auto * dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU)) {
+        auto * reg = ggml_backend_dev_backend_reg(dev);
+        numa_place_tensor = (decltype(ggml_numa_place_tensor) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_numa_place_tensor");
+    }
+
     if (upload_backend) {
         LLAMA_LOG_DEBUG("%s: using async uploads for device %s, buffer type %s, backend %s\n", __func__,
             ggml_backend_dev_name(ggml_backend_get_device(upload_backend)),
@@ -1099,6 +1106,10 @@ bool llama_model_loader::load_all_data(
             }
         }
 
+        if (numa_place_tensor && cur->buffer && ggml_backend_buffer_is_host(cur->buffer)) {
+            numa_place_tensor(cur);
+        }
+
         size_done += n_size;
     }
 
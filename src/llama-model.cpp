@@ -14727,7 +14727,8 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 cparams.n_ctx,
                                 cparams.n_seq_max,
                                 cparams.n_ubatch,
-                                padding);
+                                padding,
+                                params.kv_block_size);
                     } else {
                         GGML_ASSERT(!hparams.is_swa_any());
 
@@ -14742,7 +14743,8 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 cparams.n_seq_max,
                                 padding,
                                 hparams.n_swa,
-                                hparams.swa_type);
+                                hparams.swa_type,
+                                params.kv_block_size);
                     }
                 }
             }
@@ -15047,6 +15049,9 @@ llm_graph_result_ptr llama_model::build_graph(
     // add on pooling layer
     llm->build_pooling(gf, cls, cls_b, cls_out, cls_out_b);
 
+    // add on top-k of the logits
+    llm->build_logits_top_k(gf);
+
     return std::move(llm->res);
 }
 
@@ -129,35 +129,32 @@ struct ring_buffer {
 };
 
 static int llama_sample_dist(llama_token_data_array * cur_p, std::mt19937 & rng) {
-    // iterator for the probabilities
-#ifdef __GNUC__
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wunused-local-typedefs"
-#endif
-
-    struct probs_iterator {
-        typedef std::input_iterator_tag iterator_category;
-        typedef float value_type;
-        typedef float * pointer;
-        typedef float & reference;
-        typedef ptrdiff_t difference_type;
+    // a single uniform draw against the running sum of the probabilities, the tokens do not need to be sorted
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
 
-        const llama_token_data * data;
+    double sum = 0.0;
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        sum += cur_p->data[i].p;
+    }
 
-        bool operator==(const probs_iterator & other) const { return data == other.data; }
-        bool operator!=(const probs_iterator & other) const { return data != other.data; }
-        const float & operator*() const { return data->p; }
-        probs_iterator & operator++() { ++data; return *this; }
-        probs_iterator operator++(int) { probs_iterator tmp = *this; ++data; return tmp; }
-    };
+    const double target = sum*dist(rng);
 
-#ifdef __GNUC__
-    #pragma GCC diagnostic pop
-#endif
+    double sum_run = 0.0;
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        sum_run += cur_p->data[i].p;
+        if (sum_run > target && cur_p->data[i].p > 0.0f) {
+            return i;
+        }
+    }
 
-    std::discrete_distribution<int> dist(probs_iterator{cur_p->data}, probs_iterator{cur_p->data + cur_p->size});
+    // rounding: the last token with a non-zero probability
+    for (size_t i = cur_p->size; i > 0; --i) {
+        if (cur_p->data[i - 1].p > 0.0f) {
+            return i - 1;
+        }
+    }
 
-    return dist(rng);
+    return cur_p->size - 1;
 }
 
 /*
@@ -200,19 +197,79 @@ static void llama_sampler_temp_impl(llama_token_data_array * cur_p, float temp)
     }
 }
 
-static void llama_sampler_softmax_impl(llama_token_data_array * cur_p) {
+static bool llama_token_data_greater(const llama_token_data & a, const llama_token_data & b) {
+    return a.logit > b.logit;
+}
+
+// move the k tokens with the highest logits to the front of the array, sorted in descending order
+// the array stays a permutation of the tokens, the order of the other tokens is unspecified
+static void llama_token_data_array_partial_sort(llama_token_data_array * cur_p, size_t k) {
+    llama_token_data * data = cur_p->data;
+    const size_t       n    = cur_p->size;
+
+    k = std::min(k, n);
+    if (k == 0) {
+        return;
+    }
+
+    // the heap pays off only for a small k
+    if (k > 128) {
+        if (k < n) {
+            std::nth_element(data, data + k - 1, data + n, llama_token_data_greater);
+        }
+        std::sort(data, data + k, llama_token_data_greater);
+        return;
+    }
+
+    // streaming selection: a heap of the best k tokens so far with the lowest logit on top
+    // most of the tokens are below it, so blocks of tokens are compared at once and skipped
+    constexpr size_t block = 16;
+
+    std::make_heap(data, data + k, llama_token_data_greater);
+
+    size_t i = k;
+    for (; i < n; i += block) {
+        const size_t i1 = std::min(i + block, n);
+
+        float max_l = data[i].logit;
+        for (size_t j = i + 1; j < i1; ++j) {
+            max_l = std::max(max_l, data[j].logit);
+        }
+
+        if (!(max_l > data[0].logit)) {
+            continue;
+        }
+
+        for (size_t j = i; j < i1; ++j) {
+            if (data[j].logit > data[0].logit) {
+                std::pop_heap(data, data + k, llama_token_data_greater);
+                std::swap(data[k - 1], data[j]);
+                std::push_heap(data, data + k, llama_token_data_greater);
+            }
+        }
+    }
+
+    std::sort_heap(data, data + k, llama_token_data_greater);
+}
+
+static void llama_sampler_softmax_impl(llama_token_data_array * cur_p, bool do_sort) {
     GGML_ASSERT(cur_p->size > 0);
 
     // Sort the logits in descending order
-    if (!cur_p->sorted) {
-        std::sort(cur_p->data, cur_p->data + cur_p->size, [](const llama_token_data & a, const llama_token_data & b) {
-            return a.logit > b.logit;
-        });
+    if (do_sort && !cur_p->sorted) {
+        std::sort(cur_p->data, cur_p->data + cur_p->size, llama_token_data_greater);
         cur_p->sorted = true;
     }
 
     float max_l = cur_p->data[0].logit;
-    float cum_sum = 0.0f;
+    if (!cur_p->sorted) {
+        for (size_t i = 1; i < cur_p->size; ++i) {
+            max_l = std::max(max_l, cur_p->data[i].logit);
+        }
+    }
+
+    // accumulate in double so that the order of the tokens (sorted or not) does not change the rounding
+    double cum_sum = 0.0;
 
     for (size_t i = 0; i < cur_p->size; ++i) {
         float p = expf(cur_p->data[i].logit - max_l);
@@ -225,7 +282,8 @@ static void llama_sampler_softmax_impl(llama_token_data_array * cur_p) {
     }
 }
 
-static void llama_sampler_top_k_impl(llama_token_data_array * cur_p, int32_t k) {
+// buf is scratch memory for large k, reused between the calls
+static void llama_sampler_top_k_impl(llama_token_data_array * cur_p, int32_t k, std::vector<llama_token_data> & buf) {
     // TODO: move bucket sort to separate function so that top_p/typical/softmax first is equally fast
     // if (k >= (int32_t)cur_p->size) {
     //     return;
@@ -239,11 +297,8 @@ static void llama_sampler_top_k_impl(llama_token_data_array * cur_p, int32_t k)
 
     // Sort scores in descending order
     if (!cur_p->sorted) {
-        auto comp = [](const llama_token_data & a, const llama_token_data & b) {
-            return a.logit > b.logit;
-        };
         if (k <= 128) {
-            std::partial_sort(cur_p->data, cur_p->data + k, cur_p->data + cur_p->size, comp);
+            llama_token_data_array_partial_sort(cur_p, k);
         } else {
             constexpr int   nbuckets     = 128;
             constexpr float bucket_low   = -10.0f;
@@ -251,15 +306,15 @@ static void llama_sampler_top_k_impl(llama_token_data_array * cur_p, int32_t k)
             constexpr float bucket_scale = nbuckets/(bucket_high - bucket_low);
             constexpr float bucket_inter = -bucket_low * bucket_scale;
 
-            std::vector<int> bucket_idx(cur_p->size);
-            std::vector<int> histo(nbuckets, 0);
+            const auto bucket = [&](float val) {
+                const int ib = int(bucket_scale * val + bucket_inter); //nbuckets * (val - bucket_low) / (bucket_high - bucket_low);
+                return std::max(0, std::min(nbuckets - 1, ib));
+            };
+
+            int histo[nbuckets] = {0};
 
             for (int i = 0; i < (int)cur_p->size; ++i) {
-                const float val = cur_p->data[i].logit;
-                int ib = int(bucket_scale * val + bucket_inter); //nbuckets * (val - bucket_low) / (bucket_high - bucket_low);
-                ib = std::max(0, std::min(nbuckets - 1, ib));
-                bucket_idx[i] = ib;
-                ++histo[ib];
+                ++histo[bucket(cur_p->data[i].logit)];
             }
             int nhave = 0;
             int ib = nbuckets - 1;
@@ -269,31 +324,30 @@ static void llama_sampler_top_k_impl(llama_token_data_array * cur_p, int32_t k)
                     break;
                 }
             }
-            std::vector<llama_token_data> tmp_tokens(nhave);
-            auto * ptr = tmp_tokens.data();
-            std::vector<llama_token_data*> bucket_ptrs;
-            bucket_ptrs.reserve(nbuckets - ib);
+            buf.resize(nhave);
+            auto * ptr = buf.data();
+            llama_token_data * bucket_ptrs[nbuckets];
             for (int j = nbuckets - 1; j >= ib; --j) {
-                bucket_ptrs.push_back(ptr);
+                bucket_ptrs[nbuckets - 1 - j] = ptr;
                 ptr += histo[j];
             }
             for (int i = 0; i < (int)cur_p->size; ++i) {
-                int j = bucket_idx[i];
+                int j = bucket(cur_p->data[i].logit);
                 if (j >= ib) {
                     *bucket_ptrs[nbuckets - 1 - j]++ = cur_p->data[i];
                 }
             }
 
-            ptr = tmp_tokens.data();
+            ptr = buf.data();
             int ndone = 0;
             for (int j = nbuckets - 1; j > ib; --j) {
-                std::sort(ptr, ptr + histo[j], comp);
+                std::sort(ptr, ptr + histo[j], llama_token_data_greater);
                 ptr += histo[j];
                 ndone += histo[j];
             }
-            std::partial_sort(ptr, ptr + k - ndone, ptr + histo[ib], comp);
+            std::partial_sort(ptr, ptr + k - ndone, ptr + histo[ib], llama_token_data_greater);
 
-            std::memcpy(cur_p->data, tmp_tokens.data(), k*sizeof(llama_token_data));
+            std::memcpy(cur_p->data, buf.data(), k*sizeof(llama_token_data));
 
         }
         cur_p->sorted = true;
@@ -377,18 +431,32 @@ void llama_sampler_free(struct llama_sampler * smpl) {
 }
 
 llama_token llama_sampler_sample(struct llama_sampler * smpl, struct llama_context * ctx, int32_t idx) {
-    const auto * logits = llama_get_logits_ith(ctx, idx);
+    // TODO: do not allocate each time
+    std::vector<llama_token_data> cur;
 
-    const llama_model * model = llama_get_model(ctx);
-    const llama_vocab * vocab = llama_model_get_vocab(model);
+    float       * top_k_logits = nullptr;
+    llama_token * top_k_tokens = nullptr;
 
-    const int n_vocab = llama_vocab_n_tokens(vocab);
+    const int32_t n_top_k = llama_get_logits_top_k_ith(ctx, idx, &top_k_logits, &top_k_tokens);
 
-    // TODO: do not allocate each time
-    std::vector<llama_token_data> cur;
-    cur.reserve(n_vocab);
-    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-        cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+    if (n_top_k > 0) {
+        // only the candidates were copied out of the backend
+        cur.reserve(n_top_k);
+        for (int32_t i = 0; i < n_top_k; i++) {
+            cur.emplace_back(llama_token_data{top_k_tokens[i], top_k_logits[i], 0.0f});
+        }
+    } else {
+        const auto * logits = llama_get_logits_ith(ctx, idx);
+
+        const llama_model * model = llama_get_model(ctx);
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        const int n_vocab = llama_vocab_n_tokens(vocab);
+
+        cur.reserve(n_vocab);
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+        }
     }
 
     llama_token_data_array cur_p = {
@@ -576,7 +644,7 @@ static const char * llama_sampler_dist_name(const struct llama_sampler * /*smpl*
 static void llama_sampler_dist_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
     auto * ctx = (llama_sampler_dist *) smpl->ctx;
 
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, false);
 
     cur_p->selected = llama_sample_dist(cur_p, ctx->rng);
 }
@@ -633,7 +701,7 @@ static const char * llama_sampler_softmax_name(const struct llama_sampler * /*sm
 }
 
 static void llama_sampler_softmax_apply(struct llama_sampler * /*smpl*/, llama_token_data_array * cur_p) {
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 }
 
 static struct llama_sampler_i llama_sampler_softmax_i = {
@@ -656,6 +724,8 @@ struct llama_sampler * llama_sampler_init_softmax() {
 
 struct llama_sampler_top_k {
     const int32_t k;
+
+    std::vector<llama_token_data> buf; // scratch for the bucket sort
 };
 
 static const char * llama_sampler_top_k_name(const struct llama_sampler * /*smpl*/) {
@@ -663,8 +733,8 @@ static const char * llama_sampler_top_k_name(const struct llama_sampler * /*smpl
 }
 
 static void llama_sampler_top_k_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
-    const auto * ctx = (llama_sampler_top_k *) smpl->ctx;
-    llama_sampler_top_k_impl(cur_p, ctx->k);
+    auto * ctx = (llama_sampler_top_k *) smpl->ctx;
+    llama_sampler_top_k_impl(cur_p, ctx->k, ctx->buf);
 }
 
 static struct llama_sampler * llama_sampler_top_k_clone(const struct llama_sampler * smpl) {
@@ -689,7 +759,8 @@ struct llama_sampler * llama_sampler_init_top_k(int32_t k) {
     return llama_sampler_init(
         /* .iface = */ &llama_sampler_top_k_i,
         /* .ctx   = */ new llama_sampler_top_k {
-            /* .k = */ k,
+            /* .k   = */ k,
+            /* .buf = */ {},
         }
     );
 }
@@ -699,20 +770,108 @@ struct llama_sampler * llama_sampler_init_top_k(int32_t k) {
 struct llama_sampler_top_p {
     const float  p;
     const size_t min_keep;
+
+    std::vector<int32_t> buf; // scratch for the unsorted path
 };
 
+// the top-p set of unsorted candidates with their probabilities, kept in their order
+// the same tokens as with sorted candidates, but only the histogram bucket where the cumulative sum reaches p is sorted
+static void llama_sampler_top_p_unsorted_impl(llama_token_data_array * cur_p, float p, size_t min_keep, std::vector<int32_t> & buf) {
+    constexpr int nbuckets = 1024;
+
+    float max_p = 0.0f;
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        max_p = std::max(max_p, cur_p->data[i].p);
+    }
+
+    const float bucket_scale = nbuckets/max_p;
+
+    const auto bucket = [&](float val) {
+        return std::min(nbuckets - 1, int(bucket_scale*val));
+    };
+
+    int   histo[nbuckets] = {0};
+    float probs[nbuckets] = {0.0f};
+
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        const int ib = bucket(cur_p->data[i].p);
+        ++histo[ib];
+        probs[ib] += cur_p->data[i].p;
+    }
+
+    // the first token is always kept
+    min_keep = std::max<size_t>(min_keep, 1);
+
+    size_t nhave = 0;
+    float  cum_p = 0.0f;
+
+    int ib = nbuckets - 1;
+    for (; ib >= 0; --ib) {
+        if (cum_p + probs[ib] >= p && nhave + histo[ib] >= min_keep) {
+            break;
+        }
+        nhave += histo[ib];
+        cum_p += probs[ib];
+    }
+
+    // the sum never reaches p because of the rounding, all tokens are kept
+    if (ib < 0) {
+        return;
+    }
+
+    // the tokens of bucket ib in descending order, the ties in the order of the candidates
+    buf.clear();
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        if (bucket(cur_p->data[i].p) == ib) {
+            buf.push_back(i);
+        }
+    }
+
+    const llama_token_data * data = cur_p->data;
+
+    std::sort(buf.begin(), buf.end(), [data](int32_t a, int32_t b) {
+        return data[a].p > data[b].p || (data[a].p == data[b].p && a < b);
+    });
+
+    size_t i_last = buf.back();
+    for (int32_t i : buf) {
+        cum_p += data[i].p;
+        nhave += 1;
+        if (cum_p >= p && nhave >= min_keep) {
+            i_last = i;
+            break;
+        }
+    }
+
+    const float p_last = data[i_last].p;
+
+    size_t j = 0;
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        if (cur_p->data[i].p > p_last || (cur_p->data[i].p == p_last && i <= i_last)) {
+            cur_p->data[j++] = cur_p->data[i];
+        }
+    }
+
+    cur_p->size = j;
+}
+
 static const char * llama_sampler_top_p_name(const struct llama_sampler * /*smpl*/) {
     return "top-p";
 }
 
 static void llama_sampler_top_p_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
-    const auto * ctx = (llama_sampler_top_p *) smpl->ctx;
+    auto * ctx = (llama_sampler_top_p *) smpl->ctx;
 
     if (ctx->p >= 1.0f) {
         return;
     }
 
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, false);
+
+    if (!cur_p->sorted) {
+        llama_sampler_top_p_unsorted_impl(cur_p, ctx->p, ctx->min_keep, ctx->buf);
+        return;
+    }
 
     // Compute the cumulative probabilities
     float cum_sum = 0.0f;
@@ -757,6 +916,7 @@ struct llama_sampler * llama_sampler_init_top_p(float p, size_t min_keep) {
         /* .ctx   = */ new llama_sampler_top_p {
             /* .p        = */ p,
             /* .min_keep = */ min_keep,
+            /* .buf      = */ {},
         }
     );
 }
@@ -783,24 +943,26 @@ static void llama_sampler_min_p_apply(struct llama_sampler * smpl, llama_token_d
 
     // if the cur_p aren't sorted, try the unsorted implementation first
     if (!cur_p->sorted) {
-        std::vector<llama_token_data> filtered_tokens;
-
         float max_logit = -FLT_MAX;
         for (size_t i = 0; i < cur_p->size; ++i) {
             max_logit = std::max(max_logit, cur_p->data[i].logit);
         }
         const float min_logit = max_logit + logf(ctx->p); // min logit for p_i >= p * p_max
 
+        size_t n_filtered = 0;
         for (size_t i = 0; i < cur_p->size; ++i) {
-            if (cur_p->data[i].logit >= min_logit) {
-                filtered_tokens.push_back(cur_p->data[i]);
-            }
+            n_filtered += cur_p->data[i].logit >= min_logit;
         }
 
-        // if we have enough values the operation was a success
-        if (!filtered_tokens.empty() && filtered_tokens.size() >= ctx->min_keep) {
-            memcpy(cur_p->data, filtered_tokens.data(), filtered_tokens.size()*sizeof(llama_token_data));
-            cur_p->size = filtered_tokens.size();
+        // if we have enough values the operation was a success, the tokens are filtered in place
+        if (n_filtered > 0 && n_filtered >= ctx->min_keep) {
+            size_t j = 0;
+            for (size_t i = 0; i < cur_p->size; ++i) {
+                if (cur_p->data[i].logit >= min_logit) {
+                    cur_p->data[j++] = cur_p->data[i];
+                }
+            }
+            cur_p->size = n_filtered;
             min_p_applied = true;
         }
     }
@@ -878,7 +1040,7 @@ static void llama_sampler_typical_apply(struct llama_sampler * smpl, llama_token
     }
 
     // Compute the softmax of logits and calculate entropy
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 
     float entropy = 0.0f;
     for (size_t i = 0; i < cur_p->size; ++i) {
@@ -1027,7 +1189,7 @@ static void llama_sampler_temp_ext_apply(struct llama_sampler * smpl, llama_toke
         // Calculate maximum possible entropy
         float max_entropy = -logf(1.0f / cur_p->size);
 
-        llama_sampler_softmax_impl(cur_p);
+        llama_sampler_softmax_impl(cur_p, true);
 
         // Calculate entropy of the softmax probabilities
         float entropy = 0.0f;
@@ -1142,7 +1304,7 @@ static void llama_sample_xtc_apply(struct llama_sampler * smpl, llama_token_data
     if (chance > ctx->probability) return;
 
     // in case it's not sorted/recalculated yet
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 
     int pos_last = 0;
 
@@ -1222,6 +1384,8 @@ struct llama_sampler_mirostat {
     float mu;
 
     std::mt19937 rng;
+
+    std::vector<llama_token_data> buf; // scratch for top-k
 };
 
 static const char * llama_sampler_mirostat_name(const struct llama_sampler * /*smpl*/) {
@@ -1231,7 +1395,7 @@ static const char * llama_sampler_mirostat_name(const struct llama_sampler * /*s
 static void llama_sampler_mirostat_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
     auto * ctx = (llama_sampler_mirostat *) smpl->ctx;
 
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 
     // Estimate s_hat using the most probable m tokens
     float s_hat = 0.0;
@@ -1249,8 +1413,8 @@ static void llama_sampler_mirostat_apply(struct llama_sampler * smpl, llama_toke
     float epsilon_hat = s_hat - 1;
     float k = powf((epsilon_hat * powf(2, ctx->mu)) / (1 - powf(ctx->n_vocab, -epsilon_hat)), 1 / s_hat);
 
-    llama_sampler_top_k_impl(cur_p, std::max(int(k), 1));
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_top_k_impl(cur_p, std::max(int(k), 1), ctx->buf);
+    llama_sampler_softmax_impl(cur_p, true);
 
     const int idx = llama_sample_dist(cur_p, ctx->rng);
 
@@ -1311,6 +1475,7 @@ struct llama_sampler * llama_sampler_init_mirostat(int32_t n_vocab, uint32_t see
             /* .m        = */ m,
             /* .mu       = */ 2.0f*tau,
             /* .rng      = */ std::mt19937(seed_cur),
+            /* .buf      = */ {},
         }
     );
 }
@@ -1336,7 +1501,7 @@ static const char * llama_sampler_mirostat_v2_name(const struct llama_sampler *
 static void llama_sampler_mirostat_v2_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
     auto * ctx = (llama_sampler_mirostat_v2 *) smpl->ctx;
 
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 
     // Truncate the words with surprise values greater than mu
     cur_p->size = std::distance(cur_p->data, std::find_if(cur_p->data, cur_p->data + cur_p->size, [&](const llama_token_data & candidate) {
@@ -1348,7 +1513,7 @@ static void llama_sampler_mirostat_v2_apply(struct llama_sampler * smpl, llama_t
     }
 
     // Normalize the probabilities of the remaining words
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 
     const int idx = llama_sample_dist(cur_p, ctx->rng);
 
@@ -1470,6 +1635,11 @@ static void llama_sampler_grammar_reset(struct llama_sampler * smpl) {
                                                  ctx->grammar->lazy, trigger_patterns_c.data(), trigger_patterns_c.size(),
                                                  ctx->grammar->trigger_tokens.data(), ctx->grammar->trigger_tokens.size());
 
+    // same grammar, so the cached token masks remain valid
+    if (grammar_new) {
+        llama_grammar_share_masks(*grammar_new, *ctx->grammar);
+    }
+
     llama_grammar_free_impl(ctx->grammar);
     ctx->grammar = grammar_new;
 }
@@ -1598,6 +1768,22 @@ struct llama_sampler * llama_sampler_init_grammar_lazy_patterns(
     return llama_sampler_init_grammar_impl(vocab, grammar_str, grammar_root, /* lazy= */ true, nullptr, 0, trigger_tokens, num_trigger_tokens, trigger_patterns, num_trigger_patterns);
 }
 
+void llama_sampler_grammar_prepare(struct llama_sampler * smpl) {
+    if (smpl->iface == &llama_sampler_grammar_i) {
+        const auto * ctx = (const llama_sampler_grammar *) smpl->ctx;
+        if (ctx->grammar) {
+            llama_grammar_prepare_impl(*ctx->grammar);
+        }
+    }
+
+    if (smpl->iface == &llama_sampler_chain_i) {
+        const auto * ctx = (const llama_sampler_chain *) smpl->ctx;
+        for (auto * s : ctx->samplers) {
+            llama_sampler_grammar_prepare(s);
+        }
+    }
+}
+
 // penalties
 
 struct llama_sampler_penalties {
@@ -1786,7 +1972,7 @@ static void llama_sampler_top_n_sigma_apply(struct llama_sampler * smpl, llama_t
             cur_p->data[i].logit = -INFINITY;
         }
     }
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 }
 
 static struct llama_sampler * llama_sampler_top_n_sigma_clone(const struct llama_sampler * smpl) {
@@ -2308,7 +2494,7 @@ static const char * llama_sampler_infill_name(const struct llama_sampler * /*smp
 static void llama_sampler_infill_apply(struct llama_sampler * smpl, llama_token_data_array * cur_p) {
     auto * ctx = (llama_sampler_infill *) smpl->ctx;
 
-    llama_sampler_softmax_impl(cur_p);
+    llama_sampler_softmax_impl(cur_p, true);
 
 #if defined(GGML_DEBUG_SAMPLER_INFILL)
 #define LOG_DBG_CUR LLAMA_LOG_DEBUG
@@ -7,45 +7,15 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
 #include <vector>
 
 #define MAX_NARGS 2
 
-int main(int argc, char *argv[]) {
-
-    int n_threads = 4;
-    int n_rounds  = 100;
+// ggml-cpu/ggml-cpu-impl.h
+extern "C" enum ggml_status ggml_graph_compute_barriers_testing(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan);
 
-    if (argc > 1) {
-        n_threads = std::atoi(argv[1]);
-    }
-
-    if (argc > 2) {
-        n_rounds  = std::atoi(argv[2]);
-    }
-
-    struct ggml_init_params params = {
-        /* .mem_size   = */ 1024*1024*1024,
-        /* .mem_buffer = */ NULL,
-        /* .no_alloc   = */ false,
-    };
-
-    struct ggml_context * ctx = ggml_init(params);
-
-    // Create graph
-    struct ggml_cgraph * gf = ggml_new_graph(ctx);
-
-    // Lots of small, parallel ops where barriers in between will dominate
-    struct ggml_tensor * out = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,  64);
-    for (int i = 0; i < 1000; i++) {
-        struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 64, 128);
-        out = ggml_mul_mat(ctx, a, out);
-
-        struct ggml_tensor * d = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 128, 64);
-        out = ggml_mul_mat(ctx, d, out);
-    }
-
-    ggml_build_forward_expand(gf, out);
+static void bench_graph(const char * name, struct ggml_cgraph * gf, int n_threads, int n_rounds) {
     int n_nodes = ggml_graph_n_nodes(gf);
 
     // Create threadpool
@@ -62,7 +32,7 @@ int main(int argc, char *argv[]) {
     std::vector<uint8_t> work_data(cplan.work_size);
     cplan.work_data = work_data.data();
 
-    std::cerr << "graph-compute with"
+    std::cerr << "graph-compute " << name << " with"
               << "\n n_threads: " << n_threads
               << "\n   n_nodes: " << n_nodes
               << "\n  n_rounds: " << n_rounds
@@ -72,6 +42,10 @@ int main(int argc, char *argv[]) {
     // Warmup
     ggml_graph_compute(gf, &cplan);
 
+    // the stats are summed over the threads, and each thread passes every barrier
+    struct ggml_threadpool_stats stats;
+    ggml_threadpool_get_stats(threadpool, &stats);
+
     auto t0 = std::chrono::high_resolution_clock::now();
 
     for (int i=0; i < n_rounds; i++) {
@@ -85,10 +59,199 @@ int main(int argc, char *argv[]) {
     std::cerr << "graph-compute took " << usec << " usec "
               << "\n " << (float) usec / n_rounds << " usec per-iter"
               << "\n " << (float) nsec / (n_rounds * n_nodes) << " nsec per-node"
+              << "\n " << stats.n_barrier / n_threads << " barriers per-iter"
               << "\n";
 
     ggml_threadpool_free(threadpool);
+}
+
+// compute the graph with the barriers between independent nodes skipped and with a barrier before each node, and check
+// that both give the same result as a single thread - the ops of the graph compute each value the same way for any split
+static bool test_graph(const char * name, struct ggml_cgraph * gf, const std::vector<ggml_tensor *> & inputs, ggml_tensor * out, int n_threads, int n_rounds) {
+    std::vector<std::vector<uint8_t>> inputs_data;
+    for (auto * t : inputs) {
+        inputs_data.emplace_back((uint8_t *) t->data, (uint8_t *) t->data + ggml_nbytes(t));
+    }
+
+    // the nodes are cleared before each computation, so that a node that reads its sources before they are written does
+    // not see the results of the previous computation, and the inputs are restored since the graph writes into some of them
+    const auto compute = [&](int n_threads, bool barriers) {
+        for (int i = 0; i < ggml_graph_n_nodes(gf); i++) {
+            struct ggml_tensor * node = ggml_graph_node(gf, i);
+            if (ggml_is_contiguous(node)) {
+                memset(node->data, 0xff, ggml_nbytes(node));
+            }
+        }
+        for (size_t i = 0; i < inputs.size(); i++) {
+            memcpy(inputs[i]->data, inputs_data[i].data(), inputs_data[i].size());
+        }
+
+        struct ggml_threadpool_params tpp  = ggml_threadpool_params_default(n_threads);
+        struct ggml_threadpool* threadpool = ggml_threadpool_new(&tpp);
+
+        struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+
+        std::vector<uint8_t> work_data(cplan.work_size);
+        cplan.work_data = work_data.data();
+
+        const enum ggml_status status = barriers ? ggml_graph_compute_barriers_testing(gf, &cplan) : ggml_graph_compute(gf, &cplan);
+        GGML_ASSERT(status == GGML_STATUS_SUCCESS);
+
+        ggml_threadpool_free(threadpool);
+
+        return std::vector<uint8_t>((uint8_t *) out->data, (uint8_t *) out->data + ggml_nbytes(out));
+    };
+
+    const auto ref = compute(1, false);
+
+    int n_failed = 0;
+
+    for (int i = 0; i < n_rounds; i++) {
+        n_failed += compute(n_threads, false) != ref;
+        n_failed += compute(n_threads, true)  != ref;
+    }
+
+    fprintf(stderr, "graph-test %s with %d threads, %d rounds: %s\n", name, n_threads, n_rounds, n_failed == 0 ? "OK" : "FAILED");
+
+    return n_failed == 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    int n_threads = 4;
+    int n_rounds  = 100;
+
+    if (argc > 1) {
+        n_threads = std::atoi(argv[1]);
+    }
+
+    if (argc > 2) {
+        n_rounds  = std::atoi(argv[2]);
+    }
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 1024*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    bool ok = true;
+
+    {
+        struct ggml_cgraph * gf = ggml_new_graph(ctx);
+
+        // read-after-write chains between nodes whose rows are split between the threads, with independent nodes in
+        // between, in-place ops and copies into views of a tensor that is read as a whole
+        const int n = 64;
+
+        struct ggml_tensor * x   = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, n);
+        struct ggml_tensor * y   = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, n);
+        struct ggml_tensor * z   = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, n);
+        struct ggml_tensor * acc = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, 4*n);
+
+        const std::vector<ggml_tensor *> inputs = { x, y, z, acc };
+        for (auto * t : inputs) {
+            for (int64_t i = 0; i < ggml_nelements(t); i++) {
+                ((float *) t->data)[i] = 2.0f*rand()/RAND_MAX - 1.0f;
+            }
+        }
+
+        for (int i = 0; i < 16; i++) {
+            struct ggml_tensor * a = ggml_add(ctx, x, y);
+            struct ggml_tensor * b = ggml_mul(ctx, z, z);
+
+            // the columns of a, written by all threads
+            struct ggml_tensor * c = ggml_cont(ctx, ggml_transpose(ctx, a));
+
+            struct ggml_tensor * d = ggml_add_inplace(ctx, b, c);
+
+            struct ggml_tensor * slice = ggml_view_2d(ctx, acc, n, n, acc->nb[1], (i % 4)*n*acc->nb[1]);
+            struct ggml_tensor * e = ggml_cpy(ctx, d, slice);
+
+            // all the slices of acc
+            struct ggml_tensor * s = ggml_sum_rows(ctx, ggml_reshape_2d(ctx, e->view_src, 4*n, n));
+
+            x = ggml_scale(ctx, ggml_add(ctx, c, s), 0.25f);
+            y = ggml_scale(ctx, d, 0.5f);
+            z = ggml_sub(ctx, ggml_cont(ctx, ggml_transpose(ctx, y)), a);
+        }
+
+        struct ggml_tensor * out = ggml_add(ctx, ggml_add(ctx, x, y), z);
+
+        ggml_build_forward_expand(gf, out);
+
+        ok = test_graph("raw-chains", gf, inputs, out, n_threads, 20) && ok;
+    }
+
+    {
+        // Create graph
+        struct ggml_cgraph * gf = ggml_new_graph(ctx);
+
+        // Lots of small, parallel ops where barriers in between will dominate
+        struct ggml_tensor * out = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,  64);
+        for (int i = 0; i < 1000; i++) {
+            struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 64, 128);
+            out = ggml_mul_mat(ctx, a, out);
+
+            struct ggml_tensor * d = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 128, 64);
+            out = ggml_mul_mat(ctx, d, out);
+        }
+
+        ggml_build_forward_expand(gf, out);
+
+        bench_graph("chain", gf, n_threads, n_rounds);
+    }
+
+    {
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx, 16384, false);
+
+        // The attention input of a decoder layer for one token: the Q and K ropes and the K and V cache writes do not
+        // depend on each other, so they do not need barriers between them
+        const int n_embd    = 256;
+        const int n_head    = 4;
+        const int n_embd_kv = 128;
+        const int n_kv      = 256;
+
+        struct ggml_tensor * pos = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
+        ((int32_t *) pos->data)[0] = n_kv - 1;
+
+        struct ggml_tensor * x = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+        for (int i = 0; i < 100; i++) {
+            struct ggml_tensor * wq = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, n_embd, n_embd);
+            struct ggml_tensor * wk = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, n_embd, n_embd_kv);
+            struct ggml_tensor * wv = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, n_embd, n_embd_kv);
+            struct ggml_tensor * wo = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, n_embd, n_embd);
+
+            struct ggml_tensor * k_cache = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_embd_kv, n_kv);
+            struct ggml_tensor * v_cache = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_embd_kv, n_kv);
+
+            struct ggml_tensor * cur = ggml_rms_norm(ctx, x, 1e-6f);
+
+            struct ggml_tensor * q = ggml_reshape_3d(ctx, ggml_mul_mat(ctx, wq, cur), n_embd/n_head, n_head, 1);
+            struct ggml_tensor * k = ggml_reshape_3d(ctx, ggml_mul_mat(ctx, wk, cur), n_embd/n_head, n_embd_kv/(n_embd/n_head), 1);
+            struct ggml_tensor * v = ggml_mul_mat(ctx, wv, cur);
+
+            q = ggml_rope(ctx, q, pos, n_embd/n_head, 0);
+            k = ggml_rope(ctx, k, pos, n_embd/n_head, 0);
+
+            struct ggml_tensor * k_cpy = ggml_cpy(ctx, k, ggml_view_1d(ctx, k_cache, n_embd_kv, (n_kv - 1)*k_cache->nb[1]));
+            struct ggml_tensor * v_cpy = ggml_cpy(ctx, v, ggml_view_1d(ctx, v_cache, n_embd_kv, (n_kv - 1)*v_cache->nb[1]));
+
+            ggml_build_forward_expand(gf, q);
+            ggml_build_forward_expand(gf, k_cpy);
+            ggml_build_forward_expand(gf, v_cpy);
+
+            x = ggml_add(ctx, x, ggml_mul_mat(ctx, wo, ggml_reshape_1d(ctx, q, n_embd)));
+        }
+
+        ggml_build_forward_expand(gf, x);
+
+        bench_graph("attn-input", gf, n_threads, n_rounds);
+    }
+
     ggml_free(ctx);
 
-    return 0;
+    return ok ? 0 : 1;
 }
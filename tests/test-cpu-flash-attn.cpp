@@ -0,0 +1,183 @@
+// compare the CPU flash attention (q/KV tiles, and the KV sequence split between the threads for small batches) with
+// a naive softmax(scale*KQ + mask)*V computed in double precision
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static std::vector<float> rand_data(size_t n) {
+    std::vector<float> res(n);
+    for (auto & v : res) {
+        v = 2.0f*rand()/RAND_MAX - 1.0f;
+    }
+    return res;
+}
+
+// set the data of t and return the values that ggml sees after the conversion to its type
+static std::vector<float> set_data(ggml_tensor * t, const std::vector<float> & data) {
+    const int64_t nrows = ggml_nrows(t);
+    const int64_t n     = t->ne[0];
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+        return data;
+    }
+
+    ggml_quantize_chunk(t->type, data.data(), t->data, 0, nrows, n, nullptr);
+
+    std::vector<float> res(data.size());
+    ggml_get_type_traits(t->type)->to_float(t->data, res.data(), nrows*n);
+    return res;
+}
+
+// normalized mean squared error, as in test-backend-ops
+static double nmse(const std::vector<double> & a, const float * b) {
+    double mse_a_b = 0.0;
+    double mse_a_0 = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        mse_a_b += (a[i] - b[i]) * (a[i] - b[i]);
+        mse_a_0 += a[i] * a[i];
+    }
+    return mse_a_b / mse_a_0;
+}
+
+enum test_mask {
+    MASK_CAUSAL, // the q rows are the last n_q cells
+    MASK_HOLES,  // causal, and a range of whole KV tiles is hidden for every row
+};
+
+static bool test_flash_attn(ggml_type type_kv, int64_t D, int64_t n_head, int64_t n_head_kv, int64_t n_q, int64_t n_kv,
+        test_mask mask_type, int n_threads, double max_err) {
+    ggml_init_params params = {
+        /* .mem_size   = */ 256*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    ggml_context * ctx = ggml_init(params);
+
+    ggml_tensor * q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, D, n_q,  n_head);
+    ggml_tensor * k = ggml_new_tensor_3d(ctx, type_kv,       D, n_kv, n_head_kv);
+    ggml_tensor * v = ggml_new_tensor_3d(ctx, type_kv,       D, n_kv, n_head_kv);
+    ggml_tensor * m = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_kv, GGML_PAD(n_q, GGML_KQ_MASK_PAD));
+
+    const auto qd = set_data(q, rand_data(ggml_nelements(q)));
+    const auto kd = set_data(k, rand_data(ggml_nelements(k)));
+    const auto vd = set_data(v, rand_data(ggml_nelements(v)));
+
+    std::vector<float> md(ggml_nelements(m), -INFINITY);
+    for (int64_t i = 0; i < n_q; ++i) {
+        const int64_t pos = n_kv - n_q + i;
+        for (int64_t j = 0; j <= pos; ++j) {
+            // cells [128, 256) are two whole KV tiles of the CPU backend
+            const bool hole = mask_type == MASK_HOLES && j >= 128 && j < 256;
+            md[i*n_kv + j] = hole ? -INFINITY : 0.0f;
+        }
+    }
+    for (size_t i = 0; i < md.size(); ++i) {
+        ((ggml_fp16_t *) m->data)[i] = ggml_fp32_to_fp16(md[i]);
+    }
+
+    const float scale = 1.0f/sqrtf(D);
+
+    ggml_tensor * out = ggml_flash_attn_ext(ctx, q, k, v, m, scale, 0.0f, 0.0f);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    // out: [D, n_head, n_q]
+    std::vector<double> ref(ggml_nelements(out));
+    std::vector<double> s(n_kv);
+    for (int64_t h = 0; h < n_head; ++h) {
+        const int64_t hk = h/(n_head/n_head_kv);
+        for (int64_t i = 0; i < n_q; ++i) {
+            const float * qr = qd.data() + (h*n_q + i)*D;
+
+            double s_max = -INFINITY;
+            for (int64_t j = 0; j < n_kv; ++j) {
+                const float * kr = kd.data() + (hk*n_kv + j)*D;
+
+                double dot = 0.0;
+                for (int64_t d = 0; d < D; ++d) {
+                    dot += (double) qr[d]*kr[d];
+                }
+                s[j] = scale*dot + md[i*n_kv + j];
+                s_max = std::max(s_max, s[j]);
+            }
+
+            double sum = 0.0;
+            for (int64_t j = 0; j < n_kv; ++j) {
+                s[j] = exp(s[j] - s_max);
+                sum += s[j];
+            }
+
+            double * o = ref.data() + (i*n_head + h)*D;
+            for (int64_t j = 0; j < n_kv; ++j) {
+                const float * vr = vd.data() + (hk*n_kv + j)*D;
+                for (int64_t d = 0; d < D; ++d) {
+                    o[d] += s[j]/sum*vr[d];
+                }
+            }
+        }
+    }
+
+    const double err = nmse(ref, (const float *) out->data);
+
+    const bool ok = err <= max_err;
+
+    printf("%s: type_kv = %4s, D = %3d, n_head = %d/%d, n_q = %3d, n_kv = %4d, mask = %s, n_threads = %d: nmse = %e %s\n",
+            __func__, ggml_type_name(type_kv), (int) D, (int) n_head, (int) n_head_kv, (int) n_q, (int) n_kv,
+            mask_type == MASK_CAUSAL ? "causal" : "holes ", n_threads, err, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(void) {
+    ggml_cpu_init();
+
+    srand(1234);
+
+    int n_failed = 0;
+
+    // F16 K/V are converted to F32 tiles, a quantized K is multiplied in its vec_dot type and V is accumulated with vec_mad
+    const struct {
+        ggml_type type;
+        double    max_err;
+    } types[] = {
+        { GGML_TYPE_F16,  1e-6 },
+        { GGML_TYPE_Q8_0, 5e-4 },
+        { GGML_TYPE_Q4_0, 5e-4 },
+    };
+
+    for (const auto & t : types) {
+        for (test_mask mask_type : { MASK_CAUSAL, MASK_HOLES }) {
+            for (int n_threads : { 1, 4, 8 }) {
+                // decode: one q tile per group of heads, the KV sequence is split with more than one thread
+                n_failed += !test_flash_attn(t.type,  64, 8, 2,  1, 2048, mask_type, n_threads, t.max_err);
+                n_failed += !test_flash_attn(t.type, 128, 4, 4,  1, 1100, mask_type, n_threads, t.max_err);
+
+                // partial q and KV tiles
+                n_failed += !test_flash_attn(t.type,  64, 8, 2,  4,  700, mask_type, n_threads, t.max_err);
+                n_failed += !test_flash_attn(t.type, 128, 4, 1, 37,  300, mask_type, n_threads, t.max_err);
+
+                // more q tiles than threads
+                n_failed += !test_flash_attn(t.type,  64, 4, 4, 96,  352, mask_type, n_threads, t.max_err);
+            }
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+// compare the nodes that the CPU backend computes together (fused) with the same nodes computed one graph at a time
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static void fill(ggml_tensor * t) {
+    std::vector<float> data(ggml_nelements(t));
+    for (auto & v : data) {
+        v = 2.0f*rand()/RAND_MAX - 1.0f;
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        ggml_quantize_chunk(t->type, data.data(), t->data, 0, ggml_nelements(t)/t->ne[0], t->ne[0], nullptr);
+    }
+}
+
+static void compute(ggml_context * ctx, const std::vector<ggml_tensor *> & outs, int n_threads) {
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    for (auto * out : outs) {
+        ggml_build_forward_expand(gf, out);
+    }
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+}
+
+static std::vector<float> get_data(const ggml_tensor * t) {
+    std::vector<float> res(ggml_nelements(t));
+    memcpy(res.data(), t->data, ggml_nbytes(t));
+    return res;
+}
+
+static double max_diff(const std::vector<float> & a, const std::vector<float> & b) {
+    double res = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        res = std::max(res, (double) fabsf(a[i] - b[i]));
+    }
+    return res;
+}
+
+// a leaf with the current data of t, so that a graph with one of its users does not compute t again
+static ggml_tensor * new_leaf(ggml_context * ctx, const ggml_tensor * t) {
+    ggml_tensor * res = ggml_dup_tensor(ctx, t);
+    memcpy(res->data, t->data, ggml_nbytes(t));
+    return res;
+}
+
+static ggml_context * new_ctx() {
+    ggml_init_params params = {
+        /* .mem_size   = */ 256*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    return ggml_init(params);
+}
+
+// the up and gate projections of the experts: two MUL_MAT_ID with the same src1 and ids
+static bool test_mul_mat_id_pair(ggml_type type, int n_tokens, int n_threads) {
+    const int n_embd     = 256;
+    const int n_ff       = 96;
+    const int n_expert   = 8;
+    const int n_exp_used = 2;
+
+    ggml_context * ctx = new_ctx();
+
+    ggml_tensor * up   = ggml_new_tensor_3d(ctx, type, n_embd, n_ff, n_expert);
+    ggml_tensor * gate = ggml_new_tensor_3d(ctx, type, n_embd, n_ff, n_expert);
+    ggml_tensor * cur  = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd, 1, n_tokens);
+    ggml_tensor * ids  = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, n_exp_used, n_tokens);
+
+    fill(up);
+    fill(gate);
+    fill(cur);
+
+    for (int t = 0; t < n_tokens; ++t) {
+        for (int e = 0; e < n_exp_used; ++e) {
+            ((int32_t *) ids->data)[t*n_exp_used + e] = (t + 3*e) % n_expert;
+        }
+    }
+
+    ggml_tensor * out_up   = ggml_mul_mat_id(ctx, up,   cur, ids);
+    ggml_tensor * out_gate = ggml_mul_mat_id(ctx, gate, cur, ids);
+
+    // consecutive nodes - computed together
+    compute(ctx, { out_up, out_gate }, n_threads);
+
+    const auto fused_up   = get_data(out_up);
+    const auto fused_gate = get_data(out_gate);
+
+    // one node per graph
+    compute(ctx, { out_up   }, n_threads);
+    compute(ctx, { out_gate }, n_threads);
+
+    const double err = std::max(max_diff(fused_up, get_data(out_up)), max_diff(fused_gate, get_data(out_gate)));
+
+    const bool ok = err <= 1e-6;
+
+    printf("%s: type = %4s, n_tokens = %3d, n_threads = %d: max diff = %e %s\n", __func__,
+            ggml_type_name(type), n_tokens, n_threads, err, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+// the residual add and the norm of the next block: ADD -> RMS_NORM -> MUL, or only RMS_NORM -> MUL
+static bool test_add_rms_norm_mul(bool with_add, int n_rows, int n_threads) {
+    const int   n_embd = 512;
+    const float eps    = 1e-6f;
+
+    ggml_context * ctx = new_ctx();
+
+    ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_rows);
+    ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_rows);
+    ggml_tensor * w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+
+    fill(a);
+    fill(b);
+    fill(w);
+
+    ggml_tensor * x    = with_add ? ggml_add(ctx, a, b) : a;
+    ggml_tensor * norm = ggml_rms_norm(ctx, x, eps);
+    ggml_tensor * out  = ggml_mul(ctx, norm, w);
+
+    // consecutive nodes - computed together
+    compute(ctx, { out }, n_threads);
+
+    const auto fused_x   = get_data(x);
+    const auto fused_out = get_data(out);
+
+    // one node per graph
+    ggml_tensor * ref_x = with_add ? ggml_add(ctx, a, b) : a;
+    if (with_add) {
+        compute(ctx, { ref_x }, n_threads);
+    }
+
+    ggml_tensor * ref_norm = ggml_rms_norm(ctx, new_leaf(ctx, ref_x), eps);
+    compute(ctx, { ref_norm }, n_threads);
+
+    ggml_tensor * ref_out = ggml_mul(ctx, new_leaf(ctx, ref_norm), w);
+    compute(ctx, { ref_out }, n_threads);
+
+    const double err = std::max(max_diff(fused_x, get_data(ref_x)), max_diff(fused_out, get_data(ref_out)));
+
+    const bool ok = err <= 1e-5;
+
+    printf("%s: add = %d, n_rows = %3d, n_threads = %d: max diff = %e %s\n", __func__,
+            with_add, n_rows, n_threads, err, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(void) {
+    ggml_cpu_init();
+
+    srand(1234);
+
+    int n_failed = 0;
+
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_Q4_0, GGML_TYPE_Q8_0 }) {
+        for (int n_tokens : { 1, 7, 64 }) {
+            for (int n_threads : { 1, 4 }) {
+                n_failed += !test_mul_mat_id_pair(type, n_tokens, n_threads);
+            }
+        }
+    }
+
+    for (bool with_add : { false, true }) {
+        for (int n_rows : { 1, 7, 64 }) {
+            for (int n_threads : { 1, 4 }) {
+                n_failed += !test_add_rms_norm_mul(with_add, n_rows, n_threads);
+            }
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    return 0;
+}
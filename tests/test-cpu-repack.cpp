@@ -0,0 +1,175 @@
+// compare the mul_mat of weights in the CPU_REPACK buffer type (interleaved gemv/gemm kernels) with the same weights in a
+// plain CPU buffer, with the kernels of this CPU and with the generic kernels
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// ggml-cpu/repack.h
+extern bool ggml_repack_set_generic_testing(struct ggml_tensor * tensor);
+
+static std::vector<float> rand_data(size_t n) {
+    std::vector<float> res(n);
+    for (auto & v : res) {
+        v = 2.0f*rand()/RAND_MAX - 1.0f;
+    }
+    return res;
+}
+
+// normalized mean squared error, as in test-backend-ops
+static double nmse(const std::vector<float> & a, const std::vector<float> & b) {
+    double mse_a_b = 0.0;
+    double mse_a_0 = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        mse_a_b += (a[i] - b[i]) * (a[i] - b[i]);
+        mse_a_0 += a[i] * a[i];
+    }
+    return mse_a_b / mse_a_0;
+}
+
+static std::vector<float> get_data(const ggml_tensor * t) {
+    std::vector<float> res(ggml_nelements(t));
+    ggml_backend_tensor_get(t, res.data(), 0, ggml_nbytes(t));
+    return res;
+}
+
+static ggml_context * new_ctx() {
+    ggml_init_params params = {
+        /* .mem_size   = */ 16*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+    return ggml_init(params);
+}
+
+static ggml_backend_buffer_type_t get_repack_buft() {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (get_extra_bufts == nullptr) {
+        return nullptr;
+    }
+
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+        if (strcmp(ggml_backend_buft_name(*buft), "CPU_REPACK") == 0) {
+            return *buft;
+        }
+    }
+
+    return nullptr;
+}
+
+// n_tokens == 1 uses the gemv kernel, larger batches the gemm kernel for each 4 rows and gemv for the rest
+// generic: use the generic kernels of the layout instead of the kernels of this CPU
+static bool test_mul_mat(ggml_backend_t backend, ggml_backend_buffer_type_t repack_buft, ggml_type type, int n_tokens, int n_threads, bool generic) {
+    const int n_embd = 512;
+    const int n_out  = 72; // the AVX-512 kernels take 16 columns at a time, and a block of 8 for the rest
+
+    ggml_context * ctx_w = new_ctx();
+    ggml_context * ctx   = new_ctx();
+
+    ggml_tensor * w     = ggml_new_tensor_2d(ctx_w, type, n_embd, n_out);
+    ggml_tensor * w_ref = ggml_new_tensor_2d(ctx,   type, n_embd, n_out);
+    ggml_tensor * x     = ggml_new_tensor_2d(ctx,   GGML_TYPE_F32, n_embd, n_tokens);
+
+    ggml_tensor * out     = ggml_mul_mat(ctx, w,     x);
+    ggml_tensor * out_ref = ggml_mul_mat(ctx, w_ref, x);
+
+    ggml_backend_buffer_t buf_w = ggml_backend_alloc_ctx_tensors_from_buft(ctx_w, repack_buft);
+    ggml_backend_buffer_t buf   = ggml_backend_alloc_ctx_tensors(ctx, backend);
+
+    // the buffer sets the repack traits of the weight only if this CPU has kernels for its type
+    if (generic) {
+        GGML_ASSERT(ggml_repack_set_generic_testing(w));
+    } else if (w->extra == nullptr) {
+        printf("%s: type = %4s: not repacked on this CPU, skipping\n", __func__, ggml_type_name(type));
+
+        ggml_backend_buffer_free(buf_w);
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx_w);
+        ggml_free(ctx);
+
+        return true;
+    }
+
+    {
+        const auto data = rand_data(ggml_nelements(w));
+
+        std::vector<uint8_t> q(ggml_nbytes(w));
+        ggml_quantize_chunk(type, data.data(), q.data(), 0, n_out, n_embd, nullptr);
+
+        // the repack buffer interleaves the rows while setting the data
+        ggml_backend_tensor_set(w,     q.data(), 0, q.size());
+        ggml_backend_tensor_set(w_ref, q.data(), 0, q.size());
+    }
+    {
+        const auto data = rand_data(ggml_nelements(x));
+        ggml_backend_tensor_set(x, data.data(), 0, ggml_nbytes(x));
+    }
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+    ggml_build_forward_expand(gf, out_ref);
+
+    ggml_backend_cpu_set_n_threads(backend, n_threads);
+    ggml_backend_graph_compute(backend, gf);
+
+    const double err = nmse(get_data(out_ref), get_data(out));
+
+    const bool ok = err <= 1e-10;
+
+    printf("%s: type = %4s, n_tokens = %3d, n_threads = %d%s: nmse = %e %s\n", __func__,
+            ggml_type_name(type), n_tokens, n_threads, generic ? ", generic" : "", err, ok ? "OK" : "FAILED");
+
+    ggml_backend_buffer_free(buf_w);
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx_w);
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(void) {
+    ggml_backend_buffer_type_t repack_buft = get_repack_buft();
+    if (repack_buft == nullptr) {
+        printf("no CPU_REPACK buffer type, skipping\n");
+        return 0;
+    }
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+
+    srand(1234);
+
+    int n_failed = 0;
+
+    for (ggml_type type : { GGML_TYPE_Q8_0, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K }) {
+        for (int n_tokens : { 1, 4, 7, 32 }) {
+            for (int n_threads : { 1, 4 }) {
+                n_failed += !test_mul_mat(backend, repack_buft, type, n_tokens, n_threads, false);
+            }
+        }
+    }
+
+    for (ggml_type type : { GGML_TYPE_Q8_0, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K }) {
+        for (int n_tokens : { 1, 7 }) {
+            n_failed += !test_mul_mat(backend, repack_buft, type, n_tokens, 4, true);
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+// Benchmark the grammar sampler on JSON schema constrained output over the full vocabulary
+
+#include "llama.h"
+#include "common.h"
+#include "json-schema-to-grammar.h"
+
+#include <nlohmann/json.hpp>
+
+#undef NDEBUG
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char * schema_str = R"""({
+    "type": "object",
+    "properties": {
+        "name":    { "type": "string" },
+        "age":     { "type": "integer", "minimum": 0 },
+        "score":   { "type": "number" },
+        "active":  { "type": "boolean" },
+        "tags":    { "type": "array", "items": { "type": "string" } },
+        "address": {
+            "type": "object",
+            "properties": {
+                "street": { "type": "string" },
+                "city":   { "type": "string" },
+                "zip":    { "type": "string", "pattern": "^[0-9]{5}$" }
+            },
+            "required": ["street", "city", "zip"],
+            "additionalProperties": false
+        }
+    },
+    "required": ["name", "age", "score", "active", "tags", "address"],
+    "additionalProperties": false
+})""";
+
+static const char * doc_str = R"""({"name": "Alice Smith", "age": 42, "score": 97.25, "active": true, "tags": ["admin", "editor", "reviewer of the quarterly reports"], "address": {"street": "1234 Elm Street, Apartment 56", "city": "Springfield", "zip": "12345"}})""";
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <vocab-file> [n_docs]\n", argv[0]);
+        return 1;
+    }
+
+    const char * vocab_file = argv[1];
+    const int    n_docs     = argc > 2 ? std::atoi(argv[2]) : 8;
+
+    llama_backend_init();
+
+    auto mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_model_load_from_file(vocab_file, mparams);
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load vocab '%s'\n", __func__, vocab_file);
+        return 1;
+    }
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+
+    const std::string grammar_str = json_schema_to_grammar(nlohmann::ordered_json::parse(schema_str));
+
+    const std::vector<llama_token> tokens = common_tokenize(vocab, doc_str, false, false);
+
+    llama_sampler * smpl = llama_sampler_init_grammar(vocab, grammar_str.c_str(), "root");
+    assert(smpl != nullptr);
+
+    // reference for the first document: with few candidates, the tokens are matched one by one
+    llama_sampler * smpl_ref = llama_sampler_init_grammar(vocab, grammar_str.c_str(), "root");
+    assert(smpl_ref != nullptr);
+
+    std::vector<llama_token_data> cur(n_vocab);
+    std::vector<llama_token_data> sub;
+
+    int64_t t_first = 0;
+    int64_t t_total = 0;
+
+    for (int d = 0; d < n_docs; d++) {
+        llama_sampler_reset(smpl);
+
+        for (size_t i = 0; i < tokens.size(); i++) {
+            for (llama_token id = 0; id < n_vocab; id++) {
+                cur[id] = llama_token_data{id, 0.0f, 0.0f};
+            }
+            llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+
+            const int64_t t_start = ggml_time_us();
+            llama_sampler_apply(smpl, &cur_p);
+            const int64_t t_apply = ggml_time_us() - t_start;
+
+            if (d == 0) {
+                t_first += t_apply;
+            }
+            t_total += t_apply;
+
+            if (std::isinf(cur[tokens[i]].logit)) {
+                fprintf(stderr, "%s: error: token %zu (%d) of the document was rejected by the grammar\n", __func__, i, tokens[i]);
+                return 1;
+            }
+
+            // a few candidates must give the same result as the full vocabulary
+            if (d == 0) {
+                sub.clear();
+                for (int j = 0; j < 256; j++) {
+                    sub.push_back(llama_token_data{(llama_token) ((tokens[i] + 397*j) % n_vocab), 0.0f, 0.0f});
+                }
+                llama_token_data_array sub_p = { sub.data(), sub.size(), -1, false };
+                llama_sampler_apply(smpl_ref, &sub_p);
+                llama_sampler_accept(smpl_ref, tokens[i]);
+
+                for (const auto & td : sub) {
+                    if (std::isinf(td.logit) != std::isinf(cur[td.id].logit)) {
+                        fprintf(stderr, "%s: error: token %d differs between the full vocabulary and a subset\n", __func__, td.id);
+                        return 1;
+                    }
+                }
+            }
+
+            llama_sampler_accept(smpl, tokens[i]);
+        }
+    }
+
+    // with the masks prepared after each accept (on a worker thread, while the model is evaluated), only the lookup remains
+    llama_sampler * smpl_prep = llama_sampler_init_grammar(vocab, grammar_str.c_str(), "root");
+    assert(smpl_prep != nullptr);
+
+    int64_t t_prepare  = 0;
+    int64_t t_prepared = 0;
+
+    for (size_t i = 0; i < tokens.size(); i++) {
+        int64_t t_start = ggml_time_us();
+        std::thread worker(llama_sampler_grammar_prepare, smpl_prep);
+        worker.join();
+        t_prepare += ggml_time_us() - t_start;
+
+        for (llama_token id = 0; id < n_vocab; id++) {
+            cur[id] = llama_token_data{id, 0.0f, 0.0f};
+        }
+        llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+
+        t_start = ggml_time_us();
+        llama_sampler_apply(smpl_prep, &cur_p);
+        t_prepared += ggml_time_us() - t_start;
+
+        if (std::isinf(cur[tokens[i]].logit)) {
+            fprintf(stderr, "%s: error: token %zu (%d) of the document was rejected by the prepared grammar\n", __func__, i, tokens[i]);
+            return 1;
+        }
+
+        llama_sampler_accept(smpl_prep, tokens[i]);
+    }
+
+    printf("n_vocab = %d, n_tokens = %zu, n_docs = %d\n", n_vocab, tokens.size(), n_docs);
+    printf("%-30s: %10.3f us/token\n", "first document",  t_first / (double) tokens.size());
+    printf("%-30s: %10.3f us/token\n", "all documents",   t_total / (double) (tokens.size()*n_docs));
+    printf("%-30s: %10.3f us/token\n", "prepare (worker thread)", t_prepare  / (double) tokens.size());
+    printf("%-30s: %10.3f us/token\n", "apply after prepare",     t_prepared / (double) tokens.size());
+
+    llama_sampler_free(smpl_prep);
+    llama_sampler_free(smpl);
+    llama_sampler_free(smpl_ref);
+    llama_model_free(model);
+
+    return 0;
+}
@@ -23,6 +23,7 @@ constexpr float MAX_QUANTIZATION_TOTAL_ERROR_3BITS_XXS = 0.0050f;
 constexpr float MAX_DOT_PRODUCT_ERROR = 0.02f;
 constexpr float MAX_DOT_PRODUCT_ERROR_LOWBIT = 0.04f;
 constexpr float MAX_DOT_PRODUCT_ERROR_TERNARY = 0.15f;
+constexpr float MAX_VEC_MAD_ERROR = 0.00001f;
 
 static const char* RESULT_STR[] = {"ok", "FAILED"};
 
@@ -98,6 +99,27 @@ static float dot_product_error(const ggml_type_traits * qfns, const ggml_type_tr
     return fabsf(result - dot_ref) / test_size;
 }
 
+// Multiply-add error of a quantized row against the dequantized row
+static float vec_mad_error(const ggml_type_traits * qfns, const ggml_type_traits_cpu * qfns_cpu, size_t test_size, const float * test_data1, const float * test_data2) {
+    std::vector<uint8_t> tmp_q(2*test_size);
+    std::vector<float> tmp_x(test_size);
+
+    qfns_cpu->from_float(test_data1, tmp_q.data(), test_size);
+    qfns->to_float(tmp_q.data(), tmp_x.data(), test_size);
+
+    const float v = 0.7f;
+
+    std::vector<float> result(test_data2, test_data2 + test_size);
+    qfns_cpu->vec_mad(test_size, result.data(), tmp_q.data(), v);
+
+    std::vector<float> result_ref(test_size);
+    for (size_t i = 0; i < test_size; i++) {
+        result_ref[i] = test_data2[i] + v*tmp_x[i];
+    }
+
+    return array_rmse(result.data(), result_ref.data(), test_size);
+}
+
 int main(int argc, char * argv[]) {
     bool verbose = false;
     const size_t test_size = 32 * 128;
@@ -175,6 +197,18 @@ int main(int argc, char * argv[]) {
             if (failed || verbose) {
                 printf("%5s dot product error:              %s (%f)\n", ggml_type_name(type), RESULT_STR[failed], vec_dot_error);
             }
+
+            if (qfns_cpu->vec_mad) {
+                // also a row that is not a multiple of the SIMD width
+                for (size_t n : { test_size, test_size - qfns->blck_size }) {
+                    const float mad_error = vec_mad_error(qfns, qfns_cpu, n, test_data.data(), test_data2.data());
+                    failed = !(mad_error < MAX_VEC_MAD_ERROR);
+                    num_failed += failed;
+                    if (failed || verbose) {
+                        printf("%5s vec mad error (n = %4zu):       %s (%f)\n", ggml_type_name(type), n, RESULT_STR[failed], mad_error);
+                    }
+                }
+            }
         }
     }
 
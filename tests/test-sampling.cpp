@@ -48,8 +48,19 @@ struct sampler_tester {
 
     void check() {
         GGML_ASSERT(cur_p.size == probs_expected.size());
+
+        std::vector<float> probs(cur_p.size);
+        for (size_t i = 0; i < cur_p.size; i++) {
+            probs[i] = cur_p.data[i].p;
+        }
+
+        // the dist sampler does not sort the tokens, the expected probabilities are in descending order
+        if (!cur_p.sorted) {
+            std::sort(probs.begin(), probs.end(), std::greater<float>());
+        }
+
         for (size_t i = 0; i < cur_p.size; i++) {
-            GGML_ASSERT(fabs(cur_p.data[i].p - probs_expected[i]) < 1e-5);
+            GGML_ASSERT(fabs(probs[i] - probs_expected[i]) < 1e-5);
         }
     }
 
@@ -213,6 +224,18 @@ static void test_sampler_queue(const size_t n_vocab, const std::string & sampler
 
         auto & cur_p = tester.cur_p;
 
+        // the dist sampler does not sort the tokens, but a sampler that flags them as sorted must have sorted them
+        if (cur_p.sorted) {
+            for (size_t i = 1; i < cur_p.size; i++) {
+                GGML_ASSERT(cur_p.data[i - 1].logit >= cur_p.data[i].logit);
+            }
+        } else {
+            std::sort(cur_p.data, cur_p.data + cur_p.size, [](const llama_token_data & a, const llama_token_data & b) {
+                return a.logit > b.logit;
+            });
+            cur_p.sorted = true;
+        }
+
         const int size = cur_p.size;
 
         if (s == 'k') {
@@ -267,6 +290,75 @@ static void test_sampler_queue(const size_t n_vocab, const std::string & sampler
            samplers_sequence.c_str(), n_vocab, top_k, top_p, min_p);
 }
 
+// top-k, top-p and min-p have fast paths for unsorted candidates that do not sort the full vocabulary, they must keep
+// the same tokens with the same probabilities as the sorted paths, which are taken when the candidates are sorted first
+static void test_sampler_chain_unsorted(const size_t n_vocab, const std::string & samplers_sequence, const int top_k, const float top_p, const float min_p, const float temp) {
+    std::vector<llama_token_data> data;
+    for (size_t i = 0; i < n_vocab; i++) {
+        data.push_back(llama_token_data{(llama_token) i, 8.0f*((float) rand()/RAND_MAX - 0.5f), 0.0f});
+    }
+
+    const auto apply = [&](llama_token_data_array * cur_p) {
+        llama_sampler * chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+        for (auto s : samplers_sequence) {
+            switch (s) {
+                case 'k': llama_sampler_chain_add(chain, llama_sampler_init_top_k(top_k));    break;
+                case 'p': llama_sampler_chain_add(chain, llama_sampler_init_top_p(top_p, 1)); break;
+                case 'm': llama_sampler_chain_add(chain, llama_sampler_init_min_p(min_p, 1)); break;
+                case 't': llama_sampler_chain_add(chain, llama_sampler_init_temp(temp));      break;
+                default : GGML_ABORT("Unknown sampler");
+            }
+        }
+        llama_sampler_chain_add(chain, llama_sampler_init_dist(0));
+
+        llama_sampler_apply(chain, cur_p);
+        llama_sampler_free(chain);
+
+        GGML_ASSERT(cur_p->selected >= 0 && (size_t) cur_p->selected < cur_p->size);
+    };
+
+    std::vector<llama_token_data> cur = data;
+    llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+    apply(&cur_p);
+
+    std::vector<llama_token_data> cur_ref = data;
+    std::sort(cur_ref.begin(), cur_ref.end(), [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit;
+    });
+    llama_token_data_array cur_p_ref = { cur_ref.data(), cur_ref.size(), -1, true };
+    apply(&cur_p_ref);
+
+    GGML_ASSERT(cur_p.size == cur_p_ref.size);
+
+    std::vector<float> probs_ref(n_vocab, -1.0f);
+    for (size_t i = 0; i < cur_p_ref.size; i++) {
+        probs_ref[cur_p_ref.data[i].id] = cur_p_ref.data[i].p;
+    }
+    for (size_t i = 0; i < cur_p.size; i++) {
+        const float p_ref = probs_ref[cur_p.data[i].id];
+        GGML_ASSERT(p_ref >= 0.0f);
+        GGML_ASSERT(fabs(cur_p.data[i].p - p_ref) <= 1e-6f + 1e-5f*p_ref);
+    }
+
+    printf("Sampler chain %4s OK with n_vocab=%05zu top_k=%05d top_p=%f min_p=%f temp=%f, %zu tokens kept\n",
+           samplers_sequence.c_str(), n_vocab, top_k, top_p, min_p, temp, cur_p.size);
+}
+
+// the sampler chain of common_sampler with the default parameters
+static llama_sampler * sampler_chain(int32_t top_k, float top_p, float min_p) {
+    llama_sampler * chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+
+    llama_sampler_chain_add(chain, llama_sampler_init_penalties(64, 1.0f, 0.0f, 0.0f));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_k(top_k));
+    llama_sampler_chain_add(chain, llama_sampler_init_typical(1.0f, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_p(top_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_min_p(min_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(0.8f));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(1));
+
+    return chain;
+}
+
 static void bench(llama_sampler * cnstr, const char * cnstr_name, const std::vector<llama_token_data> & data, int n_iter) {
     std::vector<llama_token_data> cur(data.size());
     std::copy(data.begin(), data.end(), cur.begin());
@@ -303,6 +395,10 @@ static void test_perf() {
     BENCH(llama_sampler_init_min_p  (0.2f, 1),                data, 32);
     BENCH(llama_sampler_init_typical(0.5f, 1),                data, 32);
     BENCH(llama_sampler_init_xtc    (1.0f, 0.1f, 1, 1),       data, 32);
+    BENCH(llama_sampler_init_dist   (1),                      data, 32);
+    BENCH(llama_sampler_init_top_k  (1000),                   data, 32);
+    BENCH(sampler_chain(40, 0.95f, 0.05f),                    data, 32);
+    BENCH(sampler_chain( 0, 0.95f, 0.05f),                    data, 32);
 }
 
 int main(void) {
@@ -392,6 +488,15 @@ int main(void) {
     test_sampler_queue(10000, "mkp", 100, 0.8f, 0.1f);
     test_sampler_queue(10000, "mpk", 100, 0.8f, 0.1f);
 
+    test_sampler_chain_unsorted(32000, "kpmt",    40, 0.95f, 0.05f, 0.8f);
+    test_sampler_chain_unsorted(32000, "kpmt",     0, 0.95f, 0.05f, 0.8f);
+    test_sampler_chain_unsorted(32000, "tkpm",    40, 0.90f, 0.00f, 1.5f);
+    test_sampler_chain_unsorted(32000, "tkpm",  1000, 0.90f, 0.00f, 1.5f);
+    test_sampler_chain_unsorted(32000, "pkm",   5000, 0.50f, 0.50f, 1.0f);
+    test_sampler_chain_unsorted(32000, "mp",       0, 0.99f, 0.01f, 1.0f);
+    test_sampler_chain_unsorted(32000, "t",        0, 1.00f, 0.00f, 0.5f);
+    test_sampler_chain_unsorted(   10, "pmt",      0, 0.00f, 0.00f, 1.0f);
+
     printf("OK\n");
 
     test_perf();
@@ -0,0 +1,183 @@
+// test the verification of a tree of draft tokens: common_speculative_tree_batch, common_sampler_sample_and_accept_tree
+// and common_speculative_tree_accept, with the accepted path in the first branch, in a later branch and empty
+
+#include "llama.h"
+#include "common.h"
+#include "sampling.h"
+#include "speculative.h"
+#include "get-model.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#undef NDEBUG
+#include <cassert>
+
+static llama_token argmax(llama_context * ctx, int idx) {
+    const int     n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+    const float * logits  = llama_get_logits_ith(ctx, idx);
+
+    return std::max_element(logits, logits + n_vocab) - logits;
+}
+
+static void test_tree(
+        llama_context * ctx,
+        common_sampler * smpl,
+        llama_batch & batch,
+        const char * name,
+        const common_speculative_tree & tree,
+        llama_token id_last,
+        llama_pos n_past,
+        const llama_tokens & expected,
+        const llama_tokens & ref) {
+    llama_memory_t mem = llama_get_memory(ctx);
+
+    const std::vector<llama_seq_id> seq_ids = { 0, 1, 2 };
+
+    common_speculative_tree_batch(mem, batch, tree, id_last, n_past, seq_ids);
+
+    assert(batch.n_tokens == (int) tree.tokens.size() + 1);
+    assert(llama_decode(ctx, batch) == 0);
+
+    common_sampler_reset(smpl);
+
+    const auto ids = common_sampler_sample_and_accept_tree(smpl, ctx, tree.tokens, tree.parents);
+
+    fprintf(stderr, "%s: accepted %zu of %zu tokens\n", __func__, ids.size() - 1, tree.tokens.size());
+
+    if (ids != expected) {
+        fprintf(stderr, "%s: %s: unexpected accepted tokens\n", __func__, name);
+        exit(1);
+    }
+
+    common_speculative_tree_accept(mem, tree, ids, n_past, seq_ids);
+
+    // only the last token and the accepted path remain, in the main sequence
+    const llama_pos p_end = n_past + ids.size();
+
+    assert(llama_memory_seq_pos_max(mem, 0) == p_end - 1);
+    for (size_t b = 1; b < seq_ids.size(); ++b) {
+        assert(llama_memory_seq_pos_max(mem, seq_ids[b]) == -1);
+    }
+
+    // the continuation after the accepted tokens matches the reference
+    common_batch_clear(batch);
+    common_batch_add  (batch, ids.back(), p_end, { 0 }, true);
+
+    assert(llama_decode(ctx, batch) == 0);
+
+    if (argmax(ctx, 0) != ref[ids.size()]) {
+        fprintf(stderr, "%s: %s: the continuation does not match the reference\n", __func__, name);
+        exit(1);
+    }
+
+    llama_memory_seq_rm(mem, 0, n_past, -1);
+
+    fprintf(stderr, "%s: %s: OK\n", __func__, name);
+}
+
+int main(int argc, char ** argv) {
+    auto * model_path = get_model_or_exit(argc, argv);
+
+    llama_backend_init();
+
+    auto * model = llama_model_load_from_file(model_path, llama_model_default_params());
+    if (model == nullptr) {
+        fprintf(stderr, "%s: failed to load model '%s'\n", __func__, model_path);
+        return 1;
+    }
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+
+    auto cparams = llama_context_default_params();
+    cparams.n_ctx     = 256;
+    cparams.n_batch   = 64;
+    cparams.n_seq_max = 3;
+
+    auto * ctx = llama_init_from_model(model, cparams);
+
+    common_params_sampling sparams;
+    sparams.samplers = { COMMON_SAMPLER_TYPE_TOP_K };
+    sparams.top_k    = 1;
+
+    auto * smpl = common_sampler_init(model, sparams);
+
+    llama_batch batch = llama_batch_init(64, 0, 3);
+
+    llama_tokens prompt = { llama_vocab_bos(vocab) };
+    for (int i = 0; i < 7; ++i) {
+        prompt.push_back((17*i + 5) % n_vocab);
+    }
+
+    const llama_token id_last = prompt.back();
+    const llama_pos   n_past  = prompt.size() - 1;
+
+    common_batch_clear(batch);
+    for (llama_pos i = 0; i < n_past; ++i) {
+        common_batch_add(batch, prompt[i], i, { 0 }, false);
+    }
+    assert(llama_decode(ctx, batch) == 0);
+
+    // reference greedy continuation of the prompt, decoded one token at a time in a separate sequence
+    llama_tokens ref;
+    {
+        llama_memory_seq_cp(llama_get_memory(ctx), 0, 2, -1, -1);
+
+        llama_token id = id_last;
+        for (int i = 0; i < 5; ++i) {
+            common_batch_clear(batch);
+            common_batch_add  (batch, id, n_past + i, { 2 }, true);
+            assert(llama_decode(ctx, batch) == 0);
+
+            id = argmax(ctx, 0);
+            ref.push_back(id);
+        }
+
+        llama_memory_seq_rm(llama_get_memory(ctx), 2, -1, -1);
+    }
+
+    // a token that is not the reference
+    const auto other = [&](llama_token id) { return (id + 1) % n_vocab; };
+
+    // the first branch is accepted entirely, the second one splits after its first token
+    {
+        common_speculative_tree tree;
+        tree.tokens  = { ref[0], ref[1], ref[2], other(ref[1]) };
+        tree.parents = { -1,     0,      1,      0             };
+        tree.leaves  = { 2, 3 };
+
+        test_tree(ctx, smpl, batch, "first branch", tree, id_last, n_past, { ref[0], ref[1], ref[2], ref[3] }, ref);
+    }
+
+    // the accepted path is in the second of three branches
+    {
+        common_speculative_tree tree;
+        tree.tokens  = { other(ref[0]), ref[0], ref[1], other(ref[2]), ref[0], other(ref[1]) };
+        tree.parents = { -1,            -1,     1,      2,             0,      -1            };
+        tree.leaves  = { 4, 3, 5 };
+
+        test_tree(ctx, smpl, batch, "later branch", tree, id_last, n_past, { ref[0], ref[1], ref[2] }, ref);
+    }
+
+    // no token of the tree is accepted
+    {
+        common_speculative_tree tree;
+        tree.tokens  = { other(ref[0]), ref[1], other(other(ref[0])) };
+        tree.parents = { -1,            0,      -1                   };
+        tree.leaves  = { 1, 2 };
+
+        test_tree(ctx, smpl, batch, "empty", tree, id_last, n_past, { ref[0] }, ref);
+    }
+
+    llama_batch_free(batch);
+    common_sampler_free(smpl);
+    llama_free(ctx);
+    llama_model_free(model);
+    llama_backend_free();
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// a chain of matrix multiplications, so that the threads meet in many barriers
+struct test_graph {
+    ggml_context * ctx = nullptr;
+    ggml_cgraph  * gf  = nullptr;
+    ggml_tensor  * out = nullptr;
+
+    test_graph(int seed, int n_layers) {
+        ggml_init_params params = {
+            /* .mem_size   = */ 64*1024*1024,
+            /* .mem_buffer = */ NULL,
+            /* .no_alloc   = */ false,
+        };
+        ctx = ggml_init(params);
+
+        srand(seed);
+
+        ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 128, 4);
+        fill(x);
+
+        out = x;
+        for (int i = 0; i < n_layers; i++) {
+            ggml_tensor * w = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 128, 128);
+            fill(w);
+            out = ggml_tanh(ctx, ggml_mul_mat(ctx, w, out));
+        }
+
+        gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, out);
+    }
+
+    ~test_graph() {
+        ggml_free(ctx);
+    }
+
+    static void fill(ggml_tensor * t) {
+        float * data = (float *) t->data;
+        for (int64_t i = 0; i < ggml_nelements(t); i++) {
+            data[i] = (float) rand() / RAND_MAX - 0.5f;
+        }
+    }
+
+    std::vector<float> compute(ggml_threadpool * threadpool, int n_threads) {
+        ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+
+        std::vector<uint8_t> work_data(cplan.work_size);
+        cplan.work_data = work_data.data();
+
+        if (ggml_graph_compute(gf, &cplan) != GGML_STATUS_SUCCESS) {
+            return {};
+        }
+
+        const float * data = (const float *) out->data;
+        return std::vector<float>(data, data + ggml_nelements(out));
+    }
+};
+
+static bool check(const char * name, const std::vector<float> & res, const std::vector<float> & ref) {
+    bool ok = res.size() == ref.size();
+    for (size_t i = 0; ok && i < ref.size(); i++) {
+        ok = std::fabs(res[i] - ref[i]) <= 1e-5f;
+    }
+    printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+    int n_threads = 6;
+    int n_rounds  = 20;
+
+    if (argc > 1) {
+        n_threads = std::atoi(argv[1]);
+    }
+
+    if (argc > 2) {
+        n_rounds  = std::atoi(argv[2]);
+    }
+
+    if (n_threads < 3) {
+        fprintf(stderr, "need at least 3 threads\n");
+        return 1;
+    }
+
+    test_graph g0(1, 64);
+    test_graph g1(2, 48);
+
+    const std::vector<float> ref0 = g0.compute(nullptr, 1);
+    const std::vector<float> ref1 = g1.compute(nullptr, 1);
+
+    ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+    ggml_threadpool * threadpool = ggml_threadpool_new(&tpp);
+    if (!threadpool) {
+        fprintf(stderr, "threadpool create failed : n_threads %d\n", n_threads);
+        return 1;
+    }
+
+    bool ok = check("threadpool", g0.compute(threadpool, n_threads), ref0);
+
+    // two partitions, each with its own calling thread as thread 0: workers [1, n0) and [n0, n_threads - 1)
+    const int n0 = n_threads/2;
+    const int n1 = n_threads - n0;
+
+    ggml_threadpool * part0 = ggml_threadpool_new_partition(threadpool, 1,  n0);
+    ggml_threadpool * part1 = ggml_threadpool_new_partition(threadpool, n0, n1);
+    if (!part0 || !part1) {
+        fprintf(stderr, "partition create failed\n");
+        return 1;
+    }
+
+    // partitions must fit in the workers of the threadpool
+    ok = ggml_threadpool_new_partition(threadpool, n0, n_threads) == nullptr && ok;
+
+    std::vector<float> res0;
+    std::vector<float> res1;
+    bool ok0 = true;
+    bool ok1 = true;
+
+    std::thread t0([&]() {
+        for (int i = 0; i < n_rounds; i++) {
+            res0 = g0.compute(part0, n0);
+            ok0 = ok0 && res0 == g0.compute(part0, n0);
+        }
+    });
+    std::thread t1([&]() {
+        for (int i = 0; i < n_rounds; i++) {
+            res1 = g1.compute(part1, n1);
+            ok1 = ok1 && res1 == g1.compute(part1, n1);
+        }
+    });
+    t0.join();
+    t1.join();
+
+    ok = check("partition 0", ok0 ? res0 : std::vector<float>(), ref0) && ok;
+    ok = check("partition 1", ok1 ? res1 : std::vector<float>(), ref1) && ok;
+
+    // the workers return to the threadpool
+    ggml_threadpool_free(part0);
+    ggml_threadpool_free(part1);
+
+    ok = check("threadpool after partitions", g1.compute(threadpool, n_threads), ref1) && ok;
+
+    ggml_threadpool_free(threadpool);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+// multi-producer microbenchmark of server_queue and server_response
+//
+// each producer thread plays an HTTP thread: it posts a completion task and receives the streamed results of the task
+// one by one. a single main loop plays update_slots(): every iteration it sends one result to each active request, and
+// the last one is the final result. no model is loaded, so this only measures the task and result queues.
+//
+// build with -DLLAMA_SERVER_BENCH=ON
+// usage: llama-server-bench-queue [n_results_per_request] [n_requests_per_producer]
+
+#include "server-queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// the queues only look at the ids, the type and the priority, so the benchmark uses its own small task and result types
+enum bench_task_type {
+    BENCH_TASK_TYPE_COMPLETION,
+    BENCH_TASK_TYPE_NEXT_RESPONSE,
+};
+
+struct bench_task {
+    int id        = -1;
+    int id_target = -1;
+
+    bench_task_type type;
+
+    bench_task(bench_task_type type) : type(type) {}
+
+    bool is_cancel() const {
+        return false;
+    }
+
+    int get_priority() const {
+        return 0;
+    }
+};
+
+struct bench_task_result {
+    int  id   = -1;
+    bool stop = false;
+};
+
+struct bench_result {
+    int     n_requests;
+    int64_t n_results;
+    int64_t t_us;
+};
+
+static bench_result bench_queue(int n_producers, int n_requests, int n_results) {
+    server_queue_t<bench_task>           queue_tasks;
+    server_response_t<bench_task_result> queue_results;
+
+    // id_task -> number of results sent
+    std::vector<std::pair<int, int>> active;
+
+    queue_tasks.on_new_task([&](bench_task && task) {
+        if (task.type == BENCH_TASK_TYPE_COMPLETION) {
+            active.emplace_back(task.id, 0);
+        }
+    });
+
+    queue_tasks.on_update_slots([&]() {
+        if (active.empty()) {
+            return;
+        }
+
+        for (auto & [id, n_sent] : active) {
+            auto res = std::make_unique<bench_task_result>();
+            res->id   = id;
+            res->stop = ++n_sent >= n_results;
+            queue_results.send(std::move(res));
+        }
+
+        active.erase(std::remove_if(active.begin(), active.end(), [&](const std::pair<int, int> & a) {
+            return a.second >= n_results;
+        }), active.end());
+
+        bench_task task(BENCH_TASK_TYPE_NEXT_RESPONSE);
+        task.id = queue_tasks.get_new_id();
+        queue_tasks.post(std::move(task));
+    });
+
+    std::thread t_loop([&]() { queue_tasks.start_loop(); });
+
+    std::atomic<int64_t> n_recv = 0;
+
+    const int64_t t_start = ggml_time_us();
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < n_producers; ++p) {
+        producers.emplace_back([&]() {
+            for (int r = 0; r < n_requests; ++r) {
+                bench_task task(BENCH_TASK_TYPE_COMPLETION);
+                task.id = queue_tasks.get_new_id();
+
+                const int id_task = task.id;
+
+                queue_results.add_waiting_task_id(id_task);
+                queue_tasks.post(std::move(task));
+
+                while (true) {
+                    auto res = queue_results.recv(id_task);
+                    n_recv++;
+                    if (res->stop) {
+                        break;
+                    }
+                }
+
+                queue_results.remove_waiting_task_id(id_task);
+            }
+        });
+    }
+
+    for (auto & t : producers) {
+        t.join();
+    }
+
+    const int64_t t_end = ggml_time_us();
+
+    queue_tasks.terminate();
+    t_loop.join();
+
+    return { n_producers*n_requests, n_recv.load(), t_end - t_start };
+}
+
+int main(int argc, char ** argv) {
+    const int n_results  = argc > 1 ? atoi(argv[1]) : 128;
+    const int n_requests = argc > 2 ? atoi(argv[2]) : 16;
+
+    ggml_time_init();
+
+    printf("| producers | requests | results | time (ms) |  results/s |\n");
+    printf("| --------: | -------: | ------: | --------: | ---------: |\n");
+
+    for (int n_producers : { 1, 4, 16, 64, 256 }) {
+        const bench_result res = bench_queue(n_producers, n_requests, n_results);
+
+        printf("| %9d | %8d | %7" PRId64 " | %9.1f | %10.0f |\n", n_producers, res.n_requests, res.n_results,
+                res.t_us/1e3, res.n_results/(res.t_us/1e6));
+    }
+
+    return 0;
+}
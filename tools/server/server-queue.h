@@ -0,0 +1,402 @@
+#pragma once
+
+#include "ggml.h"
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define QUE_INF(fmt, ...) LOG_INF("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
+#define QUE_WRN(fmt, ...) LOG_WRN("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
+#define QUE_ERR(fmt, ...) LOG_ERR("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
+#define QUE_DBG(fmt, ...) LOG_DBG("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
+
+// the task queue and the result queue of the server
+//
+// they are templates so that they do not depend on the server's task and result types:
+// - a task has an id, an id_target, is_cancel() and get_priority()
+// - a result has an id
+// server.cpp instantiates them with server_task and server_task_result
+
+template <typename task_t>
+struct server_queue_t {
+    std::atomic<int> id = 0;
+    bool running;
+
+    // queues
+    std::deque<task_t> queue_tasks;
+    std::deque<task_t> queue_tasks_deferred;
+
+    std::mutex mutex_tasks;
+    std::condition_variable condition_tasks;
+
+    // callback functions
+    std::function<void(task_t &&)> callback_new_task;
+    std::function<void(void)>           callback_update_slots;
+
+    // Add a new task to the end of the queue
+    int post(task_t && task, bool front = false) {
+        GGML_ASSERT(task.id != -1);
+        const int task_id = task.id;
+        QUE_DBG("new task, id = %d, front = %d\n", task_id, front);
+        {
+            std::unique_lock<std::mutex> lock(mutex_tasks);
+            // if this is cancel task make sure to clean up pending tasks
+            if (task.is_cancel()) {
+                cleanup_pending_task(task.id_target);
+            }
+            if (front) {
+                queue_tasks.push_front(std::move(task));
+            } else {
+                queue_tasks.push_back(std::move(task));
+            }
+        }
+        condition_tasks.notify_one();
+        return task_id;
+    }
+
+    // multi-task version of post()
+    int post(std::vector<task_t> && tasks, bool front = false) {
+        for (auto & task : tasks) {
+            if (task.id == -1) {
+                task.id = get_new_id();
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_tasks);
+            for (auto & task : tasks) {
+                // if this is cancel task make sure to clean up pending tasks
+                if (task.is_cancel()) {
+                    cleanup_pending_task(task.id_target);
+                }
+                QUE_DBG("new task, id = %d/%d, front = %d\n", task.id, (int) tasks.size(), front);
+                if (front) {
+                    queue_tasks.push_front(std::move(task));
+                } else {
+                    queue_tasks.push_back(std::move(task));
+                }
+            }
+        }
+        condition_tasks.notify_one();
+        return 0;
+    }
+
+    // Add a new task, but defer until one slot is available
+    void defer(task_t && task) {
+        std::unique_lock<std::mutex> lock(mutex_tasks);
+        QUE_DBG("defer task, id = %d\n", task.id);
+        queue_tasks_deferred.push_back(std::move(task));
+        condition_tasks.notify_one();
+    }
+
+    // Get the next id for creating a new task
+    int get_new_id() {
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Register function to process a new task
+    void on_new_task(std::function<void(task_t &&)> callback) {
+        callback_new_task = std::move(callback);
+    }
+
+    // Register the function to be called when all slots data is ready to be processed
+    void on_update_slots(std::function<void(void)> callback) {
+        callback_update_slots = std::move(callback);
+    }
+
+    // Call when the state of one slot is changed, it will move one task from deferred to main queue
+    void pop_deferred_task() {
+        std::unique_lock<std::mutex> lock(mutex_tasks);
+        if (!queue_tasks_deferred.empty()) {
+            // the oldest task with the highest priority
+            auto it = std::max_element(queue_tasks_deferred.begin(), queue_tasks_deferred.end(),
+                    [](const task_t & a, const task_t & b) { return a.get_priority() < b.get_priority(); });
+
+            queue_tasks.emplace_back(std::move(*it));
+            queue_tasks_deferred.erase(it);
+        }
+        condition_tasks.notify_one();
+    }
+
+    // end the start_loop routine
+    void terminate() {
+        std::unique_lock<std::mutex> lock(mutex_tasks);
+        running = false;
+        condition_tasks.notify_all();
+    }
+
+    /**
+     * Main loop consists of these steps:
+     * - Wait until a new task arrives
+     * - Process the task (i.e. maybe copy data into slot)
+     * - Check if multitask is finished
+     * - Update all slots
+     */
+    void start_loop() {
+        running = true;
+
+        while (true) {
+            QUE_DBG("%s", "processing new tasks\n");
+
+            while (true) {
+                std::unique_lock<std::mutex> lock(mutex_tasks);
+                if (!running) {
+                    QUE_DBG("%s", "terminate\n");
+                    return;
+                }
+                if (queue_tasks.empty()) {
+                    lock.unlock();
+                    break;
+                }
+                task_t task = std::move(queue_tasks.front());
+                queue_tasks.pop_front();
+                lock.unlock();
+
+                QUE_DBG("processing task, id = %d\n", task.id);
+                callback_new_task(std::move(task));
+            }
+
+            // all tasks in the current loop is processed, slots data is now ready
+            QUE_DBG("%s", "update slots\n");
+
+            callback_update_slots();
+
+            QUE_DBG("%s", "waiting for new tasks\n");
+            {
+                std::unique_lock<std::mutex> lock(mutex_tasks);
+                if (!running) {
+                    QUE_DBG("%s", "terminate\n");
+                    return;
+                }
+                if (queue_tasks.empty()) {
+                    condition_tasks.wait(lock, [&]{
+                        return (!queue_tasks.empty() || !running);
+                    });
+                }
+            }
+        }
+    }
+
+private:
+    void cleanup_pending_task(int id_target) {
+        // no need lock because this is called exclusively by post()
+        auto rm_func = [id_target](const task_t & task) {
+            return task.id_target == id_target;
+        };
+        queue_tasks.erase(
+            std::remove_if(queue_tasks.begin(),          queue_tasks.end(),          rm_func),
+            queue_tasks.end());
+        queue_tasks_deferred.erase(
+            std::remove_if(queue_tasks_deferred.begin(), queue_tasks_deferred.end(), rm_func),
+            queue_tasks_deferred.end());
+    }
+};
+
+template <typename result_t>
+struct server_response_t {
+    using result_ptr = std::unique_ptr<result_t>;
+
+    std::atomic<bool> running = true;
+
+    // results of the tasks of a single request
+    // only the thread that processes the request reads from it and only the main loop writes to it,
+    // so the streamed results of different requests do not contend on a common lock
+    struct channel {
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        std::deque<result_ptr> results;
+    };
+
+    using channel_ptr = std::shared_ptr<channel>;
+
+    // for keeping track of all tasks waiting for the result: id_task -> channel of the request
+    std::unordered_map<int, channel_ptr> waiting_tasks;
+
+    // only guards waiting_tasks - held briefly for lookups, never while waiting
+    std::shared_mutex mutex_waiting;
+
+    // add the id_task to the list of tasks waiting for response
+    void add_waiting_task_id(int id_task) {
+        std::unique_lock<std::shared_mutex> lock(mutex_waiting);
+
+        QUE_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) waiting_tasks.size());
+        waiting_tasks[id_task] = std::make_shared<channel>();
+    }
+
+    // the results of all tasks are delivered through a single channel
+    template <typename task_t>
+    void add_waiting_tasks(const std::vector<task_t> & tasks) {
+        auto chan = std::make_shared<channel>();
+
+        std::unique_lock<std::shared_mutex> lock(mutex_waiting);
+
+        for (const auto & task : tasks) {
+            QUE_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) waiting_tasks.size());
+            waiting_tasks[task.id] = chan;
+        }
+    }
+
+    // when the request is finished, we can remove task associated with it
+    void remove_waiting_task_id(int id_task) {
+        channel_ptr chan;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_waiting);
+
+            QUE_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_tasks.size());
+            auto it = waiting_tasks.find(id_task);
+            if (it == waiting_tasks.end()) {
+                return;
+            }
+            chan = std::move(it->second);
+            waiting_tasks.erase(it);
+        }
+
+        // make sure to clean up all pending results
+        std::unique_lock<std::mutex> lock(chan->mutex);
+        chan->results.erase(
+            std::remove_if(chan->results.begin(), chan->results.end(), [id_task](const result_ptr & res) {
+                return res->id == id_task;
+            }),
+            chan->results.end());
+    }
+
+    void remove_waiting_task_ids(const std::unordered_set<int> & id_tasks) {
+        std::unique_lock<std::shared_mutex> lock(mutex_waiting);
+
+        for (const auto & id_task : id_tasks) {
+            QUE_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_tasks.size());
+            waiting_tasks.erase(id_task);
+        }
+    }
+
+    // This function blocks the thread until there is a response for one of the id_tasks
+    result_ptr recv(const std::unordered_set<int> & id_tasks) {
+        channel_ptr chan = get_channel(id_tasks);
+        GGML_ASSERT(chan != nullptr && "recv() on tasks that are not waiting");
+
+        std::unique_lock<std::mutex> lock(chan->mutex);
+        chan->cond.wait(lock, [&]{
+            if (!running) {
+                QUE_DBG("%s : queue result stop\n", __func__);
+                std::terminate(); // we cannot return here since the caller is HTTP code
+            }
+            return has_result(*chan, id_tasks);
+        });
+
+        return pop_result(*chan, id_tasks);
+    }
+
+    // same as recv(), but have timeout in seconds
+    // if timeout is reached, nullptr is returned
+    result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
+        channel_ptr chan = get_channel(id_tasks);
+        GGML_ASSERT(chan != nullptr && "recv_with_timeout() on tasks that are not waiting");
+
+        std::unique_lock<std::mutex> lock(chan->mutex);
+        const bool ready = chan->cond.wait_for(lock, std::chrono::seconds(timeout), [&]{
+            if (!running) {
+                QUE_DBG("%s : queue result stop\n", __func__);
+                std::terminate(); // we cannot return here since the caller is HTTP code
+            }
+            return has_result(*chan, id_tasks);
+        });
+
+        if (!ready) {
+            return nullptr;
+        }
+
+        return pop_result(*chan, id_tasks);
+    }
+
+    // single-task version of recv()
+    result_ptr recv(int id_task) {
+        std::unordered_set<int> id_tasks = {id_task};
+        return recv(id_tasks);
+    }
+
+    // Send a new result to a waiting id_task
+    void send(result_ptr && result) {
+        QUE_DBG("sending result for task id = %d\n", result->id);
+
+        channel_ptr chan;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_waiting);
+
+            auto it = waiting_tasks.find(result->id);
+            if (it == waiting_tasks.end()) {
+                return;
+            }
+            chan = it->second;
+        }
+
+        QUE_DBG("task id = %d pushed to result queue\n", result->id);
+
+        {
+            std::unique_lock<std::mutex> lock(chan->mutex);
+            chan->results.emplace_back(std::move(result));
+        }
+        chan->cond.notify_one();
+    }
+
+    // terminate the waiting loop
+    void terminate() {
+        running = false;
+
+        std::shared_lock<std::shared_mutex> lock(mutex_waiting);
+        for (auto & it : waiting_tasks) {
+            // lock to make sure the waiter is either before its predicate check or already waiting
+            std::unique_lock<std::mutex> lock_chan(it.second->mutex);
+            it.second->cond.notify_all();
+        }
+    }
+
+private:
+    channel_ptr get_channel(const std::unordered_set<int> & id_tasks) {
+        std::shared_lock<std::shared_mutex> lock(mutex_waiting);
+
+        for (const auto & id_task : id_tasks) {
+            auto it = waiting_tasks.find(id_task);
+            if (it != waiting_tasks.end()) {
+                return it->second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // the channel holds the results of all tasks of the request - only the ones of id_tasks are taken
+    // the channel mutex must be held
+    static typename std::deque<result_ptr>::iterator find_result(channel & chan, const std::unordered_set<int> & id_tasks) {
+        return std::find_if(chan.results.begin(), chan.results.end(), [&](const result_ptr & res) {
+            return id_tasks.find(res->id) != id_tasks.end();
+        });
+    }
+
+    static bool has_result(channel & chan, const std::unordered_set<int> & id_tasks) {
+        return find_result(chan, id_tasks) != chan.results.end();
+    }
+
+    static result_ptr pop_result(channel & chan, const std::unordered_set<int> & id_tasks) {
+        auto it = find_result(chan, id_tasks);
+        if (it == chan.results.end()) {
+            return nullptr;
+        }
+
+        result_ptr res = std::move(*it);
+        chan.results.erase(it);
+
+        return res;
+    }
+};
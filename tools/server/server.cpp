@@ -1,5 +1,6 @@
 #include "chat.h"
 #include "utils.hpp"
+#include "server-queue.h"
 
 #include "arg.h"
 #include "common.h"
@@ -24,8 +25,12 @@
 #include <cstddef>
 #include <cinttypes>
 #include <deque>
+#include <fstream>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <signal.h>
 #include <thread>
 #include <unordered_map>
@@ -35,6 +40,9 @@ using json = nlohmann::ordered_json;
 
 constexpr int HTTP_POLLING_SECONDS = 1;
 
+// iterations that a prompt which cannot be split waits for room within the prefill budget before it can use the whole batch
+constexpr int PREFILL_BUDGET_MAX_WAIT = 4;
+
 enum stop_type {
     STOP_TYPE_NONE,
     STOP_TYPE_EOS,
@@ -117,6 +125,7 @@ struct slot_params {
     int32_t n_discard =  0; // number of tokens after n_keep that may be discarded when shifting context, 0 defaults to half
     int32_t n_predict = -1; // new tokens to predict
     int32_t n_indent  =  0; // mininum line indentation for the generated text in number of whitespace characters
+    int32_t priority  =  0; // scheduling priority - prompts and deferred tasks with higher priority are processed first
 
     int64_t t_max_prompt_ms  = -1; // TODO: implement
     int64_t t_max_predict_ms = -1; // if positive, limit the generation phase to this time limit
@@ -186,6 +195,7 @@ struct slot_params {
             {"max_tokens",                n_predict}, // User configured n_predict
             {"n_keep",                    n_keep},
             {"n_discard",                 n_discard},
+            {"priority",                  priority},
             {"ignore_eos",                sampling.ignore_eos},
             {"stream",                    stream},
             {"logit_bias",                format_logit_bias(sampling.logit_bias)},
@@ -203,6 +213,8 @@ struct slot_params {
             {"speculative.n_max",         speculative.n_max},
             {"speculative.n_min",         speculative.n_min},
             {"speculative.p_min",         speculative.p_min},
+            {"speculative.p_split",       speculative.p_split},
+            {"speculative.n_branch",      speculative.n_branch},
             {"timings_per_token",         timings_per_token},
             {"post_sampling_probs",       post_sampling_probs},
             {"lora",                      lora},
@@ -240,6 +252,15 @@ struct server_task {
 
     server_task(server_task_type type) : type(type) {}
 
+    // used by server_queue
+    bool is_cancel() const {
+        return type == SERVER_TASK_TYPE_CANCEL;
+    }
+
+    int get_priority() const {
+        return params.priority;
+    }
+
     static slot_params params_from_json_cmpl(
             const llama_context * ctx,
             const common_params & params_base,
@@ -266,6 +287,7 @@ struct server_task {
         params.n_indent         = json_value(data, "n_indent",           defaults.n_indent);
         params.n_keep           = json_value(data, "n_keep",             defaults.n_keep);
         params.n_discard        = json_value(data, "n_discard",          defaults.n_discard);
+        params.priority         = json_value(data, "priority",           defaults.priority);
       //params.t_max_prompt_ms  = json_value(data, "t_max_prompt_ms",    defaults.t_max_prompt_ms); // TODO: implement
         params.t_max_predict_ms = json_value(data, "t_max_predict_ms",   defaults.t_max_predict_ms);
         params.response_fields  = json_value(data, "response_fields",   std::vector<std::string>());
@@ -300,10 +322,17 @@ struct server_task {
         params.speculative.n_max = json_value(data, "speculative.n_max", defaults.speculative.n_max);
         params.speculative.p_min = json_value(data, "speculative.p_min", defaults.speculative.p_min);
 
+        params.speculative.p_split  = json_value(data, "speculative.p_split",  defaults.speculative.p_split);
+        params.speculative.n_branch = json_value(data, "speculative.n_branch", defaults.speculative.n_branch);
+
         params.speculative.n_min = std::min(params.speculative.n_max, params.speculative.n_min);
         params.speculative.n_min = std::max(params.speculative.n_min, 0);
         params.speculative.n_max = std::max(params.speculative.n_max, 0);
 
+        // the sequences of the branches are reserved when the context is created
+        params.speculative.n_branch = std::min(params.speculative.n_branch, defaults.speculative.n_branch);
+        params.speculative.n_branch = std::max(params.speculative.n_branch, 1);
+
         // Use OpenAI API logprobs only if n_probs wasn't provided
         if (data.contains("logprobs") && params.sampling.n_probs == defaults.sampling.n_probs){
             params.sampling.n_probs = json_value(data, "logprobs", defaults.sampling.n_probs);
@@ -474,6 +503,20 @@ struct server_task {
             }
         }
 
+        // with --logits-top-k, only the top-k candidates are sampled
+        if (params_base.logits_top_k > 0) {
+            if (!params.sampling.grammar.empty()) {
+                throw std::runtime_error("Error: \"grammar\" and \"json_schema\" are not supported with --logits-top-k");
+            }
+
+            // a negative bias only lowers the candidates, but a positive bias cannot raise a token that is not among them
+            for (const auto & lb : params.sampling.logit_bias) {
+                if (lb.bias > 0.0f) {
+                    throw std::runtime_error("Error: a positive \"logit_bias\" is not supported with --logits-top-k");
+                }
+            }
+        }
+
         {
             params.antiprompt.clear();
 
@@ -1159,6 +1202,12 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_prompt_cache_lookups_total = 0;
+    uint64_t n_prompt_cache_hits_total    = 0;
+    uint64_t n_prompt_tokens_cached_total = 0;
+    uint64_t n_prompt_cache_bytes         = 0;
+    uint64_t n_prompt_cache_bytes_disk    = 0;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1183,6 +1232,12 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_prompt_cache_lookups_total",    n_prompt_cache_lookups_total },
+            { "n_prompt_cache_hits_total",       n_prompt_cache_hits_total },
+            { "n_prompt_tokens_cached_total",    n_prompt_tokens_cached_total },
+            { "n_prompt_cache_bytes",            n_prompt_cache_bytes },
+            { "n_prompt_cache_bytes_disk",       n_prompt_cache_bytes_disk },
+
             { "slots",                           slots_data },
         };
     }
@@ -1255,6 +1310,9 @@ struct server_slot {
 
     common_speculative * spec = nullptr;
 
+    // the sequences of the branches of the draft tree, the first one is the slot id
+    std::vector<llama_seq_id> seq_ids_spec;
+
     std::vector<common_adapter_lora_info> lora;
 
     // the index relative to completion multi-task request
@@ -1279,6 +1337,9 @@ struct server_slot {
     int32_t n_prompt_tokens           = 0;
     int32_t n_prompt_tokens_processed = 0;
 
+    // iterations that the prompt has waited for room within the prefill budget
+    int32_t n_prefill_wait = 0;
+
     // input prompt tokens
     server_tokens prompt_tokens;
 
@@ -1306,6 +1367,12 @@ struct server_slot {
 
     llama_token sampled;
 
+    // the last sampled token, if its text is not processed yet
+    // it is processed after the next batch has been submitted, while the backend is computing (see update_slots())
+    bool has_pending_token = false;
+    completion_token_output pending_token;
+    int32_t pending_n_past = 0; // n_past when the token was sampled, used for the limits checked in process_token()
+
     common_chat_format chat_format = COMMON_CHAT_FORMAT_CONTENT_ONLY;
     std::vector<std::string> generated_tool_call_ids;
 
@@ -1328,6 +1395,7 @@ struct server_slot {
         SLT_DBG(*this, "%s", "\n");
 
         n_prompt_tokens    = 0;
+        n_prefill_wait     = 0;
         last_nl_pos        = 0;
         generated_text     = "";
         has_new_line       = false;
@@ -1337,6 +1405,7 @@ struct server_slot {
         n_past             = 0;
         n_sent_text        = 0;
         task_type          = SERVER_TASK_TYPE_COMPLETION;
+        has_pending_token  = false;
         chat_format        = COMMON_CHAT_FORMAT_CONTENT_ONLY;
 
         generated_tokens.clear();
@@ -1526,355 +1595,423 @@ struct server_slot {
     }
 };
 
-struct server_metrics {
-    int64_t t_start = 0;
+// radix tree over the token sequences of the cached prompts
+// each entry is either the KV cache of an idle slot, or the saved state of a slot. the saved states are kept in host
+//   memory (see --cache-ram) and the least recently used ones are spilled to disk (see --cache-disk)
+// used to find the entry with the longest common prefix with a new prompt in O(prompt length)
+struct server_prompt_cache {
+    struct entry {
+        int id_slot = -1; // the idle slot that holds the tokens, or -1 for a saved state
 
-    uint64_t n_prompt_tokens_processed_total = 0;
-    uint64_t t_prompt_processing_total       = 0;
-    uint64_t n_tokens_predicted_total        = 0;
-    uint64_t t_tokens_generation_total       = 0;
+        llama_tokens tokens;
 
-    uint64_t n_prompt_tokens_processed = 0;
-    uint64_t t_prompt_processing       = 0;
+        std::vector<uint8_t> data; // saved state in host memory, see llama_state_seq_get_data()
+        std::string          path; // saved state spilled to disk (data is empty)
 
-    uint64_t n_tokens_predicted  = 0;
-    uint64_t t_tokens_generation = 0;
+        size_t size = 0; // size of the saved state
 
-    uint64_t n_decode_total     = 0;
-    uint64_t n_busy_slots_total = 0;
+        std::vector<common_adapter_lora_info> lora;
 
-    void init() {
-        t_start = ggml_time_us();
-    }
+        int64_t t_last = 0;
+    };
 
-    void on_prompt_eval(const server_slot & slot) {
-        n_prompt_tokens_processed_total += slot.n_prompt_tokens_processed;
-        n_prompt_tokens_processed       += slot.n_prompt_tokens_processed;
-        t_prompt_processing             += slot.t_prompt_processing;
-        t_prompt_processing_total       += slot.t_prompt_processing;
-    }
+    struct node {
+        llama_tokens edge; // tokens on the edge from the parent node
 
-    void on_prediction(const server_slot & slot) {
-        n_tokens_predicted_total   += slot.n_decoded;
-        n_tokens_predicted         += slot.n_decoded;
-        t_tokens_generation        += slot.t_token_generation;
-        t_tokens_generation_total  += slot.t_token_generation;
-    }
+        std::map<llama_token, std::unique_ptr<node>> children;
 
-    void on_decoded(const std::vector<server_slot> & slots) {
-        n_decode_total++;
-        for (const auto & slot : slots) {
-            if (slot.is_processing()) {
-                n_busy_slots_total++;
+        std::set<int> ids; // the entries in the subtree of this node
+    };
+
+    struct match {
+        int id       = -1;
+        int n_tokens =  0;
+    };
+
+    node root;
+
+    std::map<int, entry> entries;
+
+    int id_next = 0;
+
+    // host memory used by the saved states and the limit
+    size_t n_bytes     = 0;
+    size_t n_bytes_max = 0;
+
+    // disk space used by the spilled states and the limit
+    size_t n_bytes_disk     = 0;
+    size_t n_bytes_disk_max = 0;
+
+    // directory for the spilled states
+    std::string path_disk;
+
+    // used to make the file names unique to this server instance
+    const int64_t t_init = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    ~server_prompt_cache() {
+        for (const auto & it : entries) {
+            if (!it.second.path.empty()) {
+                std::remove(it.second.path.c_str());
             }
         }
     }
 
-    void reset_bucket() {
-        n_prompt_tokens_processed = 0;
-        t_prompt_processing       = 0;
-        n_tokens_predicted        = 0;
-        t_tokens_generation       = 0;
+    bool can_save() const {
+        return n_bytes_max > 0 || n_bytes_disk_max > 0;
     }
-};
 
-struct server_queue {
-    int id = 0;
-    bool running;
-
-    // queues
-    std::deque<server_task> queue_tasks;
-    std::deque<server_task> queue_tasks_deferred;
-
-    std::mutex mutex_tasks;
-    std::condition_variable condition_tasks;
-
-    // callback functions
-    std::function<void(server_task &&)> callback_new_task;
-    std::function<void(void)>           callback_update_slots;
-
-    // Add a new task to the end of the queue
-    int post(server_task && task, bool front = false) {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        GGML_ASSERT(task.id != -1);
-        // if this is cancel task make sure to clean up pending tasks
-        if (task.type == SERVER_TASK_TYPE_CANCEL) {
-            cleanup_pending_task(task.id_target);
-        }
-        const int task_id = task.id;
-        QUE_DBG("new task, id = %d, front = %d\n", task_id, front);
-        if (front) {
-            queue_tasks.push_front(std::move(task));
-        } else {
-            queue_tasks.push_back(std::move(task));
+    // returns the id of the new entry, or -1 if the entry was not added
+    int add(entry && e) {
+        if (e.tokens.empty()) {
+            return -1;
         }
-        condition_tasks.notify_one();
-        return task_id;
-    }
 
-    // multi-task version of post()
-    int post(std::vector<server_task> && tasks, bool front = false) {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        for (auto & task : tasks) {
-            if (task.id == -1) {
-                task.id = id++;
+        if (e.id_slot < 0) {
+            e.size = e.data.size();
+
+            if (e.size > std::max(n_bytes_max, n_bytes_disk_max)) {
+                return -1;
             }
-            // if this is cancel task make sure to clean up pending tasks
-            if (task.type == SERVER_TASK_TYPE_CANCEL) {
-                cleanup_pending_task(task.id_target);
+
+            n_bytes += e.size;
+        }
+
+        const int id = id_next++;
+
+        node * cur = &root;
+        cur->ids.insert(id);
+
+        size_t i = 0;
+        while (i < e.tokens.size()) {
+            auto it = cur->children.find(e.tokens[i]);
+            if (it == cur->children.end()) {
+                auto child = std::make_unique<node>();
+                child->edge.assign(e.tokens.begin() + i, e.tokens.end());
+                child->ids.insert(id);
+
+                cur->children[e.tokens[i]] = std::move(child);
+                break;
             }
-            QUE_DBG("new task, id = %d/%d, front = %d\n", task.id, (int) tasks.size(), front);
-            if (front) {
-                queue_tasks.push_front(std::move(task));
-            } else {
-                queue_tasks.push_back(std::move(task));
+
+            node * next = it->second.get();
+
+            size_t k = 0;
+            while (k < next->edge.size() && i + k < e.tokens.size() && next->edge[k] == e.tokens[i + k]) {
+                k++;
+            }
+
+            if (k < next->edge.size()) {
+                // split the edge at the first mismatch
+                auto mid = std::make_unique<node>();
+                mid->edge.assign(next->edge.begin(), next->edge.begin() + k);
+                mid->ids = next->ids;
+
+                next->edge.erase(next->edge.begin(), next->edge.begin() + k);
+
+                mid->children[next->edge[0]] = std::move(it->second);
+                it->second = std::move(mid);
+
+                next = it->second.get();
             }
+
+            next->ids.insert(id);
+
+            cur = next;
+            i  += k;
         }
-        condition_tasks.notify_one();
-        return 0;
-    }
 
-    // Add a new task, but defer until one slot is available
-    void defer(server_task && task) {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        QUE_DBG("defer task, id = %d\n", task.id);
-        queue_tasks_deferred.push_back(std::move(task));
-        condition_tasks.notify_one();
-    }
+        entries[id] = std::move(e);
 
-    // Get the next id for creating a new task
-    int get_new_id() {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        int new_id = id++;
-        return new_id;
-    }
+        evict();
 
-    // Register function to process a new task
-    void on_new_task(std::function<void(server_task &&)> callback) {
-        callback_new_task = std::move(callback);
+        return id;
     }
 
-    // Register the function to be called when all slots data is ready to be processed
-    void on_update_slots(std::function<void(void)> callback) {
-        callback_update_slots = std::move(callback);
-    }
+    void remove(int id) {
+        auto it = entries.find(id);
+        if (it == entries.end()) {
+            return;
+        }
+
+        const auto & tokens = it->second.tokens;
+
+        node * cur = &root;
+        cur->ids.erase(id);
+
+        size_t i = 0;
+        while (i < tokens.size()) {
+            auto it_child = cur->children.find(tokens[i]);
+            GGML_ASSERT(it_child != cur->children.end());
+
+            node * next = it_child->second.get();
+            next->ids.erase(id);
 
-    // Call when the state of one slot is changed, it will move one task from deferred to main queue
-    void pop_deferred_task() {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        if (!queue_tasks_deferred.empty()) {
-            queue_tasks.emplace_back(std::move(queue_tasks_deferred.front()));
-            queue_tasks_deferred.pop_front();
+            if (next->ids.empty()) {
+                // no more entries in this subtree
+                cur->children.erase(it_child);
+                break;
+            }
+
+            cur = next;
+            i  += next->edge.size();
+        }
+
+        if (it->second.id_slot < 0) {
+            if (it->second.path.empty()) {
+                n_bytes -= it->second.size;
+            } else {
+                n_bytes_disk -= it->second.size;
+                std::remove(it->second.path.c_str());
+            }
         }
-        condition_tasks.notify_one();
+
+        entries.erase(it);
     }
 
-    // end the start_loop routine
-    void terminate() {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        running = false;
-        condition_tasks.notify_all();
+    // remove the entry of an idle slot (e.g. the slot is about to process a new task)
+    void remove_slot(int id_slot) {
+        for (const auto & [id, e] : entries) {
+            if (e.id_slot == id_slot) {
+                remove(id);
+                break;
+            }
+        }
     }
 
-    /**
-     * Main loop consists of these steps:
-     * - Wait until a new task arrives
-     * - Process the task (i.e. maybe copy data into slot)
-     * - Check if multitask is finished
-     * - Update all slots
-     */
-    void start_loop() {
-        running = true;
+    // find the entry of the given kind (idle slot or saved state) with the longest common prefix with the tokens
+    match find(const llama_tokens & tokens, bool saved) const {
+        // the nodes along the path of the tokens and the number of matched tokens at each of them
+        std::vector<std::pair<const node *, int>> path;
 
-        while (true) {
-            QUE_DBG("%s", "processing new tasks\n");
+        const node * cur = &root;
 
-            while (true) {
-                std::unique_lock<std::mutex> lock(mutex_tasks);
-                if (!running) {
-                    QUE_DBG("%s", "terminate\n");
-                    return;
-                }
-                if (queue_tasks.empty()) {
-                    lock.unlock();
-                    break;
-                }
-                server_task task = std::move(queue_tasks.front());
-                queue_tasks.pop_front();
-                lock.unlock();
+        size_t i = 0;
+        while (i < tokens.size()) {
+            auto it = cur->children.find(tokens[i]);
+            if (it == cur->children.end()) {
+                break;
+            }
+
+            const node * next = it->second.get();
 
-                QUE_DBG("processing task, id = %d\n", task.id);
-                callback_new_task(std::move(task));
+            size_t k = 0;
+            while (k < next->edge.size() && i + k < tokens.size() && next->edge[k] == tokens[i + k]) {
+                k++;
             }
 
-            // all tasks in the current loop is processed, slots data is now ready
-            QUE_DBG("%s", "update slots\n");
+            i += k;
+            path.emplace_back(next, (int) i);
 
-            callback_update_slots();
+            if (k < next->edge.size()) {
+                break;
+            }
 
-            QUE_DBG("%s", "waiting for new tasks\n");
-            {
-                std::unique_lock<std::mutex> lock(mutex_tasks);
-                if (!running) {
-                    QUE_DBG("%s", "terminate\n");
-                    return;
-                }
-                if (queue_tasks.empty()) {
-                    condition_tasks.wait(lock, [&]{
-                        return (!queue_tasks.empty() || !running);
-                    });
+            cur = next;
+        }
+
+        match res;
+
+        for (auto it = path.rbegin(); it != path.rend() && res.id < 0; ++it) {
+            int64_t t_last = -1;
+
+            for (const int id : it->first->ids) {
+                const auto & e = entries.at(id);
+
+                if ((e.id_slot < 0) == saved && e.t_last > t_last) {
+                    t_last = e.t_last;
+
+                    res.id       = id;
+                    res.n_tokens = it->second;
                 }
             }
         }
-    }
 
-private:
-    void cleanup_pending_task(int id_target) {
-        // no need lock because this is called exclusively by post()
-        auto rm_func = [id_target](const server_task & task) {
-            return task.id_target == id_target;
-        };
-        queue_tasks.erase(
-            std::remove_if(queue_tasks.begin(),          queue_tasks.end(),          rm_func),
-            queue_tasks.end());
-        queue_tasks_deferred.erase(
-            std::remove_if(queue_tasks_deferred.begin(), queue_tasks_deferred.end(), rm_func),
-            queue_tasks_deferred.end());
+        return res;
     }
-};
 
-struct server_response {
-    bool running = true;
+    // get the data of a saved state, reading it from disk if needed
+    // states that fit in host memory are moved back there, otherwise the data is read into buf
+    // returns nullptr on failure
+    const uint8_t * load(int id, std::vector<uint8_t> & buf) {
+        auto & e = entries.at(id);
 
-    // for keeping track of all tasks waiting for the result
-    std::unordered_set<int> waiting_task_ids;
+        if (e.path.empty()) {
+            return e.data.data();
+        }
 
-    // the main result queue (using ptr for polymorphism)
-    std::vector<server_task_result_ptr> queue_results;
+        const bool to_ram = e.size <= n_bytes_max;
 
-    std::mutex mutex_results;
-    std::condition_variable condition_results;
+        auto & dst = to_ram ? e.data : buf;
+        dst.resize(e.size);
 
-    // add the id_task to the list of tasks waiting for response
-    void add_waiting_task_id(int id_task) {
-        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) waiting_task_ids.size());
+        std::ifstream file(e.path, std::ios::binary);
+        if (!file.read((char *) dst.data(), e.size)) {
+            SRV_WRN("failed to read prompt state from '%s'\n", e.path.c_str());
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.insert(id_task);
-    }
+            dst.clear();
+            remove(id);
 
-    void add_waiting_tasks(const std::vector<server_task> & tasks) {
-        std::unique_lock<std::mutex> lock(mutex_results);
+            return nullptr;
+        }
 
-        for (const auto & task : tasks) {
-            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) waiting_task_ids.size());
-            waiting_task_ids.insert(task.id);
+        if (!to_ram) {
+            return buf.data();
         }
-    }
 
-    // when the request is finished, we can remove task associated with it
-    void remove_waiting_task_id(int id_task) {
-        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
-
-        std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.erase(id_task);
-        // make sure to clean up all pending results
-        queue_results.erase(
-            std::remove_if(queue_results.begin(), queue_results.end(), [id_task](const server_task_result_ptr & res) {
-                return res->id == id_task;
-            }),
-            queue_results.end());
+        std::remove(e.path.c_str());
+        e.path.clear();
+
+        n_bytes_disk -= e.size;
+        n_bytes      += e.size;
+
+        // the state is the most recently used one, so it stays in host memory
+        e.t_last = ggml_time_us();
+
+        evict();
+
+        return e.data.data();
     }
 
-    void remove_waiting_task_ids(const std::unordered_set<int> & id_tasks) {
-        std::unique_lock<std::mutex> lock(mutex_results);
+    // move the least recently used saved states from host memory to disk, and drop them when the disk is full
+    void evict() {
+        while (n_bytes > n_bytes_max) {
+            const int id_lru = get_lru(false);
 
-        for (const auto & id_task : id_tasks) {
-            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
-            waiting_task_ids.erase(id_task);
+            if (!spill(id_lru)) {
+                SRV_DBG("evicting saved prompt state, n_tokens = %zu, size = %zu bytes\n", entries.at(id_lru).tokens.size(), entries.at(id_lru).size);
+
+                remove(id_lru);
+            }
+        }
+
+        while (n_bytes_disk > n_bytes_disk_max) {
+            const int id_lru = get_lru(true);
+
+            SRV_DBG("evicting spilled prompt state, n_tokens = %zu, size = %zu bytes\n", entries.at(id_lru).tokens.size(), entries.at(id_lru).size);
+
+            remove(id_lru);
         }
     }
 
-    // This function blocks the thread until there is a response for one of the id_tasks
-    server_task_result_ptr recv(const std::unordered_set<int> & id_tasks) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
-            condition_results.wait(lock, [&]{
-                if (!running) {
-                    SRV_DBG("%s : queue result stop\n", __func__);
-                    std::terminate(); // we cannot return here since the caller is HTTP code
-                }
-                return !queue_results.empty();
-            });
+    // the least recently used saved state in host memory or on disk
+    int get_lru(bool on_disk) const {
+        int id_lru = -1;
+        int64_t t_lru = std::numeric_limits<int64_t>::max();
 
-            for (size_t i = 0; i < queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
-                }
+        for (const auto & [id, e] : entries) {
+            if (e.id_slot < 0 && e.path.empty() != on_disk && e.t_last < t_lru) {
+                t_lru  = e.t_last;
+                id_lru = id;
             }
         }
 
-        // should never reach here
+        GGML_ASSERT(id_lru >= 0);
+
+        return id_lru;
     }
 
-    // same as recv(), but have timeout in seconds
-    // if timeout is reached, nullptr is returned
-    server_task_result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
+    // write a saved state to disk and free its host memory
+    bool spill(int id) {
+        auto & e = entries.at(id);
 
-            for (int i = 0; i < (int) queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
-                }
-            }
+        if (path_disk.empty() || e.size > n_bytes_disk_max) {
+            return false;
+        }
 
-            std::cv_status cr_res = condition_results.wait_for(lock, std::chrono::seconds(timeout));
-            if (!running) {
-                SRV_DBG("%s : queue result stop\n", __func__);
-                std::terminate(); // we cannot return here since the caller is HTTP code
-            }
-            if (cr_res == std::cv_status::timeout) {
-                return nullptr;
+        const std::string path = path_disk + string_format("prompt-cache-%" PRId64 "-%d.bin", t_init, id);
+
+        {
+            std::ofstream file(path, std::ios::binary);
+            if (!file.write((const char *) e.data.data(), e.size)) {
+                SRV_WRN("failed to write prompt state to '%s'\n", path.c_str());
+                std::remove(path.c_str());
+
+                return false;
             }
         }
 
-        // should never reach here
+        SRV_DBG("spilled prompt state to disk, n_tokens = %zu, size = %zu bytes\n", e.tokens.size(), e.size);
+
+        e.data.clear();
+        e.data.shrink_to_fit();
+        e.path = path;
+
+        n_bytes      -= e.size;
+        n_bytes_disk += e.size;
+
+        return true;
     }
+};
+
+struct server_metrics {
+    int64_t t_start = 0;
 
-    // single-task version of recv()
-    server_task_result_ptr recv(int id_task) {
-        std::unordered_set<int> id_tasks = {id_task};
-        return recv(id_tasks);
+    uint64_t n_prompt_tokens_processed_total = 0;
+    uint64_t t_prompt_processing_total       = 0;
+    uint64_t n_tokens_predicted_total        = 0;
+    uint64_t t_tokens_generation_total       = 0;
+
+    uint64_t n_prompt_tokens_processed = 0;
+    uint64_t t_prompt_processing       = 0;
+
+    uint64_t n_tokens_predicted  = 0;
+    uint64_t t_tokens_generation = 0;
+
+    uint64_t n_decode_total     = 0;
+    uint64_t n_busy_slots_total = 0;
+
+    // prompts that reused tokens from the cache of a slot or from a saved state
+    uint64_t n_prompt_cache_lookups_total = 0;
+    uint64_t n_prompt_cache_hits_total    = 0;
+    uint64_t n_prompt_tokens_cached_total = 0;
+
+    void init() {
+        t_start = ggml_time_us();
     }
 
-    // Send a new result to a waiting id_task
-    void send(server_task_result_ptr && result) {
-        SRV_DBG("sending result for task id = %d\n", result->id);
+    void on_prompt_eval(const server_slot & slot) {
+        n_prompt_tokens_processed_total += slot.n_prompt_tokens_processed;
+        n_prompt_tokens_processed       += slot.n_prompt_tokens_processed;
+        t_prompt_processing             += slot.t_prompt_processing;
+        t_prompt_processing_total       += slot.t_prompt_processing;
+    }
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        for (const auto & id_task : waiting_task_ids) {
-            if (result->id == id_task) {
-                SRV_DBG("task id = %d pushed to result queue\n", result->id);
+    void on_prediction(const server_slot & slot) {
+        n_tokens_predicted_total   += slot.n_decoded;
+        n_tokens_predicted         += slot.n_decoded;
+        t_tokens_generation        += slot.t_token_generation;
+        t_tokens_generation_total  += slot.t_token_generation;
+    }
 
-                queue_results.emplace_back(std::move(result));
-                condition_results.notify_all();
-                return;
+    void on_prompt_cache(const server_slot & slot) {
+        n_prompt_cache_lookups_total++;
+
+        if (slot.n_past > 0) {
+            n_prompt_cache_hits_total++;
+            n_prompt_tokens_cached_total += slot.n_past;
+        }
+    }
+
+    void on_decoded(const std::vector<server_slot> & slots) {
+        n_decode_total++;
+        for (const auto & slot : slots) {
+            if (slot.is_processing()) {
+                n_busy_slots_total++;
             }
         }
     }
 
-    // terminate the waiting loop
-    void terminate() {
-        running = false;
-        condition_results.notify_all();
+    void reset_bucket() {
+        n_prompt_tokens_processed = 0;
+        t_prompt_processing       = 0;
+        n_tokens_predicted        = 0;
+        t_tokens_generation       = 0;
     }
 };
 
+using server_queue    = server_queue_t<server_task>;
+using server_response = server_response_t<server_task_result>;
+
 struct server_context {
     common_params params_base;
 
@@ -1899,6 +2036,7 @@ struct server_context {
     bool clean_kv_cache = true;
     bool add_bos_token  = true;
     bool has_eos_token  = false;
+    bool defer_tokens   = false; // process the sampled tokens while the next batch is computing
 
     int32_t n_ctx; // total context for all clients / slots
 
@@ -1911,6 +2049,9 @@ struct server_context {
 
     server_metrics metrics;
 
+    // cached prompts of the idle slots and saved states
+    server_prompt_cache prompt_cache;
+
     // Necessary similarity of prompt for slot selection
     float slot_prompt_similarity = 0.0f;
 
@@ -1942,7 +2083,27 @@ struct server_context {
 
         params_base = params;
 
-        llama_init = common_init_from_params(params_base);
+        const int n_seq_max = (int) llama_max_parallel_sequences();
+
+        if (params_base.n_parallel * params_base.speculative.n_branch > n_seq_max) {
+            const int n_branch = std::max(1, n_seq_max / params_base.n_parallel);
+
+            SRV_WRN("--draft-branches %d with %d slots needs more than %d sequences, using --draft-branches %d\n",
+                    params_base.speculative.n_branch, params_base.n_parallel, n_seq_max, n_branch);
+
+            params_base.speculative.n_branch = n_branch;
+        }
+
+        {
+            auto params_tgt = params_base;
+
+            // the branches of the draft trees are verified in additional sequences of the target context
+            if (!params_base.speculative.model.path.empty() || !params_base.speculative.model.hf_repo.empty()) {
+                params_tgt.n_parallel *= params_base.speculative.n_branch;
+            }
+
+            llama_init = common_init_from_params(params_tgt);
+        }
 
         model = llama_init.model.get();
         ctx   = llama_init.context.get();
@@ -1968,7 +2129,7 @@ struct server_context {
             params_dft.model        = params_base.speculative.model;
             params_dft.n_ctx        = params_base.speculative.n_ctx == 0 ? params_base.n_ctx / params_base.n_parallel : params_base.speculative.n_ctx;
             params_dft.n_gpu_layers = params_base.speculative.n_gpu_layers;
-            params_dft.n_parallel   = 1;
+            params_dft.n_parallel   = params_base.speculative.n_branch;
             params_dft.cache_type_k = params_base.speculative.cache_type_k;
             params_dft.cache_type_v = params_base.speculative.cache_type_v;
 
@@ -2047,6 +2208,11 @@ struct server_context {
             }
         }
 
+        // on the CPU, llama_decode() returns only after the batch is computed - deferring the tokens would overlap
+        // nothing and only delay the streamed results by one decode
+        defer_tokens = llama_decode_is_async(ctx);
+        SRV_INF("process sampled tokens during the next decode: %s\n", defer_tokens ? "yes" : "no");
+
         return true;
     }
 
@@ -2066,7 +2232,7 @@ struct server_context {
             slot.cache_tokens.has_mtmd = mctx != nullptr;
 
             if (model_dft) {
-                slot.batch_spec = llama_batch_init(params_base.speculative.n_max + 1, 0, 1);
+                slot.batch_spec = llama_batch_init(params_base.speculative.n_max + 1, 0, params_base.speculative.n_branch);
 
                 slot.ctx_dft = llama_init_from_model(model_dft, cparams_dft);
                 if (slot.ctx_dft == nullptr) {
@@ -2079,6 +2245,11 @@ struct server_context {
                     SRV_ERR("%s", "failed to create speculator\n");
                     return;
                 }
+
+                slot.seq_ids_spec = { slot.id };
+                for (int j = 1; j < params_base.speculative.n_branch; ++j) {
+                    slot.seq_ids_spec.push_back(params_base.n_parallel + i*(params_base.speculative.n_branch - 1) + j - 1);
+                }
             }
 
             SLT_INF(slot, "new slot n_ctx_slot = %d\n", slot.n_ctx);
@@ -2086,7 +2257,8 @@ struct server_context {
             slot.params.sampling = params_base.sampling;
             slot.params.n_keep = params_base.n_keep;
 
-            slot.callback_on_release = [this](int) {
+            slot.callback_on_release = [this](int id_slot) {
+                prompt_cache_add_slot(slots[id_slot]);
                 queue_tasks.pop_deferred_task();
             };
 
@@ -2106,6 +2278,17 @@ struct server_context {
 
         metrics.init();
 
+        prompt_cache.n_bytes_max = (size_t) params_base.cache_ram_mib*1024*1024;
+
+        if (params_base.cache_disk_mib > 0) {
+            if (params_base.cache_disk_path.empty()) {
+                SRV_WRN("%s", "--cache-disk requires --cache-disk-path - the prompt states will not be spilled to disk\n");
+            } else {
+                prompt_cache.n_bytes_disk_max = (size_t) params_base.cache_disk_mib*1024*1024;
+                prompt_cache.path_disk        = params_base.cache_disk_path;
+            }
+        }
+
         oai_parser_opt = {
             /* use_jinja             */ params_base.use_jinja,
             /* prefill_assistant     */ params_base.prefill_assistant,
@@ -2128,11 +2311,126 @@ struct server_context {
         return nullptr;
     }
 
+    // index the cached prompt of a slot that has become idle
+    void prompt_cache_add_slot(const server_slot & slot) {
+        if (mctx) {
+            return;
+        }
+
+        prompt_cache.remove_slot(slot.id);
+
+        server_prompt_cache::entry e;
+        e.id_slot = slot.id;
+        e.tokens  = slot.cache_tokens.get_text_tokens();
+        e.lora    = slot.lora;
+        e.t_last  = ggml_time_us();
+
+        prompt_cache.add(std::move(e));
+    }
+
+    // keep a copy of the cached prompt of the slot in host memory, before it is overwritten by a new prompt
+    void prompt_cache_save(const server_slot & slot) {
+        if (mctx || !prompt_cache.can_save() || slot.cache_tokens.empty()) {
+            return;
+        }
+
+        const llama_tokens & tokens = slot.cache_tokens.get_text_tokens();
+
+        // already saved
+        const auto hit = prompt_cache.find(tokens, true);
+        if (hit.id >= 0 && hit.n_tokens == (int) tokens.size() && prompt_cache.entries.at(hit.id).tokens.size() == tokens.size()) {
+            prompt_cache.entries.at(hit.id).t_last = ggml_time_us();
+            return;
+        }
+
+        server_prompt_cache::entry e;
+        e.tokens = tokens;
+        e.lora   = slot.lora;
+        e.t_last = ggml_time_us();
+
+        e.data.resize(llama_state_seq_get_size(ctx, slot.id));
+
+        const size_t n_write = llama_state_seq_get_data(ctx, e.data.data(), e.data.size(), slot.id);
+        if (n_write == 0) {
+            SLT_WRN(slot, "%s", "failed to save the prompt state\n");
+            return;
+        }
+
+        e.data.resize(n_write);
+
+        if (prompt_cache.add(std::move(e)) >= 0) {
+            SLT_INF(slot, "saved prompt state, n_tokens = %zu, size = %.3f MiB, total = %.3f MiB (host) + %.3f MiB (disk)\n",
+                    tokens.size(), n_write/1024.0/1024.0, prompt_cache.n_bytes/1024.0/1024.0, prompt_cache.n_bytes_disk/1024.0/1024.0);
+        }
+    }
+
+    // load the saved state with the longest common prefix with the prompt, if it is better than the cache of the slot
+    void prompt_cache_load(server_slot & slot) {
+        if (mctx || prompt_cache.n_bytes + prompt_cache.n_bytes_disk == 0) {
+            return;
+        }
+
+        const llama_tokens & tokens = slot.prompt_tokens.get_text_tokens();
+
+        const auto hit = prompt_cache.find(tokens, true);
+        if (hit.id < 0 || hit.n_tokens <= (int) slot.cache_tokens.get_common_prefix(slot.prompt_tokens)) {
+            return;
+        }
+
+        if (!are_lora_equal(prompt_cache.entries.at(hit.id).lora, slot.lora)) {
+            return;
+        }
+
+        // the state may have been spilled to disk
+        std::vector<uint8_t> buf;
+
+        const uint8_t * data = prompt_cache.load(hit.id, buf);
+        if (data == nullptr) {
+            return;
+        }
+
+        auto & e = prompt_cache.entries.at(hit.id);
+
+        const size_t n_read = llama_state_seq_set_data(ctx, data, e.size, slot.id);
+        if (n_read == 0) {
+            SLT_WRN(slot, "%s", "failed to load the saved prompt state\n");
+
+            llama_memory_seq_rm(llama_get_memory(ctx), slot.id, -1, -1);
+            slot.cache_tokens.clear();
+            return;
+        }
+
+        SLT_INF(slot, "loaded saved prompt state, n_tokens = %zu, n_match = %d\n", e.tokens.size(), hit.n_tokens);
+
+        slot.cache_tokens.clear();
+        slot.cache_tokens.insert(e.tokens);
+
+        e.t_last = ggml_time_us();
+    }
+
     server_slot * get_available_slot(const server_task & task) {
         server_slot * ret = nullptr;
 
-        // find the slot that has at least n% prompt similarity
-        if (ret == nullptr && slot_prompt_similarity != 0.0f) {
+        // find the idle slot with the longest common prefix, if it has at least n% prompt similarity
+        if (ret == nullptr && slot_prompt_similarity != 0.0f && !mctx) {
+            const auto hit = prompt_cache.find(task.prompt_tokens.get_text_tokens(), false);
+
+            if (hit.id >= 0) {
+                const auto & e = prompt_cache.entries.at(hit.id);
+
+                // fraction of the common prefix length compared to the current slot's prompt length
+                const float similarity = static_cast<float>(hit.n_tokens) / static_cast<int>(e.tokens.size());
+
+                if (similarity > slot_prompt_similarity && !slots[e.id_slot].is_processing()) {
+                    ret = &slots[e.id_slot];
+
+                    SLT_DBG(*ret, "selected slot by prompt cache, n_match = %d, similarity = %f\n", hit.n_tokens, similarity);
+                }
+            }
+        }
+
+        // multimodal prompts are not indexed in the prompt cache
+        if (ret == nullptr && slot_prompt_similarity != 0.0f && mctx) {
             int lcs_len = 0;
             float similarity = 0;
 
@@ -2199,12 +2497,27 @@ struct server_context {
         slot.params        = std::move(task.params);
         slot.prompt_tokens = std::move(task.prompt_tokens);
 
+        prompt_cache.remove_slot(slot.id);
+
+        if (!mctx) {
+            const bool lora_changed = !are_lora_equal(slot.params.lora, slot.lora);
+
+            // the cached prompt of the slot is about to be overwritten - keep a copy in host memory
+            if (lora_changed || slot.cache_tokens.get_common_prefix(slot.prompt_tokens) < slot.cache_tokens.size()) {
+                prompt_cache_save(slot);
+            }
+        }
+
         if (!are_lora_equal(slot.params.lora, slot.lora)) {
             // if lora is changed, we cannot reuse cached tokens
             slot.cache_tokens.clear();
             slot.lora = slot.params.lora;
         }
 
+        if (slot.params.cache_prompt) {
+            prompt_cache_load(slot);
+        }
+
         if (!slot.prompt_tokens.validate(ctx)) {
             send_error(task, "Prompt contains invalid tokens", ERROR_TYPE_INVALID_REQUEST);
             return false;
@@ -2237,7 +2550,7 @@ struct server_context {
         if (slot.ctx_dft) {
             llama_batch_free(slot.batch_spec);
 
-            slot.batch_spec = llama_batch_init(slot.params.speculative.n_max + 1, 0, 1);
+            slot.batch_spec = llama_batch_init(slot.params.speculative.n_max + 1, 0, slot.params.speculative.n_branch);
         }
 
         slot.state = SLOT_STATE_STARTED;
@@ -2407,9 +2720,40 @@ struct server_context {
         return slot.has_next_token; // continue
     }
 
+    // check if the text of the sampled token can be processed after the next batch has been submitted
+    // the stop conditions that do not depend on the text are checked here, so that a slot stopped by them never decodes an extra token
+    bool can_defer_token(server_slot & slot, llama_token tok) {
+        if (!defer_tokens || slot.can_speculate()) {
+            return false;
+        }
+
+        if (!params_base.ctx_shift && slot.n_past + 1 >= slot.n_ctx) {
+            return false;
+        }
+
+        if (slot.n_decoded > 0 && !slot.has_budget(params_base)) {
+            return false;
+        }
+
+        if (slot.n_past >= slot.n_ctx) {
+            return false;
+        }
+
+        if (llama_vocab_is_eog(vocab, tok)) {
+            return false;
+        }
+
+        const auto n_ctx_train = llama_model_n_ctx_train(model);
+
+        if (slot.params.n_predict < 1 && slot.n_predict < 1 && slot.n_prompt_tokens + slot.n_decoded >= n_ctx_train) {
+            return false;
+        }
+
+        return true;
+    }
+
     void populate_token_probs(const server_slot & slot, completion_token_output & result, bool post_sampling, bool special, int idx) {
         size_t n_probs = slot.params.sampling.n_probs;
-        size_t n_vocab = llama_vocab_n_tokens(vocab);
         if (post_sampling) {
             const auto * cur_p = common_sampler_get_candidates(slot.smpl);
             const size_t max_probs = cur_p->size;
@@ -2433,10 +2777,13 @@ struct server_context {
             }
         } else {
             // TODO: optimize this with min-p optimization
+            // with --logits-top-k, only the top-k candidates are available
             std::vector<llama_token_data> cur = get_token_probabilities(ctx, idx);
 
+            const size_t n_cur = cur.size();
+
             // set probability for sampled token
-            for (size_t i = 0; i < n_vocab; i++) {
+            for (size_t i = 0; i < n_cur; i++) {
                 // set probability for sampled token
                 if (cur[i].id == result.tok) {
                     result.prob = cur[i].p;
@@ -2446,7 +2793,7 @@ struct server_context {
 
             // set probability for top n_probs tokens
             result.probs.reserve(n_probs);
-            for (size_t i = 0; i < std::min(n_vocab, n_probs); i++) {
+            for (size_t i = 0; i < std::min(n_cur, n_probs); i++) {
                 result.probs.push_back({
                     cur[i].id,
                     common_token_to_piece(ctx, cur[i].id, special),
@@ -2827,6 +3174,12 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    res->n_prompt_cache_lookups_total = metrics.n_prompt_cache_lookups_total;
+                    res->n_prompt_cache_hits_total    = metrics.n_prompt_cache_hits_total;
+                    res->n_prompt_tokens_cached_total = metrics.n_prompt_tokens_cached_total;
+                    res->n_prompt_cache_bytes         = prompt_cache.n_bytes;
+                    res->n_prompt_cache_bytes_disk    = prompt_cache.n_bytes_disk;
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -2900,6 +3253,7 @@ struct server_context {
                     size_t nread = llama_state_seq_load_file(ctx, filepath.c_str(), slot->id, tokens.data(), tokens.size(), &token_count);
                     if (nread == 0) {
                         slot->cache_tokens.clear(); // KV may already been invalidated?
+                        prompt_cache.remove_slot(slot->id);
                         send_error(task, "Unable to restore slot, no available space in KV cache or invalid slot save file", ERROR_TYPE_INVALID_REQUEST);
                         break;
                     }
@@ -2907,6 +3261,8 @@ struct server_context {
                     slot->cache_tokens.clear();
                     slot->cache_tokens.insert(tokens);
 
+                    prompt_cache_add_slot(*slot);
+
                     const int64_t t_end = ggml_time_us();
                     const double t_restore_ms = (t_end - t_start) / 1000.0;
 
@@ -2941,6 +3297,8 @@ struct server_context {
                     llama_memory_seq_rm(llama_get_memory(ctx), slot->id, -1, -1);
                     slot->cache_tokens.clear();
 
+                    prompt_cache.remove_slot(slot->id);
+
                     auto res = std::make_unique<server_task_result_slot_erase>();
                     res->id       = task.id;
                     res->id_slot  = id_slot;
@@ -3044,6 +3402,43 @@ struct server_context {
             return params_base.special || slot.params.sampling.preserved_tokens.find(token) != slot.params.sampling.preserved_tokens.end();
         };
 
+        // process the text of the tokens sampled in the previous iteration
+        // a slot that stops here has already submitted its next token - the result of it is simply ignored
+        auto process_pending_tokens = [&]() {
+            for (auto & slot : slots) {
+                if (!slot.has_pending_token) {
+                    continue;
+                }
+
+                slot.has_pending_token = false;
+
+                if (slot.state != SLOT_STATE_GENERATING) {
+                    continue;
+                }
+
+                completion_token_output & result = slot.pending_token;
+                result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
+
+                // the next token has already been added to the batch - check the limits as when the token was sampled
+                const int32_t n_past = slot.n_past;
+                slot.n_past = slot.pending_n_past;
+
+                const bool has_next = process_token(result, slot);
+
+                slot.n_past = n_past;
+
+                if (!has_next) {
+                    // release slot because of stop condition
+                    slot.release();
+                    slot.print_timings();
+                    send_final_response(slot);
+                    metrics.on_prediction(slot);
+
+                    slot.i_batch = -1;
+                }
+            }
+        };
+
         // frist, add sampled tokens from any ongoing sequences
         for (auto & slot : slots) {
             if (slot.state != SLOT_STATE_GENERATING) {
@@ -3072,9 +3467,31 @@ struct server_context {
         int32_t n_batch  = llama_n_batch(ctx);
         int32_t n_ubatch = llama_n_ubatch(ctx);
 
+        // limit the number of prompt tokens in the batch while other slots are generating, so that a long prompt
+        // does not stall them - the rest of the prompt is processed in the next iterations (chunked prefill)
+        int32_t n_batch_prompt = n_batch;
+        if (params_base.n_prefill_budget > 0 && batch.n_tokens > 0) {
+            n_batch_prompt = std::min(n_batch, batch.n_tokens + params_base.n_prefill_budget);
+        }
+
         // next, batch any pending prompts without exceeding n_batch
-        if (params_base.cont_batching || batch.n_tokens == 0) {
+        if ((params_base.cont_batching || batch.n_tokens == 0) && batch.n_tokens < n_batch_prompt) {
+            // process the prompts in order of priority, and in order of arrival for equal priorities
+            std::vector<server_slot *> slots_prompt;
             for (auto & slot : slots) {
+                slots_prompt.push_back(&slot);
+            }
+
+            std::stable_sort(slots_prompt.begin(), slots_prompt.end(), [](const server_slot * a, const server_slot * b) {
+                if (a->params.priority != b->params.priority) {
+                    return a->params.priority > b->params.priority;
+                }
+                return a->id_task < b->id_task;
+            });
+
+            for (auto * slot_ptr : slots_prompt) {
+                auto & slot = *slot_ptr;
+
                 // check if we can batch this slot with the previous one
                 if (slot.is_processing()) {
                     if (!slot_batched) {
@@ -3272,9 +3689,21 @@ struct server_context {
                         slot.n_prompt_tokens_processed = 0;
                     }
 
+                    // the prompt tokens that this slot can add to the batch
+                    int32_t n_batch_slot = n_batch_prompt;
+
                     if (!slot.can_split()) {
+                        // a prompt larger than the prefill budget would never fit within it - after a few iterations it
+                        // can use the whole batch
+                        if (slot.n_prefill_wait >= PREFILL_BUDGET_MAX_WAIT) {
+                            n_batch_slot = n_batch;
+                        }
+
                         // cannot fit the prompt in the current batch - will try next iter
-                        if (batch.n_tokens + slot.n_prompt_tokens > n_batch) {
+                        if (batch.n_tokens + slot.n_prompt_tokens > n_batch_slot) {
+                            if (batch.n_tokens + slot.n_prompt_tokens <= n_batch) {
+                                slot.n_prefill_wait++;
+                            }
                             continue;
                         }
                     }
@@ -3293,6 +3722,24 @@ struct server_context {
                     // remove the non-common part from the cache
                     slot.cache_tokens.keep_first(slot.n_past);
 
+                    // nothing to reuse from the slot's own cache - try to share a prefix computed by another slot
+                    if (slot.n_past == 0 && slot.n_prompt_tokens_processed == 0 && slot.params.cache_prompt && !mctx && params_base.kv_block_size > 0) {
+                        const llama_tokens & tokens = slot.prompt_tokens.get_text_tokens();
+
+                        // at least one token has to be evaluated
+                        const int32_t n_attached = llama_memory_seq_attach_prefix(llama_get_memory(ctx), slot.id, tokens.data(), slot.n_prompt_tokens - 1);
+                        if (n_attached > 0) {
+                            SLT_INF(slot, "attached %d shared prompt tokens from the cache\n", n_attached);
+
+                            slot.cache_tokens.insert({tokens.begin(), tokens.begin() + n_attached});
+                            slot.n_past = n_attached;
+                        }
+                    }
+
+                    if (slot.n_prompt_tokens_processed == 0) {
+                        metrics.on_prompt_cache(slot);
+                    }
+
                     // check if we should process the image
                     if (slot.n_past < slot.n_prompt_tokens && slot.prompt_tokens[slot.n_past] == LLAMA_TOKEN_NULL) {
                         // process the image
@@ -3318,7 +3765,7 @@ struct server_context {
                     }
 
                     // add prompt tokens for processing in the current batch
-                    while (slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch) {
+                    while (slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch_slot) {
                         // get next token to process
                         llama_token cur_tok = slot.prompt_tokens[slot.n_past];
                         if (cur_tok == LLAMA_TOKEN_NULL) {
@@ -3366,7 +3813,7 @@ struct server_context {
                     }
                 }
 
-                if (batch.n_tokens >= n_batch) {
+                if (batch.n_tokens >= n_batch_prompt) {
                     break;
                 }
             }
@@ -3374,6 +3821,7 @@ struct server_context {
 
         if (batch.n_tokens == 0) {
             SRV_WRN("%s", "no tokens to decode\n");
+            process_pending_tokens();
             return;
         }
 
@@ -3404,6 +3852,9 @@ struct server_context {
 
             const int ret = llama_decode(ctx, batch_view);
 
+            // the backend may still be computing the batch - until the logits are requested below, the host is free
+            process_pending_tokens();
+
             metrics.on_decoded(slots);
 
             if (ret != 0) {
@@ -3484,6 +3935,9 @@ struct server_context {
 
                 common_sampler_accept(slot.smpl, id, true);
 
+                // the grammar constraints for the next token are computed while the next batch is evaluated
+                common_sampler_prepare_async(slot.smpl);
+
                 slot.n_decoded += 1;
 
                 const int64_t t_current = ggml_time_us();
@@ -3498,13 +3952,24 @@ struct server_context {
 
                 completion_token_output result;
                 result.tok          = id;
-                result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
                 result.prob         = 1.0f; // TODO: set it here instead of doing inside populate_token_probs
 
                 if (slot.params.sampling.n_probs > 0) {
                     populate_token_probs(slot, result, slot.params.post_sampling_probs, params_base.special, tok_idx);
                 }
 
+                slot.sampled = id;
+
+                // defer the detokenization and the stop string checks until the next batch has been submitted
+                if (can_defer_token(slot, id)) {
+                    slot.pending_token     = std::move(result);
+                    slot.pending_n_past    = slot.n_past;
+                    slot.has_pending_token = true;
+                    continue;
+                }
+
+                result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
+
                 if (!process_token(result, slot)) {
                     // release slot because of stop condition
                     slot.release();
@@ -3555,34 +4020,36 @@ struct server_context {
                 params_spec.n_draft   = n_draft_max;
                 params_spec.n_reuse   = llama_n_ctx(slot.ctx_dft) - slot.params.speculative.n_max;
                 params_spec.p_min     = slot.params.speculative.p_min;
+                params_spec.p_split   = slot.params.speculative.p_split;
+                params_spec.n_branch  = slot.params.speculative.n_branch;
 
                 const llama_tokens & cached_text_tokens = slot.cache_tokens.get_text_tokens();
-                llama_tokens draft = common_speculative_gen_draft(slot.spec, params_spec, cached_text_tokens, id);
+                const auto draft = common_speculative_gen_draft_tree(slot.spec, params_spec, cached_text_tokens, id);
 
                 // ignore small drafts
-                if (slot.params.speculative.n_min > (int) draft.size()) {
-                    SLT_DBG(slot, "ignoring small draft: %d < %d\n", (int) draft.size(), slot.params.speculative.n_min);
+                if (slot.params.speculative.n_min > (int) draft.tokens.size()) {
+                    SLT_DBG(slot, "ignoring small draft: %d < %d\n", (int) draft.tokens.size(), slot.params.speculative.n_min);
 
                     continue;
                 }
 
                 // keep track of total number of drafted tokens tested
-                slot.n_draft_total += draft.size();
-
-                // construct the speculation batch
-                common_batch_clear(slot.batch_spec);
-                common_batch_add  (slot.batch_spec, id, slot.n_past, { slot.id }, true);
+                slot.n_draft_total += draft.tokens.size();
 
-                for (size_t i = 0; i < draft.size(); ++i) {
-                    common_batch_add(slot.batch_spec, draft[i], slot.n_past + 1 + i, { slot.id }, true);
-                }
+                // construct the speculation batch, with the branches of the draft in separate sequences
+                common_speculative_tree_batch(llama_get_memory(ctx), slot.batch_spec, draft, id, slot.n_past, slot.seq_ids_spec);
 
-                SLT_DBG(slot, "decoding speculative batch, size = %d\n", slot.batch_spec.n_tokens);
+                SLT_DBG(slot, "decoding speculative batch, size = %d, branches = %d\n", slot.batch_spec.n_tokens, (int) draft.leaves.size());
 
                 llama_decode(ctx, slot.batch_spec);
 
                 // the accepted tokens from the speculation
-                const auto ids = common_sampler_sample_and_accept_n(slot.smpl, ctx, draft);
+                const auto ids = common_sampler_sample_and_accept_tree(slot.smpl, ctx, draft.tokens, draft.parents);
+
+                common_sampler_prepare_async(slot.smpl);
+
+                // keep the accepted branch in the slot sequence
+                common_speculative_tree_accept(llama_get_memory(ctx), draft, ids, slot.n_past, slot.seq_ids_spec);
 
                 slot.n_past    += ids.size();
                 slot.n_decoded += ids.size();
@@ -3593,8 +4060,6 @@ struct server_context {
                 slot.cache_tokens.push_back(id);
                 slot.cache_tokens.insert({ids.begin(), ids.end() - 1});
 
-                llama_memory_seq_rm(llama_get_memory(ctx), slot.id, slot.n_past, -1);
-
                 for (size_t i = 0; i < ids.size(); ++i) {
                     completion_token_output result;
 
@@ -3614,7 +4079,7 @@ struct server_context {
                     }
                 }
 
-                SLT_DBG(slot, "accepted %d/%d draft tokens, new n_past = %d\n", (int) ids.size() - 1, (int) draft.size(), slot.n_past);
+                SLT_DBG(slot, "accepted %d/%d draft tokens, new n_past = %d\n", (int) ids.size() - 1, (int) draft.tokens.size(), slot.n_past);
             }
         }
 
@@ -3944,6 +4409,14 @@ int main(int argc, char ** argv) {
                     {"name",  "n_busy_slots_per_decode"},
                     {"help",  "Average number of busy slots per llama_decode() call"},
                     {"value",  (float) res_metrics->n_busy_slots_total / std::max((float) res_metrics->n_decode_total, 1.f)}
+            }, {
+                    {"name",  "prompt_cache_hits_total"},
+                    {"help",  "Number of prompts that reused cached tokens."},
+                    {"value",  res_metrics->n_prompt_cache_hits_total}
+            }, {
+                    {"name",  "prompt_tokens_cached_total"},
+                    {"help",  "Number of prompt tokens reused from the cache instead of being processed."},
+                    {"value",  res_metrics->n_prompt_tokens_cached_total}
             }}},
             {"gauge", {{
                     {"name",  "prompt_tokens_seconds"},
@@ -3961,6 +4434,18 @@ int main(int argc, char ** argv) {
                     {"name",  "requests_deferred"},
                     {"help",  "Number of requests deferred."},
                     {"value",  (uint64_t) res_metrics->n_tasks_deferred}
+            },{
+                    {"name",  "prompt_cache_hit_ratio"},
+                    {"help",  "Fraction of prompts that reused cached tokens."},
+                    {"value",  (float) res_metrics->n_prompt_cache_hits_total / std::max((float) res_metrics->n_prompt_cache_lookups_total, 1.f)}
+            },{
+                    {"name",  "prompt_cache_bytes"},
+                    {"help",  "Host memory used by the saved prompt states."},
+                    {"value",  res_metrics->n_prompt_cache_bytes}
+            },{
+                    {"name",  "prompt_cache_disk_bytes"},
+                    {"help",  "Disk space used by the prompt states spilled from host memory."},
+                    {"value",  res_metrics->n_prompt_cache_bytes_disk}
             }}}
         };
 
@@ -39,11 +39,6 @@ using json = nlohmann::ordered_json;
 #define SRV_ERR(fmt, ...) LOG_ERR("srv  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
 #define SRV_DBG(fmt, ...) LOG_DBG("srv  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
 
-#define QUE_INF(fmt, ...) LOG_INF("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
-#define QUE_WRN(fmt, ...) LOG_WRN("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
-#define QUE_ERR(fmt, ...) LOG_ERR("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
-#define QUE_DBG(fmt, ...) LOG_DBG("que  %12.*s: " fmt, 12, __func__, __VA_ARGS__)
-
 using raw_buffer = std::vector<uint8_t>;
 
 template <typename T>
@@ -995,16 +990,37 @@ static std::string safe_json_to_str(const json & data) {
 
 static std::vector<llama_token_data> get_token_probabilities(llama_context * ctx, int idx) {
     std::vector<llama_token_data> cur;
-    const auto * logits = llama_get_logits_ith(ctx, idx);
 
-    const llama_model * model = llama_get_model(ctx);
-    const llama_vocab * vocab = llama_model_get_vocab(model);
+    float       * top_k_logits = nullptr;
+    llama_token * top_k_tokens = nullptr;
+
+    const int32_t n_top_k = llama_get_logits_top_k_ith(ctx, idx, &top_k_logits, &top_k_tokens);
+
+    if (n_top_k > 0) {
+        // only the top-k logits are available, the probabilities are normalized over them
+        cur.resize(n_top_k);
+        for (int32_t i = 0; i < n_top_k; i++) {
+            cur[i] = llama_token_data{top_k_tokens[i], top_k_logits[i], 0.0f};
+        }
+    } else {
+        const auto * logits = llama_get_logits_ith(ctx, idx);
+        if (logits == nullptr) {
+            return cur;
+        }
+
+        const llama_model * model = llama_get_model(ctx);
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        const int n_vocab = llama_vocab_n_tokens(vocab);
 
-    const int n_vocab = llama_vocab_n_tokens(vocab);
+        cur.resize(n_vocab);
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+        }
+    }
 
-    cur.resize(n_vocab);
-    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-        cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+    if (cur.empty()) {
+        return cur;
     }
 
     // sort tokens by logits